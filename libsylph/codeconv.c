@@ -42,6 +42,7 @@
 #include "base64.h"
 #include "quoted-printable.h"
 #include "utils.h"
+#include "slock.h"
 
 typedef enum
 {
@@ -770,16 +771,6 @@ static gchar *conv_jistoutf8(const gchar *inbuf, gint *error)
 	return utf8str;
 }
 
-#if USE_THREADS
-#define S_LOCK_DEFINE_STATIC(name)	G_LOCK_DEFINE_STATIC(name)
-#define S_LOCK(name)	G_LOCK(name)
-#define S_UNLOCK(name)	G_UNLOCK(name)
-#else
-#define S_LOCK_DEFINE_STATIC(name)
-#define S_LOCK(name)
-#define S_UNLOCK(name)
-#endif
-
 static gchar *conv_sjistoutf8(const gchar *inbuf, gint *error)
 {
 	static iconv_t cd = (iconv_t)-1;
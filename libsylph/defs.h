@@ -62,8 +62,12 @@
 #define TEMPLATE_DIR		"templates"
 #define TMP_DIR			"tmp"
 #define UIDL_DIR		"uidl"
+#define REMOVING_LIST		"removing_list"
 #define PLUGIN_DIR		"plugins"
 #define NEWSGROUP_LIST		".newsgroup_list"
+#define NEWSGROUP_INDEX		".newsgroup_index"
+#define NEWS_ACCESS_INDEX	".sylpheed_access"
+#define IMAP_FLAG_QUEUE		".sylpheed_flag_queue"
 #define ADDRESS_BOOK		"addressbook.xml"
 #define MANUAL_HTML_INDEX	"sylpheed.html"
 #define FAQ_HTML_INDEX		"sylpheed-faq.html"
@@ -75,10 +79,13 @@
 #define FOLDER_LIST		"folderlist.xml"
 #define CACHE_FILE		".sylpheed_cache"
 #define MARK_FILE		".sylpheed_mark"
+#define MIME_CACHE_FILE		".sylpheed_mime"
 #define SEARCH_CACHE		"search_cache"
 #define CACHE_VERSION		0x21
 #define MARK_VERSION		2
 #define SEARCH_CACHE_VERSION	1
+#define MIME_CACHE_VERSION	2
+#define NEWSGROUP_INDEX_VERSION	1
 
 #ifdef G_OS_WIN32
 #  define REMOTE_CMD_PORT	50215
@@ -35,6 +35,17 @@
 #  include <regex.h>
 #endif
 #include <time.h>
+#include <unistd.h>
+#ifdef G_OS_WIN32
+#  include <windows.h>
+#else
+#  include <signal.h>
+#endif
+#if HAVE_SYS_WAIT_H
+#  include <sys/wait.h>
+#endif
+
+#undef MEASURE_TIME
 
 #include "filter.h"
 #include "procmsg.h"
@@ -67,6 +78,10 @@ static gboolean filter_match_in_addressbook
 					 GSList		*hlist,
 					 FilterInfo	*fltinfo);
 
+static gint filter_cmd_exec_file	(const gchar	*cmdline,
+					 const gchar	*file,
+					 gboolean	 async_wait);
+
 static void filter_cond_free		(FilterCond	*cond);
 static void filter_action_free		(FilterAction	*action);
 
@@ -160,6 +175,7 @@ gint filter_action_exec(FilterRule *rule, MsgInfo *msginfo, const gchar *file,
 	FolderItem *dest_folder = NULL;
 	FilterAction *action;
 	GSList *cur;
+	const gchar *cmd;
 	gchar *cmdline;
 	gboolean copy_to_self = FALSE;
 	gint ret;
@@ -199,22 +215,21 @@ gint filter_action_exec(FilterRule *rule, MsgInfo *msginfo, const gchar *file,
 			fltinfo->actions[action->type] = TRUE;
 			break;
 		case FLT_ACTION_EXEC:
-			cmdline = g_strconcat(action->str_value, " \"", file,
-					      "\"", NULL);
-			ret = execute_command_line(cmdline, FALSE);
+			ret = filter_cmd_exec_file(action->str_value, file,
+						   FALSE);
 			fltinfo->last_exec_exit_status = ret;
 			if (ret == -1) {
 				fltinfo->error = FLT_ERROR_EXEC_FAILED;
-				g_warning("filter_action_exec: cannot execute command: %s", cmdline);
-				g_free(cmdline);
+				g_warning("filter_action_exec: cannot execute command: %s \"%s\"", action->str_value, file);
 				return -1;
 			}
-			g_free(cmdline);
 			fltinfo->actions[action->type] = TRUE;
 			break;
 		case FLT_ACTION_EXEC_ASYNC:
-			cmdline = g_strconcat(action->str_value, " \"", file,
-					      "\"", NULL);
+			cmd = action->str_value;
+			if (g_str_has_prefix(cmd, FILTER_COPROC_PREFIX))
+				cmd += strlen(FILTER_COPROC_PREFIX);
+			cmdline = g_strconcat(cmd, " \"", file, "\"", NULL);
 			ret = execute_command_line(cmdline, TRUE);
 			fltinfo->last_exec_exit_status = ret;
 			if (ret == -1) {
@@ -486,7 +501,6 @@ static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
 	gboolean not_match = FALSE;
 	gint64 timediff = 0;
 	gchar *file;
-	gchar *cmdline;
 	PrefsAccount *cond_ac;
 
 	switch (cond->type) {
@@ -507,16 +521,25 @@ static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
 					       cond->match_func);
 		break;
 	case FLT_COND_CMD_TEST:
+		if (fltinfo->cmd_test_cache &&
+		    !strcmp(fltinfo->cmd_test_cache->cmdline,
+			    cond->str_value)) {
+			ret = GPOINTER_TO_INT(g_hash_table_lookup
+				(fltinfo->cmd_test_cache->table, msginfo));
+			if (ret > 0) {
+				fltinfo->last_exec_exit_status = ret - 1;
+				matched = (ret == 1);
+				break;
+			}
+		}
 		file = procmsg_get_message_file(msginfo);
 		if (!file)
 			return FALSE;
-		cmdline = g_strconcat(cond->str_value, " \"", file, "\"", NULL);
-		ret = execute_command_line_async_wait(cmdline);
+		ret = filter_cmd_exec_file(cond->str_value, file, TRUE);
 		fltinfo->last_exec_exit_status = ret;
 		matched = (ret == 0);
 		if (ret == -1)
 			fltinfo->error = FLT_ERROR_EXEC_FAILED;
-		g_free(cmdline);
 		g_free(file);
 		break;
 	case FLT_COND_SIZE_GREATER:
@@ -1005,6 +1028,813 @@ GSList *filter_read_file(const gchar *file)
 	return list;
 }
 
+/* persistent command processes (FILTER_COPROC_PREFIX) */
+
+#define FILTER_COPROC_TIMEOUT	30	/* seconds */
+#define FILTER_COPROC_MAX_FAIL	3
+
+typedef enum
+{
+	FILTER_COPROC_WAIT,
+	FILTER_COPROC_READ,
+	FILTER_COPROC_ERROR,
+	FILTER_COPROC_TIMEDOUT
+} FilterCoprocState;
+
+typedef struct _FilterCoproc
+{
+	gchar *cmdline;
+	GPid pid;
+	gint in_fd;
+	GIOChannel *out_ch;
+	GString *buf;
+
+	FilterCoprocState state;
+	guint io_tag;
+	guint timeout_tag;
+
+	gboolean busy;
+	gint n_fail;
+	gboolean disabled;
+#ifdef MEASURE_TIME
+	gint n_req;
+	gdouble elapsed;
+#endif
+} FilterCoproc;
+
+static GHashTable *coproc_table = NULL;
+
+#ifdef MEASURE_TIME
+static gint spawn_n_req = 0;
+static gdouble spawn_elapsed = 0.0;
+#endif
+
+static void filter_coproc_child_exit(GPid pid, gint status, gpointer data)
+{
+	g_spawn_close_pid(pid);
+}
+
+static gboolean filter_coproc_start(FilterCoproc *coproc)
+{
+	gchar **argv;
+	gint out_fd;
+	GError *error = NULL;
+
+	argv = strsplit_with_quote(coproc->cmdline, " ", 0);
+	if (!argv || !argv[0]) {
+		g_strfreev(argv);
+		return FALSE;
+	}
+
+	if (g_spawn_async_with_pipes(NULL, argv, NULL,
+				     G_SPAWN_SEARCH_PATH |
+				     G_SPAWN_DO_NOT_REAP_CHILD,
+				     NULL, NULL, &coproc->pid, &coproc->in_fd,
+				     &out_fd, NULL, &error) == FALSE) {
+		g_warning("filter_coproc_start: can't execute command: %s: %s",
+			  coproc->cmdline, error ? error->message : "");
+		if (error)
+			g_error_free(error);
+		g_strfreev(argv);
+		return FALSE;
+	}
+	g_strfreev(argv);
+
+#ifdef G_OS_WIN32
+	coproc->out_ch = g_io_channel_win32_new_fd(out_fd);
+#else
+	coproc->out_ch = g_io_channel_unix_new(out_fd);
+#endif
+	g_io_channel_set_encoding(coproc->out_ch, NULL, NULL);
+	g_io_channel_set_buffered(coproc->out_ch, FALSE);
+	g_io_channel_set_close_on_unref(coproc->out_ch, TRUE);
+
+	debug_print("filter_coproc_start: started: %s\n", coproc->cmdline);
+
+	return TRUE;
+}
+
+/* closing the pipe tells the process to exit. It is killed if it
+   doesn't respond anymore. */
+static void filter_coproc_stop(FilterCoproc *coproc, gboolean kill_proc)
+{
+	if (!coproc->out_ch)
+		return;
+
+	debug_print("filter_coproc_stop: stopping: %s\n", coproc->cmdline);
+
+	close(coproc->in_fd);
+	coproc->in_fd = -1;
+	g_io_channel_unref(coproc->out_ch);
+	coproc->out_ch = NULL;
+
+	if (kill_proc) {
+#ifdef G_OS_WIN32
+		TerminateProcess(coproc->pid, 1);
+#else
+		kill(coproc->pid, SIGTERM);
+#endif
+	}
+	g_child_watch_add(coproc->pid, filter_coproc_child_exit, NULL);
+	coproc->pid = 0;
+}
+
+static gboolean filter_coproc_read_cb(GIOChannel *source,
+				      GIOCondition condition, gpointer data)
+{
+	FilterCoproc *coproc = (FilterCoproc *)data;
+	gchar buf[BUFFSIZE];
+	gsize len = 0;
+	GIOStatus status;
+
+	status = g_io_channel_read_chars(source, buf, sizeof(buf), &len, NULL);
+	if (len > 0) {
+		g_string_append_len(coproc->buf, buf, len);
+		if (!memchr(buf, '\n', len))
+			return TRUE;
+		coproc->state = FILTER_COPROC_READ;
+	} else if (status == G_IO_STATUS_AGAIN)
+		return TRUE;
+	else
+		coproc->state = FILTER_COPROC_ERROR;
+
+	coproc->io_tag = 0;
+	return FALSE;
+}
+
+static gboolean filter_coproc_timeout_cb(gpointer data)
+{
+	FilterCoproc *coproc = (FilterCoproc *)data;
+
+	coproc->state = FILTER_COPROC_TIMEDOUT;
+	coproc->timeout_tag = 0;
+	return FALSE;
+}
+
+static gint filter_coproc_write_all(gint fd, const gchar *buf, gint len)
+{
+	gint n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* send one request line (the message file) and wait for the response
+   line (the exit status), while keeping the main loop running. */
+static gint filter_coproc_request(FilterCoproc *coproc, const gchar *file)
+{
+	gchar *req;
+	gchar *end;
+	gint ret = -1;
+	gint len;
+
+	if (!coproc->out_ch && !filter_coproc_start(coproc))
+		return -1;
+
+	g_string_truncate(coproc->buf, 0);
+	coproc->state = FILTER_COPROC_WAIT;
+
+	req = g_strconcat(file, "\n", NULL);
+	len = strlen(req);
+	if (filter_coproc_write_all(coproc->in_fd, req, len) < 0)
+		coproc->state = FILTER_COPROC_ERROR;
+	g_free(req);
+
+	if (coproc->state == FILTER_COPROC_WAIT) {
+		coproc->io_tag = g_io_add_watch
+			(coproc->out_ch, G_IO_IN | G_IO_HUP | G_IO_ERR,
+			 filter_coproc_read_cb, coproc);
+		coproc->timeout_tag = g_timeout_add
+			(FILTER_COPROC_TIMEOUT * 1000,
+			 filter_coproc_timeout_cb, coproc);
+		while (coproc->state == FILTER_COPROC_WAIT)
+			event_loop_iterate();
+		if (coproc->io_tag > 0) {
+			g_source_remove(coproc->io_tag);
+			coproc->io_tag = 0;
+		}
+		if (coproc->timeout_tag > 0) {
+			g_source_remove(coproc->timeout_tag);
+			coproc->timeout_tag = 0;
+		}
+	}
+
+	if (coproc->state == FILTER_COPROC_READ) {
+		ret = strtol(coproc->buf->str, &end, 10);
+		if (end == coproc->buf->str || (*end != '\n' && *end != '\r'))
+			ret = -1;
+	}
+
+	if (ret < 0) {
+		g_warning("filter_coproc_request: %s: %s", coproc->cmdline,
+			  coproc->state == FILTER_COPROC_TIMEDOUT ?
+			  "timed out" : "invalid response");
+		filter_coproc_stop(coproc, TRUE);
+		if (++coproc->n_fail >= FILTER_COPROC_MAX_FAIL) {
+			g_warning("filter_coproc_request: %s: failed %d times, "
+				  "using one process per message",
+				  coproc->cmdline, coproc->n_fail);
+			coproc->disabled = TRUE;
+		}
+	} else
+		coproc->n_fail = 0;
+
+	return ret;
+}
+
+/* execute CMDLINE for FILE and return the exit status. Commands with
+   FILTER_COPROC_PREFIX are kept running and receive the file names on
+   stdin. If that fails, the command is executed with the file as its
+   argument as usual. */
+static gint filter_cmd_exec_file(const gchar *cmdline, const gchar *file,
+				 gboolean async_wait)
+{
+	FilterCoproc *coproc;
+	gchar *cmd;
+	gint ret = -1;
+#ifdef MEASURE_TIME
+	GTimer *timer;
+
+	timer = g_timer_new();
+#endif
+
+	if (g_str_has_prefix(cmdline, FILTER_COPROC_PREFIX)) {
+		cmdline += strlen(FILTER_COPROC_PREFIX);
+
+		if (!coproc_table)
+			coproc_table = g_hash_table_new(g_str_hash,
+							g_str_equal);
+		coproc = g_hash_table_lookup(coproc_table, cmdline);
+		if (!coproc) {
+			coproc = g_new0(FilterCoproc, 1);
+			coproc->cmdline = g_strdup(cmdline);
+			coproc->in_fd = -1;
+			coproc->buf = g_string_new(NULL);
+			g_hash_table_insert(coproc_table, coproc->cmdline,
+					    coproc);
+		}
+
+		/* the process is in use by an outer call while the main
+		   loop is running */
+		if (!coproc->disabled && !coproc->busy &&
+		    !strchr(file, '\n')) {
+			coproc->busy = TRUE;
+			ret = filter_coproc_request(coproc, file);
+			coproc->busy = FALSE;
+		}
+
+		if (ret >= 0) {
+#ifdef MEASURE_TIME
+			coproc->n_req++;
+			coproc->elapsed += g_timer_elapsed(timer, NULL);
+			g_timer_destroy(timer);
+#endif
+			return ret;
+		}
+	}
+
+	cmd = g_strconcat(cmdline, " \"", file, "\"", NULL);
+	if (async_wait)
+		ret = execute_command_line_async_wait(cmd);
+	else
+		ret = execute_command_line(cmd, FALSE);
+	g_free(cmd);
+
+#ifdef MEASURE_TIME
+	spawn_n_req++;
+	spawn_elapsed += g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+#endif
+
+	return ret;
+}
+
+static void filter_coproc_stop_func(gpointer key, gpointer value,
+				    gpointer data)
+{
+	FilterCoproc *coproc = (FilterCoproc *)value;
+
+#ifdef MEASURE_TIME
+	if (coproc->n_req > 0)
+		debug_print("filter_coproc_stop_all: %s: %d messages, "
+			    "%.1f msgs/sec\n", coproc->cmdline, coproc->n_req,
+			    coproc->elapsed > 0.0 ?
+			    coproc->n_req / coproc->elapsed : 0.0);
+#endif
+
+	filter_coproc_stop(coproc, FALSE);
+	g_string_free(coproc->buf, TRUE);
+	g_free(coproc->cmdline);
+	g_free(coproc);
+}
+
+void filter_coproc_stop_all(void)
+{
+#ifdef MEASURE_TIME
+	if (spawn_n_req > 0)
+		debug_print("filter_coproc_stop_all: one process per message: "
+			    "%d messages, %.1f msgs/sec\n", spawn_n_req,
+			    spawn_elapsed > 0.0 ?
+			    spawn_n_req / spawn_elapsed : 0.0);
+#endif
+
+	if (!coproc_table)
+		return;
+
+	g_hash_table_foreach(coproc_table, filter_coproc_stop_func, NULL);
+	g_hash_table_destroy(coproc_table);
+	coproc_table = NULL;
+}
+
+#define FILTER_CMD_THREADS	4
+#define FILTER_BULK_MAX_FILES	200
+
+typedef struct _FilterCmdJob
+{
+	gchar **argv;
+	GSList *mlist;
+	GSList *files;
+	gboolean get_output;
+	gchar *output;
+	gint status;
+} FilterCmdJob;
+
+typedef struct _FilterCmdBatch
+{
+	volatile gint remain;
+} FilterCmdBatch;
+
+static gint filter_cmd_spawn(gchar **argv, gchar **output)
+{
+	gint status;
+
+	if (!output)
+		return execute_sync(argv);
+
+	if (g_spawn_sync(NULL, argv, NULL,
+			 G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL,
+			 NULL, NULL, output, NULL, &status, NULL) == FALSE) {
+		g_warning("Can't execute command: %s\n", argv[0]);
+		return -1;
+	}
+
+#ifdef G_OS_WIN32
+	return status;
+#else
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	else
+		return -1;
+#endif
+}
+
+static void filter_cmd_job_run(FilterCmdJob *job)
+{
+	job->status = filter_cmd_spawn(job->argv,
+				       job->get_output ? &job->output : NULL);
+}
+
+#if USE_THREADS
+static void filter_cmd_job_func(gpointer push_data, gpointer data)
+{
+	FilterCmdBatch *batch = (FilterCmdBatch *)data;
+
+	filter_cmd_job_run((FilterCmdJob *)push_data);
+	if (g_atomic_int_dec_and_test(&batch->remain))
+		g_main_context_wakeup(NULL);
+}
+#endif
+
+/* run the jobs with at most MAX_THREADS commands at the same time, while
+   keeping the main loop running. */
+static void filter_cmd_run_jobs(GPtrArray *jobs, gint max_threads)
+{
+	guint i;
+#if USE_THREADS
+	FilterCmdBatch batch;
+	GThreadPool *pool;
+
+	if (jobs->len == 0)
+		return;
+
+	batch.remain = jobs->len;
+
+	pool = g_thread_pool_new(filter_cmd_job_func, &batch, max_threads,
+				 FALSE, NULL);
+	if (pool) {
+		for (i = 0; i < jobs->len; i++)
+			g_thread_pool_push(pool, g_ptr_array_index(jobs, i),
+					   NULL);
+		while (g_atomic_int_get(&batch.remain) > 0)
+			event_loop_iterate();
+		g_thread_pool_free(pool, FALSE, TRUE);
+		return;
+	}
+#endif
+
+	for (i = 0; i < jobs->len; i++)
+		filter_cmd_job_run((FilterCmdJob *)g_ptr_array_index(jobs, i));
+}
+
+static void filter_cmd_jobs_free(GPtrArray *jobs)
+{
+	FilterCmdJob *job;
+	guint i;
+
+	for (i = 0; i < jobs->len; i++) {
+		job = (FilterCmdJob *)g_ptr_array_index(jobs, i);
+		g_strfreev(job->argv);
+		g_slist_free(job->mlist);
+		g_slist_free(job->files);
+		g_free(job->output);
+		g_free(job);
+	}
+	g_ptr_array_free(jobs, TRUE);
+}
+
+/* returns the arguments of CMDLINE rewritten for the bulk mode of the
+   known junk filters, or NULL if the command doesn't have one. The
+   message files are to be appended to them.
+   bogofilter: '-I' is replaced with '-B' (classification and learning).
+   sylfilter: takes several files when learning (-j, -c). */
+static GPtrArray *filter_cmd_get_bulk_args(const gchar *cmdline,
+					   gboolean classify)
+{
+	gchar **argv;
+	gchar *base;
+	gsize len;
+	GPtrArray *args = NULL;
+	gint i;
+
+	argv = strsplit_with_quote(cmdline, " ", 0);
+	if (!argv)
+		return NULL;
+	if (!argv[0]) {
+		g_strfreev(argv);
+		return NULL;
+	}
+
+	base = g_path_get_basename(argv[0]);
+	len = strlen(base);
+	if (len > 4 && !g_ascii_strcasecmp(base + len - 4, ".exe"))
+		base[len - 4] = '\0';
+
+	if (!g_ascii_strcasecmp(base, "bogofilter")) {
+		args = g_ptr_array_new();
+		for (i = 0; argv[i] != NULL; i++) {
+			if (!strcmp(argv[i], "-I") || !strcmp(argv[i], "-b") ||
+			    !strcmp(argv[i], "-B"))
+				continue;
+			g_ptr_array_add(args, g_strdup(argv[i]));
+		}
+		g_ptr_array_add(args, g_strdup("-B"));
+	} else if (!g_ascii_strcasecmp(base, "sylfilter") && !classify) {
+		for (i = 1; argv[i] != NULL; i++) {
+			if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "-c"))
+				break;
+		}
+		if (argv[i] != NULL) {
+			args = g_ptr_array_new();
+			for (i = 0; argv[i] != NULL; i++)
+				g_ptr_array_add(args, g_strdup(argv[i]));
+		}
+	}
+
+	g_free(base);
+	g_strfreev(argv);
+
+	return args;
+}
+
+static FilterCmdJob *filter_cmd_job_new_bulk(GPtrArray *args, GSList *mlist,
+					     GSList *files, gint n)
+{
+	FilterCmdJob *job;
+	gint i;
+
+	job = g_new0(FilterCmdJob, 1);
+	job->argv = g_new(gchar *, args->len + n + 1);
+	for (i = 0; i < args->len; i++)
+		job->argv[i] = g_strdup((gchar *)g_ptr_array_index(args, i));
+	for (; n > 0 && mlist != NULL && files != NULL;
+	     n--, mlist = mlist->next, files = files->next) {
+		job->mlist = g_slist_prepend(job->mlist, mlist->data);
+		job->files = g_slist_prepend(job->files, files->data);
+		job->argv[i++] = g_strdup((gchar *)files->data);
+	}
+	job->argv[i] = NULL;
+	job->mlist = g_slist_reverse(job->mlist);
+	job->files = g_slist_reverse(job->files);
+
+	return job;
+}
+
+static FilterCmdJob *filter_cmd_job_new(const gchar *cmdline, MsgInfo *msginfo,
+					const gchar *file)
+{
+	FilterCmdJob *job;
+	gchar *cmd;
+
+	job = g_new0(FilterCmdJob, 1);
+	cmd = g_strconcat(cmdline, " \"", file, "\"", NULL);
+	job->argv = strsplit_with_quote(cmd, " ", 0);
+	job->mlist = g_slist_append(NULL, msginfo);
+	g_free(cmd);
+
+	return job;
+}
+
+/* split the messages into bulk jobs of at most FILTER_BULK_MAX_FILES
+   files to keep the command line short. */
+static GPtrArray *filter_cmd_create_bulk_jobs(GPtrArray *args, GSList *mlist,
+					      GSList *files,
+					      gboolean get_output)
+{
+	GPtrArray *jobs;
+	FilterCmdJob *job;
+	gint i;
+
+	jobs = g_ptr_array_new();
+
+	while (mlist != NULL && files != NULL) {
+		job = filter_cmd_job_new_bulk(args, mlist, files,
+					      FILTER_BULK_MAX_FILES);
+		job->get_output = get_output;
+		g_ptr_array_add(jobs, job);
+		for (i = 0; i < FILTER_BULK_MAX_FILES && mlist != NULL;
+		     i++, mlist = mlist->next, files = files->next)
+			;
+	}
+
+	return jobs;
+}
+
+/* convert the verdict of a bulk classification line into the exit status
+   of the single message mode (0: junk, 1: clean, 2: unsure). */
+static gint filter_cmd_parse_verdict(const gchar *str)
+{
+	while (g_ascii_isspace(*str))
+		str++;
+	if (!g_ascii_strncasecmp(str, "X-Bogosity:", 11)) {
+		str += 11;
+		while (g_ascii_isspace(*str))
+			str++;
+	}
+
+	switch (g_ascii_toupper(*str)) {
+	case 'S':
+	case 'Y':
+		return 0;
+	case 'H':
+	case 'N':
+		return 1;
+	case 'U':
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+/* the bulk output has one '<file> <verdict>' line per message, in the
+   order of the arguments. */
+static void filter_cmd_parse_bulk_output(FilterCmdJob *job,
+					 GHashTable *table)
+{
+	GSList *cur_msg = job->mlist;
+	GSList *cur_file = job->files;
+	gchar *line, *next;
+	const gchar *file;
+	gsize len;
+	gint ret;
+
+	if (!job->output)
+		return;
+
+	for (line = job->output; *line != '\0' && cur_file != NULL;
+	     line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		strretchomp(line);
+
+		file = (const gchar *)cur_file->data;
+		len = strlen(file);
+		if (strncmp(line, file, len) != 0 ||
+		    (line[len] != ' ' && line[len] != '\t'))
+			continue;
+
+		ret = filter_cmd_parse_verdict(line + len);
+		if (ret >= 0)
+			g_hash_table_insert(table, cur_msg->data,
+					    GINT_TO_POINTER(ret + 1));
+		cur_msg = cur_msg->next;
+		cur_file = cur_file->next;
+	}
+}
+
+static GSList *filter_cmd_get_file_list(GSList *mlist, GSList **msg_list)
+{
+	GSList *files = NULL;
+	GSList *cur;
+	gchar *file;
+
+	*msg_list = NULL;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		file = procmsg_get_message_file((MsgInfo *)cur->data);
+		if (!file)
+			continue;
+		files = g_slist_prepend(files, file);
+		*msg_list = g_slist_prepend(*msg_list, cur->data);
+	}
+
+	*msg_list = g_slist_reverse(*msg_list);
+	return g_slist_reverse(files);
+}
+
+/* run the command test CMDLINE for all messages of MLIST at once, using
+   the bulk mode of the classifier if available, and several commands in
+   parallel otherwise. The results are used by the FLT_COND_CMD_TEST
+   condition through FilterInfo::cmd_test_cache. */
+FilterCmdTestCache *filter_cmd_test_bulk(const gchar *cmdline, GSList *mlist)
+{
+	FilterCmdTestCache *cache;
+	GSList *files, *msgs, *cur, *cur_file;
+	GPtrArray *args;
+	GPtrArray *jobs;
+	FilterCmdJob *job;
+	GTimer *timer;
+	gdouble elapsed;
+	gint n_bulk = 0;
+	gint n_single = 0;
+	guint i;
+
+	g_return_val_if_fail(cmdline != NULL, NULL);
+
+	cache = g_new0(FilterCmdTestCache, 1);
+	cache->cmdline = g_strdup(cmdline);
+	cache->table = g_hash_table_new(NULL, NULL);
+
+	/* persistent processes classify one message at a time */
+	if (!mlist || g_str_has_prefix(cmdline, FILTER_COPROC_PREFIX))
+		return cache;
+
+	timer = g_timer_new();
+
+	files = filter_cmd_get_file_list(mlist, &msgs);
+
+	args = filter_cmd_get_bulk_args(cmdline, TRUE);
+	if (args) {
+		jobs = filter_cmd_create_bulk_jobs(args, msgs, files, TRUE);
+		filter_cmd_run_jobs(jobs, FILTER_CMD_THREADS);
+		for (i = 0; i < jobs->len; i++) {
+			job = (FilterCmdJob *)g_ptr_array_index(jobs, i);
+			filter_cmd_parse_bulk_output(job, cache->table);
+		}
+		filter_cmd_jobs_free(jobs);
+		n_bulk = g_hash_table_size(cache->table);
+		g_ptr_array_foreach(args, (GFunc)g_free, NULL);
+		g_ptr_array_free(args, TRUE);
+	}
+
+	/* the rest of messages (or all of them if the bulk mode is not
+	   available) are classified one by one */
+	jobs = g_ptr_array_new();
+	for (cur = msgs, cur_file = files; cur != NULL && cur_file != NULL;
+	     cur = cur->next, cur_file = cur_file->next) {
+		if (g_hash_table_lookup(cache->table, cur->data))
+			continue;
+		job = filter_cmd_job_new(cmdline, (MsgInfo *)cur->data,
+					 (gchar *)cur_file->data);
+		g_ptr_array_add(jobs, job);
+	}
+	filter_cmd_run_jobs(jobs, FILTER_CMD_THREADS);
+	for (i = 0; i < jobs->len; i++) {
+		job = (FilterCmdJob *)g_ptr_array_index(jobs, i);
+		if (job->status >= 0) {
+			g_hash_table_insert(cache->table, job->mlist->data,
+					    GINT_TO_POINTER(job->status + 1));
+			n_single++;
+		}
+	}
+	filter_cmd_jobs_free(jobs);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	debug_print("filter_cmd_test_bulk: %d messages classified "
+		    "(bulk: %d, single: %d) in %.2f sec (%.1f msgs/sec)\n",
+		    n_bulk + n_single, n_bulk, n_single, elapsed,
+		    elapsed > 0.0 ? (n_bulk + n_single) / elapsed : 0.0);
+	g_timer_destroy(timer);
+
+	slist_free_strings(files);
+	g_slist_free(files);
+	g_slist_free(msgs);
+
+	return cache;
+}
+
+void filter_cmd_test_cache_free(FilterCmdTestCache *cache)
+{
+	if (!cache)
+		return;
+
+	g_hash_table_destroy(cache->table);
+	g_free(cache->cmdline);
+	g_free(cache);
+}
+
+/* execute CMDLINE (e.g. the learning command of the junk filter) for all
+   messages of MLIST. Several files are passed to one command if the
+   classifier supports it. Returns 0 on success, -1 if the command could
+   not be executed, and the exit status of the first failed command
+   otherwise. */
+gint filter_cmd_exec_bulk(const gchar *cmdline, GSList *mlist)
+{
+	GSList *files, *msgs, *cur, *cur_file;
+	GPtrArray *args;
+	GPtrArray *jobs;
+	FilterCmdJob *job;
+	GTimer *timer;
+	gint n;
+	gint ret = 0;
+	guint i;
+
+	g_return_val_if_fail(cmdline != NULL, -1);
+
+	if (!mlist)
+		return 0;
+
+	timer = g_timer_new();
+
+	files = filter_cmd_get_file_list(mlist, &msgs);
+	n = g_slist_length(files);
+
+	if (g_str_has_prefix(cmdline, FILTER_COPROC_PREFIX)) {
+		for (cur = files; cur != NULL; cur = cur->next) {
+			ret = filter_cmd_exec_file(cmdline, (gchar *)cur->data,
+						   TRUE);
+			if (ret != 0) {
+				g_warning("filter_cmd_exec_bulk: command returned %d: %s",
+					  ret, cmdline);
+				break;
+			}
+		}
+		slist_free_strings(files);
+		g_slist_free(files);
+		g_slist_free(msgs);
+		g_timer_destroy(timer);
+		return ret;
+	}
+
+	args = filter_cmd_get_bulk_args(cmdline, FALSE);
+	if (args) {
+		jobs = filter_cmd_create_bulk_jobs(args, msgs, files, FALSE);
+		g_ptr_array_foreach(args, (GFunc)g_free, NULL);
+		g_ptr_array_free(args, TRUE);
+	} else {
+		jobs = g_ptr_array_new();
+		for (cur = msgs, cur_file = files;
+		     cur != NULL && cur_file != NULL;
+		     cur = cur->next, cur_file = cur_file->next) {
+			job = filter_cmd_job_new(cmdline, (MsgInfo *)cur->data,
+						 (gchar *)cur_file->data);
+			g_ptr_array_add(jobs, job);
+		}
+	}
+
+	/* learning updates the database, so the commands are run one by one */
+	filter_cmd_run_jobs(jobs, 1);
+	for (i = 0; i < jobs->len; i++) {
+		job = (FilterCmdJob *)g_ptr_array_index(jobs, i);
+		if (job->status != 0) {
+			g_warning("filter_cmd_exec_bulk: command returned %d: %s",
+				  job->status, cmdline);
+			ret = job->status;
+			break;
+		}
+	}
+
+	debug_print("filter_cmd_exec_bulk: %d messages in %d command(s) "
+		    "in %.2f sec\n", n, jobs->len, g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	filter_cmd_jobs_free(jobs);
+	slist_free_strings(files);
+	g_slist_free(files);
+	g_slist_free(msgs);
+
+	return ret;
+}
+
 void filter_read_config(void)
 {
 	gchar *rcpath;
@@ -1540,6 +2370,7 @@ FilterInfo *filter_info_new(void)
 	fltinfo->drop_done = FALSE;
 	fltinfo->error = FLT_ERROR_OK;
 	fltinfo->last_exec_exit_status = 0;
+	fltinfo->cmd_test_cache = NULL;
 
 	return fltinfo;
 }
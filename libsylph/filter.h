@@ -30,6 +30,7 @@ typedef struct _FilterCond	FilterCond;
 typedef struct _FilterAction	FilterAction;
 typedef struct _FilterRule	FilterRule;
 typedef struct _FilterInfo	FilterInfo;
+typedef struct _FilterCmdTestCache	FilterCmdTestCache;
 
 typedef enum
 {
@@ -111,6 +112,14 @@ typedef enum
 #define FLT_IS_NOT_MATCH(flag)	((flag & FLT_NOT_MATCH) != 0)
 #define FLT_IS_CASE_SENS(flag)	((flag & FLT_CASE_SENS) != 0)
 
+/* Commands of FLT_COND_CMD_TEST and FLT_ACTION_EXEC starting with this
+   prefix are kept running between messages. The path of each message
+   file is written to the stdin of the process as one line, and the
+   process answers with one line containing the exit status. The process
+   is restarted if it exits or doesn't answer in time, and the command is
+   executed with the file as its argument if it keeps failing. */
+#define FILTER_COPROC_PREFIX	"coproc:"
+
 typedef gboolean (*FilterInAddressBookFunc)	(const gchar	*address);
 
 struct _FilterCond
@@ -164,6 +173,14 @@ struct _FilterInfo
 
 	FilterErrorValue error;
 	gint last_exec_exit_status;
+
+	FilterCmdTestCache *cmd_test_cache;
+};
+
+struct _FilterCmdTestCache
+{
+	gchar *cmdline;
+	GHashTable *table;	/* MsgInfo -> exit status + 1 */
 };
 
 gint filter_apply			(GSList			*fltlist,
@@ -214,6 +231,14 @@ FilterAction *filter_action_new		(FilterActionType	 type,
 					 const gchar		*str);
 FilterInfo *filter_info_new		(void);
 
+FilterCmdTestCache *filter_cmd_test_bulk	(const gchar	*cmdline,
+						 GSList		*mlist);
+void filter_cmd_test_cache_free		(FilterCmdTestCache	*cache);
+gint filter_cmd_exec_bulk		(const gchar		*cmdline,
+					 GSList			*mlist);
+
+void filter_coproc_stop_all		(void);
+
 FilterRule *filter_junk_rule_create	(PrefsAccount		*account,
 					 FolderItem		*default_junk,
 					 gboolean		 is_manual);
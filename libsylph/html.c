@@ -19,6 +19,7 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -27,6 +28,7 @@
 #include "utils.h"
 
 #define HTMLBUFSIZE	8192
+#define HTMLREADSIZE	65536
 #define HR_STR		"------------------------------------------------"
 
 typedef struct _HTMLSymbol	HTMLSymbol;
@@ -168,7 +170,74 @@ static HTMLSymbol other_symbol_list[] = {
 	{"&fnof;"  , "\xc6\x92"},
 };
 
-static GHashTable *default_symbol_table;
+/* all symbols sorted by key, for the binary search in html_lookup_symbol() */
+static HTMLSymbol **symbol_index;
+static guint symbol_index_len;
+
+typedef enum
+{
+	HTML_TAG_UNKNOWN,
+	HTML_TAG_BR,
+	HTML_TAG_A,
+	HTML_TAG_A_END,
+	HTML_TAG_P,
+	HTML_TAG_PRE,
+	HTML_TAG_PRE_END,
+	HTML_TAG_BLOCKQUOTE,
+	HTML_TAG_BLOCKQUOTE_END,
+	HTML_TAG_HR,
+	HTML_TAG_BLOCK,
+	HTML_TAG_TABLE_END,
+	HTML_TAG_BLOCK_END
+} HTMLTagType;
+
+typedef struct _HTMLTagEntry	HTMLTagEntry;
+
+struct _HTMLTagEntry
+{
+	const gchar *name;
+	HTMLTagType type;
+};
+
+/* perfect hash of the known tag names, indexed by HTML_TAG_HASH() */
+#define HTML_TAG_HASH(name, len)				\
+	((g_ascii_tolower((name)[0]) * 6 +			\
+	  g_ascii_tolower((name)[(len) - 1]) * 22 + (len)) & 31)
+
+static const HTMLTagEntry tag_table[32] = {
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"p"		, HTML_TAG_P},
+	{"/div"		, HTML_TAG_BLOCK_END},
+	{"/li"		, HTML_TAG_BLOCK_END},
+	{"blockquote"	, HTML_TAG_BLOCKQUOTE},
+	{"/ul"		, HTML_TAG_BLOCK_END},
+	{"tr"		, HTML_TAG_BLOCK},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"ul"		, HTML_TAG_BLOCK},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"table"	, HTML_TAG_BLOCK},
+	{"/pre"		, HTML_TAG_PRE_END},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"/table"	, HTML_TAG_TABLE_END},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"li"		, HTML_TAG_BLOCK},
+	{"pre"		, HTML_TAG_PRE},
+	{"/a"		, HTML_TAG_A_END},
+	{"/blockquote"	, HTML_TAG_BLOCKQUOTE_END},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"br"		, HTML_TAG_BR},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{NULL		, HTML_TAG_UNKNOWN},
+	{"a"		, HTML_TAG_A},
+	{"hr"		, HTML_TAG_HR},
+	{"div"		, HTML_TAG_BLOCK}
+};
 
 static HTMLState html_read_line		(HTMLParser	*parser);
 
@@ -187,13 +256,24 @@ static gchar *html_find_str_case	(HTMLParser	*parser,
 
 static HTMLState html_parse_tag		(HTMLParser	*parser);
 static void html_parse_special		(HTMLParser	*parser);
-static void html_get_parenthesis	(HTMLParser	*parser,
-					 gchar		*buf,
+static gint html_get_parenthesis	(HTMLParser	*parser,
+					 const gchar   **tag);
+
+static const gchar *html_lookup_symbol	(const gchar	*name,
 					 gint		 len);
+static gchar *html_get_href		(const gchar	*str,
+					 const gchar	*end);
+static gchar *html_unescape_str		(const gchar	*str,
+					 gint		 size);
 
-static gchar *html_unescape_str		(HTMLParser	*parser,
-					 const gchar	*str);
 
+static gint html_symbol_compare(gconstpointer a, gconstpointer b)
+{
+	const HTMLSymbol *sym_a = *(const HTMLSymbol **)a;
+	const HTMLSymbol *sym_b = *(const HTMLSymbol **)b;
+
+	return strcmp(sym_a->key, sym_b->key);
+}
 
 HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
 {
@@ -207,6 +287,7 @@ HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
 	parser->conv = conv;
 	parser->str = g_string_new(NULL);
 	parser->buf = g_string_new(NULL);
+	parser->rawbuf = g_string_new(NULL);
 	parser->bufp = parser->buf->str;
 	parser->state = HTML_NORMAL;
 	parser->href = NULL;
@@ -216,25 +297,27 @@ HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
 	parser->pre = FALSE;
 	parser->blockquote = 0;
 
-#define SYMBOL_TABLE_ADD(table, list) \
+#define SYMBOL_INDEX_ADD(list) \
 { \
 	gint i; \
  \
 	for (i = 0; i < sizeof(list) / sizeof(list[0]); i++) \
-		g_hash_table_insert(table, list[i].key, list[i].val); \
+		symbol_index[symbol_index_len++] = &list[i]; \
 }
 
-	if (!default_symbol_table) {
-		default_symbol_table =
-			g_hash_table_new(g_str_hash, g_str_equal);
-		SYMBOL_TABLE_ADD(default_symbol_table, symbol_list);
-		SYMBOL_TABLE_ADD(default_symbol_table, latin_symbol_list);
-		SYMBOL_TABLE_ADD(default_symbol_table, other_symbol_list);
+	if (!symbol_index) {
+		symbol_index = g_new(HTMLSymbol *,
+				     G_N_ELEMENTS(symbol_list) +
+				     G_N_ELEMENTS(latin_symbol_list) +
+				     G_N_ELEMENTS(other_symbol_list));
+		SYMBOL_INDEX_ADD(symbol_list);
+		SYMBOL_INDEX_ADD(latin_symbol_list);
+		SYMBOL_INDEX_ADD(other_symbol_list);
+		qsort(symbol_index, symbol_index_len, sizeof(HTMLSymbol *),
+		      html_symbol_compare);
 	}
 
-#undef SYMBOL_TABLE_ADD
-
-	parser->symbol_table = default_symbol_table;
+#undef SYMBOL_INDEX_ADD
 
 	return parser;
 }
@@ -243,24 +326,27 @@ void html_parser_destroy(HTMLParser *parser)
 {
 	g_string_free(parser->str, TRUE);
 	g_string_free(parser->buf, TRUE);
+	g_string_free(parser->rawbuf, TRUE);
 	g_free(parser->href);
 	g_free(parser);
 }
 
+/* returns the text up to the next tag which changes the state. text which
+   spans several lines is returned as one fragment. */
 const gchar *html_parse(HTMLParser *parser)
 {
+	gsize len;
+
 	parser->state = HTML_NORMAL;
 	g_string_truncate(parser->str, 0);
 
-	if (*parser->bufp == '\0') {
-		g_string_truncate(parser->buf, 0);
-		parser->bufp = parser->buf->str;
-		if (html_read_line(parser) == HTML_EOF)
-			return NULL;
-	}
-
-	while (*parser->bufp != '\0') {
+	for (;;) {
 		switch (*parser->bufp) {
+		case '\0':
+			if (html_read_line(parser) == HTML_EOF)
+				return parser->str->len > 0 ?
+					parser->str->str : NULL;
+			break;
 		case '<':
 			if (parser->str->len == 0)
 				html_parse_tag(parser);
@@ -284,47 +370,85 @@ const gchar *html_parse(HTMLParser *parser)
 				parser->bufp++;
 				break;
 			}
-			/* fallthrough */
-		default:
 			html_append_char(parser, *parser->bufp++);
+			break;
+		default:
+			/* append the whole run of plain text at once */
+			len = strcspn(parser->bufp + 1, "<& \t\r\n") + 1;
+			html_append_str(parser, parser->bufp, len);
+			parser->bufp += len;
 		}
 	}
-
-	return parser->str->str;
 }
 
+/* read the next block and append its complete lines to the buffer after
+   conversion. the data before the current position may be discarded,
+   so the pointers into the buffer become invalid. */
 static HTMLState html_read_line(HTMLParser *parser)
 {
-	gchar buf[HTMLBUFSIZE];
+	GString *raw = parser->rawbuf;
+	HTMLState state = HTML_NORMAL;
+	gsize consumed;
+	gsize len;
+	gsize size;
+	gchar *p;
+	gchar *end;
+	gchar *eol;
 	gchar *conv_str;
-	gint index;
+	gchar c;
+
+	/* discard the consumed data when it's at least half of the buffer,
+	   so each byte is moved at most once on average */
+	consumed = parser->bufp - parser->buf->str;
+	if (consumed > 0 && consumed >= parser->buf->len / 2) {
+		g_string_erase(parser->buf, 0, consumed);
+		consumed = 0;
+	}
+
+	len = raw->len;
+	g_string_set_size(raw, len + HTMLREADSIZE);
+	size = fread(raw->str + len, 1, HTMLREADSIZE, parser->fp);
+	g_string_truncate(raw, len + size);
 
-	if (fgets(buf, sizeof(buf), parser->fp) == NULL) {
+	if (raw->len == 0) {
+		parser->bufp = parser->buf->str + consumed;
 		parser->state = HTML_EOF;
 		return HTML_EOF;
 	}
 
-	conv_str = conv_convert(parser->conv, buf);
-	if (!conv_str) {
-		index = parser->bufp - parser->buf->str;
+	/* convert line by line (or by HTMLBUFSIZE - 1 bytes as fgets() does)
+	   so that a line which fails to convert falls back on its own */
+	p = raw->str;
+	end = raw->str + raw->len;
+	while (p < end) {
+		if ((eol = memchr(p, '\n', MIN(end - p, HTMLBUFSIZE - 1)))
+		    != NULL)
+			eol++;
+		else if (end - p >= HTMLBUFSIZE - 1)
+			eol = p + HTMLBUFSIZE - 1;
+		else if (size == HTMLREADSIZE)
+			break;
+		else
+			eol = end;
+
+		c = *eol;
+		*eol = '\0';
+		conv_str = conv_convert(parser->conv, p);
+		if (!conv_str) {
+			conv_str = conv_utf8todisp(p, NULL);
+			state = HTML_CONV_FAILED;
+		}
+		*eol = c;
 
-		conv_str = conv_utf8todisp(buf, NULL);
 		g_string_append(parser->buf, conv_str);
 		g_free(conv_str);
-
-		parser->bufp = parser->buf->str + index;
-
-		return HTML_CONV_FAILED;
+		p = eol;
 	}
+	g_string_erase(raw, 0, p - raw->str);
 
-	index = parser->bufp - parser->buf->str;
-
-	g_string_append(parser->buf, conv_str);
-	g_free(conv_str);
+	parser->bufp = parser->buf->str + consumed;
 
-	parser->bufp = parser->buf->str + index;
-
-	return HTML_NORMAL;
+	return state;
 }
 
 static void html_append_char(HTMLParser *parser, gchar ch)
@@ -391,11 +515,19 @@ static void html_append_str(HTMLParser *parser, const gchar *str, gint len)
 		parser->newline = FALSE;
 }
 
+#define HTML_BUF_REMAIN(parser) \
+	((parser)->buf->len - ((parser)->bufp - (parser)->buf->str))
+
+/* the searches below don't rescan the data which has already been
+   searched before reading more */
 static gchar *html_find_char(HTMLParser *parser, gchar ch)
 {
 	gchar *p;
+	gsize scanned = 0;
 
-	while ((p = strchr(parser->bufp, ch)) == NULL) {
+	while ((p = memchr(parser->bufp + scanned, ch,
+			   HTML_BUF_REMAIN(parser) - scanned)) == NULL) {
+		scanned = HTML_BUF_REMAIN(parser);
 		if (html_read_line(parser) == HTML_EOF)
 			return NULL;
 	}
@@ -406,8 +538,13 @@ static gchar *html_find_char(HTMLParser *parser, gchar ch)
 static gchar *html_find_str(HTMLParser *parser, const gchar *str)
 {
 	gchar *p;
+	gsize scanned = 0;
+	gsize len;
 
-	while ((p = strstr(parser->bufp, str)) == NULL) {
+	len = strlen(str);
+	while ((p = strstr(parser->bufp + scanned, str)) == NULL) {
+		if (HTML_BUF_REMAIN(parser) >= len)
+			scanned = HTML_BUF_REMAIN(parser) - len + 1;
 		if (html_read_line(parser) == HTML_EOF)
 			return NULL;
 	}
@@ -418,8 +555,13 @@ static gchar *html_find_str(HTMLParser *parser, const gchar *str)
 static gchar *html_find_str_case(HTMLParser *parser, const gchar *str)
 {
 	gchar *p;
+	gsize scanned = 0;
+	gsize len;
 
-	while ((p = strcasestr(parser->bufp, str)) == NULL) {
+	len = strlen(str);
+	while ((p = strcasestr(parser->bufp + scanned, str)) == NULL) {
+		if (HTML_BUF_REMAIN(parser) >= len)
+			scanned = HTML_BUF_REMAIN(parser) - len + 1;
 		if (html_read_line(parser) == HTML_EOF)
 			return NULL;
 	}
@@ -427,145 +569,64 @@ static gchar *html_find_str_case(HTMLParser *parser, const gchar *str)
 	return p;
 }
 
-static HTMLTag *html_get_tag(const gchar *str)
+static HTMLTagType html_get_tag_type(const gchar *name, gint len)
 {
-	HTMLTag *tag;
-	gchar *tmp;
-	gchar *tmpp;
-
-	g_return_val_if_fail(str != NULL, NULL);
-
-	if (*str == '\0' || *str == '!') return NULL;
-
-	tmp = g_strdup(str);
+	const HTMLTagEntry *entry;
 
-	tag = g_new0(HTMLTag, 1);
+	entry = &tag_table[HTML_TAG_HASH(name, len)];
+	if (entry->name && !g_ascii_strncasecmp(entry->name, name, len) &&
+	    entry->name[len] == '\0')
+		return entry->type;
 
-	for (tmpp = tmp; *tmpp != '\0' && !g_ascii_isspace(*tmpp); tmpp++) {
-		if (tmpp > tmp && *tmpp == '/') {
-			*tmpp = '\0';
-			break;
-		}
-	}
-
-	if (*tmpp == '\0') {
-		g_strdown(tmp);
-		tag->name = tmp;
-		return tag;
-	} else {
-		*tmpp++ = '\0';
-		g_strdown(tmp);
-		tag->name = g_strdup(tmp);
-	}
-
-	while (*tmpp != '\0') {
-		HTMLAttr *attr;
-		gchar *attr_name;
-		gchar *attr_value;
-		gchar *p;
-		gchar quote;
-
-		while (g_ascii_isspace(*tmpp)) tmpp++;
-		if (tmpp > tmp && *tmpp == '/')
-			break;
-		attr_name = tmpp;
-
-		while (*tmpp != '\0' && !g_ascii_isspace(*tmpp) &&
-		       *tmpp != '=')
-			tmpp++;
-		if (*tmpp != '\0' && *tmpp != '=') {
-			*tmpp++ = '\0';
-			while (g_ascii_isspace(*tmpp)) tmpp++;
-		}
-
-		if (*tmpp == '=') {
-			*tmpp++ = '\0';
-			while (g_ascii_isspace(*tmpp)) tmpp++;
-
-			if (*tmpp == '"' || *tmpp == '\'') {
-				/* name="value" */
-				quote = *tmpp;
-				tmpp++;
-				attr_value = tmpp;
-				if ((p = strchr(attr_value, quote)) == NULL) {
-					g_warning("html_get_tag(): syntax error in tag: '%s'\n", str);
-					break;
-				}
-				tmpp = p;
-				*tmpp++ = '\0';
-				while (g_ascii_isspace(*tmpp)) tmpp++;
-			} else {
-				/* name=value */
-				attr_value = tmpp;
-				while (*tmpp != '\0' && !g_ascii_isspace(*tmpp)) tmpp++;
-				if (*tmpp != '\0')
-					*tmpp++ = '\0';
-			}
-		} else
-			attr_value = "";
-
-		g_strchomp(attr_name);
-		g_strdown(attr_name);
-		attr = g_new(HTMLAttr, 1);
-		attr->name = g_strdup(attr_name);
-		attr->value = g_strdup(attr_value);
-		tag->attr = g_list_append(tag->attr, attr);
-	}
+	/* <h1> - <h6> */
+	if (len > 1 && g_ascii_tolower(name[0]) == 'h' &&
+	    g_ascii_isdigit(name[1]))
+		return HTML_TAG_BLOCK;
 
-	g_free(tmp);
-
-	return tag;
-}
-
-static void html_free_tag(HTMLTag *tag)
-{
-	if (!tag) return;
-
-	g_free(tag->name);
-	while (tag->attr != NULL) {
-		HTMLAttr *attr = (HTMLAttr *)tag->attr->data;
-		g_free(attr->name);
-		g_free(attr->value);
-		g_free(attr);
-		tag->attr = g_list_remove(tag->attr, tag->attr->data);
-	}
-	g_free(tag);
+	return HTML_TAG_UNKNOWN;
 }
 
 static HTMLState html_parse_tag(HTMLParser *parser)
 {
-	gchar buf[HTMLBUFSIZE];
-	HTMLTag *tag;
-
-	html_get_parenthesis(parser, buf, sizeof(buf));
+	const gchar *tag;
+	const gchar *end;
+	const gchar *p;
+	gint len;
 
-	tag = html_get_tag(buf);
+	len = html_get_parenthesis(parser, &tag);
 
 	parser->state = HTML_UNKNOWN;
-	if (!tag) return HTML_UNKNOWN;
+	if (len == 0 || *tag == '!') return HTML_UNKNOWN;
+
+	end = tag + len;
+	for (p = tag; p < end && !g_ascii_isspace(*p); p++) {
+		if (p > tag && *p == '/')
+			break;
+	}
 
-	if (!strcmp(tag->name, "br")) {
+	switch (html_get_tag_type(tag, p - tag)) {
+	case HTML_TAG_BR:
 		parser->space = FALSE;
 		html_append_char(parser, '\n');
 		parser->state = HTML_BR;
-	} else if (!strcmp(tag->name, "a")) {
-		GList *cur;
+		break;
+	case HTML_TAG_A:
+		if (p < end && *p != '/') {
+			gchar *href;
 
-		for (cur = tag->attr; cur != NULL; cur = cur->next) {
-			HTMLAttr *attr = (HTMLAttr *)cur->data;
-
-			if (attr && !strcmp(attr->name, "href")) {
+			if ((href = html_get_href(p + 1, end)) != NULL) {
 				g_free(parser->href);
-				parser->href = html_unescape_str(parser, attr->value);
+				parser->href = href;
 				parser->state = HTML_HREF;
-				break;
 			}
 		}
-	} else if (!strcmp(tag->name, "/a")) {
+		break;
+	case HTML_TAG_A_END:
 		g_free(parser->href);
 		parser->href = NULL;
 		parser->state = HTML_NORMAL;
-	} else if (!strcmp(tag->name, "p")) {
+		break;
+	case HTML_TAG_P:
 		parser->space = FALSE;
 		if (!parser->empty_line) {
 			parser->space = FALSE;
@@ -573,66 +634,83 @@ static HTMLState html_parse_tag(HTMLParser *parser)
 			html_append_char(parser, '\n');
 		}
 		parser->state = HTML_PAR;
-	} else if (!strcmp(tag->name, "pre")) {
+		break;
+	case HTML_TAG_PRE:
 		parser->pre = TRUE;
 		parser->state = HTML_PRE;
-	} else if (!strcmp(tag->name, "/pre")) {
+		break;
+	case HTML_TAG_PRE_END:
 		parser->pre = FALSE;
 		parser->state = HTML_NORMAL;
-	} else if (!strcmp(tag->name, "blockquote")) {
+		break;
+	case HTML_TAG_BLOCKQUOTE:
 		parser->blockquote++;
 		parser->state = HTML_BLOCKQUOTE;
-	} else if (!strcmp(tag->name, "/blockquote")) {
+		break;
+	case HTML_TAG_BLOCKQUOTE_END:
 		parser->blockquote--;
 		if (parser->blockquote < 0)
 			parser->blockquote = 0;
 		parser->state = HTML_NORMAL;
-	} else if (!strcmp(tag->name, "hr")) {
+		break;
+	case HTML_TAG_HR:
 		if (!parser->newline) {
 			parser->space = FALSE;
 			html_append_char(parser, '\n');
 		}
 		html_append_str(parser, HR_STR "\n", -1);
 		parser->state = HTML_HR;
-	} else if (!strcmp(tag->name, "div")    ||
-		   !strcmp(tag->name, "ul")     ||
-		   !strcmp(tag->name, "li")     ||
-		   !strcmp(tag->name, "table")  ||
-		   !strcmp(tag->name, "tr")     ||
-		   (tag->name[0] == 'h' && g_ascii_isdigit(tag->name[1]))) {
+		break;
+	case HTML_TAG_BLOCK:
+	case HTML_TAG_BLOCK_END:
 		if (!parser->newline) {
 			parser->space = FALSE;
 			html_append_char(parser, '\n');
 		}
 		parser->state = HTML_NORMAL;
-	} else if (!strcmp(tag->name, "/table") ||
-		   (tag->name[0] == '/' &&
-		    tag->name[1] == 'h' &&
-		    g_ascii_isdigit(tag->name[1]))) {
+		break;
+	case HTML_TAG_TABLE_END:
 		if (!parser->empty_line) {
 			parser->space = FALSE;
 			if (!parser->newline) html_append_char(parser, '\n');
 			html_append_char(parser, '\n');
 		}
 		parser->state = HTML_NORMAL;
-	} else if (!strcmp(tag->name, "/div")   ||
-		   !strcmp(tag->name, "/ul")    ||
-		   !strcmp(tag->name, "/li")) {
-		if (!parser->newline) {
-			parser->space = FALSE;
-			html_append_char(parser, '\n');
-		}
-		parser->state = HTML_NORMAL;
+		break;
+	default:
+		break;
 	}
 
-	html_free_tag(tag);
-
 	return parser->state;
 }
 
+/* find the symbol whose key is the @len bytes at @name ("&foo;") */
+static const gchar *html_lookup_symbol(const gchar *name, gint len)
+{
+	guint lo = 0, hi = symbol_index_len;
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		const gchar *key = symbol_index[mid]->key;
+		gint cmp;
+
+		cmp = strncmp(key, name, len);
+		if (cmp == 0 && key[len] != '\0')
+			cmp = 1;
+		if (cmp == 0)
+			return symbol_index[mid]->val;
+		else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
 static void html_parse_special(HTMLParser *parser)
 {
-	gchar symbol_name[9];
+	const gchar *symbol_name;
 	gint n;
 	const gchar *val;
 
@@ -640,23 +718,24 @@ static void html_parse_special(HTMLParser *parser)
 	g_return_if_fail(*parser->bufp == '&');
 
 	/* &foo; */
-	for (n = 0; parser->bufp[n] != '\0' && parser->bufp[n] != ';'; n++)
+	symbol_name = parser->bufp;
+	for (n = 1; n <= 7 && symbol_name[n] != '\0' &&
+	     symbol_name[n] != ';' && symbol_name[n] != '\n'; n++)
 		;
-	if (n > 7 || parser->bufp[n] != ';') {
+	if (n > 7 || symbol_name[n] != ';') {
 		/* output literal `&' */
 		html_append_char(parser, *parser->bufp++);
 		parser->state = HTML_NORMAL;
 		return;
 	}
-	strncpy2(symbol_name, parser->bufp, n + 2);
 	parser->bufp += n + 1;
 
-	if ((val = g_hash_table_lookup(parser->symbol_table, symbol_name))
-	    != NULL) {
+	if ((val = html_lookup_symbol(symbol_name, n + 1)) != NULL) {
 		html_append_str(parser, val, -1);
 		parser->state = HTML_NORMAL;
 		return;
-	} else if (symbol_name[1] == '#' && g_ascii_isdigit(symbol_name[2])) {
+	} else if (n > 2 && symbol_name[1] == '#' &&
+		   g_ascii_isdigit(symbol_name[2])) {
 		gint ch;
 
 		ch = atoi(symbol_name + 2);
@@ -664,7 +743,7 @@ static void html_parse_special(HTMLParser *parser)
 			html_append_char(parser, ch);
 			parser->state = HTML_NORMAL;
 			return;
-		} else {
+		} else if (ch > 0) {
 			/* ISO 10646 to UTF-8 */
 			gchar buf[6];
 			gint len;
@@ -678,22 +757,26 @@ static void html_parse_special(HTMLParser *parser)
 		}
 	}
 
-	html_append_str(parser, symbol_name, -1);
+	html_append_str(parser, symbol_name, n + 1);
 }
 
-static void html_get_parenthesis(HTMLParser *parser, gchar *buf, gint len)
+/* skip the tag at the current position, and return the stripped contents
+   of it (up to HTMLBUFSIZE - 1 bytes) in @tag without copying. */
+static gint html_get_parenthesis(HTMLParser *parser, const gchar **tag)
 {
 	gchar *p;
+	const gchar *start;
+	const gchar *end;
 
-	buf[0] = '\0';
-	g_return_if_fail(*parser->bufp == '<');
+	*tag = "";
+	g_return_val_if_fail(*parser->bufp == '<', 0);
 
 	/* ignore comment / CSS / script stuff */
 	if (!strncmp(parser->bufp, "<!--", 4)) {
 		parser->bufp += 4;
 		if ((p = html_find_str(parser, "-->")) != NULL)
 			parser->bufp = p + 3;
-		return;
+		return 0;
 	}
 	if (!g_ascii_strncasecmp(parser->bufp, "<style", 6)) {
 		parser->bufp += 6;
@@ -702,7 +785,7 @@ static void html_get_parenthesis(HTMLParser *parser, gchar *buf, gint len)
 			if ((p = html_find_char(parser, '>')) != NULL)
 				parser->bufp = p + 1;
 		}
-		return;
+		return 0;
 	}
 	if (!g_ascii_strncasecmp(parser->bufp, "<script", 7)) {
 		parser->bufp += 7;
@@ -711,22 +794,91 @@ static void html_get_parenthesis(HTMLParser *parser, gchar *buf, gint len)
 			if ((p = html_find_char(parser, '>')) != NULL)
 				parser->bufp = p + 1;
 		}
-		return;
+		return 0;
 	}
 
 	parser->bufp++;
 	if ((p = html_find_char(parser, '>')) == NULL)
-		return;
-
-	strncpy2(buf, parser->bufp, MIN(p - parser->bufp + 1, len));
-	g_strstrip(buf);
+		return 0;
+
+	start = parser->bufp;
+	end = start + MIN(p - start, HTMLBUFSIZE - 1);
+	while (start < end && g_ascii_isspace(*start))
+		start++;
+	while (end > start && g_ascii_isspace(*(end - 1)))
+		end--;
 	parser->bufp = p + 1;
+
+	*tag = start;
+	return end - start;
 }
 
-static gchar *html_unescape_str(HTMLParser *parser, const gchar *str)
+/* scan the attributes between @str and @end, and return the unescaped
+   value of href, if any */
+static gchar *html_get_href(const gchar *str, const gchar *end)
 {
 	const gchar *p = str;
-	gchar symbol_name[9];
+
+	while (p < end) {
+		const gchar *attr_name;
+		const gchar *attr_name_end;
+		const gchar *attr_value;
+		const gchar *attr_value_end;
+		gchar quote;
+
+		while (p < end && g_ascii_isspace(*p)) p++;
+		if (p < end && *p == '/')
+			break;
+		attr_name = p;
+
+		while (p < end && !g_ascii_isspace(*p) && *p != '=')
+			p++;
+		attr_name_end = p;
+		if (p < end && *p != '=') {
+			p++;
+			while (p < end && g_ascii_isspace(*p)) p++;
+		}
+
+		if (p < end && *p == '=') {
+			p++;
+			while (p < end && g_ascii_isspace(*p)) p++;
+
+			if (p < end && (*p == '"' || *p == '\'')) {
+				/* name="value" */
+				quote = *p;
+				p++;
+				attr_value = p;
+				attr_value_end = memchr(p, quote, end - p);
+				if (attr_value_end == NULL) {
+					g_warning("html_get_href(): syntax error in tag: '%.*s'\n", (gint)(end - str), str);
+					break;
+				}
+				p = attr_value_end + 1;
+				while (p < end && g_ascii_isspace(*p)) p++;
+			} else {
+				/* name=value */
+				attr_value = p;
+				while (p < end && !g_ascii_isspace(*p)) p++;
+				attr_value_end = p;
+				if (p < end)
+					p++;
+			}
+		} else
+			attr_value = attr_value_end = p;
+
+		if (attr_name_end - attr_name == 4 &&
+		    !g_ascii_strncasecmp(attr_name, "href", 4))
+			return html_unescape_str(attr_value,
+						 attr_value_end - attr_value);
+	}
+
+	return NULL;
+}
+
+static gchar *html_unescape_str(const gchar *str, gint size)
+{
+	const gchar *p = str;
+	const gchar *end = str + size;
 	gint n;
 	const gchar *val;
 	gchar *unescape_str;
@@ -735,36 +887,34 @@ static gchar *html_unescape_str(HTMLParser *parser, const gchar *str)
 	if (!str)
 		return NULL;
 
-	up = unescape_str = g_malloc(strlen(str) + 1);
+	up = unescape_str = g_malloc(size + 1);
 
-	while (*p != '\0') {
+	while (p < end) {
 		switch (*p) {
 		case '&':
-			for (n = 0; p[n] != '\0' && p[n] != ';'; n++)
+			for (n = 1; n <= 7 && p + n < end && p[n] != ';'; n++)
 				;
-			if (n > 7 || p[n] != ';') {
+			if (n > 7 || p + n == end) {
 				*up++ = *p++;
 				break;
 			}
-			strncpy2(symbol_name, p, n + 2);
-			p += n + 1;
 
-			if ((val = g_hash_table_lookup(parser->symbol_table, symbol_name)) != NULL) {
+			if ((val = html_lookup_symbol(p, n + 1)) != NULL) {
 				gint len = strlen(val);
 				if (len <= n + 1) {
-					strcpy(up, val);
+					memcpy(up, val, len);
 					up += len;
 				} else {
-					strcpy(up, symbol_name);
+					memcpy(up, p, n + 1);
 					up += n + 1;
 				}
-			} else if (symbol_name[1] == '#' && g_ascii_isdigit(symbol_name[2])) {
+			} else if (n > 2 && p[1] == '#' && g_ascii_isdigit(p[2])) {
 				gint ch;
 
-				ch = atoi(symbol_name + 2);
+				ch = atoi(p + 2);
 				if (ch < 128 && g_ascii_isprint(ch)) {
 					*up++ = ch;
-				} else {
+				} else if (ch > 0) {
 					/* ISO 10646 to UTF-8 */
 					gchar buf[6];
 					gint len;
@@ -774,11 +924,15 @@ static gchar *html_unescape_str(HTMLParser *parser, const gchar *str)
 						memcpy(up, buf, len);
 						up += len;
 					} else {
-						strcpy(up, symbol_name);
+						memcpy(up, p, n + 1);
 						up += n + 1;
 					}
+				} else {
+					memcpy(up, p, n + 1);
+					up += n + 1;
 				}
 			}
+			p += n + 1;
 
 			break;
 		default:
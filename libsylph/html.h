@@ -51,10 +51,9 @@ struct _HTMLParser
 	FILE *fp;
 	CodeConverter *conv;
 
-	GHashTable *symbol_table;
-
 	GString *str;
 	GString *buf;
+	GString *rawbuf;
 
 	gchar *bufp;
 
@@ -54,6 +54,8 @@
 #include "prefs_common.h"
 #include "virtual.h"
 
+#undef MEASURE_TIME
+
 #define IMAP4_PORT	143
 #if USE_SSL
 #define IMAPS_PORT	993
@@ -62,6 +64,16 @@
 #define IMAP_COPY_LIMIT	200
 #define IMAP_CMD_LIMIT	1000
 
+/* limits of the messages sent at once by MULTIAPPEND or pipelined
+   APPENDs */
+#define IMAP_APPEND_BATCH_MSGS	100
+#define IMAP_APPEND_BATCH_SIZE	(4 * 1024 * 1024)
+/* maximum size of the non-synchronizing literal with LITERAL- */
+#define IMAP_LITERAL_MINUS_MAX	4096
+
+/* interval to send the queued flag changes (msec) */
+#define IMAP_FLAG_QUEUE_INTERVAL	3000
+
 #define QUOTE_IF_REQUIRED(out, str)					\
 {									\
 	if (!str || *str == '\0') {					\
@@ -96,9 +108,47 @@ typedef gint (*IMAPProgressFunc)	(IMAPSession	*session,
 					 gint		 total,
 					 gpointer	 data);
 
+/* pending flag change of a message. set_flags and unset_flags don't
+   overlap. color is -1 if the color label is unchanged */
+typedef struct _IMAPFlagChange
+{
+	guint32 uid;
+	IMAPFlags set_flags;
+	IMAPFlags unset_flags;
+	gint color;
+} IMAPFlagChange;
+
+/* pending flag changes of a mailbox. the UIDs are only valid for
+   uid_validity */
+typedef struct _IMAPFlagQueue
+{
+	gchar *path;
+	gchar *file;
+	guint32 uid_validity;
+	GHashTable *changes;
+} IMAPFlagQueue;
+
+typedef struct _IMAPFlagQueueFile
+{
+	FILE *fp;
+	guint32 uid_validity;
+} IMAPFlagQueueFile;
+
+typedef struct _IMAPAppendData
+{
+	MsgFileInfo *fileinfo;
+	IMAPFlags flags;
+	FILE *fp;
+	gchar date_time[64];
+	gint size;
+	guint32 new_uid;
+	gboolean appended;
+} IMAPAppendData;
+
 typedef struct _IMAPRealSession
 {
 	IMAPSession imap_session;
+	guint32 mbox_uid_validity;
 #if USE_THREADS
 	GThreadPool *pool;
 	IMAPThreadFunc thread_func;
@@ -380,11 +430,24 @@ static gint imap_cmd_search	(IMAPSession	*session,
 static gint imap_cmd_fetch	(IMAPSession	*session,
 				 guint32	 uid,
 				 const gchar	*filename);
+static void imap_get_date_time	(gchar		*buf,
+				 size_t		 len,
+				 stime_t	 timer);
 static gint imap_cmd_append	(IMAPSession	*session,
 				 const gchar	*destfolder,
 				 const gchar	*file,
 				 IMAPFlags	 flags,
 				 guint32	*new_uid);
+static gint imap_cmd_append_multi
+				(IMAPSession	*session,
+				 const gchar	*destfolder,
+				 IMAPAppendData	*msgs,
+				 gint		 n_msgs);
+static gint imap_cmd_append_pipelined
+				(IMAPSession	*session,
+				 const gchar	*destfolder,
+				 IMAPAppendData	*msgs,
+				 gint		 n_msgs);
 static gint imap_cmd_copy	(IMAPSession	*session,
 				 const gchar	*seq_set,
 				 const gchar	*destfolder);
@@ -398,8 +461,14 @@ static gint imap_cmd_ok		(IMAPSession	*session,
 				 GPtrArray	*argbuf);
 static gint imap_cmd_ok_real	(IMAPSession	*session,
 				 GPtrArray	*argbuf);
+static gint imap_cmd_ok_tag	(IMAPSession	*session,
+				 GPtrArray	*argbuf,
+				 guint		 tag);
 static gint imap_cmd_gen_send	(IMAPSession	*session,
 				 const gchar	*format, ...);
+static gint imap_cmd_gen_send_real
+				(IMAPSession	*session,
+				 const gchar	*cmd);
 static gint imap_cmd_gen_recv	(IMAPSession	*session,
 				 gchar	       **ret);
 
@@ -427,6 +496,8 @@ static gchar *imap_utf8_to_modified_utf7	(const gchar	*from);
 
 static GSList *imap_get_seq_set_from_msglist	(GSList		*msglist,
 						 gint		 limit);
+static GSList *imap_get_seq_set_from_uids	(GArray		*uids,
+						 gint		 limit);
 static gint imap_seq_set_get_count		(const gchar	*seq_set);
 static void imap_seq_set_free			(GSList		*seq_list);
 
@@ -496,10 +567,21 @@ static Folder *imap_folder_new(const gchar *name, const gchar *path)
 	return folder;
 }
 
+static void imap_flag_queue_free		(IMAPFolder	*folder);
+static void imap_flag_queue_load		(IMAPFolder	*folder,
+						 FolderItem	*item);
+static void imap_flag_queue_remove		(IMAPFolder	*folder,
+						 const gchar	*path);
+static gint imap_flag_queue_flush		(IMAPSession	*session,
+						 IMAPFolder	*folder);
+
 static void imap_folder_destroy(Folder *folder)
 {
 	g_return_if_fail(folder->account != NULL);
 
+	/* the pending changes are kept in the files */
+	imap_flag_queue_free(IMAP_FOLDER(folder));
+
 	if (REMOTE_FOLDER(folder)->remove_cache_on_destroy) {
 		gchar *dir;
 		gchar *server;
@@ -1018,6 +1100,10 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		return mlist;
 	}
 
+	/* changes left from the previous session are sent by
+	   imap_select() before the flags are fetched */
+	imap_flag_queue_load(IMAP_FOLDER(folder), item);
+
 	ok = imap_select(session, IMAP_FOLDER(folder), item->path,
 			 &exists, &recent, &unseen, &uid_validity);
 	if (ok != IMAP_SUCCESS) THROW;
@@ -1360,6 +1446,232 @@ static gint imap_add_msg(Folder *folder, FolderItem *dest, const gchar *file,
 	return imap_add_msgs(folder, dest, &file_list, remove_source, NULL);
 }
 
+static IMAPFlags imap_get_add_flags(FolderItem *dest, MsgFileInfo *fileinfo)
+{
+	IMAPFlags iflags = 0;
+
+	if (fileinfo->flags) {
+		if (MSG_IS_MARKED(*fileinfo->flags))
+			iflags |= IMAP_FLAG_FLAGGED;
+		if (MSG_IS_REPLIED(*fileinfo->flags))
+			iflags |= IMAP_FLAG_ANSWERED;
+		if (!MSG_IS_UNREAD(*fileinfo->flags))
+			iflags |= IMAP_FLAG_SEEN;
+	}
+
+	if (dest->stype == F_OUTBOX ||
+	    dest->stype == F_QUEUE  ||
+	    dest->stype == F_DRAFT)
+		iflags |= IMAP_FLAG_SEEN;
+
+	return iflags;
+}
+
+static void imap_add_msgs_added(IMAPSession *session, FolderItem *dest,
+				MsgFileInfo *fileinfo, guint32 new_uid,
+				guint32 *last_uid)
+{
+	if (syl_app_get())
+		g_signal_emit_by_name(syl_app_get(), "add-msg", dest, fileinfo->file, new_uid);
+
+	if (!session->uidplus)
+		(*last_uid)++;
+	else if (*last_uid < new_uid)
+		*last_uid = new_uid;
+
+	dest->last_num = *last_uid;
+	dest->total++;
+	dest->updated = TRUE;
+
+	if (fileinfo->flags) {
+		if (MSG_IS_UNREAD(*fileinfo->flags))
+			dest->unread++;
+	} else
+		dest->unread++;
+}
+
+static gboolean imap_append_literal_nonsync(IMAPSession *session, gint size)
+{
+	if (imap_has_capability(session, "LITERAL+"))
+		return TRUE;
+	if (imap_has_capability(session, "LITERAL-") &&
+	    size <= IMAP_LITERAL_MINUS_MAX)
+		return TRUE;
+	return FALSE;
+}
+
+/* convert line breaks to CRLF in the same way as
+   canonicalize_file_stream(). the result is written to sock if it's not
+   NULL. returns the size of the converted data, or -1 on error */
+static gint imap_write_canonical(SockInfo *sock, FILE *fp)
+{
+	gchar buf[BUFFSIZE];
+	gchar obuf[BUFFSIZE * 2];
+	gint olen = 0;
+	gint length = 0;
+	gint len;
+	gboolean last_linebreak = FALSE;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		len = strlen(buf);
+		if (len == 0) break;
+		last_linebreak = FALSE;
+
+		if (buf[len - 1] != '\n') {
+			last_linebreak = TRUE;
+			memcpy(obuf + olen, buf, len);
+			olen += len;
+		} else if (len > 1 && buf[len - 2] == '\r') {
+			memcpy(obuf + olen, buf, len);
+			olen += len;
+		} else {
+			memcpy(obuf + olen, buf, len - 1);
+			olen += len - 1;
+			obuf[olen++] = '\r';
+			obuf[olen++] = '\n';
+		}
+
+		if (olen >= BUFFSIZE) {
+			if (sock && sock_write_all(sock, obuf, olen) < 0)
+				return -1;
+			length += olen;
+			olen = 0;
+		}
+	}
+
+	if (last_linebreak) {
+		obuf[olen++] = '\r';
+		obuf[olen++] = '\n';
+	}
+	if (olen > 0) {
+		if (sock && sock_write_all(sock, obuf, olen) < 0)
+			return -1;
+		length += olen;
+	}
+
+	if (ferror(fp)) {
+		FILE_OP_ERROR("imap_write_canonical", "fgets");
+		return -1;
+	}
+
+	return length;
+}
+
+static gint imap_append_data_open(IMAPAppendData *data)
+{
+	MsgInfo *msginfo;
+	MsgFlags flags_ = {0, 0};
+
+	if ((data->fp = g_fopen(data->fileinfo->file, "rb")) == NULL) {
+		FILE_OP_ERROR(data->fileinfo->file, "fopen");
+		return -1;
+	}
+
+	/* use Date: header as received date */
+	data->date_time[0] = '\0';
+	msginfo = procheader_parse_stream(data->fp, flags_, FALSE);
+	imap_get_date_time(data->date_time, sizeof(data->date_time),
+			   msginfo->date_t);
+	procmsg_msginfo_free(msginfo);
+
+	rewind(data->fp);
+	data->size = imap_write_canonical(NULL, data->fp);
+	rewind(data->fp);
+	if (data->size < 0) {
+		fclose(data->fp);
+		data->fp = NULL;
+		return -1;
+	}
+
+	data->new_uid = 0;
+	data->appended = FALSE;
+
+	return 0;
+}
+
+static void imap_append_data_close(IMAPAppendData *msgs, gint n_msgs)
+{
+	gint i;
+
+	for (i = 0; i < n_msgs; i++) {
+		if (msgs[i].fp) {
+			fclose(msgs[i].fp);
+			msgs[i].fp = NULL;
+		}
+	}
+}
+
+/* send the messages with MULTIAPPEND (RFC 3502), or with pipelined
+   APPENDs using non-synchronizing literals (RFC 7888) */
+static gint imap_add_msgs_bulk(IMAPSession *session, FolderItem *dest,
+			       const gchar *destdir, GSList *file_list,
+			       guint32 *last_uid)
+{
+	IMAPAppendData msgs[IMAP_APPEND_BATCH_MSGS];
+	gboolean multiappend;
+	GSList *cur = file_list;
+	gint n_msgs;
+	gint batch_size;
+	gint count = 0;
+	gint total;
+	gint ok = IMAP_SUCCESS;
+	gint i;
+
+	multiappend = imap_has_capability(session, "MULTIAPPEND");
+	total = g_slist_length(file_list);
+
+	while (cur != NULL) {
+		n_msgs = 0;
+		batch_size = 0;
+
+		for (; cur != NULL && n_msgs < IMAP_APPEND_BATCH_MSGS &&
+		     batch_size < IMAP_APPEND_BATCH_SIZE; cur = cur->next) {
+			IMAPAppendData *data = &msgs[n_msgs];
+
+			data->fileinfo = (MsgFileInfo *)cur->data;
+			data->flags = imap_get_add_flags(dest, data->fileinfo);
+			if (imap_append_data_open(data) < 0) {
+				g_warning("can't append message %s\n",
+					  data->fileinfo->file);
+				imap_append_data_close(msgs, n_msgs);
+				return -1;
+			}
+			batch_size += data->size;
+			n_msgs++;
+		}
+
+		status_print(_("Appending messages to %s (%d / %d)"),
+			     dest->path, count + n_msgs, total);
+		progress_show(count + n_msgs, total);
+		ui_update();
+
+		if (multiappend)
+			ok = imap_cmd_append_multi(session, destdir, msgs,
+						   n_msgs);
+		else
+			ok = imap_cmd_append_pipelined(session, destdir, msgs,
+						       n_msgs);
+		imap_append_data_close(msgs, n_msgs);
+
+		/* the pipelined APPENDs after a failed one may have been
+		   stored too */
+		for (i = 0; i < n_msgs; i++) {
+			if (msgs[i].appended)
+				imap_add_msgs_added(session, dest,
+						    msgs[i].fileinfo,
+						    msgs[i].new_uid, last_uid);
+		}
+
+		if (ok != IMAP_SUCCESS) {
+			g_warning("can't append messages to %s\n", destdir);
+			return -1;
+		}
+		count += n_msgs;
+	}
+
+	return 0;
+}
+
 static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			  gboolean remove_source, gint *first)
 {
@@ -1374,6 +1686,9 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 	gint total;
 	gint ok;
 	GTimeVal tv_prev, tv_cur;
+#ifdef MEASURE_TIME
+	GTimer *timer;
+#endif
 
 	g_return_val_if_fail(folder != NULL, -1);
 	g_return_val_if_fail(dest != NULL, -1);
@@ -1401,25 +1716,30 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 
 	total = g_slist_length(file_list);
 
+#ifdef MEASURE_TIME
+	timer = g_timer_new();
+#endif
+
+	/* several messages can be sent without waiting for each response */
+	if (total > 1 &&
+	    (imap_has_capability(session, "MULTIAPPEND") ||
+	     imap_has_capability(session, "LITERAL+") ||
+	     imap_has_capability(session, "LITERAL-"))) {
+		ok = imap_add_msgs_bulk(session, dest, destdir, file_list,
+					&last_uid);
+		progress_show(0, 0);
+		g_free(destdir);
+		if (ok < 0)
+			return -1;
+		goto done;
+	}
+
 	for (cur = file_list; cur != NULL; cur = cur->next) {
-		IMAPFlags iflags = 0;
+		IMAPFlags iflags;
 		guint32 new_uid = 0;
 
 		fileinfo = (MsgFileInfo *)cur->data;
-
-		if (fileinfo->flags) {
-			if (MSG_IS_MARKED(*fileinfo->flags))
-				iflags |= IMAP_FLAG_FLAGGED;
-			if (MSG_IS_REPLIED(*fileinfo->flags))
-				iflags |= IMAP_FLAG_ANSWERED;
-			if (!MSG_IS_UNREAD(*fileinfo->flags))
-				iflags |= IMAP_FLAG_SEEN;
-		}
-
-		if (dest->stype == F_OUTBOX ||
-		    dest->stype == F_QUEUE  ||
-		    dest->stype == F_DRAFT)
-			iflags |= IMAP_FLAG_SEEN;
+		iflags = imap_get_add_flags(dest, fileinfo);
 
 		g_get_current_time(&tv_cur);
 		if (tv_cur.tv_sec > tv_prev.tv_sec ||
@@ -1443,28 +1763,21 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			return -1;
 		}
 
-		if (syl_app_get())
-			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, fileinfo->file, new_uid);
-
-		if (!session->uidplus)
-			last_uid++;
-		else if (last_uid < new_uid)
-			last_uid = new_uid;
-
-		dest->last_num = last_uid;
-		dest->total++;
-		dest->updated = TRUE;
-
-		if (fileinfo->flags) {
-			if (MSG_IS_UNREAD(*fileinfo->flags))
-				dest->unread++;
-		} else
-			dest->unread++;
+		imap_add_msgs_added(session, dest, fileinfo, new_uid,
+				    &last_uid);
 	}
 
 	progress_show(0, 0);
 	g_free(destdir);
 
+done:
+#ifdef MEASURE_TIME
+	g_timer_stop(timer);
+	g_print("%s: %s: %d messages: elapsed time: %f sec\n",
+		G_STRFUNC, dest->path, total, g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+#endif
+
 	if (remove_source) {
 		for (cur = file_list; cur != NULL; cur = cur->next) {
 			fileinfo = (MsgFileInfo *)cur->data;
@@ -1829,8 +2142,13 @@ static gint imap_remove_all_msg(Folder *folder, FolderItem *item)
 	item->updated = TRUE;
 
 	dir = folder_item_get_path(item);
-	if (is_dir_exist(dir))
-		remove_all_numbered_files(dir);
+	if (is_dir_exist(dir)) {
+		/* numbered subfolders must be kept in place */
+		if (item->node && item->node->children)
+			remove_all_numbered_files(dir);
+		else
+			remove_all_numbered_files_async(dir);
+	}
 	g_free(dir);
 
 	return IMAP_SUCCESS;
@@ -2561,6 +2879,10 @@ static gint imap_rename_folder_real(Folder *folder, FolderItem *item,
 	session = imap_session_get(folder);
 	if (!session) return -1;
 
+	if (imap_flag_queue_flush(session, IMAP_FOLDER(folder))
+	    != IMAP_SUCCESS)
+		return -1;
+
 	real_oldpath = imap_get_real_path(IMAP_FOLDER(folder), item->path);
 
 	g_free(session->mbox);
@@ -2702,6 +3024,8 @@ static gint imap_remove_folder(Folder *folder, FolderItem *item)
 		return -1;
 	}
 
+	imap_flag_queue_remove(IMAP_FOLDER(folder), item->path);
+
 	g_free(path);
 	cache_dir = folder_item_get_path(item);
 	if (is_dir_exist(cache_dir) && remove_dir_recursive(cache_dir) < 0)
@@ -3488,100 +3812,227 @@ static MsgInfo *imap_parse_envelope(IMAPSession *session, FolderItem *item,
 	return msginfo;
 }
 
-static gint imap_msg_list_change_perm_flags(GSList *msglist, MsgPermFlags flags,
-					    gboolean is_set)
-{
-	Folder *folder;
-	IMAPSession *session;
-	IMAPFlags iflags = 0;
-	MsgInfo *msginfo;
-	GSList *seq_list, *cur;
-	gint ok = IMAP_SUCCESS;
+/* flag changes are not sent immediately. they are merged per message
+   in the queue of the mailbox and sent together by
+   imap_flag_queue_flush() before selecting a mailbox and on exit. in
+   the meantime, a timer sends the changes of the selected mailbox
+   through the IMAP thread, without selecting it again. each change is
+   also appended to a file in the cache directory so that it is sent
+   in the next session if it's lost. the file starts with the UIDVALIDITY line, and each
+   change is also tagged with the UIDVALIDITY, so that the changes are
+   never sent to other messages which got the same UIDs. */
 
-	if (msglist == NULL) return IMAP_SUCCESS;
+static guint imap_flag_queue_timer_tag = 0;
+static gboolean imap_flag_queue_flushing = FALSE;
 
-	msginfo = (MsgInfo *)msglist->data;
-	g_return_val_if_fail(msginfo != NULL, -1);
+static gboolean imap_flag_queue_timeout_cb(gpointer data);
 
-	g_return_val_if_fail(MSG_IS_IMAP(msginfo->flags), -1);
-	g_return_val_if_fail(msginfo->folder != NULL, -1);
-	g_return_val_if_fail(msginfo->folder->folder != NULL, -1);
+/* apply the newer change to dest */
+static void imap_flag_change_merge(IMAPFlagChange *dest, IMAPFlags set_flags,
+				   IMAPFlags unset_flags, gint color)
+{
+	dest->set_flags = (dest->set_flags & ~unset_flags) | set_flags;
+	dest->unset_flags = (dest->unset_flags & ~set_flags) | unset_flags;
+	if (color >= 0)
+		dest->color = color;
+}
 
-	folder = msginfo->folder->folder;
-	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
+static IMAPFlagChange *imap_flag_queue_add_change(GHashTable *changes,
+						  guint32 uid,
+						  IMAPFlags set_flags,
+						  IMAPFlags unset_flags,
+						  gint color)
+{
+	IMAPFlagChange *change;
 
-	session = imap_session_get(folder);
-	if (!session) return -1;
+	change = g_hash_table_lookup(changes, GUINT_TO_POINTER(uid));
+	if (!change) {
+		change = g_new0(IMAPFlagChange, 1);
+		change->uid = uid;
+		change->color = -1;
+		g_hash_table_insert(changes, GUINT_TO_POINTER(uid), change);
+	}
+	imap_flag_change_merge(change, set_flags, unset_flags, color);
 
-	ok = imap_select(session, IMAP_FOLDER(folder), msginfo->folder->path,
-			 NULL, NULL, NULL, NULL);
-	if (ok != IMAP_SUCCESS)
-		return ok;
+	return change;
+}
 
-	seq_list = imap_get_seq_set_from_msglist(msglist, 0);
+static GHashTable *imap_flag_queue_changes_new(void)
+{
+	return g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				     NULL, g_free);
+}
 
-	if (flags & MSG_MARKED)  iflags |= IMAP_FLAG_FLAGGED;
-	if (flags & MSG_REPLIED) iflags |= IMAP_FLAG_ANSWERED;
+static void imap_flag_queue_write	(IMAPFlagQueue	*queue);
 
-	for (cur = seq_list; cur != NULL; cur = cur->next) {
-		gchar *seq_set = (gchar *)cur->data;
+static IMAPFlagQueue *imap_flag_queue_get(IMAPFolder *folder,
+					  FolderItem *item)
+{
+	IMAPFlagQueue *queue;
+	gchar *dir;
+	FILE *fp;
+	gchar buf[BUFFSIZE];
+	guint32 uid_validity, uid;
+	guint set_flags, unset_flags;
+	gint color;
+	gint dropped = 0;
 
-		if (iflags) {
-			ok = imap_set_message_flags(session, seq_set, iflags,
-						    is_set);
-			if (ok != IMAP_SUCCESS) break;
-		}
+	if (!folder->flag_queue)
+		folder->flag_queue = g_hash_table_new(g_str_hash, g_str_equal);
+
+	queue = g_hash_table_lookup(folder->flag_queue, item->path);
+	if (queue)
+		return queue;
 
-		if (flags & MSG_UNREAD) {
-			ok = imap_set_message_flags(session, seq_set,
-						    IMAP_FLAG_SEEN, !is_set);
-			if (ok != IMAP_SUCCESS) break;
+	queue = g_new0(IMAPFlagQueue, 1);
+	queue->path = g_strdup(item->path);
+	dir = folder_item_get_path(item);
+	if (!is_dir_exist(dir))
+		make_dir_hier(dir);
+	queue->file = g_strconcat(dir, G_DIR_SEPARATOR_S, IMAP_FLAG_QUEUE,
+				  NULL);
+	g_free(dir);
+	queue->uid_validity = (guint32)item->mtime;
+	queue->changes = imap_flag_queue_changes_new();
+	g_hash_table_insert(folder->flag_queue, queue->path, queue);
+
+	/* replay the changes which were not sent. the changes for another
+	   UIDVALIDITY than the one of the cache are dropped */
+	if ((fp = g_fopen(queue->file, "rb")) != NULL) {
+		if (fgets(buf, sizeof(buf), fp) == NULL ||
+		    sscanf(buf, "UIDVALIDITY %u", &uid_validity) != 1 ||
+		    uid_validity != queue->uid_validity) {
+			debug_print("imap_flag_queue_get: %s: "
+				    "UIDVALIDITY doesn't match\n",
+				    queue->path);
+			dropped++;
+		} else {
+			while (fgets(buf, sizeof(buf), fp) != NULL) {
+				if (sscanf(buf, "%u %u %u %u %d",
+					   &uid_validity, &uid, &set_flags,
+					   &unset_flags, &color) != 5 ||
+				    uid == 0 ||
+				    uid_validity != queue->uid_validity) {
+					dropped++;
+					continue;
+				}
+				imap_flag_queue_add_change
+					(queue->changes, uid, set_flags,
+					 unset_flags, color);
+			}
 		}
+		fclose(fp);
+		debug_print("imap_flag_queue_get: %s: %u pending changes "
+			    "(%d dropped)\n", queue->path,
+			    g_hash_table_size(queue->changes), dropped);
+		if (dropped > 0)
+			imap_flag_queue_write(queue);
 	}
 
-	imap_seq_set_free(seq_list);
+	return queue;
+}
 
-	return ok;
+static void imap_flag_queue_destroy(IMAPFlagQueue *queue)
+{
+	g_hash_table_destroy(queue->changes);
+	g_free(queue->file);
+	g_free(queue->path);
+	g_free(queue);
 }
 
-gint imap_msg_set_perm_flags(MsgInfo *msginfo, MsgPermFlags flags)
+static void imap_flag_queue_free_func(gpointer key, gpointer value,
+				      gpointer data)
 {
-	GSList msglist;
+	imap_flag_queue_destroy((IMAPFlagQueue *)value);
+}
 
-	msglist.data = msginfo;
-	msglist.next = NULL;
+static void imap_flag_queue_free(IMAPFolder *folder)
+{
+	if (folder->flag_queue) {
+		g_hash_table_foreach(folder->flag_queue,
+				     imap_flag_queue_free_func, NULL);
+		g_hash_table_destroy(folder->flag_queue);
+		folder->flag_queue = NULL;
+	}
+}
 
-	return imap_msg_list_change_perm_flags(&msglist, flags, TRUE);
+static void imap_flag_queue_load(IMAPFolder *folder, FolderItem *item)
+{
+	imap_flag_queue_get(folder, item);
 }
 
-gint imap_msg_unset_perm_flags(MsgInfo *msginfo, MsgPermFlags flags)
+static void imap_flag_queue_remove(IMAPFolder *folder, const gchar *path)
 {
-	GSList msglist;
+	IMAPFlagQueue *queue;
 
-	msglist.data = msginfo;
-	msglist.next = NULL;
+	if (!folder->flag_queue)
+		return;
 
-	return imap_msg_list_change_perm_flags(&msglist, flags, FALSE);
+	queue = g_hash_table_lookup(folder->flag_queue, path);
+	if (queue) {
+		g_hash_table_remove(folder->flag_queue, path);
+		g_unlink(queue->file);
+		imap_flag_queue_destroy(queue);
+	}
 }
 
-gint imap_msg_list_set_perm_flags(GSList *msglist, MsgPermFlags flags)
+static void imap_flag_queue_clear(IMAPFlagQueue *queue,
+				  guint32 uid_validity)
 {
-	return imap_msg_list_change_perm_flags(msglist, flags, TRUE);
+	g_hash_table_destroy(queue->changes);
+	queue->changes = imap_flag_queue_changes_new();
+	queue->uid_validity = uid_validity;
 }
 
-gint imap_msg_list_unset_perm_flags(GSList *msglist, MsgPermFlags flags)
+static void imap_flag_change_write(FILE *fp, guint32 uid_validity,
+				   IMAPFlagChange *change)
 {
-	return imap_msg_list_change_perm_flags(msglist, flags, FALSE);
+	fprintf(fp, "%u %u %u %u %d\n", uid_validity, change->uid,
+		change->set_flags, change->unset_flags, change->color);
 }
 
-gint imap_msg_list_set_colorlabel_flags(GSList *msglist, guint color)
+static void imap_flag_queue_write_change(gpointer key, gpointer value,
+					 gpointer data)
+{
+	IMAPFlagQueueFile *qfile = (IMAPFlagQueueFile *)data;
+
+	imap_flag_change_write(qfile->fp, qfile->uid_validity,
+			       (IMAPFlagChange *)value);
+}
+
+/* rewrite the file with the current changes */
+static void imap_flag_queue_write(IMAPFlagQueue *queue)
+{
+	FILE *fp;
+	IMAPFlagQueueFile qfile;
+
+	if (g_hash_table_size(queue->changes) == 0) {
+		if (is_file_exist(queue->file) && g_unlink(queue->file) < 0)
+			FILE_OP_ERROR(queue->file, "unlink");
+		return;
+	}
+
+	if ((fp = g_fopen(queue->file, "wb")) == NULL) {
+		FILE_OP_ERROR(queue->file, "fopen");
+		return;
+	}
+	fprintf(fp, "UIDVALIDITY %u\n", queue->uid_validity);
+	qfile.fp = fp;
+	qfile.uid_validity = queue->uid_validity;
+	g_hash_table_foreach(queue->changes, imap_flag_queue_write_change,
+			     &qfile);
+	if (fclose(fp) == EOF)
+		FILE_OP_ERROR(queue->file, "fclose");
+}
+
+static gint imap_flag_queue_add_list(GSList *msglist, IMAPFlags set_flags,
+				     IMAPFlags unset_flags, gint color)
 {
-	Folder *folder;
-	IMAPSession *session;
-	IMAPFlags iflags = 0;
 	MsgInfo *msginfo;
-	GSList *seq_list, *cur;
-	gint ok = IMAP_SUCCESS;
+	IMAPFlagQueue *queue;
+	GSList *cur;
+	FILE *fp;
+	gboolean new_file;
 
 	if (msglist == NULL) return IMAP_SUCCESS;
 
@@ -3591,41 +4042,480 @@ gint imap_msg_list_set_colorlabel_flags(GSList *msglist, guint color)
 	g_return_val_if_fail(MSG_IS_IMAP(msginfo->flags), -1);
 	g_return_val_if_fail(msginfo->folder != NULL, -1);
 	g_return_val_if_fail(msginfo->folder->folder != NULL, -1);
+	g_return_val_if_fail
+		(FOLDER_TYPE(msginfo->folder->folder) == F_IMAP, -1);
 
-	folder = msginfo->folder->folder;
-	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
+	queue = imap_flag_queue_get(IMAP_FOLDER(msginfo->folder->folder),
+				    msginfo->folder);
 
-	session = imap_session_get(folder);
-	if (!session) return -1;
+	/* the cache was rebuilt for another UIDVALIDITY */
+	if (queue->uid_validity != (guint32)msginfo->folder->mtime) {
+		debug_print("imap_flag_queue_add_list: %s: "
+			    "UIDVALIDITY has been changed.\n", queue->path);
+		imap_flag_queue_clear(queue, (guint32)msginfo->folder->mtime);
+		imap_flag_queue_write(queue);
+	}
 
-	ok = imap_select(session, IMAP_FOLDER(folder), msginfo->folder->path,
-			 NULL, NULL, NULL, NULL);
-	if (ok != IMAP_SUCCESS)
-		return ok;
+	/* append to the file to keep the changes over a crash */
+	new_file = get_file_size(queue->file) <= 0;
+	if ((fp = g_fopen(queue->file, "ab")) == NULL) {
+		FILE_OP_ERROR(queue->file, "fopen");
+	} else if (new_file)
+		fprintf(fp, "UIDVALIDITY %u\n", queue->uid_validity);
 
-	seq_list = imap_get_seq_set_from_msglist(msglist, 0);
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		IMAPFlagChange *change;
 
-	IMAP_SET_COLORLABEL_VALUE(iflags, color);
+		msginfo = (MsgInfo *)cur->data;
+		change = imap_flag_queue_add_change
+			(queue->changes, msginfo->msgnum,
+			 set_flags, unset_flags, color);
+		if (fp)
+			imap_flag_change_write(fp, queue->uid_validity,
+					       change);
+	}
 
-	for (cur = seq_list; cur != NULL; cur = cur->next) {
-		gchar *seq_set = (gchar *)cur->data;
+	if (fp && fclose(fp) == EOF)
+		FILE_OP_ERROR(queue->file, "fclose");
+
+	if (imap_flag_queue_timer_tag == 0)
+		imap_flag_queue_timer_tag =
+			g_timeout_add_full(G_PRIORITY_LOW,
+					   IMAP_FLAG_QUEUE_INTERVAL,
+					   imap_flag_queue_timeout_cb,
+					   NULL, NULL);
+
+	return IMAP_SUCCESS;
+}
+
+static gint imap_flag_change_cmp_flags(const IMAPFlagChange *ca,
+				      const IMAPFlagChange *cb)
+{
+	if (ca->set_flags != cb->set_flags)
+		return ca->set_flags < cb->set_flags ? -1 : 1;
+	if (ca->unset_flags != cb->unset_flags)
+		return ca->unset_flags < cb->unset_flags ? -1 : 1;
+	if (ca->color != cb->color)
+		return ca->color < cb->color ? -1 : 1;
+	return 0;
+}
+
+static gint imap_flag_change_cmp(gconstpointer a, gconstpointer b)
+{
+	const IMAPFlagChange *ca = *(const IMAPFlagChange **)a;
+	const IMAPFlagChange *cb = *(const IMAPFlagChange **)b;
+	gint ret;
 
-		ok = imap_cmd_store(session, seq_set,
-				    "-FLAGS.SILENT ($label1 $label2 $label3 $label4 $label5 $label6 $label7)");
-		if (ok != IMAP_SUCCESS) break;
+	if ((ret = imap_flag_change_cmp_flags(ca, cb)) != 0)
+		return ret;
+	if (ca->uid != cb->uid)
+		return ca->uid < cb->uid ? -1 : 1;
+	return 0;
+}
+
+static void imap_flag_change_add_to_array(gpointer key, gpointer value,
+					  gpointer data)
+{
+	g_ptr_array_add((GPtrArray *)data, value);
+}
 
-		if (iflags) {
-			ok = imap_set_message_flags(session, seq_set, iflags,
-						    TRUE);
-			if (ok != IMAP_SUCCESS) break;
+/* the arguments of a STORE command which sets or unsets flags */
+static gchar *imap_flag_queue_store_cmd(const gchar *seq_set, IMAPFlags flags,
+					gboolean is_set)
+{
+	gchar *flag_str;
+	gchar *cmd;
+
+	flag_str = imap_get_flag_str(flags);
+	cmd = g_strdup_printf("UID STORE %s %cFLAGS.SILENT (%s)",
+			      seq_set, is_set ? '+' : '-', flag_str);
+	g_free(flag_str);
+
+	return cmd;
+}
+
+static gint imap_flag_queue_store_func(IMAPSession *session, gpointer data)
+{
+	GSList *cur;
+	gint ok = IMAP_SUCCESS;
+
+	for (cur = (GSList *)data; cur != NULL; cur = cur->next) {
+		const gchar *cmd = (const gchar *)cur->data;
+
+		ok = imap_cmd_gen_send_real(session, cmd);
+		if (ok == IMAP_SUCCESS)
+			ok = imap_cmd_ok_real(session, NULL);
+		if (ok != IMAP_SUCCESS) {
+			log_warning(_("error while imap command: %s\n"), cmd);
+			break;
 		}
 	}
 
-	imap_seq_set_free(seq_list);
+	return ok;
+}
+
+/* send the changes of the mailbox selected now. messages with the same
+   changes are grouped into one sequence set, and the STORE commands
+   are sent in the IMAP thread */
+static gint imap_flag_queue_send(IMAPSession *session, IMAPFlagQueue *queue,
+				 GHashTable *changes)
+{
+	GPtrArray *array;
+	GArray *uids;
+	GSList *seq_list, *cur;
+	GSList *cmds = NULL;
+	IMAPFlagChange *change;
+	IMAPFlags iflags;
+	guint i, j;
+	gint ok;
+
+	/* the UIDs now point to other messages */
+	if (((IMAPRealSession *)session)->mbox_uid_validity !=
+	    queue->uid_validity) {
+		log_warning(_("UIDVALIDITY of %s has been changed. "
+			      "The flag changes are discarded.\n"),
+			    queue->path);
+		return IMAP_SUCCESS;
+	}
+
+	array = g_ptr_array_sized_new(g_hash_table_size(changes));
+	g_hash_table_foreach(changes, imap_flag_change_add_to_array, array);
+	g_ptr_array_sort(array, imap_flag_change_cmp);
+
+	uids = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	for (i = 0; i < array->len; i = j) {
+		change = g_ptr_array_index(array, i);
+
+		g_array_set_size(uids, 0);
+		for (j = i; j < array->len &&
+		     imap_flag_change_cmp_flags(change,
+						g_ptr_array_index(array, j))
+		     == 0; j++) {
+			IMAPFlagChange *c = g_ptr_array_index(array, j);
+			g_array_append_val(uids, c->uid);
+		}
+
+		seq_list = imap_get_seq_set_from_uids(uids, 0);
+
+		for (cur = seq_list; cur != NULL; cur = cur->next) {
+			gchar *seq_set = (gchar *)cur->data;
+
+			if (change->unset_flags)
+				cmds = g_slist_prepend
+					(cmds, imap_flag_queue_store_cmd
+					 (seq_set, change->unset_flags, FALSE));
+			if (change->set_flags)
+				cmds = g_slist_prepend
+					(cmds, imap_flag_queue_store_cmd
+					 (seq_set, change->set_flags, TRUE));
+			if (change->color >= 0) {
+				cmds = g_slist_prepend
+					(cmds, g_strdup_printf
+					 ("UID STORE %s -FLAGS.SILENT ($label1 $label2 $label3 $label4 $label5 $label6 $label7)",
+					  seq_set));
+
+				iflags = 0;
+				IMAP_SET_COLORLABEL_VALUE(iflags,
+							  change->color);
+				if (iflags)
+					cmds = g_slist_prepend
+						(cmds,
+						 imap_flag_queue_store_cmd
+						 (seq_set, iflags, TRUE));
+			}
+		}
+
+		imap_seq_set_free(seq_list);
+	}
+
+	g_array_free(uids, TRUE);
+	g_ptr_array_free(array, TRUE);
+
+	cmds = g_slist_reverse(cmds);
+#if USE_THREADS
+	ok = imap_thread_run(session, imap_flag_queue_store_func, cmds);
+#else
+	ok = imap_flag_queue_store_func(session, cmds);
+#endif
+	slist_free_strings(cmds);
+	g_slist_free(cmds);
 
 	return ok;
 }
 
+static void imap_flag_queue_get_pending(gpointer key, gpointer value,
+					gpointer data)
+{
+	IMAPFlagQueue *queue = (IMAPFlagQueue *)value;
+	GSList **list = (GSList **)data;
+
+	if (g_hash_table_size(queue->changes) > 0)
+		*list = g_slist_prepend(*list, queue);
+}
+
+static gboolean imap_flag_queue_is_pending(gpointer key, gpointer value,
+					   gpointer data)
+{
+	IMAPFlagQueue *queue = (IMAPFlagQueue *)value;
+
+	return g_hash_table_size(queue->changes) > 0;
+}
+
+static gboolean imap_flag_queue_has_pending(IMAPFolder *folder)
+{
+	if (!folder->flag_queue)
+		return FALSE;
+
+	return g_hash_table_find(folder->flag_queue,
+				 imap_flag_queue_is_pending, NULL) != NULL;
+}
+
+static void imap_flag_change_restore(gpointer key, gpointer value,
+				     gpointer data)
+{
+	IMAPFlagChange *old_change = (IMAPFlagChange *)value;
+	GHashTable *changes = (GHashTable *)data;
+	IMAPFlagChange *change;
+
+	/* the changes made during the flush are newer */
+	change = g_hash_table_lookup(changes, key);
+	if (change) {
+		IMAPFlagChange newer = *change;
+
+		*change = *old_change;
+		imap_flag_change_merge(change, newer.set_flags,
+				       newer.unset_flags, newer.color);
+	} else
+		imap_flag_queue_add_change(changes, old_change->uid,
+					   old_change->set_flags,
+					   old_change->unset_flags,
+					   old_change->color);
+}
+
+/* send the queued changes of a mailbox. the mailbox is selected first
+   if do_select is TRUE, otherwise it must be the selected one */
+static gint imap_flag_queue_flush_queue(IMAPSession *session,
+					IMAPFolder *folder,
+					IMAPFlagQueue *queue,
+					gboolean do_select)
+{
+	GHashTable *changes;
+	gint exists, recent, unseen;
+	guint32 uid_validity;
+	gint ok = IMAP_SUCCESS;
+
+	/* changes made while sending go to the new table */
+	changes = queue->changes;
+	queue->changes = imap_flag_queue_changes_new();
+
+	debug_print("imap_flag_queue_flush: %s: %u changes\n",
+		    queue->path, g_hash_table_size(changes));
+	if (do_select)
+		ok = imap_select(session, folder, queue->path,
+				 &exists, &recent, &unseen, &uid_validity);
+	if (ok == IMAP_SUCCESS)
+		ok = imap_flag_queue_send(session, queue, changes);
+	/* the changes are discarded if the server refused them
+	   (e.g. the mailbox was removed) */
+	if (ok == IMAP_ERROR)
+		log_warning(_("can't set the flags of messages in %s\n"),
+			    queue->path);
+	else if (ok != IMAP_SUCCESS)
+		g_hash_table_foreach(changes, imap_flag_change_restore,
+				     queue->changes);
+	g_hash_table_destroy(changes);
+
+	imap_flag_queue_write(queue);
+
+	return ok;
+}
+
+/* send all queued changes of the folder, selecting each mailbox */
+static gint imap_flag_queue_flush(IMAPSession *session, IMAPFolder *folder)
+{
+	GSList *list = NULL, *cur;
+	gint ok = IMAP_SUCCESS;
+
+	if (imap_flag_queue_flushing || !folder->flag_queue)
+		return IMAP_SUCCESS;
+
+	g_hash_table_foreach(folder->flag_queue, imap_flag_queue_get_pending,
+			     &list);
+	if (!list)
+		return IMAP_SUCCESS;
+
+	imap_flag_queue_flushing = TRUE;
+
+	for (cur = list; cur != NULL; cur = cur->next) {
+		IMAPFlagQueue *queue = (IMAPFlagQueue *)cur->data;
+
+		ok = imap_flag_queue_flush_queue(session, folder, queue, TRUE);
+		if (ok != IMAP_SUCCESS && ok != IMAP_ERROR)
+			break;
+	}
+
+	g_slist_free(list);
+
+	imap_flag_queue_flushing = FALSE;
+
+	return ok == IMAP_ERROR ? IMAP_SUCCESS : ok;
+}
+
+/* send the queued changes of the selected mailbox only. the changes of
+   the other mailboxes are sent when a mailbox is selected next time */
+static gint imap_flag_queue_flush_selected(IMAPSession *session,
+					   IMAPFolder *folder)
+{
+	IMAPFlagQueue *queue;
+	gint ok;
+
+	if (imap_flag_queue_flushing || !folder->flag_queue || !session->mbox)
+		return IMAP_SUCCESS;
+
+	queue = g_hash_table_lookup(folder->flag_queue, session->mbox);
+	if (!queue || g_hash_table_size(queue->changes) == 0)
+		return IMAP_SUCCESS;
+
+	imap_flag_queue_flushing = TRUE;
+	ok = imap_flag_queue_flush_queue(session, folder, queue, FALSE);
+	imap_flag_queue_flushing = FALSE;
+
+	return ok == IMAP_ERROR ? IMAP_SUCCESS : ok;
+}
+
+static gboolean imap_flag_queue_is_selected_pending(IMAPFolder *folder)
+{
+	IMAPSession *session;
+	IMAPFlagQueue *queue;
+
+	session = IMAP_SESSION(REMOTE_FOLDER(folder)->session);
+	if (!session || !session->mbox || !folder->flag_queue)
+		return FALSE;
+
+	queue = g_hash_table_lookup(folder->flag_queue, session->mbox);
+
+	return queue && g_hash_table_size(queue->changes) > 0;
+}
+
+static gboolean imap_flag_queue_timeout_cb(gpointer data)
+{
+	GList *cur;
+	gboolean pending = FALSE;
+
+	for (cur = folder_get_list(); cur != NULL; cur = cur->next) {
+		Folder *folder = FOLDER(cur->data);
+
+		if (FOLDER_TYPE(folder) != F_IMAP ||
+		    !imap_flag_queue_is_selected_pending(IMAP_FOLDER(folder)))
+			continue;
+
+		/* don't connect or select a mailbox only for this, nor
+		   interrupt another command */
+		if (!imap_is_session_active(IMAP_FOLDER(folder)))
+			imap_flag_queue_flush_selected
+				(IMAP_SESSION(REMOTE_FOLDER(folder)->session),
+				 IMAP_FOLDER(folder));
+
+		/* retry later only while connected */
+		if (imap_flag_queue_is_selected_pending(IMAP_FOLDER(folder)))
+			pending = TRUE;
+	}
+
+	if (!pending) {
+		imap_flag_queue_timer_tag = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void imap_flag_queue_flush_all(void)
+{
+	GList *cur;
+
+	if (imap_flag_queue_timer_tag > 0) {
+		g_source_remove(imap_flag_queue_timer_tag);
+		imap_flag_queue_timer_tag = 0;
+	}
+
+	for (cur = folder_get_list(); cur != NULL; cur = cur->next) {
+		Folder *folder = FOLDER(cur->data);
+		IMAPSession *session;
+
+		if (FOLDER_TYPE(folder) != F_IMAP ||
+		    !imap_flag_queue_has_pending(IMAP_FOLDER(folder)))
+			continue;
+
+		/* the remaining changes are sent in the next session */
+		if (REMOTE_FOLDER(folder)->session &&
+		    (session = imap_session_get(folder)) != NULL)
+			imap_flag_queue_flush(session, IMAP_FOLDER(folder));
+	}
+}
+
+static gint imap_msg_list_change_perm_flags(GSList *msglist, MsgPermFlags flags,
+					    gboolean is_set)
+{
+	IMAPFlags iflags = 0;
+	IMAPFlags set_flags = 0, unset_flags = 0;
+
+	if (flags & MSG_MARKED)  iflags |= IMAP_FLAG_FLAGGED;
+	if (flags & MSG_REPLIED) iflags |= IMAP_FLAG_ANSWERED;
+
+	if (is_set)
+		set_flags |= iflags;
+	else
+		unset_flags |= iflags;
+
+	if (flags & MSG_UNREAD) {
+		if (is_set)
+			unset_flags |= IMAP_FLAG_SEEN;
+		else
+			set_flags |= IMAP_FLAG_SEEN;
+	}
+
+	if (set_flags == 0 && unset_flags == 0)
+		return IMAP_SUCCESS;
+
+	return imap_flag_queue_add_list(msglist, set_flags, unset_flags, -1);
+}
+
+gint imap_msg_set_perm_flags(MsgInfo *msginfo, MsgPermFlags flags)
+{
+	GSList msglist;
+
+	msglist.data = msginfo;
+	msglist.next = NULL;
+
+	return imap_msg_list_change_perm_flags(&msglist, flags, TRUE);
+}
+
+gint imap_msg_unset_perm_flags(MsgInfo *msginfo, MsgPermFlags flags)
+{
+	GSList msglist;
+
+	msglist.data = msginfo;
+	msglist.next = NULL;
+
+	return imap_msg_list_change_perm_flags(&msglist, flags, FALSE);
+}
+
+gint imap_msg_list_set_perm_flags(GSList *msglist, MsgPermFlags flags)
+{
+	return imap_msg_list_change_perm_flags(msglist, flags, TRUE);
+}
+
+gint imap_msg_list_unset_perm_flags(GSList *msglist, MsgPermFlags flags)
+{
+	return imap_msg_list_change_perm_flags(msglist, flags, FALSE);
+}
+
+gint imap_msg_list_set_colorlabel_flags(GSList *msglist, guint color)
+{
+	return imap_flag_queue_add_list(msglist, 0, 0, color & 7);
+}
+
 static gchar *imap_get_flag_str(IMAPFlags flags)
 {
 	GString *str;
@@ -3683,6 +4573,13 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 	gint exists_, recent_, unseen_;
 	guint32 uid_validity_;
 
+	/* the server must know the changes before they are used */
+	if (folder->flag_queue) {
+		ok = imap_flag_queue_flush(session, folder);
+		if (ok != IMAP_SUCCESS)
+			return ok;
+	}
+
 	if (!exists || !recent || !unseen || !uid_validity) {
 		if (session->mbox && strcmp(session->mbox, path) == 0)
 			return IMAP_SUCCESS;
@@ -3700,8 +4597,11 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 			     exists, recent, unseen, uid_validity);
 	if (ok != IMAP_SUCCESS)
 		log_warning(_("can't select folder: %s\n"), real_path);
-	else
+	else {
 		session->mbox = g_strdup(path);
+		((IMAPRealSession *)session)->mbox_uid_validity =
+			*uid_validity;
+	}
 	g_free(real_path);
 
 	return ok;
@@ -4467,6 +5367,259 @@ static gint imap_cmd_append(IMAPSession *session, const gchar *destfolder,
 	return ok;
 }
 
+static gchar *imap_append_get_args(IMAPAppendData *data, gboolean nonsync)
+{
+	gchar *flag_str;
+	gchar *args;
+
+	flag_str = imap_get_flag_str(data->flags);
+	if (data->date_time[0])
+		args = g_strdup_printf("(%s) \"%s\" {%d%s}", flag_str,
+				       data->date_time, data->size,
+				       nonsync ? "+" : "");
+	else
+		args = g_strdup_printf("(%s) {%d%s}", flag_str, data->size,
+				       nonsync ? "+" : "");
+	g_free(flag_str);
+
+	return args;
+}
+
+/* send the message data after its literal header. waits for the
+   continuation request first if the literal is synchronizing */
+static gint imap_append_send_literal(IMAPSession *session,
+				     IMAPAppendData *data, gboolean nonsync)
+{
+	gchar *ret = NULL;
+
+	if (!nonsync) {
+		if (imap_cmd_gen_recv(session, &ret) != IMAP_SUCCESS)
+			return IMAP_SOCKET;
+		if (ret[0] != '+') {
+			g_free(ret);
+			return IMAP_ERROR;
+		}
+		g_free(ret);
+	}
+
+	log_print("IMAP4> %s\n", _("(sending file...)"));
+
+	if (imap_write_canonical(SESSION(session)->sock, data->fp) < 0)
+		return IMAP_SOCKET;
+
+	return IMAP_SUCCESS;
+}
+
+/* parse the uid-set of "[APPENDUID uidvalidity uid-set]" (RFC 4315) */
+static gint imap_parse_append_uids(GPtrArray *argbuf, IMAPAppendData *msgs,
+				   gint n_msgs)
+{
+	gchar *resp_str;
+	gchar *p;
+	gchar *ep;
+	guint32 uid, uid_end, tmp;
+	gint i = 0;
+
+	if (argbuf->len == 0)
+		return 0;
+	resp_str = g_ptr_array_index(argbuf, argbuf->len - 1);
+	if (!resp_str || (p = strstr(resp_str, "[APPENDUID ")) == NULL)
+		return 0;
+
+	p += 11;
+	strtoul(p, &ep, 10);
+	if (ep == p || *ep != ' ')
+		return 0;
+	p = ep + 1;
+
+	while (i < n_msgs) {
+		uid = strtoul(p, &ep, 10);
+		if (ep == p)
+			break;
+		uid_end = uid;
+		if (*ep == ':') {
+			p = ep + 1;
+			uid_end = strtoul(p, &ep, 10);
+			if (ep == p)
+				break;
+		}
+		if (uid > uid_end) {
+			tmp = uid;
+			uid = uid_end;
+			uid_end = tmp;
+		}
+		for (; uid <= uid_end && i < n_msgs; uid++)
+			msgs[i++].new_uid = uid;
+
+		if (*ep != ',')
+			break;
+		p = ep + 1;
+	}
+
+	return i;
+}
+
+static gint imap_cmd_append_multi(IMAPSession *session,
+				  const gchar *destfolder,
+				  IMAPAppendData *msgs, gint n_msgs)
+{
+	gint ok;
+	gchar *destfolder_;
+	gchar *args;
+	gboolean nonsync;
+	GPtrArray *argbuf;
+	gint i;
+
+	g_return_val_if_fail(n_msgs > 0, IMAP_ERROR);
+
+	QUOTE_IF_REQUIRED(destfolder_, destfolder);
+
+	for (i = 0; i < n_msgs; i++) {
+		nonsync = imap_append_literal_nonsync(session, msgs[i].size);
+		args = imap_append_get_args(&msgs[i], nonsync);
+		if (i == 0)
+			ok = imap_cmd_gen_send(session, "APPEND %s %s",
+					       destfolder_, args);
+		else {
+			log_print("IMAP4> %s\n", args);
+			if (sock_write_all(SESSION(session)->sock, " ", 1) < 0 ||
+			    sock_puts(SESSION(session)->sock, args) < 0)
+				ok = IMAP_SOCKET;
+			else
+				ok = IMAP_SUCCESS;
+		}
+		g_free(args);
+
+		if (ok == IMAP_SUCCESS)
+			ok = imap_append_send_literal(session, &msgs[i],
+						      nonsync);
+		if (ok != IMAP_SUCCESS) {
+			log_warning(_("can't append %s to %s\n"),
+				    msgs[i].fileinfo->file, destfolder_);
+			return ok;
+		}
+	}
+
+	sock_puts(SESSION(session)->sock, "");
+
+	argbuf = g_ptr_array_new();
+
+	ok = imap_cmd_ok(session, argbuf);
+	if (ok != IMAP_SUCCESS)
+		log_warning(_("can't append message to %s\n"), destfolder_);
+	else {
+		/* MULTIAPPEND stores all the messages or none */
+		for (i = 0; i < n_msgs; i++)
+			msgs[i].appended = TRUE;
+		if (session->uidplus)
+			imap_parse_append_uids(argbuf, msgs, n_msgs);
+	}
+
+	ptr_array_free_strings(argbuf);
+	g_ptr_array_free(argbuf, TRUE);
+
+	return ok;
+}
+
+/* receive the responses of the pipelined APPENDs */
+static gint imap_append_pipelined_recv(IMAPSession *session,
+				       IMAPAppendData *msgs, guint *tags,
+				       gint from, gint to)
+{
+	GPtrArray *argbuf;
+	gint ok = IMAP_SUCCESS;
+	gint ok_;
+	gint i;
+
+	argbuf = g_ptr_array_new();
+
+	for (i = from; i < to; i++) {
+		/* receive all responses even if an error occurred */
+		ok_ = imap_cmd_ok_tag(session, argbuf, tags[i]);
+		if (ok_ != IMAP_SUCCESS) {
+			if (ok == IMAP_SUCCESS)
+				ok = ok_;
+			if (ok_ == IMAP_SOCKET)
+				break;
+		} else {
+			msgs[i].appended = TRUE;
+			if (session->uidplus)
+				imap_parse_append_uids(argbuf, &msgs[i], 1);
+		}
+
+		ptr_array_free_strings(argbuf);
+		g_ptr_array_set_size(argbuf, 0);
+	}
+
+	g_ptr_array_free(argbuf, TRUE);
+
+	return ok;
+}
+
+static gint imap_cmd_append_pipelined(IMAPSession *session,
+				      const gchar *destfolder,
+				      IMAPAppendData *msgs, gint n_msgs)
+{
+	gint ok = IMAP_SUCCESS;
+	gchar *destfolder_;
+	gchar *args;
+	gboolean nonsync;
+	guint tags[IMAP_APPEND_BATCH_MSGS];
+	gint pending = 0;
+	gint i;
+
+	g_return_val_if_fail(n_msgs <= IMAP_APPEND_BATCH_MSGS, IMAP_ERROR);
+
+	QUOTE_IF_REQUIRED(destfolder_, destfolder);
+
+	for (i = 0; i < n_msgs; i++) {
+		nonsync = imap_append_literal_nonsync(session, msgs[i].size);
+
+		/* the continuation request of a synchronizing literal
+		   can't be told from the pending responses */
+		if (!nonsync && pending < i) {
+			ok = imap_append_pipelined_recv(session, msgs, tags,
+							pending, i);
+			pending = i;
+			if (ok != IMAP_SUCCESS)
+				break;
+		}
+
+		args = imap_append_get_args(&msgs[i], nonsync);
+		ok = imap_cmd_gen_send(session, "APPEND %s %s",
+				       destfolder_, args);
+		g_free(args);
+		tags[i] = session->cmd_count;
+
+		if (ok == IMAP_SUCCESS)
+			ok = imap_append_send_literal(session, &msgs[i],
+						      nonsync);
+		if (ok == IMAP_SUCCESS)
+			sock_puts(SESSION(session)->sock, "");
+		else {
+			/* the command has already been finished by
+			   the rejection */
+			if (ok == IMAP_ERROR)
+				pending = i + 1;
+			break;
+		}
+	}
+
+	if (ok != IMAP_SOCKET && pending < i) {
+		gint ok_;
+
+		ok_ = imap_append_pipelined_recv(session, msgs, tags,
+						 pending, i);
+		if (ok == IMAP_SUCCESS)
+			ok = ok_;
+	}
+
+	if (ok != IMAP_SUCCESS)
+		log_warning(_("can't append message to %s\n"), destfolder_);
+
+	return ok;
+}
+
 static gint imap_cmd_copy(IMAPSession *session, const gchar *seq_set,
 			  const gchar *destfolder)
 {
@@ -4539,7 +5692,8 @@ static gint imap_cmd_close(IMAPSession *session)
 	return ok;
 }
 
-static gint imap_cmd_ok_real(IMAPSession *session, GPtrArray *argbuf)
+static gint imap_cmd_ok_tag_real(IMAPSession *session, GPtrArray *argbuf,
+				 guint tag)
 {
 	gint ok;
 	gchar *buf;
@@ -4596,8 +5750,7 @@ static gint imap_cmd_ok_real(IMAPSession *session, GPtrArray *argbuf)
 		} else if (sscanf(str->str, "%d %" Xstr(IMAPBUFSIZE) "s",
 			   &cmd_num, cmd_status) < 2) {
 			ok = IMAP_ERROR;
-		} else if (cmd_num == session->cmd_count &&
-			   !strcmp(cmd_status, "OK")) {
+		} else if (cmd_num == tag && !strcmp(cmd_status, "OK")) {
 			if (argbuf)
 				g_ptr_array_add(argbuf, g_strdup(str->str));
 		} else {
@@ -4611,6 +5764,11 @@ static gint imap_cmd_ok_real(IMAPSession *session, GPtrArray *argbuf)
 	return ok;
 }
 
+static gint imap_cmd_ok_real(IMAPSession *session, GPtrArray *argbuf)
+{
+	return imap_cmd_ok_tag_real(session, argbuf, session->cmd_count);
+}
+
 #if USE_THREADS
 static gint imap_cmd_ok_func(IMAPSession *session, gpointer data)
 {
@@ -4620,6 +5778,21 @@ static gint imap_cmd_ok_func(IMAPSession *session, gpointer data)
 	ok = imap_cmd_ok_real(session, argbuf);
 	return ok;
 }
+
+typedef struct _IMAPCmdOkData
+{
+	GPtrArray *argbuf;
+	guint tag;
+} IMAPCmdOkData;
+
+static gint imap_cmd_ok_tag_func(IMAPSession *session, gpointer data)
+{
+	IMAPCmdOkData *ok_data = (IMAPCmdOkData *)data;
+	gint ok;
+
+	ok = imap_cmd_ok_tag_real(session, ok_data->argbuf, ok_data->tag);
+	return ok;
+}
 #endif
 
 static gint imap_cmd_ok(IMAPSession *session, GPtrArray *argbuf)
@@ -4631,12 +5804,25 @@ static gint imap_cmd_ok(IMAPSession *session, GPtrArray *argbuf)
 #endif
 }
 
+/* wait for the completion of the specified command */
+static gint imap_cmd_ok_tag(IMAPSession *session, GPtrArray *argbuf,
+			    guint tag)
+{
+#if USE_THREADS
+	IMAPCmdOkData data;
+
+	data.argbuf = argbuf;
+	data.tag = tag;
+	return imap_thread_run(session, imap_cmd_ok_tag_func, &data);
+#else
+	return imap_cmd_ok_tag_real(session, argbuf, tag);
+#endif
+}
+
 static gint imap_cmd_gen_send(IMAPSession *session, const gchar *format, ...)
 {
 	IMAPRealSession *real = (IMAPRealSession *)session;
-	gchar buf[IMAPBUFSIZE];
 	gchar tmp[IMAPBUFSIZE];
-	gchar *p;
 	va_list args;
 
 	va_start(args, format);
@@ -4650,15 +5836,24 @@ static gint imap_cmd_gen_send(IMAPSession *session, const gchar *format, ...)
 	}
 #endif
 
+	return imap_cmd_gen_send_real(session, tmp);
+}
+
+/* also used by the thread functions, which run while is_running is set */
+static gint imap_cmd_gen_send_real(IMAPSession *session, const gchar *cmd)
+{
+	gchar buf[IMAPBUFSIZE];
+	gchar *p;
+
 	session->cmd_count++;
 
-	g_snprintf(buf, sizeof(buf), "%d %s\r\n", session->cmd_count, tmp);
-	if (!g_ascii_strncasecmp(tmp, "LOGIN ", 6) &&
-	    (p = strchr(tmp + 6, ' '))) {
-		*p = '\0';
-		log_print("IMAP4> %d %s ********\n", session->cmd_count, tmp);
+	g_snprintf(buf, sizeof(buf), "%d %s\r\n", session->cmd_count, cmd);
+	if (!g_ascii_strncasecmp(cmd, "LOGIN ", 6) &&
+	    (p = strchr(cmd + 6, ' '))) {
+		log_print("IMAP4> %d %.*s ********\n", session->cmd_count,
+			  (gint)(p - cmd), cmd);
 	} else
-		log_print("IMAP4> %d %s\n", session->cmd_count, tmp);
+		log_print("IMAP4> %d %s\n", session->cmd_count, cmd);
 
 	sock_write_all(SESSION(session)->sock, buf, strlen(buf));
 
@@ -4980,29 +6175,53 @@ static gchar *imap_utf8_to_modified_utf7(const gchar *from)
 
 static GSList *imap_get_seq_set_from_msglist(GSList *msglist, gint limit)
 {
-	GString *str;
+	GArray *uids;
 	GSList *sorted_list, *cur;
+	GSList *ret_list;
+
+	if (msglist == NULL)
+		return NULL;
+
+	sorted_list = g_slist_copy(msglist);
+	sorted_list = procmsg_sort_msg_list(sorted_list, SORT_BY_NUMBER,
+					    SORT_ASCENDING);
+
+	uids = g_array_new(FALSE, FALSE, sizeof(guint32));
+	for (cur = sorted_list; cur != NULL; cur = cur->next) {
+		guint32 uid = ((MsgInfo *)cur->data)->msgnum;
+		g_array_append_val(uids, uid);
+	}
+
+	ret_list = imap_get_seq_set_from_uids(uids, limit);
+
+	g_array_free(uids, TRUE);
+	g_slist_free(sorted_list);
+
+	return ret_list;
+}
+
+/* uids must be sorted in ascending order */
+static GSList *imap_get_seq_set_from_uids(GArray *uids, gint limit)
+{
+	GString *str;
 	guint first, last, next;
 	gchar *ret_str;
 	GSList *ret_list = NULL;
 	gint count = 0;
+	guint i;
 
-	if (msglist == NULL)
+	if (uids->len == 0)
 		return NULL;
 
 	str = g_string_sized_new(256);
 
-	sorted_list = g_slist_copy(msglist);
-	sorted_list = procmsg_sort_msg_list(sorted_list, SORT_BY_NUMBER,
-					    SORT_ASCENDING);
-
-	first = ((MsgInfo *)sorted_list->data)->msgnum;
+	first = g_array_index(uids, guint32, 0);
 
-	for (cur = sorted_list; cur != NULL; cur = cur->next) {
+	for (i = 0; i < uids->len; i++) {
 		++count;
-		last = ((MsgInfo *)cur->data)->msgnum;
-		if (cur->next)
-			next = ((MsgInfo *)cur->next->data)->msgnum;
+		last = g_array_index(uids, guint32, i);
+		if (i + 1 < uids->len)
+			next = g_array_index(uids, guint32, i + 1);
 		else
 			next = 0;
 
@@ -5046,7 +6265,6 @@ static GSList *imap_get_seq_set_from_msglist(GSList *msglist, gint limit)
 		ret_list = g_slist_append(ret_list, ret_str);
 	}
 
-	g_slist_free(sorted_list);
 	g_string_free(str, TRUE);
 
 	return ret_list;
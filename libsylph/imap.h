@@ -56,6 +56,9 @@ struct _IMAPFolder
 	GList *ns_personal;
 	GList *ns_others;
 	GList *ns_shared;
+
+	/* queued flag changes (path -> IMAPFlagQueue) */
+	GHashTable *flag_queue;
 };
 
 struct _IMAPSession
@@ -128,4 +131,6 @@ gint imap_msg_list_set_colorlabel_flags	(GSList		*msglist,
 
 gboolean imap_is_session_active		(IMAPFolder	*folder);
 
+void imap_flag_queue_flush_all		(void);
+
 #endif /* __IMAP_H__ */
@@ -21,17 +21,28 @@
 #  include "config.h"
 #endif
 
+#if HAVE_COPY_FILE_RANGE && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
+
 #include "defs.h"
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/file.h>
 #include <ctype.h>
 #include <time.h>
+#if HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #ifdef HAVE_LOCKFILE_H
 #  include <lockfile.h>
@@ -47,219 +58,535 @@
 #include "account.h"
 #include "utils.h"
 
-#define FPUTS_TO_TMP_ABORT_IF_FAIL(s) \
-{ \
-	if (fputs(s, tmp_fp) == EOF) { \
-		g_warning(_("can't write to temporary file\n")); \
-		fclose(tmp_fp); \
-		fclose(mbox_fp); \
-		g_unlink(tmp_file); \
-		g_free(tmp_file); \
-		return -1; \
-	} \
-}
+#ifndef O_BINARY
+#  define O_BINARY	0
+#endif
 
-gint proc_mbox(FolderItem *dest, const gchar *mbox, GHashTable *folder_table)
+/* number of messages split out of the mbox before they are parsed,
+   filtered and added to the destination folder together */
+#define MBOX_IMPORT_BATCH	256
+
+typedef struct _MboxImportMsg
 {
-	return proc_mbox_full(dest, mbox, folder_table,
-			      folder_table ? TRUE : FALSE,
-			      folder_table && prefs_common.enable_junk &&
-			      prefs_common.filter_junk_on_recv ? TRUE : FALSE);
-}
+	gchar *file;
+	MsgInfo *msginfo;
+} MboxImportMsg;
 
-gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
-		    GHashTable *folder_table, gboolean apply_filter,
-		    gboolean filter_junk)
+typedef struct _MboxWriter
 {
-	FILE *mbox_fp;
-	gchar buf[BUFFSIZE], from_line[BUFFSIZE];
-	gchar *tmp_file;
-	gint new_msgs = 0;
-	guint count = 0;
-	Folder *folder;
-	FilterRule *junk_rule = NULL;
-	GSList junk_fltlist = {NULL, NULL};
-	FolderItem *junk;
+	FILE *fp;
+	const gchar *run;
+	const gchar *run_end;
+	gboolean error;
+} MboxWriter;
+
+/* reads the mbox either from a memory map or, when the file can't be
+   mapped (e.g. larger than the address space), with fgets() */
+typedef struct _MboxReader
+{
+	GMappedFile *map;
+	const gchar *from_line;
+	const gchar *first;
+	const gchar *end;
+	gboolean unescape_first;
+
+	FILE *fp;
+	gchar from_buf[BUFFSIZE];
+	gchar buf[BUFFSIZE];
+} MboxReader;
 
-	g_return_val_if_fail(dest != NULL, -1);
-	g_return_val_if_fail(dest->folder != NULL, -1);
-	g_return_val_if_fail(mbox != NULL, -1);
+static const gchar *mbox_next_line(const gchar *p, const gchar *end)
+{
+	const gchar *nl;
 
-	debug_print(_("Getting messages from %s into %s...\n"), mbox, dest->path);
+	nl = memchr(p, '\n', end - p);
+	return nl ? nl + 1 : end;
+}
 
-	folder = dest->folder;
+#define MBOX_LINE_IS_EMPTY(p)	(*(p) == '\n' || *(p) == '\r')
+#define MBOX_LINE_HAS_PREFIX(p, e, s) \
+	((e) - (p) >= (gint)strlen(s) && !strncmp(p, s, strlen(s)))
 
-	if ((mbox_fp = g_fopen(mbox, "rb")) == NULL) {
-		FILE_OP_ERROR(mbox, "fopen");
-		return -1;
+/* same as is_header_line(), but the line is not NUL-terminated */
+static gboolean mbox_is_header_line(const gchar *p, const gchar *end)
+{
+	if (p < end && *p == ':') return FALSE;
+
+	while (p < end && *p != ' ' && *p != '\n') {
+		if (*p == ':')
+			return TRUE;
+		p++;
 	}
 
-	/* ignore empty lines on the head */
-	do {
-		if (fgets(buf, sizeof(buf), mbox_fp) == NULL) {
-			g_warning(_("can't read mbox file.\n"));
-			fclose(mbox_fp);
-			return -1;
-		}
-	} while (buf[0] == '\n' || buf[0] == '\r');
+	return FALSE;
+}
 
-	if (strncmp(buf, "From ", 5) != 0) {
-		g_warning(_("invalid mbox format: %s\n"), mbox);
-		fclose(mbox_fp);
-		return -1;
+static void mbox_writer_flush(MboxWriter *writer)
+{
+	gsize len;
+
+	if (writer->run == NULL)
+		return;
+
+	len = writer->run_end - writer->run;
+	if (len > 0 && !writer->error &&
+	    fwrite(writer->run, len, 1, writer->fp) != 1)
+		writer->error = TRUE;
+	writer->run = writer->run_end = NULL;
+}
+
+/* append a region of the mapped mbox. Adjacent regions are coalesced
+   so that unmodified runs of lines are written with a single fwrite(). */
+static void mbox_writer_append(MboxWriter *writer, const gchar *p,
+			       const gchar *end)
+{
+	if (writer->run && writer->run_end == p) {
+		writer->run_end = end;
+		return;
 	}
 
-	strcpy(from_line, buf);
-	if (fgets(buf, sizeof(buf), mbox_fp) == NULL) {
-		g_warning(_("malformed mbox: %s\n"), mbox);
-		fclose(mbox_fp);
+	mbox_writer_flush(writer);
+	writer->run = p;
+	writer->run_end = end;
+}
+
+static void mbox_writer_puts(MboxWriter *writer, const gchar *str)
+{
+	mbox_writer_flush(writer);
+	if (!writer->error && fputs(str, writer->fp) == EOF)
+		writer->error = TRUE;
+}
+
+/* Write one message starting at FROM_LINE (the "From " separator) and
+   FIRST (the first header line) into FILE.  Returns the position of the
+   next "From " separator in *NEXT_FROM, or NULL if the end of the mbox
+   was reached. */
+static gint mbox_write_msg(const gchar *file, const gchar *from_line,
+			   const gchar *first, gboolean unescape_first,
+			   const gchar *end, const gchar **next_from,
+			   const gchar **next_first,
+			   gboolean *next_unescape_first)
+{
+	FILE *fp;
+	MboxWriter writer = {NULL, NULL, NULL, FALSE};
+	const gchar *p, *line_end, *startp, *endp;
+	const gchar *pending_from = NULL;
+	gchar *rpath, *rpath_line;
+	gint empty_line = 0;
+
+	*next_from = NULL;
+	*next_first = NULL;
+	*next_unescape_first = FALSE;
+
+	if ((fp = g_fopen(file, "wb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		g_warning(_("can't open temporary file\n"));
 		return -1;
 	}
+	if (change_file_mode_rw(fp, file) < 0)
+		FILE_OP_ERROR(file, "chmod");
+	writer.fp = fp;
+
+	/* convert unix From into Return-Path */
+	line_end = mbox_next_line(from_line, end);
+	startp = from_line + 5;
+	for (endp = startp; endp < line_end && *endp != ' '; endp++)
+		;
+	rpath = g_strndup(startp, endp - startp);
+	g_strstrip(rpath);
+	rpath_line = g_strdup_printf("Return-Path: %s\n", rpath);
+	mbox_writer_puts(&writer, rpath_line);
+	g_free(rpath_line);
+	g_free(rpath);
+
+	line_end = mbox_next_line(first, end);
+	mbox_writer_append(&writer, first + (unescape_first ? 1 : 0),
+			   line_end);
+
+	for (p = line_end; p < end; p = line_end) {
+		gboolean is_next_msg = FALSE;
+		gboolean unescape = FALSE;
 
-	tmp_file = get_tmp_file();
+		line_end = mbox_next_line(p, end);
 
-	if (filter_junk) {
-		junk = folder_get_junk(folder);
-		junk_rule = filter_junk_rule_create(NULL, junk, FALSE);
-		junk_fltlist.data = junk_rule;
-	}
+		if (MBOX_LINE_IS_EMPTY(p)) {
+			empty_line++;
+			continue;
+		}
 
-	do {
-		FILE *tmp_fp;
-		GSList *cur;
-		gchar *startp, *endp, *rpath;
-		gint empty_line;
-		gboolean is_next_msg = FALSE;
-		gboolean is_junk = FALSE;
-		FilterInfo *fltinfo;
-		MsgInfo *msginfo;
+		/* From separator */
+		while (p != NULL && MBOX_LINE_HAS_PREFIX(p, end, "From ")) {
+			pending_from = p;
+			p = line_end;
+			if (p >= end) {
+				p = NULL;
+				break;
+			}
+			line_end = mbox_next_line(p, end);
 
-		count++;
-		if (folder->ui_func)
-			folder->ui_func(folder, dest, folder->ui_func_data ? dest->folder->ui_func_data : GUINT_TO_POINTER(count));
-		if (folder_call_ui_func2(folder, dest, count, 0) == FALSE) {
-			debug_print("Import of mbox cancelled at %u\n", count);
+			if (mbox_is_header_line(p, line_end)) {
+				is_next_msg = TRUE;
+				break;
+			} else if (MBOX_LINE_HAS_PREFIX(p, end, "From ")) {
+				continue;
+			} else if (MBOX_LINE_HAS_PREFIX(p, end, ">From ")) {
+				unescape = TRUE;
+				is_next_msg = TRUE;
+				break;
+			} else {
+				gchar *from_str;
+
+				from_str = g_strndup(pending_from,
+						     p - pending_from);
+				g_warning(_("unescaped From found:\n%s"),
+					  from_str);
+				g_free(from_str);
+				break;
+			}
+		}
+		if (is_next_msg) {
+			*next_from = pending_from;
+			*next_first = p;
+			*next_unescape_first = unescape;
 			break;
 		}
 
-		if ((tmp_fp = g_fopen(tmp_file, "wb")) == NULL) {
-			FILE_OP_ERROR(tmp_file, "fopen");
-			g_warning(_("can't open temporary file\n"));
-			filter_rule_free(junk_rule);
-			g_free(tmp_file);
-			fclose(mbox_fp);
-			return -1;
+		while (empty_line > 0) {
+			mbox_writer_puts(&writer, "\n");
+			empty_line--;
 		}
-		if (change_file_mode_rw(tmp_fp, tmp_file) < 0)
-			FILE_OP_ERROR(tmp_file, "chmod");
 
-		/* convert unix From into Return-Path */
-		startp = from_line + 5;
-		endp = strchr(startp, ' ');
-		if (endp == NULL)
-			rpath = g_strdup(startp);
+		if (pending_from) {
+			mbox_writer_append(&writer, pending_from,
+					   mbox_next_line(pending_from, end));
+			pending_from = NULL;
+		}
+
+		if (p == NULL)
+			break;
+
+		if (MBOX_LINE_HAS_PREFIX(p, end, ">From "))
+			mbox_writer_append(&writer, p + 1, line_end);
 		else
-			rpath = g_strndup(startp, endp - startp);
-		g_strstrip(rpath);
-		g_snprintf(from_line, sizeof(from_line),
-			   "Return-Path: %s\n", rpath);
-		g_free(rpath);
-
-		FPUTS_TO_TMP_ABORT_IF_FAIL(from_line);
-		FPUTS_TO_TMP_ABORT_IF_FAIL(buf);
-		from_line[0] = '\0';
+			mbox_writer_append(&writer, p, line_end);
+	}
 
-		empty_line = 0;
+	if (empty_line > 0) {
+		while (--empty_line)
+			mbox_writer_puts(&writer, "\n");
+	}
+
+	mbox_writer_flush(&writer);
+
+	if (writer.error) {
+		FILE_OP_ERROR(file, "fwrite");
+		g_warning(_("can't write to temporary file\n"));
+		fclose(fp);
+		g_unlink(file);
+		return -1;
+	}
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		g_warning(_("can't write to temporary file\n"));
+		g_unlink(file);
+		return -1;
+	}
+
+	return 0;
+}
+
+#define MBOX_FPUTS(s) \
+{ \
+	if (!error && fputs(s, fp) == EOF) \
+		error = TRUE; \
+}
+
+/* same as mbox_write_msg(), but reads the mbox with fgets().
+   FROM_LINE and BUF hold the "From " separator and the first line of
+   the message on entry, and those of the next message on return.
+   FROM_LINE is empty when the end of the mbox was reached. */
+static gint mbox_write_msg_fp(const gchar *file, FILE *mbox_fp,
+			      gchar *from_line, gchar *buf)
+{
+	FILE *fp;
+	gchar *startp, *endp, *rpath;
+	gint empty_line = 0;
+	gboolean is_next_msg = FALSE;
+	gboolean error = FALSE;
+
+	if ((fp = g_fopen(file, "wb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		g_warning(_("can't open temporary file\n"));
+		from_line[0] = '\0';
+		return -1;
+	}
+	if (change_file_mode_rw(fp, file) < 0)
+		FILE_OP_ERROR(file, "chmod");
+
+	/* convert unix From into Return-Path */
+	startp = from_line + 5;
+	endp = strchr(startp, ' ');
+	if (endp == NULL)
+		rpath = g_strdup(startp);
+	else
+		rpath = g_strndup(startp, endp - startp);
+	g_strstrip(rpath);
+	g_snprintf(from_line, BUFFSIZE, "Return-Path: %s\n", rpath);
+	g_free(rpath);
+
+	MBOX_FPUTS(from_line);
+	MBOX_FPUTS(buf);
+	from_line[0] = '\0';
+
+	while (fgets(buf, BUFFSIZE, mbox_fp) != NULL) {
+		if (buf[0] == '\n' || buf[0] == '\r') {
+			empty_line++;
+			buf[0] = '\0';
+			continue;
+		}
 
-		while (fgets(buf, sizeof(buf), mbox_fp) != NULL) {
-			if (buf[0] == '\n' || buf[0] == '\r') {
-				empty_line++;
+		/* From separator */
+		while (!strncmp(buf, "From ", 5)) {
+			strcpy(from_line, buf);
+			if (fgets(buf, BUFFSIZE, mbox_fp) == NULL) {
 				buf[0] = '\0';
-				continue;
+				break;
 			}
 
-			/* From separator */
-			while (!strncmp(buf, "From ", 5)) {
-				strcpy(from_line, buf);
-				if (fgets(buf, sizeof(buf), mbox_fp) == NULL) {
-					buf[0] = '\0';
-					break;
-				}
-
-				if (is_header_line(buf)) {
-					is_next_msg = TRUE;
-					break;
-				} else if (!strncmp(buf, "From ", 5)) {
-					continue;
-				} else if (!strncmp(buf, ">From ", 6)) {
-					g_memmove(buf, buf + 1, strlen(buf));
-					is_next_msg = TRUE;
-					break;
-				} else {
-					g_warning(_("unescaped From found:\n%s"),
-						  from_line);
-					break;
-				}
+			if (is_header_line(buf)) {
+				is_next_msg = TRUE;
+				break;
+			} else if (!strncmp(buf, "From ", 5)) {
+				continue;
+			} else if (!strncmp(buf, ">From ", 6)) {
+				g_memmove(buf, buf + 1, strlen(buf));
+				is_next_msg = TRUE;
+				break;
+			} else {
+				g_warning(_("unescaped From found:\n%s"),
+					  from_line);
+				break;
 			}
-			if (is_next_msg) break;
+		}
+		if (is_next_msg) break;
 
-			if (empty_line > 0) {
-				while (empty_line--)
-					FPUTS_TO_TMP_ABORT_IF_FAIL("\n");
-				empty_line = 0;
-			}
+		while (empty_line > 0) {
+			MBOX_FPUTS("\n");
+			empty_line--;
+		}
 
-			if (from_line[0] != '\0') {
-				FPUTS_TO_TMP_ABORT_IF_FAIL(from_line);
-				from_line[0] = '\0';
-			}
+		if (from_line[0] != '\0') {
+			MBOX_FPUTS(from_line);
+			from_line[0] = '\0';
+		}
 
-			if (buf[0] != '\0') {
-				if (!strncmp(buf, ">From ", 6)) {
-					FPUTS_TO_TMP_ABORT_IF_FAIL(buf + 1);
-				} else
-					FPUTS_TO_TMP_ABORT_IF_FAIL(buf);
+		if (buf[0] != '\0') {
+			if (!strncmp(buf, ">From ", 6)) {
+				MBOX_FPUTS(buf + 1);
+			} else
+				MBOX_FPUTS(buf);
+			buf[0] = '\0';
+		}
+	}
 
-				buf[0] = '\0';
-			}
+	if (empty_line > 0) {
+		while (--empty_line)
+			MBOX_FPUTS("\n");
+	}
+
+	if (error) {
+		FILE_OP_ERROR(file, "fputs");
+		g_warning(_("can't write to temporary file\n"));
+		fclose(fp);
+		g_unlink(file);
+		return -1;
+	}
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		g_warning(_("can't write to temporary file\n"));
+		g_unlink(file);
+		return -1;
+	}
+
+	return 0;
+}
+
+#undef MBOX_FPUTS
+
+/* open MBOX and position the reader on the first message */
+static gint mbox_reader_open(MboxReader *reader, const gchar *mbox)
+{
+	GError *error = NULL;
+	const gchar *p;
+
+	memset(reader, 0, sizeof(MboxReader));
+
+	reader->map = g_mapped_file_new(mbox, FALSE, &error);
+	if (!reader->map) {
+		if (error) {
+			debug_print("%s: %s, reading it with fgets()\n",
+				    mbox, error->message);
+			g_error_free(error);
+		}
+		if ((reader->fp = g_fopen(mbox, "rb")) == NULL) {
+			FILE_OP_ERROR(mbox, "fopen");
+			return -1;
 		}
 
-		if (empty_line > 0) {
-			while (--empty_line)
-				FPUTS_TO_TMP_ABORT_IF_FAIL("\n");
+		/* ignore empty lines on the head */
+		do {
+			if (fgets(reader->buf, sizeof(reader->buf),
+				  reader->fp) == NULL) {
+				g_warning(_("can't read mbox file.\n"));
+				return -1;
+			}
+		} while (reader->buf[0] == '\n' || reader->buf[0] == '\r');
+
+		if (strncmp(reader->buf, "From ", 5) != 0) {
+			g_warning(_("invalid mbox format: %s\n"), mbox);
+			return -1;
 		}
 
-		if (fclose(tmp_fp) == EOF) {
-			FILE_OP_ERROR(tmp_file, "fclose");
-			g_warning(_("can't write to temporary file\n"));
-			filter_rule_free(junk_rule);
-			g_unlink(tmp_file);
-			g_free(tmp_file);
-			fclose(mbox_fp);
+		strcpy(reader->from_buf, reader->buf);
+		if (fgets(reader->buf, sizeof(reader->buf), reader->fp)
+		    == NULL) {
+			g_warning(_("malformed mbox: %s\n"), mbox);
 			return -1;
 		}
 
-		fltinfo = filter_info_new();
-		fltinfo->flags.perm_flags = MSG_NEW|MSG_UNREAD;
-		fltinfo->flags.tmp_flags = MSG_RECEIVED;
+		return 0;
+	}
+
+	p = g_mapped_file_get_contents(reader->map);
+	reader->end = p + g_mapped_file_get_length(reader->map);
+
+	/* ignore empty lines on the head */
+	while (p < reader->end && MBOX_LINE_IS_EMPTY(p))
+		p = mbox_next_line(p, reader->end);
+	if (p >= reader->end) {
+		g_warning(_("can't read mbox file.\n"));
+		return -1;
+	}
+
+	if (!MBOX_LINE_HAS_PREFIX(p, reader->end, "From ")) {
+		g_warning(_("invalid mbox format: %s\n"), mbox);
+		return -1;
+	}
+
+	reader->from_line = p;
+	reader->first = mbox_next_line(p, reader->end);
+	if (reader->first >= reader->end) {
+		g_warning(_("malformed mbox: %s\n"), mbox);
+		return -1;
+	}
+
+	return 0;
+}
+
+static gboolean mbox_reader_has_msg(MboxReader *reader)
+{
+	if (reader->map)
+		return reader->from_line != NULL;
+	else
+		return reader->from_buf[0] != '\0';
+}
+
+/* write the current message into FILE and advance to the next one */
+static gint mbox_reader_write_msg(MboxReader *reader, const gchar *file)
+{
+	if (reader->map)
+		return mbox_write_msg(file, reader->from_line, reader->first,
+				      reader->unescape_first, reader->end,
+				      &reader->from_line, &reader->first,
+				      &reader->unescape_first);
+	else
+		return mbox_write_msg_fp(file, reader->fp, reader->from_buf,
+					 reader->buf);
+}
+
+static void mbox_reader_close(MboxReader *reader)
+{
+	if (reader->map)
+		g_mapped_file_free(reader->map);
+	if (reader->fp)
+		fclose(reader->fp);
+	reader->map = NULL;
+	reader->fp = NULL;
+}
+
+static void mbox_import_msg_free(MboxImportMsg *msg)
+{
+	if (msg->file) {
+		g_unlink(msg->file);
+		g_free(msg->file);
+	}
+	if (msg->msginfo)
+		procmsg_msginfo_free(msg->msginfo);
+	g_free(msg);
+}
+
+static void mbox_import_batch_clear(GPtrArray *msgs)
+{
+	guint i;
+
+	for (i = 0; i < msgs->len; i++)
+		mbox_import_msg_free((MboxImportMsg *)g_ptr_array_index(msgs, i));
+	g_ptr_array_set_size(msgs, 0);
+}
+
+static void mbox_import_parse_msg(MboxImportMsg *msg)
+{
+	MsgFlags flags = {MSG_NEW|MSG_UNREAD, MSG_RECEIVED};
+
+	msg->msginfo = procheader_parse_file(msg->file, flags, FALSE);
+	if (msg->msginfo)
+		msg->msginfo->file_path = g_strdup(msg->file);
+}
+
+/* parse the headers of all messages in the batch. This is done in the
+   calling thread, since header decoding is not thread-safe. */
+static void mbox_import_parse_batch(GPtrArray *msgs)
+{
+	guint i;
 
-		msginfo = procheader_parse_file(tmp_file, fltinfo->flags,
-						FALSE);
+	for (i = 0; i < msgs->len; i++)
+		mbox_import_parse_msg((MboxImportMsg *)g_ptr_array_index(msgs, i));
+}
+
+/* filter the messages of the batch in mbox order, and add the ones which
+   stay in DEST with a single folder_item_add_msgs_msginfo() call. */
+static gint mbox_import_deliver_batch(FolderItem *dest, GPtrArray *msgs,
+				      GHashTable *folder_table,
+				      gboolean apply_filter,
+				      gboolean filter_junk,
+				      GSList *junk_fltlist)
+{
+	GSList *add_list = NULL;
+	GSList *cur;
+	gint new_msgs = 0;
+	gboolean parse_failed = FALSE;
+	guint i;
+
+	for (i = 0; i < msgs->len; i++) {
+		MboxImportMsg *msg = g_ptr_array_index(msgs, i);
+		MsgInfo *msginfo = msg->msginfo;
+		FilterInfo *fltinfo;
+		gboolean is_junk = FALSE;
+
+		/* the previous messages are already filtered, so they are
+		   still added below, as they were before this one */
 		if (!msginfo) {
 			g_warning("proc_mbox_full: procheader_parse_file failed");
-			filter_info_free(fltinfo);
-			filter_rule_free(junk_rule);
-			g_unlink(tmp_file);
-			g_free(tmp_file);
-			fclose(mbox_fp);
-			return -1;
+			parse_failed = TRUE;
+			break;
 		}
+
+		fltinfo = filter_info_new();
 		fltinfo->flags = msginfo->flags;
-		msginfo->file_path = g_strdup(tmp_file);
 
 		if (filter_junk && prefs_common.enable_junk &&
-		    prefs_common.filter_junk_before && junk_rule) {
-			filter_apply_msginfo(&junk_fltlist, msginfo, fltinfo);
+		    prefs_common.filter_junk_before && junk_fltlist->data) {
+			filter_apply_msginfo(junk_fltlist, msginfo, fltinfo);
 			if (fltinfo->drop_done)
 				is_junk = TRUE;
 		}
@@ -270,8 +597,8 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 
 		if (!fltinfo->drop_done &&
 		    filter_junk && prefs_common.enable_junk &&
-		    !prefs_common.filter_junk_before && junk_rule) {
-			filter_apply_msginfo(&junk_fltlist, msginfo, fltinfo);
+		    !prefs_common.filter_junk_before && junk_fltlist->data) {
+			filter_apply_msginfo(junk_fltlist, msginfo, fltinfo);
 			if (fltinfo->drop_done)
 				is_junk = TRUE;
 		}
@@ -279,35 +606,18 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 		if (fltinfo->actions[FLT_ACTION_MOVE] == FALSE &&
 		    fltinfo->actions[FLT_ACTION_DELETE] == FALSE) {
 			msginfo->flags = fltinfo->flags;
-			if (folder_item_add_msg_msginfo(dest, msginfo, FALSE) < 0) {
-				procmsg_msginfo_free(msginfo);
-				filter_info_free(fltinfo);
-				filter_rule_free(junk_rule);
-				g_unlink(tmp_file);
-				g_free(tmp_file);
-				fclose(mbox_fp);
-				return -1;
-			}
+			add_list = g_slist_prepend(add_list, msginfo);
 			fltinfo->dest_list = g_slist_append(fltinfo->dest_list,
 							    dest);
 		}
 
 		for (cur = fltinfo->dest_list; cur != NULL; cur = cur->next) {
 			FolderItem *drop_folder = (FolderItem *)cur->data;
-			gint val = 0;
 
-			if (folder_table) {
-				val = GPOINTER_TO_INT(g_hash_table_lookup
-						      (folder_table,
-						       drop_folder));
-			}
-			if (val == 0) {
-				if (folder_table) {
-					g_hash_table_insert(folder_table,
-							    drop_folder,
-							    GINT_TO_POINTER(1));
-				}
-			}
+			if (folder_table &&
+			    g_hash_table_lookup(folder_table, drop_folder) == NULL)
+				g_hash_table_insert(folder_table, drop_folder,
+						    GINT_TO_POINTER(1));
 		}
 
 		if (!is_junk &&
@@ -315,16 +625,137 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 		    fltinfo->actions[FLT_ACTION_MARK_READ] == FALSE)
 			new_msgs++;
 
-		procmsg_msginfo_free(msginfo);
 		filter_info_free(fltinfo);
-		g_unlink(tmp_file);
-	} while (from_line[0] != '\0');
+	}
+
+	if (add_list) {
+		add_list = g_slist_reverse(add_list);
+		if (folder_item_add_msgs_msginfo(dest, add_list, FALSE, NULL)
+		    < 0) {
+			g_slist_free(add_list);
+			return -1;
+		}
+		g_slist_free(add_list);
+	}
+
+	if (parse_failed)
+		return -1;
+
+	return new_msgs;
+}
+
+gint proc_mbox(FolderItem *dest, const gchar *mbox, GHashTable *folder_table)
+{
+	return proc_mbox_full(dest, mbox, folder_table,
+			      folder_table ? TRUE : FALSE,
+			      folder_table && prefs_common.enable_junk &&
+			      prefs_common.filter_junk_on_recv ? TRUE : FALSE);
+}
+
+/* The mbox is mapped into memory (or read with fgets() if that fails)
+   and split on "From " separators. Messages are written out and
+   processed in batches of MBOX_IMPORT_BATCH, keeping the order of the
+   mbox. */
+gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
+		    GHashTable *folder_table, gboolean apply_filter,
+		    gboolean filter_junk)
+{
+	MboxReader *reader;
+	GPtrArray *msgs;
+	gint new_msgs = 0;
+	guint count = 0;
+	gint ret = 0;
+	Folder *folder;
+	FilterRule *junk_rule = NULL;
+	GSList junk_fltlist = {NULL, NULL};
+	FolderItem *junk;
+
+	g_return_val_if_fail(dest != NULL, -1);
+	g_return_val_if_fail(dest->folder != NULL, -1);
+	g_return_val_if_fail(mbox != NULL, -1);
+
+	debug_print(_("Getting messages from %s into %s...\n"), mbox, dest->path);
+
+	folder = dest->folder;
+
+	reader = g_new(MboxReader, 1);
+	if (mbox_reader_open(reader, mbox) < 0) {
+		mbox_reader_close(reader);
+		g_free(reader);
+		return -1;
+	}
+
+	if (filter_junk) {
+		junk = folder_get_junk(folder);
+		junk_rule = filter_junk_rule_create(NULL, junk, FALSE);
+		junk_fltlist.data = junk_rule;
+	}
+
+	msgs = g_ptr_array_new();
+
+	while (mbox_reader_has_msg(reader)) {
+		MboxImportMsg *msg;
+		gint n;
+
+		count++;
+		if (folder->ui_func)
+			folder->ui_func(folder, dest, folder->ui_func_data ? dest->folder->ui_func_data : GUINT_TO_POINTER(count));
+		if (folder_call_ui_func2(folder, dest, count, 0) == FALSE) {
+			debug_print("Import of mbox cancelled at %u\n", count);
+			break;
+		}
+
+		msg = g_new0(MboxImportMsg, 1);
+		msg->file = get_tmp_file();
+		if (mbox_reader_write_msg(reader, msg->file) < 0) {
+			g_free(msg->file);
+			g_free(msg);
+			ret = -1;
+			break;
+		}
+		g_ptr_array_add(msgs, msg);
+
+		if (msgs->len < MBOX_IMPORT_BATCH &&
+		    mbox_reader_has_msg(reader))
+			continue;
+
+		mbox_import_parse_batch(msgs);
+		n = mbox_import_deliver_batch(dest, msgs, folder_table,
+					      apply_filter, filter_junk,
+					      &junk_fltlist);
+		mbox_import_batch_clear(msgs);
+		if (n < 0) {
+			ret = -1;
+			break;
+		}
+		new_msgs += n;
+	}
+
+	/* messages already split before cancellation are still delivered */
+	if (ret == 0 && msgs->len > 0) {
+		gint n;
+
+		mbox_import_parse_batch(msgs);
+		n = mbox_import_deliver_batch(dest, msgs, folder_table,
+					      apply_filter, filter_junk,
+					      &junk_fltlist);
+		if (n < 0)
+			ret = -1;
+		else
+			new_msgs += n;
+	}
+	mbox_import_batch_clear(msgs);
+	g_ptr_array_free(msgs, TRUE);
 
 	if (junk_rule)
 		filter_rule_free(junk_rule);
 
-	g_free(tmp_file);
-	fclose(mbox_fp);
+	mbox_reader_close(reader);
+	g_free(reader);
+
+	if (ret < 0)
+		return -1;
+
 	debug_print("%d new messages found.\n", new_msgs);
 
 	return new_msgs;
@@ -502,17 +933,216 @@ gint export_to_mbox(FolderItem *src, const gchar *mbox)
 	return ret;
 }
 
+#define MBOX_EXPORT_BUFSIZE	65536
+/* unescaped runs shorter than this are copied through the write buffer */
+#define MBOX_EXPORT_COPY_MIN	16384
+#define MBOX_EXPORT_THREADS	4
+
+typedef struct _MboxExportBuf
+{
+	gint fd;
+	gsize len;
+	gboolean error;
+	gchar buf[MBOX_EXPORT_BUFSIZE];
+} MboxExportBuf;
+
+typedef struct _MboxExportMsg
+{
+	gchar *file;
+	gchar *from_line;
+	gboolean queued;
+} MboxExportMsg;
+
+typedef struct _MboxExportJob
+{
+	FolderItem *src;
+	gchar *mbox;
+	GPtrArray *msgs;
+	gint ret;
+	volatile gint *remain;
+} MboxExportJob;
+
+static MboxExportBuf *mbox_export_buf_open(const gchar *mbox)
+{
+	MboxExportBuf *out;
+	gint fd;
+
+	if ((fd = g_open(mbox, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0644)) < 0) {
+		FILE_OP_ERROR(mbox, "open");
+		return NULL;
+	}
+
+	out = g_new(MboxExportBuf, 1);
+	out->fd = fd;
+	out->len = 0;
+	out->error = FALSE;
+
+	return out;
+}
+
+static void mbox_export_buf_flush(MboxExportBuf *out)
+{
+	const gchar *p = out->buf;
+	gssize n;
+
+	while (!out->error && out->len > 0) {
+		n = write(out->fd, p, out->len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			out->error = TRUE;
+			break;
+		}
+		p += n;
+		out->len -= n;
+	}
+	out->len = 0;
+}
+
+static void mbox_export_buf_write(MboxExportBuf *out, const gchar *data,
+				  gsize len)
+{
+	gsize n;
+
+	while (len > 0 && !out->error) {
+		if (out->len == sizeof(out->buf))
+			mbox_export_buf_flush(out);
+		n = MIN(len, sizeof(out->buf) - out->len);
+		memcpy(out->buf + out->len, data, n);
+		out->len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+static gint mbox_export_buf_close(MboxExportBuf *out)
+{
+	gint ret;
+
+	mbox_export_buf_flush(out);
+	ret = out->error ? -1 : 0;
+	if (close(out->fd) < 0) {
+		perror("close");
+		ret = -1;
+	}
+	g_free(out);
+
+	return ret;
+}
+
+/* copy LEN bytes at OFFSET of the source file. Long runs are copied
+   inside the kernel when possible. */
+static void mbox_export_copy_run(MboxExportBuf *out, gint src_fd,
+				 const gchar *map, off_t offset, gsize len)
+{
+#if HAVE_COPY_FILE_RANGE
+	if (len >= MBOX_EXPORT_COPY_MIN) {
+		loff_t off_in = offset;
+		gssize n;
+
+		mbox_export_buf_flush(out);
+		while (len > 0 && !out->error) {
+			n = copy_file_range(src_fd, &off_in, out->fd, NULL,
+					    len, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			len -= n;
+		}
+		offset = off_in;
+		if (len == 0)
+			return;
+		/* fall back to write() if copy_file_range() is not
+		   supported between these files */
+	}
+#endif
+	mbox_export_buf_write(out, map + offset, len);
+}
+
+/* append the message read from MSG_FP (from its current position) to OUT,
+   quoting lines beginning with "From ". The message is scanned only once;
+   the runs between such lines are copied as a whole. */
+static gint mbox_export_msg(MboxExportBuf *out, FILE *msg_fp)
+{
+	gint fd;
+	off_t start;
+	struct stat s;
+	gchar *map = NULL;
+	const gchar *p, *end, *run, *nl;
+
+	fd = fileno(msg_fp);
+	start = ftell(msg_fp);
+	if (start < 0 || fstat(fd, &s) < 0)
+		return -1;
+	if (s.st_size <= start)
+		return 0;
+
+#if HAVE_SYS_MMAN_H
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		map = NULL;
+#endif
+	if (!map) {
+		gchar buf[BUFFSIZE];
+
+		while (fgets(buf, sizeof(buf), msg_fp) != NULL) {
+			if (!strncmp(buf, "From ", 5))
+				mbox_export_buf_write(out, ">", 1);
+			mbox_export_buf_write(out, buf, strlen(buf));
+		}
+		return out->error ? -1 : 0;
+	}
+
+	end = map + s.st_size;
+	for (p = run = map + start; p < end; p = nl ? nl + 1 : end) {
+		if (end - p >= 5 && !strncmp(p, "From ", 5)) {
+			if (p > run)
+				mbox_export_copy_run(out, fd, map, run - map,
+						     p - run);
+			mbox_export_buf_write(out, ">", 1);
+			run = p;
+		}
+		nl = memchr(p, '\n', end - p);
+	}
+	if (end > run)
+		mbox_export_copy_run(out, fd, map, run - map, end - run);
+
+#if HAVE_SYS_MMAN_H
+	munmap(map, s.st_size);
+#endif
+
+	return out->error ? -1 : 0;
+}
+
+static gchar *mbox_export_get_from_line(MsgInfo *msginfo,
+					PrefsAccount *cur_ac)
+{
+	gchar buf[BUFFSIZE];
+	time_t date_t_;
+
+	strncpy2(buf,
+		 msginfo->from ? msginfo->from :
+		 cur_ac && cur_ac->address ?
+		 cur_ac->address : "unknown",
+		 sizeof(buf));
+	extract_address(buf);
+
+	date_t_ = msginfo->date_t;
+	return g_strdup_printf("From %s %s", buf, ctime(&date_t_));
+}
+
 /* store MLIST into one MBOX file. */
 gint export_msgs_to_mbox(FolderItem *src, GSList *mlist, const gchar *mbox)
 {
 	GSList *cur;
 	MsgInfo *msginfo;
 	FILE *msg_fp;
-	FILE *mbox_fp;
-	gchar buf[BUFFSIZE];
+	MboxExportBuf *out;
+	gchar *from_line;
 	PrefsAccount *cur_ac;
 	guint count = 0, length;
-	time_t date_t_;
 
 	g_return_val_if_fail(src != NULL, -1);
 	g_return_val_if_fail(src->folder != NULL, -1);
@@ -522,10 +1152,8 @@ gint export_msgs_to_mbox(FolderItem *src, GSList *mlist, const gchar *mbox)
 	debug_print(_("Exporting messages from %s into %s...\n"),
 		    src->path, mbox);
 
-	if ((mbox_fp = g_fopen(mbox, "wb")) == NULL) {
-		FILE_OP_ERROR(mbox, "fopen");
+	if ((out = mbox_export_buf_open(mbox)) == NULL)
 		return -1;
-	}
 
 	cur_ac = account_get_current_account();
 
@@ -546,27 +1174,188 @@ gint export_msgs_to_mbox(FolderItem *src, GSList *mlist, const gchar *mbox)
 		if (!msg_fp)
 			continue;
 
-		strncpy2(buf,
-			 msginfo->from ? msginfo->from :
-			 cur_ac && cur_ac->address ?
-			 cur_ac->address : "unknown",
-			 sizeof(buf));
-		extract_address(buf);
+		from_line = mbox_export_get_from_line(msginfo, cur_ac);
+		mbox_export_buf_write(out, from_line, strlen(from_line));
+		g_free(from_line);
 
-		date_t_ = msginfo->date_t;
-		fprintf(mbox_fp, "From %s %s", buf, ctime(&date_t_));
+		mbox_export_msg(out, msg_fp);
+		mbox_export_buf_write(out, "\n", 1);
 
-		while (fgets(buf, sizeof(buf), msg_fp) != NULL) {
-			if (!strncmp(buf, "From ", 5))
-				fputc('>', mbox_fp);
-			fputs(buf, mbox_fp);
+		fclose(msg_fp);
+
+		if (out->error)
+			break;
+	}
+
+	return mbox_export_buf_close(out);
+}
+
+static void mbox_export_job_run(MboxExportJob *job)
+{
+	MboxExportBuf *out;
+	guint i;
+
+	if ((out = mbox_export_buf_open(job->mbox)) == NULL) {
+		job->ret = -1;
+		return;
+	}
+
+	for (i = 0; i < job->msgs->len && !out->error; i++) {
+		MboxExportMsg *msg = g_ptr_array_index(job->msgs, i);
+		FILE *msg_fp;
+
+		if ((msg_fp = g_fopen(msg->file, "rb")) == NULL) {
+			FILE_OP_ERROR(msg->file, "fopen");
+			continue;
+		}
+		if (msg->queued) {
+			gchar buf[BUFFSIZE];
+
+			while (fgets(buf, sizeof(buf), msg_fp) != NULL)
+				if (buf[0] == '\r' || buf[0] == '\n') break;
 		}
-		fputc('\n', mbox_fp);
+
+		mbox_export_buf_write(out, msg->from_line,
+				      strlen(msg->from_line));
+		mbox_export_msg(out, msg_fp);
+		mbox_export_buf_write(out, "\n", 1);
 
 		fclose(msg_fp);
 	}
 
-	fclose(mbox_fp);
+	job->ret = mbox_export_buf_close(out);
+}
 
-	return 0;
+#if USE_THREADS
+static void mbox_export_job_func(gpointer push_data, gpointer data)
+{
+	MboxExportJob *job = (MboxExportJob *)push_data;
+
+	mbox_export_job_run(job);
+	if (g_atomic_int_dec_and_test(job->remain))
+		g_main_context_wakeup(NULL);
+}
+#endif
+
+static void mbox_export_jobs_free(GPtrArray *jobs)
+{
+	guint i, j;
+
+	for (i = 0; i < jobs->len; i++) {
+		MboxExportJob *job = g_ptr_array_index(jobs, i);
+
+		for (j = 0; j < job->msgs->len; j++) {
+			MboxExportMsg *msg = g_ptr_array_index(job->msgs, j);
+
+			g_free(msg->file);
+			g_free(msg->from_line);
+			g_free(msg);
+		}
+		g_ptr_array_free(job->msgs, TRUE);
+		g_free(job->mbox);
+		g_free(job);
+	}
+	g_ptr_array_free(jobs, TRUE);
+}
+
+/* export each folder of SRC_LIST into the corresponding file of MBOX_LIST.
+   Message files are looked up (and fetched if remote) in the calling
+   thread; the mbox files are then written in parallel. */
+gint export_folders_to_mbox(GSList *src_list, GSList *mbox_list)
+{
+	GPtrArray *jobs;
+	GSList *cur, *mcur;
+	PrefsAccount *cur_ac;
+	volatile gint remain = 0;
+	gint ret = 0;
+	guint i;
+
+	g_return_val_if_fail(src_list != NULL, -1);
+	g_return_val_if_fail
+		(g_slist_length(src_list) == g_slist_length(mbox_list), -1);
+
+	cur_ac = account_get_current_account();
+	jobs = g_ptr_array_new();
+
+	for (cur = src_list, mcur = mbox_list; cur != NULL;
+	     cur = cur->next, mcur = mcur->next) {
+		FolderItem *src = (FolderItem *)cur->data;
+		MboxExportJob *job;
+		GSList *mlist, *mlcur;
+
+		if (!src || !mcur->data) {
+			g_warning("export_folders_to_mbox: invalid argument");
+			mbox_export_jobs_free(jobs);
+			return -1;
+		}
+
+		job = g_new0(MboxExportJob, 1);
+		job->src = src;
+		job->mbox = g_strdup((gchar *)mcur->data);
+		job->msgs = g_ptr_array_new();
+		job->remain = &remain;
+		g_ptr_array_add(jobs, job);
+
+		debug_print(_("Exporting messages from %s into %s...\n"),
+			    src->path, job->mbox);
+
+		mlist = folder_item_get_msg_list(src, TRUE);
+		for (mlcur = mlist; mlcur != NULL; mlcur = mlcur->next) {
+			MsgInfo *msginfo = (MsgInfo *)mlcur->data;
+			MboxExportMsg *msg;
+			gchar *file;
+
+			file = procmsg_get_message_file_path(msginfo);
+			if (!file)
+				continue;
+			if (!is_file_exist(file)) {
+				g_free(file);
+				file = procmsg_get_message_file(msginfo);
+				if (!file)
+					continue;
+			}
+
+			msg = g_new(MboxExportMsg, 1);
+			msg->file = file;
+			msg->from_line =
+				mbox_export_get_from_line(msginfo, cur_ac);
+			msg->queued = MSG_IS_QUEUED(msginfo->flags) != 0;
+			g_ptr_array_add(job->msgs, msg);
+		}
+		procmsg_msg_list_free(mlist);
+	}
+
+#if USE_THREADS
+	{
+		GThreadPool *pool;
+
+		remain = jobs->len;
+		pool = g_thread_pool_new(mbox_export_job_func, NULL,
+					 MBOX_EXPORT_THREADS, FALSE, NULL);
+		if (pool) {
+			for (i = 0; i < jobs->len; i++)
+				g_thread_pool_push
+					(pool, g_ptr_array_index(jobs, i), NULL);
+			while (g_atomic_int_get(&remain) > 0)
+				event_loop_iterate();
+			g_thread_pool_free(pool, FALSE, TRUE);
+		} else {
+			for (i = 0; i < jobs->len; i++)
+				mbox_export_job_run(g_ptr_array_index(jobs, i));
+		}
+	}
+#else
+	for (i = 0; i < jobs->len; i++)
+		mbox_export_job_run(g_ptr_array_index(jobs, i));
+#endif
+
+	for (i = 0; i < jobs->len; i++) {
+		MboxExportJob *job = g_ptr_array_index(jobs, i);
+
+		if (job->ret < 0)
+			ret = -1;
+	}
+	mbox_export_jobs_free(jobs);
+
+	return ret;
 }
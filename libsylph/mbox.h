@@ -52,5 +52,8 @@ gint export_to_mbox	(FolderItem	*src,
 gint export_msgs_to_mbox(FolderItem	*src,
 			 GSList		*mlist,
 			 const gchar	*mbox);
+gint export_folders_to_mbox
+			(GSList		*src_list,
+			 GSList		*mbox_list);
 
 #endif /* __MBOX_H__ */
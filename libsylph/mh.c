@@ -45,15 +45,9 @@
 #include "procheader.h"
 #include "utils.h"
 #include "prefs_common.h"
+#include "slock.h"
 
-#if USE_THREADS
-G_LOCK_DEFINE_STATIC(mh);
-#define S_LOCK(name)	G_LOCK(name)
-#define S_UNLOCK(name)	G_UNLOCK(name)
-#else
-#define S_LOCK(name)
-#define S_UNLOCK(name)
-#endif
+S_LOCK_DEFINE_STATIC(mh);
 
 static void	mh_folder_init		(Folder		*folder,
 					 const gchar	*name,
@@ -136,8 +130,6 @@ static gint    mh_move_folder		(Folder		*folder,
 static gint    mh_remove_folder		(Folder		*folder,
 					 FolderItem	*item);
 
-static gchar   *mh_get_new_msg_filename		(FolderItem	*dest);
-
 static gint	mh_do_move_msgs			(Folder		*folder,
 						 FolderItem	*dest,
 						 GSList		*msglist);
@@ -395,33 +387,309 @@ static MsgInfo *mh_get_msginfo(Folder *folder, FolderItem *item, gint num)
 	return msginfo;
 }
 
-static gchar *mh_get_new_msg_filename(FolderItem *dest)
+/*
+ * Batch transactions.
+ *
+ * A batch reserves the message numbers following dest->last_num once, and
+ * places each message with link() so that an existing file is never
+ * overwritten (EEXIST just skips to the next number).  Sources which must
+ * be removed (moves) are recorded in a journal in the destination
+ * directory, which is synced before any source is unlinked.  Each entry
+ * holds the identity (device, inode and size) of the source taken before
+ * it was placed, and that of the placed destination file.  If the batch
+ * is interrupted, mh_batch_recover() removes a source only if it is a
+ * hard link to the destination, or if both files are still exactly the
+ * ones recorded, so a crash can leave a duplicated message but never
+ * lose one.
+ */
+
+#define MH_BATCH_JOURNAL	".sylpheed_mh_journal"
+#define MH_BATCH_TMP		".sylpheed_mh_tmp"
+
+typedef struct _MHBatch
 {
-	gchar *destfile;
-	gchar *destpath;
+	FolderItem *dest;
+	gchar *path;
+	gint next_num;
+	FILE *journal_fp;
+	GSList *unlink_list;
+} MHBatch;
 
-	destpath = folder_item_get_path(dest);
-	g_return_val_if_fail(destpath != NULL, NULL);
+/* st_ino is always 0 on Windows, so the files can't be identified there
+   and both copies are kept */
+#ifdef G_OS_WIN32
+#define MH_BATCH_SAME_FILE(s1, s2)		FALSE
+#define MH_BATCH_STAT_MATCH(s, dev, ino, size)	FALSE
+#else
+#define MH_BATCH_SAME_FILE(s1, s2) \
+	((s1).st_dev == (s2).st_dev && (s1).st_ino == (s2).st_ino)
+#define MH_BATCH_STAT_MATCH(s, dev, ino, size)				\
+	((guint64)(s).st_dev == g_ascii_strtoull(dev, NULL, 10) &&	\
+	 (guint64)(s).st_ino == g_ascii_strtoull(ino, NULL, 10) &&	\
+	 (guint64)(s).st_size == g_ascii_strtoull(size, NULL, 10))
+#endif
 
-	if (!is_dir_exist(destpath))
-		make_dir_hier(destpath);
+static void mh_batch_recover(const gchar *path)
+{
+	gchar *journal, *tmp;
+	FILE *fp;
+	gchar buf[BUFFSIZE];
+
+	tmp = g_strconcat(path, G_DIR_SEPARATOR_S, MH_BATCH_TMP, NULL);
+	if (is_file_entry_exist(tmp))
+		g_unlink(tmp);
+	g_free(tmp);
+
+	journal = g_strconcat(path, G_DIR_SEPARATOR_S, MH_BATCH_JOURNAL, NULL);
+	if ((fp = g_fopen(journal, "rb")) == NULL) {
+		g_free(journal);
+		return;
+	}
 
-	for (;;) {
-		destfile = g_strdup_printf("%s%c%d", destpath, G_DIR_SEPARATOR,
-					   dest->last_num + 1);
-		if (is_file_entry_exist(destfile)) {
-			dest->last_num++;
-			g_free(destfile);
+	debug_print("mh_batch_recover: replaying %s\n", journal);
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		gchar **field;
+		gchar *dest, nstr[16];
+		GStatBuf s_src, s_dest;
+		gint num;
+
+		/* ignore a line truncated by the crash */
+		if (buf[0] == '\0' || buf[strlen(buf) - 1] != '\n')
+			break;
+		strretchomp(buf);
+
+		/* num, dest dev, dest ino, src dev, src ino, size, src */
+		field = g_strsplit(buf, "\t", 7);
+		if (g_strv_length(field) != 7 ||
+		    (num = to_number(field[0])) <= 0) {
+			g_strfreev(field);
+			continue;
+		}
+
+		dest = g_strconcat(path, G_DIR_SEPARATOR_S,
+				   utos_buf(nstr, num), NULL);
+		if (g_stat(dest, &s_dest) == 0 &&
+		    g_stat(field[6], &s_src) == 0 &&
+		    (MH_BATCH_SAME_FILE(s_dest, s_src) ||
+		     (MH_BATCH_STAT_MATCH(s_dest, field[1], field[2],
+					  field[5]) &&
+		      MH_BATCH_STAT_MATCH(s_src, field[3], field[4],
+					  field[5])))) {
+			debug_print("mh_batch_recover: removing %s\n",
+				    field[6]);
+			if (g_unlink(field[6]) < 0)
+				FILE_OP_ERROR(field[6], "unlink");
 		} else
+			debug_print("mh_batch_recover: keeping %s\n",
+				    field[6]);
+		g_free(dest);
+		g_strfreev(field);
+	}
+
+	fclose(fp);
+	if (g_unlink(journal) < 0)
+		FILE_OP_ERROR(journal, "unlink");
+	g_free(journal);
+}
+
+/* must be called without holding the mh lock */
+static MHBatch *mh_batch_begin(Folder *folder, FolderItem *dest)
+{
+	MHBatch *batch;
+	gchar *path, *file, nstr[16];
+
+	if (dest->last_num < 0) {
+		mh_scan_folder(folder, dest);
+		if (dest->last_num < 0) return NULL;
+	}
+
+	path = folder_item_get_path(dest);
+	g_return_val_if_fail(path != NULL, NULL);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+
+	/* reserve the range after last_num. If the first number is already
+	   taken, last_num is stale and the directory is scanned once. */
+	file = g_strconcat(path, G_DIR_SEPARATOR_S,
+			   utos_buf(nstr, dest->last_num + 1), NULL);
+	if (is_file_entry_exist(file))
+		mh_scan_folder_full(folder, dest, FALSE);
+	else
+		mh_batch_recover(path);
+	g_free(file);
+
+	batch = g_new0(MHBatch, 1);
+	batch->dest = dest;
+	batch->path = path;
+	batch->next_num = dest->last_num + 1;
+
+	return batch;
+}
+
+static gint mh_batch_copy_to_tmp(MHBatch *batch, const gchar *file,
+				 gchar **tmp)
+{
+	*tmp = g_strconcat(batch->path, G_DIR_SEPARATOR_S, MH_BATCH_TMP,
+			   NULL);
+	if (copy_file(file, *tmp, FALSE) < 0) {
+		g_free(*tmp);
+		*tmp = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Place FILE into the destination under the next free number and return
+   that number, or -1 on error. If MOVE is TRUE, FILE is removed on
+   mh_batch_commit(). If COPY is TRUE, the destination never shares the
+   inode of FILE. */
+static gint mh_batch_add_file(MHBatch *batch, const gchar *file,
+			      gboolean move, gboolean copy, gchar **destfile)
+{
+	gchar *tmp = NULL;
+	gchar *dest;
+	gchar nstr[16];
+	GStatBuf s_src, s_dest;
+	gboolean has_id = FALSE;
+	gint num;
+
+	/* the identity of the source is taken before it is copied */
+	if (move && g_stat(file, &s_src) == 0)
+		has_id = TRUE;
+
+	if (copy && mh_batch_copy_to_tmp(batch, file, &tmp) < 0) {
+		g_warning(_("can't copy message %s to %s\n"), file,
+			  batch->path);
+		return -1;
+	}
+
+	for (;;) {
+		num = batch->next_num;
+		dest = g_strconcat(batch->path, G_DIR_SEPARATOR_S,
+				   utos_buf(nstr, num), NULL);
+
+		if (syl_link(tmp ? tmp : file, dest) == 0)
 			break;
+		if (errno == EEXIST) {
+			batch->next_num++;
+			g_free(dest);
+			continue;
+		}
+
+		/* hard links are not available: copy through a temporary
+		   file and rename it into place */
+		if (!tmp && mh_batch_copy_to_tmp(batch, file, &tmp) < 0) {
+			g_warning(_("can't copy message %s to %s\n"),
+				  file, dest);
+			g_free(dest);
+			return -1;
+		}
+		if (is_file_entry_exist(dest)) {
+			batch->next_num++;
+			g_free(dest);
+			continue;
+		}
+		if (g_rename(tmp, dest) < 0) {
+			FILE_OP_ERROR(tmp, "rename");
+			g_unlink(tmp);
+			g_free(tmp);
+			g_free(dest);
+			return -1;
+		}
+		g_free(tmp);
+		tmp = NULL;
+		break;
+	}
+
+	if (tmp) {
+		g_unlink(tmp);
+		g_free(tmp);
 	}
 
-	g_free(destpath);
+	if (move) {
+		if (!batch->journal_fp) {
+			gchar *journal;
+
+			journal = g_strconcat(batch->path, G_DIR_SEPARATOR_S,
+					      MH_BATCH_JOURNAL, NULL);
+			if ((batch->journal_fp = g_fopen(journal, "wb")) == NULL)
+				FILE_OP_ERROR(journal, "fopen");
+			g_free(journal);
+		}
+		if (has_id && g_stat(dest, &s_dest) < 0) {
+			FILE_OP_ERROR(dest, "stat");
+			has_id = FALSE;
+		}
+		if (batch->journal_fp && has_id)
+			fprintf(batch->journal_fp,
+				"%d\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT
+				"\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT
+				"\t%" G_GUINT64_FORMAT "\t%s\n", num,
+				(guint64)s_dest.st_dev, (guint64)s_dest.st_ino,
+				(guint64)s_src.st_dev, (guint64)s_src.st_ino,
+				(guint64)s_src.st_size, file);
+		batch->unlink_list = g_slist_prepend(batch->unlink_list,
+						     g_strdup(file));
+	}
 
-	return destfile;
+	batch->next_num = num + 1;
+	if (destfile)
+		*destfile = dest;
+	else
+		g_free(dest);
+
+	return num;
+}
+
+/* Sync the journal, remove the moved sources and, if FLUSH_QUEUE is TRUE,
+   append the queued mark and cache entries of the destination at once. */
+static void mh_batch_commit(MHBatch *batch, gboolean flush_queue)
+{
+	FolderItem *dest = batch->dest;
+	GSList *cur;
+
+	if (batch->journal_fp) {
+		if (fflush(batch->journal_fp) == EOF)
+			perror("fflush");
+#if HAVE_FSYNC
+		if (fsync(fileno(batch->journal_fp)) < 0)
+			perror("fsync");
+#endif
+	}
+
+	batch->unlink_list = g_slist_reverse(batch->unlink_list);
+	for (cur = batch->unlink_list; cur != NULL; cur = cur->next) {
+		if (g_unlink((gchar *)cur->data) < 0)
+			FILE_OP_ERROR((gchar *)cur->data, "unlink");
+		g_free(cur->data);
+	}
+	g_slist_free(batch->unlink_list);
+	batch->unlink_list = NULL;
+
+	if (flush_queue && !dest->opened) {
+		procmsg_flush_mark_queue(dest, NULL);
+		procmsg_flush_cache_queue(dest, NULL);
+	}
+
+	if (batch->journal_fp) {
+		gchar *journal;
+
+		fclose(batch->journal_fp);
+		batch->journal_fp = NULL;
+		journal = g_strconcat(batch->path, G_DIR_SEPARATOR_S,
+				      MH_BATCH_JOURNAL, NULL);
+		if (g_unlink(journal) < 0)
+			FILE_OP_ERROR(journal, "unlink");
+		g_free(journal);
+	}
+
+	g_free(batch->path);
+	g_free(batch);
 }
 
-#define SET_DEST_MSG_FLAGS(fp, dest, n, fl)				\
+#define SET_DEST_MSG_FLAGS(queue, dest, n, fl)				\
 {									\
 	MsgInfo newmsginfo;						\
 									\
@@ -436,10 +704,10 @@ static gchar *mh_get_new_msg_filename(FolderItem *dest)
 		MSG_UNSET_PERM_FLAGS(newmsginfo.flags, MSG_DELETED);	\
 	}								\
 									\
-	if (fp)								\
-		procmsg_write_flags(&newmsginfo, fp);			\
-	else 								\
+	if (queue)							\
 		procmsg_add_mark_queue(dest, n, newmsginfo.flags);	\
+	else								\
+		procmsg_add_flags(dest, n, newmsginfo.flags);		\
 }
 
 static gint mh_add_msg(Folder *folder, FolderItem *dest, const gchar *file,
@@ -461,28 +729,22 @@ static gint mh_add_msg(Folder *folder, FolderItem *dest, const gchar *file,
 static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			gboolean remove_source, gint *first)
 {
+	MHBatch *batch;
 	gchar *destfile;
 	GSList *cur;
 	MsgFileInfo *fileinfo;
 	MsgInfo *msginfo;
 	gint first_ = 0;
-	FILE *fp = NULL;
+	gint num;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(file_list != NULL, -1);
 
-	if (dest->last_num < 0) {
-		mh_scan_folder(folder, dest);
-		if (dest->last_num < 0) return -1;
-	}
+	if ((batch = mh_batch_begin(folder, dest)) == NULL)
+		return -1;
 
 	S_LOCK(mh);
 
-	if (!dest->opened) {
-		if ((fp = procmsg_open_mark_file(dest, DATA_APPEND)) == NULL)
-			g_warning("mh_add_msgs: can't open mark file.");
-	}
-
 	for (cur = file_list; cur != NULL; cur = cur->next) {
 		MsgFlags flags = {MSG_NEW|MSG_UNREAD, 0};
 
@@ -491,35 +753,27 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			flags = *fileinfo->flags;
 		msginfo = procheader_parse_file(fileinfo->file, flags, 0);
 		if (!msginfo) {
-			if (fp) fclose(fp);
+			mh_batch_commit(batch, FALSE);
 			S_UNLOCK(mh);
 			return -1;
 		}
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (destfile == NULL) {
+		num = mh_batch_add_file(batch, fileinfo->file, remove_source,
+					FALSE, &destfile);
+		if (num < 0) {
+			procmsg_msginfo_free(msginfo);
+			mh_batch_commit(batch, FALSE);
 			S_UNLOCK(mh);
 			return -1;
 		}
-		if (first_ == 0 || first_ > dest->last_num + 1)
-			first_ = dest->last_num + 1;
-
-		if (syl_link(fileinfo->file, destfile) < 0) {
-			if (copy_file(fileinfo->file, destfile, TRUE) < 0) {
-				g_warning(_("can't copy message %s to %s\n"),
-					  fileinfo->file, destfile);
-				g_free(destfile);
-				if (fp) fclose(fp);
-				S_UNLOCK(mh);
-				return -1;
-			}
-		}
+		if (first_ == 0 || first_ > num)
+			first_ = num;
 
 		if (syl_app_get())
-			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
+			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, num);
 
 		g_free(destfile);
-		dest->last_num++;
+		dest->last_num = num;
 		dest->total++;
 		dest->updated = TRUE;
 		dest->mtime = 0;
@@ -532,7 +786,7 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			dest->unmarked_num++;
 			procmsg_add_mark_queue(dest, dest->last_num, flags);
 		} else {
-			SET_DEST_MSG_FLAGS(fp, dest, dest->last_num, flags);
+			SET_DEST_MSG_FLAGS(FALSE, dest, dest->last_num, flags);
 		}
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 		if (MSG_IS_NEW(flags))
@@ -541,19 +795,10 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			dest->unread++;
 	}
 
-	if (fp)
-		fclose(fp);
-
 	if (first)
 		*first = first_;
 
-	if (remove_source) {
-		for (cur = file_list; cur != NULL; cur = cur->next) {
-			fileinfo = (MsgFileInfo *)cur->data;
-			if (g_unlink(fileinfo->file) < 0)
-				FILE_OP_ERROR(fileinfo->file, "unlink");
-		}
-	}
+	mh_batch_commit(batch, FALSE);
 
 	S_UNLOCK(mh);
 	return dest->last_num;
@@ -577,64 +822,49 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 				GSList *msglist, gboolean remove_source,
 				gint *first)
 {
+	MHBatch *batch;
 	GSList *cur;
 	MsgInfo *msginfo;
 	gchar *srcfile;
 	gchar *destfile;
 	gint first_ = 0;
-	FILE *fp = NULL;
+	gint num;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(msglist != NULL, -1);
 
-	if (dest->last_num < 0) {
-		mh_scan_folder(folder, dest);
-		if (dest->last_num < 0) return -1;
-	}
+	if ((batch = mh_batch_begin(folder, dest)) == NULL)
+		return -1;
 
 	S_LOCK(mh);
 
-	if (!dest->opened) {
-		if ((fp = procmsg_open_mark_file(dest, DATA_APPEND)) == NULL)
-			g_warning("mh_add_msgs_msginfo: can't open mark file.");
-	}
-
 	for (cur = msglist; cur != NULL; cur = cur->next) {
 		msginfo = (MsgInfo *)cur->data;
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (!destfile) {
-			if (fp) fclose(fp);
-			S_UNLOCK(mh);
-			return -1;
-		}
-		if (first_ == 0 || first_ > dest->last_num + 1)
-			first_ = dest->last_num + 1;
-
 		srcfile = procmsg_get_message_file(msginfo);
 		if (!srcfile) {
-			if (fp) fclose(fp);
-			g_free(destfile);
+			mh_batch_commit(batch, FALSE);
 			S_UNLOCK(mh);
 			return -1;
 		}
-		if (syl_link(srcfile, destfile) < 0) {
-			if (copy_file(srcfile, destfile, TRUE) < 0) {
-				g_warning("mh_add_msgs_msginfo: can't copy message %s to %s", srcfile, destfile);
-				g_free(srcfile);
-				g_free(destfile);
-				if (fp) fclose(fp);
-				S_UNLOCK(mh);
-				return -1;
-			}
+		num = mh_batch_add_file(batch, srcfile, remove_source, FALSE,
+					&destfile);
+		if (num < 0) {
+			g_warning("mh_add_msgs_msginfo: can't copy message %s to %s", srcfile, batch->path);
+			g_free(srcfile);
+			mh_batch_commit(batch, FALSE);
+			S_UNLOCK(mh);
+			return -1;
 		}
+		if (first_ == 0 || first_ > num)
+			first_ = num;
 
 		if (syl_app_get())
-			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
+			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, num);
 
 		g_free(srcfile);
 		g_free(destfile);
-		dest->last_num++;
+		dest->last_num = num;
 		dest->total++;
 		dest->updated = TRUE;
 		dest->mtime = 0;
@@ -648,7 +878,7 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 			procmsg_add_mark_queue(dest, dest->last_num,
 					       msginfo->flags);
 		} else {
-			SET_DEST_MSG_FLAGS(fp, dest, dest->last_num,
+			SET_DEST_MSG_FLAGS(FALSE, dest, dest->last_num,
 					   msginfo->flags);
 		}
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
@@ -658,21 +888,10 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 			dest->unread++;
 	}
 
-	if (fp)
-		fclose(fp);
-
 	if (first)
 		*first = first_;
 
-	if (remove_source) {
-		for (cur = msglist; cur != NULL; cur = cur->next) {
-			msginfo = (MsgInfo *)cur->data;
-			srcfile = procmsg_get_message_file(msginfo);
-			if (g_unlink(srcfile) < 0)
-				FILE_OP_ERROR(srcfile, "unlink");
-			g_free(srcfile);
-		}
-	}
+	mh_batch_commit(batch, FALSE);
 
 	S_UNLOCK(mh);
 	return dest->last_num;
@@ -681,19 +900,19 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 
 static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 {
+	MHBatch *batch;
 	FolderItem *src;
 	gchar *srcfile;
 	gchar *destfile;
 	GSList *cur;
 	MsgInfo *msginfo;
+	gint num;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(msglist != NULL, -1);
 
-	if (dest->last_num < 0) {
-		mh_scan_folder(folder, dest);
-		if (dest->last_num < 0) return -1;
-	}
+	if ((batch = mh_batch_begin(folder, dest)) == NULL)
+		return -1;
 
 	S_LOCK(mh);
 
@@ -708,20 +927,20 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		debug_print("Moving message %s/%d to %s ...\n",
 			    src->path, msginfo->msgnum, dest->path);
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (!destfile) break;
 		srcfile = procmsg_get_message_file(msginfo);
+		if (!srcfile) break;
 
 		/* g_signal_emit_by_name(syl_app_get(), "remove-msg", src, srcfile, msginfo->msgnum); */
 
-		if (move_file(srcfile, destfile, FALSE) < 0) {
+		num = mh_batch_add_file(batch, srcfile, TRUE, FALSE,
+					&destfile);
+		if (num < 0) {
 			g_free(srcfile);
-			g_free(destfile);
 			break;
 		}
 
 		if (syl_app_get()) {
-			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
+			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, num);
 			g_signal_emit_by_name(syl_app_get(), "remove-msg", src, srcfile, msginfo->msgnum);
 		}
 
@@ -730,12 +949,12 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		src->total--;
 		src->updated = TRUE;
 		src->mtime = 0;
-		dest->last_num++;
+		dest->last_num = num;
 		dest->total++;
 		dest->updated = TRUE;
 		dest->mtime = 0;
 
-		SET_DEST_MSG_FLAGS(NULL, dest, dest->last_num, msginfo->flags);
+		SET_DEST_MSG_FLAGS(TRUE, dest, dest->last_num, msginfo->flags);
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 
 		if (MSG_IS_NEW(msginfo->flags)) {
@@ -750,10 +969,7 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		MSG_SET_TMP_FLAGS(msginfo->flags, MSG_INVALID);
 	}
 
-	if (!dest->opened) {
-		procmsg_flush_mark_queue(dest, NULL);
-		procmsg_flush_cache_queue(dest, NULL);
-	}
+	mh_batch_commit(batch, TRUE);
 
 	S_UNLOCK(mh);
 	return dest->last_num;
@@ -803,18 +1019,18 @@ static gint mh_copy_msg(Folder *folder, FolderItem *dest, MsgInfo *msginfo)
 
 static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 {
+	MHBatch *batch;
 	gchar *srcfile;
 	gchar *destfile;
 	GSList *cur;
 	MsgInfo *msginfo;
+	gint num;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(msglist != NULL, -1);
 
-	if (dest->last_num < 0) {
-		mh_scan_folder(folder, dest);
-		if (dest->last_num < 0) return -1;
-	}
+	if ((batch = mh_batch_begin(folder, dest)) == NULL)
+		return -1;
 
 	S_LOCK(mh);
 
@@ -828,28 +1044,28 @@ static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		debug_print(_("Copying message %s/%d to %s ...\n"),
 			    msginfo->folder->path, msginfo->msgnum, dest->path);
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (!destfile) break;
 		srcfile = procmsg_get_message_file(msginfo);
+		if (!srcfile) break;
 
-		if (copy_file(srcfile, destfile, TRUE) < 0) {
+		num = mh_batch_add_file(batch, srcfile, FALSE, TRUE,
+					&destfile);
+		if (num < 0) {
 			FILE_OP_ERROR(srcfile, "copy");
 			g_free(srcfile);
-			g_free(destfile);
 			break;
 		}
 
 		if (syl_app_get())
-			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
+			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, num);
 
 		g_free(srcfile);
 		g_free(destfile);
-		dest->last_num++;
+		dest->last_num = num;
 		dest->total++;
 		dest->updated = TRUE;
 		dest->mtime = 0;
 
-		SET_DEST_MSG_FLAGS(NULL, dest, dest->last_num, msginfo->flags);
+		SET_DEST_MSG_FLAGS(TRUE, dest, dest->last_num, msginfo->flags);
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 
 		if (MSG_IS_NEW(msginfo->flags))
@@ -858,10 +1074,7 @@ static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 			dest->unread++;
 	}
 
-	if (!dest->opened) {
-		procmsg_flush_mark_queue(dest, NULL);
-		procmsg_flush_cache_queue(dest, NULL);
-	}
+	mh_batch_commit(batch, TRUE);
 
 	S_UNLOCK(mh);
 	return dest->last_num;
@@ -920,7 +1133,11 @@ static gint mh_remove_all_msg(Folder *folder, FolderItem *item)
 
 	S_LOCK(mh);
 
-	val = remove_all_numbered_files(path);
+	/* numbered subfolders must be kept in place */
+	if (item->node && item->node->children)
+		val = remove_all_numbered_files(path);
+	else
+		val = remove_all_numbered_files_async(path);
 	g_free(path);
 	if (val == 0) {
 		item->new = item->unread = item->total = 0;
@@ -1069,6 +1286,7 @@ static gint mh_scan_folder_full(Folder *folder, FolderItem *item,
 		S_UNLOCK(mh);
 		return -1;
 	}
+	mh_batch_recover(path);
 	g_free(path);
 
 #ifdef G_OS_WIN32
@@ -1309,6 +1527,9 @@ static gint mh_move_folder_real(Folder *folder, FolderItem *item,
 
 	S_LOCK(mh);
 
+	/* close the cached mark files before renaming the directory */
+	procmsg_sync_mark_files();
+
 	oldpath = folder_item_get_path(item);
 	if (new_parent) {
 		if (name) {
@@ -1439,6 +1660,8 @@ static gint mh_remove_folder(Folder *folder, FolderItem *item)
 
 	S_LOCK(mh);
 
+	procmsg_sync_mark_files();
+
 	path = folder_item_get_path(item);
 	if (remove_dir_recursive(path) < 0) {
 		g_warning("can't remove directory `%s'\n", path);
@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
 
 #include "news.h"
@@ -42,6 +43,7 @@
 #include "session.h"
 #include "codeconv.h"
 #include "utils.h"
+#include "slock.h"
 #include "prefs_common.h"
 #include "prefs_account.h"
 #if USE_SSL
@@ -54,6 +56,9 @@
 #define NNTPS_PORT	563
 #endif
 
+/* number of articles retrieved by one XOVER */
+#define NEWS_OVERVIEW_CHUNK	5000
+
 static void news_folder_init		 (Folder	*folder,
 					  const gchar	*name,
 					  const gchar	*path);
@@ -113,16 +118,35 @@ static gint news_select_group		 (NNTPSession	*session,
 					  gint		*last);
 static GSList *news_get_uncached_articles(NNTPSession	*session,
 					  FolderItem	*item,
+					  gboolean	 use_cache,
 					  gint		 cache_last,
 					  gint		*rfirst,
 					  gint		*rlast);
+static gint news_get_overview		 (NNTPSession	*session,
+					  FolderItem	*item,
+					  gint		 begin,
+					  gint		 end,
+					  GSList	**newlist);
+static void news_append_cache		 (FolderItem	*item,
+					  GSList	*mlist);
 static MsgInfo *news_parse_xover	 (const gchar	*xover_str);
+static gchar *news_parse_xover_field	 (const gchar	*xover_str,
+					  gint		 field,
+					  const gchar	*header);
 static gchar *news_parse_xhdr		 (const gchar	*xhdr_str,
-					  MsgInfo	*msginfo);
+					  gint		*num);
 static GSList *news_delete_old_articles	 (GSList	*alist,
 					  FolderItem	*item,
 					  gint		 first);
 static void news_delete_all_articles	 (FolderItem	*item);
+static void news_access_index_touch	 (const gchar	*dir,
+					  gint		 num);
+#if USE_THREADS
+static void news_prefetch_articles	 (Folder	*folder,
+					  FolderItem	*item,
+					  GSList	*newlist);
+static void news_prefetch_free		 (Folder	*folder);
+#endif
 static void news_delete_expired_caches	 (GSList	*alist,
 					  FolderItem	*item);
 
@@ -179,6 +203,10 @@ static Folder *news_folder_new(const gchar *name, const gchar *path)
 
 static void news_folder_destroy(Folder *folder)
 {
+#if USE_THREADS
+	news_prefetch_free(folder);
+#endif
+
 	if (REMOTE_FOLDER(folder)->remove_cache_on_destroy) {
 		gchar *dir;
 		gchar *server;
@@ -340,7 +368,7 @@ static GSList *news_get_article_list(Folder *folder, FolderItem *item,
 
 		cache_last = procmsg_get_last_num_in_msg_list(alist);
 		newlist = news_get_uncached_articles
-			(session, item, cache_last, &first, &last);
+			(session, item, TRUE, cache_last, &first, &last);
 		if (newlist)
 			item->cache_dirty = TRUE;
 		if (first == 0 && last == 0) {
@@ -353,6 +381,9 @@ static GSList *news_get_article_list(Folder *folder, FolderItem *item,
 			news_delete_expired_caches(alist, item);
 		}
 
+#if USE_THREADS
+		news_prefetch_articles(folder, item, newlist);
+#endif
 		alist = g_slist_concat(alist, newlist);
 
 		item->last_num = last;
@@ -360,7 +391,7 @@ static GSList *news_get_article_list(Folder *folder, FolderItem *item,
 		gint last;
 
 		alist = news_get_uncached_articles
-			(session, item, 0, NULL, &last);
+			(session, item, FALSE, 0, NULL, &last);
 		news_delete_all_articles(item);
 		item->last_num = last;
 		item->cache_dirty = TRUE;
@@ -401,15 +432,17 @@ static gchar *news_fetch_msg(Folder *folder, FolderItem *item, gint num)
 		make_dir_hier(path);
 	filename = g_strconcat(path, G_DIR_SEPARATOR_S, utos_buf(nstr, num),
 			       NULL);
-	g_free(path);
 
 	if (is_file_exist(filename) && get_file_size(filename) > 0) {
 		debug_print(_("article %d has been already cached.\n"), num);
+		news_access_index_touch(path, num);
+		g_free(path);
 		return filename;
 	}
 
 	session = news_session_get(folder);
 	if (!session) {
+		g_free(path);
 		g_free(filename);
 		return NULL;
 	}
@@ -420,6 +453,7 @@ static gchar *news_fetch_msg(Folder *folder, FolderItem *item, gint num)
 			session_destroy(SESSION(session));
 			REMOTE_FOLDER(folder)->session = NULL;
 		}
+		g_free(path);
 		g_free(filename);
 		return NULL;
 	}
@@ -433,10 +467,14 @@ static gchar *news_fetch_msg(Folder *folder, FolderItem *item, gint num)
 			session_destroy(SESSION(session));
 			REMOTE_FOLDER(folder)->session = NULL;
 		}
+		g_free(path);
 		g_free(filename);
 		return NULL;
 	}
 
+	news_access_index_touch(path, num);
+	g_free(path);
+
 	return filename;
 }
 
@@ -530,6 +568,7 @@ static NewsGroupInfo *news_group_info_new(const gchar *name,
 	ginfo->last = last;
 	ginfo->type = type;
 	ginfo->subscribed = FALSE;
+	ginfo->has_children = FALSE;
 
 	return ginfo;
 }
@@ -540,63 +579,82 @@ static void news_group_info_free(NewsGroupInfo *ginfo)
 	g_free(ginfo);
 }
 
-static gint news_group_info_compare(NewsGroupInfo *ginfo1,
+/* the index is sorted with strcmp() so that the descendants of a
+   hierarchy are contiguous, but the lists returned to the caller are
+   sorted case-insensitively as before */
+static gint news_group_info_compare(gconstpointer a, gconstpointer b)
+{
+	const NewsGroupInfo *ginfo1 = *(const NewsGroupInfo **)a;
+	const NewsGroupInfo *ginfo2 = *(const NewsGroupInfo **)b;
+
+	return strcmp(ginfo1->name, ginfo2->name);
+}
+
+static gint news_group_info_casecmp(NewsGroupInfo *ginfo1,
 				    NewsGroupInfo *ginfo2)
 {
 	return g_ascii_strcasecmp(ginfo1->name, ginfo2->name);
 }
 
-GSList *news_get_group_list(Folder *folder)
+/*
+ * Newsgroup index:
+ *
+ *   guint32 version
+ *   guint32 number of groups
+ *   guint32 time of the last LIST or NEWGROUPS (UTC)
+ *   NewsGroupIndexEntry entries[number of groups] (sorted by name)
+ *   NUL-terminated group names
+ */
+
+#define NEWSGROUP_INDEX_HEADER_SIZE	(sizeof(guint32) * 3)
+/* NEWGROUPS is issued with this margin for the clock skew */
+#define NEWSGROUP_SYNC_MARGIN		(60 * 60 * 24)
+
+typedef struct _NewsGroupIndexEntry
 {
-	gchar *path, *filename;
-	FILE *fp;
-	GSList *list = NULL;
-	GSList *last = NULL;
-	gchar buf[NNTPBUFSIZE];
+	guint32 name;
+	guint32 first;
+	guint32 last;
+	guint32 type;
+} NewsGroupIndexEntry;
 
-	g_return_val_if_fail(folder != NULL, NULL);
-	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, NULL);
+typedef struct _NewsGroupIndex
+{
+	GMappedFile *map;
+	guint32 count;
+	stime_t sync_time;
+	const NewsGroupIndexEntry *entries;
+	const gchar *names;
+	gsize names_len;
+} NewsGroupIndex;
+
+static gchar *news_get_group_list_file(Folder *folder, const gchar *name)
+{
+	gchar *path, *filename;
 
 	path = folder_item_get_path(FOLDER_ITEM(folder->node->data));
 	if (!is_dir_exist(path))
 		make_dir_hier(path);
-	filename = g_strconcat(path, G_DIR_SEPARATOR_S, NEWSGROUP_LIST, NULL);
+	filename = g_strconcat(path, G_DIR_SEPARATOR_S, name, NULL);
 	g_free(path);
 
-	if ((fp = g_fopen(filename, "rb")) == NULL) {
-		NNTPSession *session;
-		gint ok;
-
-		session = news_session_get(folder);
-		if (!session) {
-			g_free(filename);
-			return NULL;
-		}
+	return filename;
+}
 
-		ok = nntp_list(session);
-		if (ok != NN_SUCCESS) {
-			if (ok == NN_SOCKET) {
-				session_destroy(SESSION(session));
-				REMOTE_FOLDER(folder)->session = NULL;
-			}
-			g_free(filename);
-			return NULL;
-		}
-		if (recv_write_to_file(SESSION(session)->sock, filename) < 0) {
-			log_warning("can't retrieve newsgroup list\n");
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(folder)->session = NULL;
-			g_free(filename);
-			return NULL;
-		}
+/* parse the response of LIST or NEWGROUPS */
+static GPtrArray *news_read_group_list_file(const gchar *file)
+{
+	GPtrArray *array;
+	FILE *fp;
+	gchar buf[NNTPBUFSIZE];
 
-		if ((fp = g_fopen(filename, "rb")) == NULL) {
-			FILE_OP_ERROR(filename, "fopen");
-			g_free(filename);
-			return NULL;
-		}
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return NULL;
 	}
 
+	array = g_ptr_array_new();
+
 	while (fgets(buf, sizeof(buf), fp) != NULL) {
 		gchar *p = buf;
 		gchar *name;
@@ -622,235 +680,710 @@ GSList *news_get_group_list(Folder *folder)
 		}
 
 		ginfo = news_group_info_new(name, first_num, last_num, type);
-
-		if (!last)
-			last = list = g_slist_append(NULL, ginfo);
-		else {
-			last = g_slist_append(last, ginfo);
-			last = last->next;
-		}
+		g_ptr_array_add(array, ginfo);
 	}
 
 	fclose(fp);
-	g_free(filename);
-
-	list = g_slist_sort(list, (GCompareFunc)news_group_info_compare);
 
-	return list;
+	return array;
 }
 
-void news_group_list_free(GSList *group_list)
+static void news_group_info_array_free(GPtrArray *array)
 {
-	GSList *cur;
+	guint i;
 
-	if (!group_list) return;
-
-	for (cur = group_list; cur != NULL; cur = cur->next)
-		news_group_info_free((NewsGroupInfo *)cur->data);
-	g_slist_free(group_list);
+	for (i = 0; i < array->len; i++)
+		news_group_info_free(g_ptr_array_index(array, i));
+	g_ptr_array_free(array, TRUE);
 }
 
-void news_remove_group_list_cache(Folder *folder)
+/* sort the groups, drop the duplicates (the later one wins) and write
+   the index */
+static gint news_write_group_index(const gchar *file, GPtrArray *array,
+				   stime_t sync_time)
 {
-	gchar *path, *filename;
+	GPtrArray *sorted;
+	NewsGroupIndexEntry entry;
+	NewsGroupInfo *ginfo;
+	gchar *tmp;
+	FILE *fp;
+	guint32 data;
+	guint32 offset = 0;
+	guint i;
+
+	/* g_ptr_array_sort() is not stable, so resolve the duplicates
+	   in a hash table first */
+	{
+		GHashTable *table;
+
+		table = g_hash_table_new(g_str_hash, g_str_equal);
+		for (i = 0; i < array->len; i++) {
+			ginfo = g_ptr_array_index(array, i);
+			g_hash_table_insert(table, ginfo->name, ginfo);
+		}
+		sorted = g_ptr_array_new();
+		for (i = 0; i < array->len; i++) {
+			ginfo = g_ptr_array_index(array, i);
+			if (g_hash_table_lookup(table, ginfo->name) == ginfo)
+				g_ptr_array_add(sorted, ginfo);
+		}
+		g_hash_table_destroy(table);
+	}
+	g_ptr_array_sort(sorted, news_group_info_compare);
 
-	g_return_if_fail(folder != NULL);
-	g_return_if_fail(FOLDER_TYPE(folder) == F_NEWS);
+	tmp = g_strconcat(file, ".tmp", NULL);
+	if ((fp = g_fopen(tmp, "wb")) == NULL) {
+		FILE_OP_ERROR(tmp, "fopen");
+		g_ptr_array_free(sorted, TRUE);
+		g_free(tmp);
+		return -1;
+	}
 
-	path = folder_item_get_path(FOLDER_ITEM(folder->node->data));
-	filename = g_strconcat(path, G_DIR_SEPARATOR_S, NEWSGROUP_LIST, NULL);
-	g_free(path);
+	data = NEWSGROUP_INDEX_VERSION;
+	fwrite(&data, sizeof(data), 1, fp);
+	data = sorted->len;
+	fwrite(&data, sizeof(data), 1, fp);
+	data = (guint32)sync_time;
+	fwrite(&data, sizeof(data), 1, fp);
+
+	for (i = 0; i < sorted->len; i++) {
+		ginfo = g_ptr_array_index(sorted, i);
+		entry.name = offset;
+		entry.first = ginfo->first;
+		entry.last = ginfo->last;
+		entry.type = (guchar)ginfo->type;
+		fwrite(&entry, sizeof(entry), 1, fp);
+		offset += strlen(ginfo->name) + 1;
+	}
+	for (i = 0; i < sorted->len; i++) {
+		ginfo = g_ptr_array_index(sorted, i);
+		fwrite(ginfo->name, strlen(ginfo->name) + 1, 1, fp);
+	}
 
-	if (is_file_exist(filename)) {
-		if (remove(filename) < 0)
-			FILE_OP_ERROR(filename, "remove");
+	g_ptr_array_free(sorted, TRUE);
+
+	if (ferror(fp)) {
+		FILE_OP_ERROR(tmp, "fwrite");
+		fclose(fp);
+		g_unlink(tmp);
+		g_free(tmp);
+		return -1;
 	}
-	g_free(filename);
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(tmp, "fclose");
+		g_unlink(tmp);
+		g_free(tmp);
+		return -1;
+	}
+	if (rename_force(tmp, file) < 0) {
+		FILE_OP_ERROR(file, "rename");
+		g_unlink(tmp);
+		g_free(tmp);
+		return -1;
+	}
+
+	g_free(tmp);
+	return 0;
 }
 
-gint news_post(Folder *folder, const gchar *file)
+static void news_group_index_close(NewsGroupIndex *gindex)
 {
-	FILE *fp;
-	gint ok;
+	if (!gindex)
+		return;
+	g_mapped_file_free(gindex->map);
+	g_free(gindex);
+}
 
-	g_return_val_if_fail(folder != NULL, -1);
-	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, -1);
-	g_return_val_if_fail(file != NULL, -1);
+static NewsGroupIndex *news_group_index_open(Folder *folder)
+{
+	NewsGroupIndex *gindex;
+	GMappedFile *map;
+	gchar *filename;
+	const gchar *data;
+	gsize len;
+	guint32 header[3];
+
+	filename = news_get_group_list_file(folder, NEWSGROUP_INDEX);
+	if (!is_file_exist(filename)) {
+		g_free(filename);
+		return NULL;
+	}
 
-	if ((fp = g_fopen(file, "rb")) == NULL) {
-		FILE_OP_ERROR(file, "fopen");
-		return -1;
+	map = g_mapped_file_new(filename, FALSE, NULL);
+	if (!map) {
+		FILE_OP_ERROR(filename, "g_mapped_file_new");
+		g_free(filename);
+		return NULL;
 	}
 
-	ok = news_post_stream(folder, fp);
+	data = g_mapped_file_get_contents(map);
+	len = g_mapped_file_get_length(map);
+	if (len < NEWSGROUP_INDEX_HEADER_SIZE) {
+		g_warning("%s: newsgroup index is truncated\n", filename);
+		g_mapped_file_free(map);
+		g_free(filename);
+		return NULL;
+	}
 
-	fclose(fp);
+	memcpy(header, data, sizeof(header));
+	if (header[0] != NEWSGROUP_INDEX_VERSION ||
+	    header[1] > (len - NEWSGROUP_INDEX_HEADER_SIZE) /
+	    sizeof(NewsGroupIndexEntry) ||
+	    (header[1] > 0 && data[len - 1] != '\0')) {
+		debug_print("%s: newsgroup index is invalid\n", filename);
+		g_mapped_file_free(map);
+		g_free(filename);
+		return NULL;
+	}
 
-	return ok;
+	gindex = g_new0(NewsGroupIndex, 1);
+	gindex->map = map;
+	gindex->count = header[1];
+	gindex->sync_time = header[2];
+	gindex->entries = (const NewsGroupIndexEntry *)
+		(data + NEWSGROUP_INDEX_HEADER_SIZE);
+	gindex->names = (const gchar *)(gindex->entries + gindex->count);
+	gindex->names_len = data + len - gindex->names;
+
+	g_free(filename);
+	return gindex;
 }
 
-gint news_post_stream(Folder *folder, FILE *fp)
+static const gchar *news_group_index_get_name(NewsGroupIndex *gindex,
+					      guint32 i)
 {
-	NNTPSession *session;
-	gint ok;
-
-	g_return_val_if_fail(folder != NULL, -1);
-	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, -1);
-	g_return_val_if_fail(fp != NULL, -1);
+	guint32 offset = gindex->entries[i].name;
 
-	session = news_session_get(folder);
-	if (!session) return -1;
+	if (offset >= gindex->names_len)
+		return "";
+	return gindex->names + offset;
+}
 
-	ok = nntp_post(session, fp);
-	if (ok != NN_SUCCESS) {
-		log_warning(_("can't post article.\n"));
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(folder)->session = NULL;
-		}
-		return -1;
-	}
+static NewsGroupInfo *news_group_index_get_info(NewsGroupIndex *gindex,
+						guint32 i)
+{
+	const NewsGroupIndexEntry *entry = &gindex->entries[i];
 
-	return 0;
+	return news_group_info_new(news_group_index_get_name(gindex, i),
+				   entry->first, entry->last, entry->type);
 }
 
-static gint news_get_article_cmd(NNTPSession *session, const gchar *cmd,
-				 gint num, gchar *filename)
+/* return the position of the first group which is not less than key */
+static guint32 news_group_index_lower_bound(NewsGroupIndex *gindex,
+					    const gchar *key)
 {
-	gchar *msgid;
-	gint ok;
-
-	ok = nntp_get_article(session, cmd, num, &msgid);
-	if (ok != NN_SUCCESS)
-		return ok;
+	guint32 lo = 0, hi = gindex->count;
 
-	debug_print("Message-Id = %s, num = %d\n", msgid, num);
-	g_free(msgid);
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
 
-	ok = recv_write_to_file(SESSION(session)->sock, filename);
-	if (ok < 0) {
-		log_warning(_("can't retrieve article %d\n"), num);
-		if (ok == -2)
-			return NN_SOCKET;
+		if (strcmp(news_group_index_get_name(gindex, mid), key) < 0)
+			lo = mid + 1;
 		else
-			return NN_IOERR;
+			hi = mid;
 	}
 
-	return NN_SUCCESS;
+	return lo;
 }
 
-static gint news_get_article(NNTPSession *session, gint num, gchar *filename)
+static gint news_recv_group_list(NNTPSession *session, const gchar *file)
 {
-	return news_get_article_cmd(session, "ARTICLE", num, filename);
+	if (recv_write_to_file(SESSION(session)->sock, file) < 0) {
+		log_warning("can't retrieve newsgroup list\n");
+		return NN_SOCKET;
+	}
+
+	return NN_SUCCESS;
 }
 
-#if 0
-static gint news_get_header(NNTPSession *session, gint num, gchar *filename)
+static void news_session_error(Folder *folder, gint ok)
 {
-	return news_get_article_cmd(session, "HEAD", num, filename);
+	if (ok == NN_SOCKET) {
+		session_destroy(REMOTE_FOLDER(folder)->session);
+		REMOTE_FOLDER(folder)->session = NULL;
+	}
 }
-#endif
 
-/**
- * news_select_group:
- * @session: Active NNTP session.
- * @group: Newsgroup name.
- * @num: Estimated number of articles.
- * @first: First article number.
- * @last: Last article number.
- *
- * Select newsgroup @group with the GROUP command if it is not already
- * selected in @session, or article numbers need to be returned.
- *
- * Return value: NNTP result code.
- **/
-static gint news_select_group(NNTPSession *session, const gchar *group,
-			      gint *num, gint *first, gint *last)
+/* retrieve the whole list with LIST and rebuild the index */
+static gint news_retrieve_group_list(Folder *folder, NNTPSession *session)
 {
+	gchar *list_file, *index_file;
+	GPtrArray *array;
+	stime_t now;
 	gint ok;
-	gint num_, first_, last_;
 
-	if (!num || !first || !last) {
-		if (session->group &&
-		    g_ascii_strcasecmp(session->group, group) == 0)
-			return NN_SUCCESS;
-		num = &num_;
-		first = &first_;
-		last = &last_;
+	now = time(NULL);
+
+	ok = nntp_list(session);
+	if (ok != NN_SUCCESS) {
+		news_session_error(folder, ok);
+		return -1;
 	}
 
-	g_free(session->group);
-	session->group = NULL;
+	list_file = news_get_group_list_file(folder, NEWSGROUP_LIST);
+	ok = news_recv_group_list(session, list_file);
+	if (ok != NN_SUCCESS) {
+		news_session_error(folder, ok);
+		g_free(list_file);
+		return -1;
+	}
 
-	ok = nntp_group(session, group, num, first, last);
-	if (ok == NN_SUCCESS)
-		session->group = g_strdup(group);
-	else
-		log_warning(_("can't select group: %s\n"), group);
+	array = news_read_group_list_file(list_file);
+	g_unlink(list_file);
+	g_free(list_file);
+	if (!array)
+		return -1;
+
+	index_file = news_get_group_list_file(folder, NEWSGROUP_INDEX);
+	ok = news_write_group_index(index_file, array, now);
+	g_free(index_file);
+	news_group_info_array_free(array);
 
 	return ok;
 }
 
-static GSList *news_get_uncached_articles(NNTPSession *session,
-					  FolderItem *item, gint cache_last,
-					  gint *rfirst, gint *rlast)
+/* open the index, retrieving the list from the server if it's not cached
+   yet. The list which was cached by the older versions is converted. */
+static NewsGroupIndex *news_group_index_get(Folder *folder)
 {
-	gint ok;
-	gint num = 0, first = 0, last = 0, begin = 0, end = 0;
-	gchar buf[NNTPBUFSIZE];
-	GSList *newlist = NULL;
-	GSList *llast = NULL;
-	MsgInfo *msginfo;
-	gint max_articles;
-
-	if (rfirst) *rfirst = -1;
-	if (rlast)  *rlast  = -1;
+	NewsGroupIndex *gindex;
+	NNTPSession *session;
+	gchar *list_file;
+
+	if ((gindex = news_group_index_open(folder)) != NULL)
+		return gindex;
+
+	list_file = news_get_group_list_file(folder, NEWSGROUP_LIST);
+	if (is_file_exist(list_file)) {
+		GPtrArray *array;
+		GStatBuf s;
+
+		if ((array = news_read_group_list_file(list_file)) != NULL) {
+			gchar *index_file;
+
+			index_file = news_get_group_list_file
+				(folder, NEWSGROUP_INDEX);
+			if (g_stat(list_file, &s) < 0)
+				s.st_mtime = 0;
+			if (news_write_group_index(index_file, array,
+						   s.st_mtime) == 0)
+				g_unlink(list_file);
+			g_free(index_file);
+			news_group_info_array_free(array);
+		}
+		g_free(list_file);
 
-	g_return_val_if_fail(session != NULL, NULL);
-	g_return_val_if_fail(item != NULL, NULL);
-	g_return_val_if_fail(item->folder != NULL, NULL);
-	g_return_val_if_fail(item->folder->account != NULL, NULL);
-	g_return_val_if_fail(FOLDER_TYPE(item->folder) == F_NEWS, NULL);
+		if ((gindex = news_group_index_open(folder)) != NULL)
+			return gindex;
+	} else
+		g_free(list_file);
 
-	ok = news_select_group(session, item->path, &num, &first, &last);
-	if (ok != NN_SUCCESS) {
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-		}
+	session = news_session_get(folder);
+	if (!session)
 		return NULL;
-	}
 
-	/* calculate getting overview range */
-	if (first > last) {
-		log_warning(_("invalid article range: %d - %d\n"),
-			    first, last);
+	if (news_retrieve_group_list(folder, session) < 0)
 		return NULL;
-	}
 
-	if (rfirst) *rfirst = first;
-	if (rlast)  *rlast  = last;
+	return news_group_index_open(folder);
+}
 
-	if (cache_last < first)
-		begin = first;
-	else if (last < cache_last)
-		begin = first;
-	else if (last == cache_last) {
-		debug_print(_("no new articles.\n"));
-		return NULL;
-	} else
-		begin = cache_last + 1;
-	end = last;
+GSList *news_get_group_list(Folder *folder)
+{
+	NewsGroupIndex *gindex;
+	GSList *list = NULL;
+	guint32 i;
 
-	max_articles = item->folder->account->max_nntp_articles;
-	if (max_articles > 0 && end - begin + 1 > max_articles)
-		begin = end - max_articles + 1;
+	g_return_val_if_fail(folder != NULL, NULL);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, NULL);
 
-	log_message(_("getting xover %d - %d in %s...\n"),
-		    begin, end, item->path);
-	ok = nntp_xover(session, begin, end);
+	if ((gindex = news_group_index_get(folder)) == NULL)
+		return NULL;
+
+	for (i = gindex->count; i > 0; i--)
+		list = g_slist_prepend(list,
+				       news_group_index_get_info(gindex, i - 1));
+
+	news_group_index_close(gindex);
+
+	return g_slist_sort(list, (GCompareFunc)news_group_info_casecmp);
+}
+
+/* return the groups and the hierarchies just under parent ("" for the top
+   level). The entries of the hierarchies which are not groups themselves
+   have type '\0'. */
+GSList *news_get_group_subtree(Folder *folder, const gchar *parent)
+{
+	NewsGroupIndex *gindex;
+	GSList *list = NULL;
+	GHashTable *table;
+	gchar *prefix;
+	gsize prefix_len;
+	guint32 i;
+
+	g_return_val_if_fail(folder != NULL, NULL);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, NULL);
+	g_return_val_if_fail(parent != NULL, NULL);
+
+	if ((gindex = news_group_index_get(folder)) == NULL)
+		return NULL;
+
+	if (*parent != '\0')
+		prefix = g_strconcat(parent, ".", NULL);
+	else
+		prefix = g_strdup("");
+	prefix_len = strlen(prefix);
+
+	table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	i = news_group_index_lower_bound(gindex, prefix);
+	while (i < gindex->count) {
+		const gchar *name;
+		const gchar *p;
+		NewsGroupInfo *ginfo;
+		gchar *child;
+
+		name = news_group_index_get_name(gindex, i);
+		if (strncmp(name, prefix, prefix_len) != 0)
+			break;
+
+		p = strchr(name + prefix_len, '.');
+		if (p)
+			child = g_strndup(name, p - name);
+		else
+			child = g_strdup(name);
+
+		ginfo = g_hash_table_lookup(table, child);
+		if (!ginfo) {
+			ginfo = news_group_info_new(child, 0, 0, '\0');
+			g_hash_table_insert(table, ginfo->name, ginfo);
+			list = g_slist_prepend(list, ginfo);
+		}
+
+		if (p) {
+			gchar *next;
+
+			/* skip the descendants of the child */
+			ginfo->has_children = TRUE;
+			next = g_strconcat(child, "/", NULL);
+			i = news_group_index_lower_bound(gindex, next);
+			g_free(next);
+		} else {
+			ginfo->first = gindex->entries[i].first;
+			ginfo->last = gindex->entries[i].last;
+			ginfo->type = gindex->entries[i].type;
+			i++;
+		}
+
+		g_free(child);
+	}
+
+	g_hash_table_destroy(table);
+	g_free(prefix);
+	news_group_index_close(gindex);
+
+	return g_slist_sort(list, (GCompareFunc)news_group_info_casecmp);
+}
+
+/* return the groups whose names match the pattern */
+GSList *news_find_group_list(Folder *folder, const gchar *pattern)
+{
+	NewsGroupIndex *gindex;
+	GPatternSpec *pspec;
+	GSList *list = NULL;
+	guint32 i;
+
+	g_return_val_if_fail(folder != NULL, NULL);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, NULL);
+	g_return_val_if_fail(pattern != NULL, NULL);
+
+	if ((gindex = news_group_index_get(folder)) == NULL)
+		return NULL;
+
+	pspec = g_pattern_spec_new(pattern);
+
+	for (i = 0; i < gindex->count; i++) {
+		if (g_pattern_match_string
+			(pspec, news_group_index_get_name(gindex, i)))
+			list = g_slist_prepend
+				(list, news_group_index_get_info(gindex, i));
+	}
+
+	g_pattern_spec_free(pspec);
+	news_group_index_close(gindex);
+
+	return g_slist_sort(list, (GCompareFunc)news_group_info_casecmp);
+}
+
+/* add the groups created since the last update with NEWGROUPS. Falls back
+   to LIST if the list is not cached or the server doesn't support it. */
+gint news_update_group_list(Folder *folder)
+{
+	NewsGroupIndex *gindex;
+	NNTPSession *session;
+	GPtrArray *array;
+	gchar *list_file, *index_file;
+	stime_t now;
+	guint32 i;
+	gint ok;
+
+	g_return_val_if_fail(folder != NULL, -1);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, -1);
+
+	session = news_session_get(folder);
+	if (!session)
+		return -1;
+
+	gindex = news_group_index_open(folder);
+	if (!gindex || gindex->sync_time == 0) {
+		news_group_index_close(gindex);
+		return news_retrieve_group_list(folder, session);
+	}
+
+	now = time(NULL);
+
+	ok = nntp_newgroups_since(session,
+				  gindex->sync_time - NEWSGROUP_SYNC_MARGIN);
+	if (ok != NN_SUCCESS) {
+		news_group_index_close(gindex);
+		if (ok == NN_SOCKET) {
+			news_session_error(folder, ok);
+			return -1;
+		}
+		return news_retrieve_group_list(folder, session);
+	}
+
+	list_file = news_get_group_list_file(folder, NEWSGROUP_LIST);
+	ok = news_recv_group_list(session, list_file);
+	if (ok != NN_SUCCESS) {
+		news_session_error(folder, ok);
+		news_group_index_close(gindex);
+		g_free(list_file);
+		return -1;
+	}
+
+	array = news_read_group_list_file(list_file);
+	g_unlink(list_file);
+	g_free(list_file);
+	if (!array) {
+		news_group_index_close(gindex);
+		return -1;
+	}
+
+	debug_print("news_update_group_list: %u new groups\n", array->len);
+
+	if (array->len == 0) {
+		news_group_index_close(gindex);
+		g_ptr_array_free(array, TRUE);
+		return 0;
+	}
+
+	/* the new groups are placed after the cached ones to win */
+	{
+		GPtrArray *merged;
+
+		merged = g_ptr_array_sized_new(gindex->count + array->len);
+		for (i = 0; i < gindex->count; i++)
+			g_ptr_array_add(merged,
+					news_group_index_get_info(gindex, i));
+		for (i = 0; i < array->len; i++)
+			g_ptr_array_add(merged,
+					g_ptr_array_index(array, i));
+		g_ptr_array_free(array, TRUE);
+		array = merged;
+	}
+	news_group_index_close(gindex);
+
+	index_file = news_get_group_list_file(folder, NEWSGROUP_INDEX);
+	ok = news_write_group_index(index_file, array, now);
+	g_free(index_file);
+	news_group_info_array_free(array);
+
+	return ok;
+}
+
+void news_group_list_free(GSList *group_list)
+{
+	GSList *cur;
+
+	if (!group_list) return;
+
+	for (cur = group_list; cur != NULL; cur = cur->next)
+		news_group_info_free((NewsGroupInfo *)cur->data);
+	g_slist_free(group_list);
+}
+
+void news_remove_group_list_cache(Folder *folder)
+{
+	gchar *filename;
+
+	g_return_if_fail(folder != NULL);
+	g_return_if_fail(FOLDER_TYPE(folder) == F_NEWS);
+
+	filename = news_get_group_list_file(folder, NEWSGROUP_LIST);
+	if (is_file_exist(filename)) {
+		if (remove(filename) < 0)
+			FILE_OP_ERROR(filename, "remove");
+	}
+	g_free(filename);
+
+	filename = news_get_group_list_file(folder, NEWSGROUP_INDEX);
+	if (is_file_exist(filename)) {
+		if (remove(filename) < 0)
+			FILE_OP_ERROR(filename, "remove");
+	}
+	g_free(filename);
+}
+
+gint news_post(Folder *folder, const gchar *file)
+{
+	FILE *fp;
+	gint ok;
+
+	g_return_val_if_fail(folder != NULL, -1);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, -1);
+	g_return_val_if_fail(file != NULL, -1);
+
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return -1;
+	}
+
+	ok = news_post_stream(folder, fp);
+
+	fclose(fp);
+
+	return ok;
+}
+
+gint news_post_stream(Folder *folder, FILE *fp)
+{
+	NNTPSession *session;
+	gint ok;
+
+	g_return_val_if_fail(folder != NULL, -1);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_NEWS, -1);
+	g_return_val_if_fail(fp != NULL, -1);
+
+	session = news_session_get(folder);
+	if (!session) return -1;
+
+	ok = nntp_post(session, fp);
+	if (ok != NN_SUCCESS) {
+		log_warning(_("can't post article.\n"));
+		if (ok == NN_SOCKET) {
+			session_destroy(SESSION(session));
+			REMOTE_FOLDER(folder)->session = NULL;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+static gint news_get_article_cmd(NNTPSession *session, const gchar *cmd,
+				 gint num, gchar *filename)
+{
+	gchar *msgid;
+	gint ok;
+
+	ok = nntp_get_article(session, cmd, num, &msgid);
+	if (ok != NN_SUCCESS)
+		return ok;
+
+	debug_print("Message-Id = %s, num = %d\n", msgid, num);
+	g_free(msgid);
+
+	ok = recv_write_to_file(SESSION(session)->sock, filename);
+	if (ok < 0) {
+		log_warning(_("can't retrieve article %d\n"), num);
+		if (ok == -2)
+			return NN_SOCKET;
+		else
+			return NN_IOERR;
+	}
+
+	return NN_SUCCESS;
+}
+
+static gint news_get_article(NNTPSession *session, gint num, gchar *filename)
+{
+	return news_get_article_cmd(session, "ARTICLE", num, filename);
+}
+
+#if 0
+static gint news_get_header(NNTPSession *session, gint num, gchar *filename)
+{
+	return news_get_article_cmd(session, "HEAD", num, filename);
+}
+#endif
+
+/**
+ * news_select_group:
+ * @session: Active NNTP session.
+ * @group: Newsgroup name.
+ * @num: Estimated number of articles.
+ * @first: First article number.
+ * @last: Last article number.
+ *
+ * Select newsgroup @group with the GROUP command if it is not already
+ * selected in @session, or article numbers need to be returned.
+ *
+ * Return value: NNTP result code.
+ **/
+static gint news_select_group(NNTPSession *session, const gchar *group,
+			      gint *num, gint *first, gint *last)
+{
+	gint ok;
+	gint num_, first_, last_;
+
+	if (!num || !first || !last) {
+		if (session->group &&
+		    g_ascii_strcasecmp(session->group, group) == 0)
+			return NN_SUCCESS;
+		num = &num_;
+		first = &first_;
+		last = &last_;
+	}
+
+	g_free(session->group);
+	session->group = NULL;
+
+	ok = nntp_group(session, group, num, first, last);
+	if (ok == NN_SUCCESS)
+		session->group = g_strdup(group);
+	else
+		log_warning(_("can't select group: %s\n"), group);
+
+	return ok;
+}
+
+static GSList *news_get_uncached_articles(NNTPSession *session,
+					  FolderItem *item, gboolean use_cache,
+					  gint cache_last,
+					  gint *rfirst, gint *rlast)
+{
+	gint ok;
+	gint num = 0, first = 0, last = 0, begin = 0, end = 0;
+	gint chunk_begin, chunk_end;
+	GSList *newlist = NULL;
+	GSList *llast = NULL;
+	GSList *chunk;
+	gint count = 0;
+	gboolean append_cache;
+	gint max_articles;
+
+	if (rfirst) *rfirst = -1;
+	if (rlast)  *rlast  = -1;
+
+	g_return_val_if_fail(session != NULL, NULL);
+	g_return_val_if_fail(item != NULL, NULL);
+	g_return_val_if_fail(item->folder != NULL, NULL);
+	g_return_val_if_fail(item->folder->account != NULL, NULL);
+	g_return_val_if_fail(FOLDER_TYPE(item->folder) == F_NEWS, NULL);
+
+	ok = news_select_group(session, item->path, &num, &first, &last);
 	if (ok != NN_SUCCESS) {
-		log_warning(_("can't get xover\n"));
 		if (ok == NN_SOCKET) {
 			session_destroy(SESSION(session));
 			REMOTE_FOLDER(item->folder)->session = NULL;
@@ -858,102 +1391,243 @@ static GSList *news_get_uncached_articles(NNTPSession *session,
 		return NULL;
 	}
 
+	/* calculate getting overview range */
+	if (first > last) {
+		log_warning(_("invalid article range: %d - %d\n"),
+			    first, last);
+		return NULL;
+	}
+
+	if (rfirst) *rfirst = first;
+	if (rlast)  *rlast  = last;
+
+	if (cache_last < first)
+		begin = first;
+	else if (last < cache_last)
+		begin = first;
+	else if (last == cache_last) {
+		debug_print(_("no new articles.\n"));
+		return NULL;
+	} else
+		begin = cache_last + 1;
+	end = last;
+
+	max_articles = item->folder->account->max_nntp_articles;
+	if (max_articles > 0 && end - begin + 1 > max_articles)
+		begin = end - max_articles + 1;
+
+	/* the articles are appended to the cache chunk by chunk, so that
+	   an interrupted download resumes from the last complete chunk */
+	append_cache = (use_cache && begin > cache_last);
+
+	for (chunk_begin = begin; chunk_begin <= end;
+	     chunk_begin = chunk_end + 1) {
+		if (end - chunk_begin >= NEWS_OVERVIEW_CHUNK)
+			chunk_end = chunk_begin + NEWS_OVERVIEW_CHUNK - 1;
+		else
+			chunk_end = end;
+
+		log_message(_("getting xover %d - %d in %s...\n"),
+			    chunk_begin, chunk_end, item->path);
+		ok = news_get_overview(session, item, chunk_begin, chunk_end,
+				       &chunk);
+
+		if (chunk) {
+			if (ok == NN_SUCCESS && append_cache)
+				news_append_cache(item, chunk);
+			count += g_slist_length(chunk);
+			if (!newlist)
+				newlist = chunk;
+			else
+				llast->next = chunk;
+			llast = g_slist_last(chunk);
+		}
+
+		if (ok != NN_SUCCESS) {
+			if (ok == NN_SOCKET) {
+				session_destroy(SESSION(session));
+				REMOTE_FOLDER(item->folder)->session = NULL;
+			}
+			break;
+		}
+
+		if (item->folder->ui_func)
+			item->folder->ui_func(item->folder, item,
+					      item->folder->ui_func_data ?
+					      item->folder->ui_func_data :
+					      GINT_TO_POINTER(count));
+	}
+
+	return newlist;
+}
+
+static void news_append_cache(FolderItem *item, GSList *mlist)
+{
+	GSList *cur;
+	FILE *fp;
+
+	if ((fp = procmsg_open_cache_file(item, DATA_APPEND)) == NULL)
+		return;
+
+	for (cur = mlist; cur != NULL; cur = cur->next)
+		procmsg_write_cache((MsgInfo *)cur->data, fp);
+
+	if (fclose(fp) == EOF)
+		FILE_OP_ERROR(item->path, "fclose");
+}
+
+static const gchar *news_overview_headers[] = {"to", "cc"};
+
+#define N_OVERVIEW_HEADERS	G_N_ELEMENTS(news_overview_headers)
+
+static void news_set_overview_header(MsgInfo *msginfo, gint n,
+				     gchar *value)
+{
+	gchar **dest;
+
+	dest = n == 0 ? &msginfo->to : &msginfo->cc;
+	g_free(*dest);
+	*dest = value;
+}
+
+/* Get the overview of begin - end. To and Cc are taken from the overview
+   if LIST OVERVIEW.FMT says it has them, and the remaining ones are
+   retrieved with pipelined XHDR commands. The results are matched by the
+   article number. */
+static gint news_get_overview(NNTPSession *session, FolderItem *item,
+			      gint begin, gint end, GSList **newlist)
+{
+	GHashTable *table;
+	GSList *llast = NULL;
+	MsgInfo *msginfo;
+	gint fields[N_OVERVIEW_HEADERS];
+	gboolean sent[N_OVERVIEW_HEADERS];
+	gchar *line;
+	gchar *value;
+	gint num;
+	gint ok;
+	gint i;
+
+	*newlist = NULL;
+
+	ok = nntp_list_overview_fmt(session);
+	if (ok != NN_SUCCESS)
+		return ok;
+	for (i = 0; i < N_OVERVIEW_HEADERS; i++)
+		fields[i] = nntp_get_overview_field
+			(session, news_overview_headers[i]);
+
+	ok = nntp_xover(session, begin, end);
+	if (ok != NN_SUCCESS) {
+		log_warning(_("can't get xover\n"));
+		return ok;
+	}
+
+	table = g_hash_table_new(NULL, NULL);
+
 	for (;;) {
-		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
+		if (sock_getline(SESSION(session)->sock, &line) < 0) {
 			log_warning(_("error occurred while getting xover.\n"));
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-			return newlist;
+			g_hash_table_destroy(table);
+			return NN_SOCKET;
 		}
 
-		if (buf[0] == '.' && buf[1] == '\r') break;
+		if (line[0] == '.' && (line[1] == '\r' || line[1] == '\n')) {
+			g_free(line);
+			break;
+		}
 
-		msginfo = news_parse_xover(buf);
+		msginfo = news_parse_xover(line);
 		if (!msginfo) {
-			log_warning(_("invalid xover line: %s\n"), buf);
+			log_warning(_("invalid xover line: %s\n"), line);
+			g_free(line);
 			continue;
 		}
 
+		for (i = 0; i < N_OVERVIEW_HEADERS; i++) {
+			if (fields[i] > 0)
+				news_set_overview_header
+					(msginfo, i, news_parse_xover_field
+						(line, fields[i],
+						 news_overview_headers[i]));
+		}
+		g_free(line);
+
 		msginfo->folder = item;
 		msginfo->flags.perm_flags = MSG_NEW|MSG_UNREAD;
 		msginfo->flags.tmp_flags = MSG_NEWS;
 		msginfo->newsgroups = g_strdup(item->path);
 
-		if (!newlist)
-			llast = newlist = g_slist_append(newlist, msginfo);
+		g_hash_table_insert(table, GINT_TO_POINTER(msginfo->msgnum),
+				    msginfo);
+
+		if (!*newlist)
+			llast = *newlist = g_slist_append(*newlist, msginfo);
 		else {
 			llast = g_slist_append(llast, msginfo);
 			llast = llast->next;
 		}
 	}
 
-	ok = nntp_xhdr(session, "to", begin, end);
-	if (ok != NN_SUCCESS) {
-		log_warning(_("can't get xhdr\n"));
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
+	/* send all the XHDR commands first, then read the responses */
+	for (i = 0; i < N_OVERVIEW_HEADERS; i++) {
+		sent[i] = FALSE;
+		if (fields[i] > 0 || !*newlist)
+			continue;
+		ok = nntp_send_command(session, "XHDR %s %d-%d",
+				       news_overview_headers[i], begin, end);
+		if (ok != NN_SUCCESS) {
+			g_hash_table_destroy(table);
+			return ok;
 		}
-		return newlist;
+		sent[i] = TRUE;
 	}
 
-	llast = newlist;
-
-	for (;;) {
-		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
-			log_warning(_("error occurred while getting xhdr.\n"));
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-			return newlist;
-		}
-
-		if (buf[0] == '.' && buf[1] == '\r') break;
-		if (!llast) {
-			g_warning("llast == NULL\n");
+	for (i = 0; i < N_OVERVIEW_HEADERS; i++) {
+		if (!sent[i])
 			continue;
-		}
-
-		msginfo = (MsgInfo *)llast->data;
-		msginfo->to = news_parse_xhdr(buf, msginfo);
-
-		llast = llast->next;
-	}
 
-	ok = nntp_xhdr(session, "cc", begin, end);
-	if (ok != NN_SUCCESS) {
-		log_warning(_("can't get xhdr\n"));
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
+		ok = nntp_recv_response(session, NULL);
+		if (ok != NN_SUCCESS) {
+			log_warning(_("can't get xhdr\n"));
+			if (ok == NN_SOCKET) {
+				g_hash_table_destroy(table);
+				return ok;
+			}
+			continue;
 		}
-		return newlist;
-	}
 
-	llast = newlist;
+		for (;;) {
+			if (sock_getline(SESSION(session)->sock, &line) < 0) {
+				log_warning(_("error occurred while getting xhdr.\n"));
+				g_hash_table_destroy(table);
+				return NN_SOCKET;
+			}
 
-	for (;;) {
-		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
-			log_warning(_("error occurred while getting xhdr.\n"));
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-			return newlist;
-		}
+			if (line[0] == '.' &&
+			    (line[1] == '\r' || line[1] == '\n')) {
+				g_free(line);
+				break;
+			}
 
-		if (buf[0] == '.' && buf[1] == '\r') break;
-		if (!llast) {
-			g_warning("llast == NULL\n");
-			continue;
+			value = news_parse_xhdr(line, &num);
+			g_free(line);
+			if (!value)
+				continue;
+
+			msginfo = g_hash_table_lookup(table,
+						      GINT_TO_POINTER(num));
+			if (msginfo)
+				news_set_overview_header(msginfo, i, value);
+			else
+				g_free(value);
 		}
-
-		msginfo = (MsgInfo *)llast->data;
-		msginfo->cc = news_parse_xhdr(buf, msginfo);
-
-		llast = llast->next;
 	}
 
+	g_hash_table_destroy(table);
 	session_set_access_time(SESSION(session));
 
-	return newlist;
+	return NN_SUCCESS;
 }
 
 #define PARSE_ONE_PARAM(p, srcp) \
@@ -1020,11 +1694,42 @@ static MsgInfo *news_parse_xover(const gchar *xover_str)
 	return msginfo;
 }
 
-static gchar *news_parse_xhdr(const gchar *xhdr_str, MsgInfo *msginfo)
+/* return the value of the additional overview field. The value is
+   prefixed by the header name if the field is marked as "full". */
+static gchar *news_parse_xover_field(const gchar *xover_str, gint field,
+				     const gchar *header)
+{
+	const gchar *p = xover_str;
+	const gchar *q;
+	gint len;
+	gint i;
+
+	for (i = 0; i < field; i++) {
+		if ((p = strchr(p, '\t')) == NULL)
+			return NULL;
+		p++;
+	}
+
+	for (q = p; *q != '\0' && *q != '\t' && *q != '\r' && *q != '\n'; q++)
+		;
+
+	len = strlen(header);
+	if (q - p > len && p[len] == ':' &&
+	    !g_ascii_strncasecmp(p, header, len)) {
+		p += len + 1;
+		while (p < q && *p == ' ')
+			p++;
+	}
+	if (p == q)
+		return NULL;
+
+	return g_strndup(p, q - p);
+}
+
+static gchar *news_parse_xhdr(const gchar *xhdr_str, gint *num)
 {
 	gchar *p;
 	gchar *tmp;
-	gint num;
 
 	p = strchr(xhdr_str, ' ');
 	if (!p)
@@ -1032,8 +1737,8 @@ static gchar *news_parse_xhdr(const gchar *xhdr_str, MsgInfo *msginfo)
 	else
 		p++;
 
-	num = atoi(xhdr_str);
-	if (msginfo->msgnum != num) return NULL;
+	*num = atoi(xhdr_str);
+	if (*num <= 0) return NULL;
 
 	tmp = strchr(p, '\r');
 	if (!tmp) tmp = strchr(p, '\n');
@@ -1079,9 +1784,555 @@ static GSList *news_delete_old_articles(GSList *alist, FolderItem *item,
 	return alist;
 }
 
+/* access time index of the cached articles.
+   Each record is a pair of the article number and the time it was
+   retrieved or read. A record with number 0 holds the time of the last
+   expiration. */
+
+#define NEWS_CACHE_EXPIRE_HOURS	(24 * 7)
+#define NEWS_EXPIRE_INTERVAL	(60 * 60)
+
+S_LOCK_DEFINE_STATIC(access_index);
+
+static gchar *news_get_access_index_file(const gchar *dir)
+{
+	return g_strconcat(dir, G_DIR_SEPARATOR_S, NEWS_ACCESS_INDEX, NULL);
+}
+
+/* build the index from the files cached before the index existed */
+static GHashTable *news_access_index_scan_dir(const gchar *dir)
+{
+	GHashTable *table;
+	GDir *dp;
+	const gchar *dir_name;
+	gchar *file;
+	struct stat s;
+	guint num;
+
+	table = g_hash_table_new(NULL, NULL);
+
+	if ((dp = g_dir_open(dir, 0, NULL)) == NULL)
+		return table;
+
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		if ((num = to_unumber(dir_name)) == 0)
+			continue;
+		file = g_strconcat(dir, G_DIR_SEPARATOR_S, dir_name, NULL);
+		if (g_stat(file, &s) == 0 && !S_ISDIR(s.st_mode))
+			g_hash_table_insert
+				(table, GUINT_TO_POINTER(num),
+				 GUINT_TO_POINTER(MAX(s.st_mtime, s.st_atime)));
+		g_free(file);
+	}
+
+	g_dir_close(dp);
+
+	return table;
+}
+
+static void news_access_index_write_func(gpointer key, gpointer value,
+					 gpointer data)
+{
+	guint32 rec[2];
+
+	rec[0] = GPOINTER_TO_UINT(key);
+	rec[1] = GPOINTER_TO_UINT(value);
+	fwrite(rec, sizeof(rec), 1, (FILE *)data);
+}
+
+/* create the index with the files already in the cache, so that they
+   are expired as well. Must be called with the access_index lock. */
+static void news_access_index_create(const gchar *dir, const gchar *file)
+{
+	GHashTable *table;
+	FILE *fp;
+
+	debug_print("creating %s\n", file);
+
+	table = news_access_index_scan_dir(dir);
+
+	if ((fp = g_fopen(file, "wb")) != NULL) {
+		g_hash_table_foreach(table, news_access_index_write_func, fp);
+		if (fclose(fp) == EOF) {
+			FILE_OP_ERROR(file, "fclose");
+			g_unlink(file);
+		}
+	} else
+		FILE_OP_ERROR(file, "fopen");
+
+	g_hash_table_destroy(table);
+}
+
+static void news_access_index_touch(const gchar *dir, gint num)
+{
+	gchar *file;
+	guint32 rec[2];
+	FILE *fp;
+
+	file = news_get_access_index_file(dir);
+	rec[0] = num;
+	rec[1] = (guint32)time(NULL);
+
+	S_LOCK(access_index);
+	if (!is_file_exist(file))
+		news_access_index_create(dir, file);
+	if ((fp = g_fopen(file, "ab")) != NULL) {
+		if (fwrite(rec, sizeof(rec), 1, fp) != 1)
+			FILE_OP_ERROR(file, "fwrite");
+		fclose(fp);
+	} else
+		FILE_OP_ERROR(file, "fopen");
+	S_UNLOCK(access_index);
+
+	g_free(file);
+}
+
+static GHashTable *news_access_index_read(const gchar *file,
+					  stime_t *last_expire)
+{
+	GHashTable *table;
+	guint32 rec[2];
+	gpointer value;
+	FILE *fp;
+
+	*last_expire = 0;
+
+	if ((fp = g_fopen(file, "rb")) == NULL)
+		return NULL;
+
+	table = g_hash_table_new(NULL, NULL);
+
+	while (fread(rec, sizeof(rec), 1, fp) == 1) {
+		if (rec[0] == 0) {
+			*last_expire = rec[1];
+			continue;
+		}
+		value = g_hash_table_lookup(table, GUINT_TO_POINTER(rec[0]));
+		if (GPOINTER_TO_UINT(value) < rec[1])
+			g_hash_table_insert(table, GUINT_TO_POINTER(rec[0]),
+					    GUINT_TO_POINTER(rec[1]));
+	}
+
+	fclose(fp);
+
+	return table;
+}
+
+typedef struct _NewsExpireData
+{
+	const gchar *dir;
+	FILE *fp;
+	stime_t expire_time;
+} NewsExpireData;
+
+static gboolean news_expire_func(gpointer key, gpointer value, gpointer data)
+{
+	NewsExpireData *expire = (NewsExpireData *)data;
+	guint32 rec[2];
+	gchar nstr[16];
+	gchar *file;
+
+	if (GPOINTER_TO_UINT(value) < expire->expire_time) {
+		file = g_strconcat(expire->dir, G_DIR_SEPARATOR_S,
+				   utos_buf(nstr, GPOINTER_TO_UINT(key)),
+				   NULL);
+		if (g_unlink(file) < 0 && errno != ENOENT)
+			FILE_OP_ERROR(file, "unlink");
+		g_free(file);
+		return TRUE;
+	}
+
+	rec[0] = GPOINTER_TO_UINT(key);
+	rec[1] = GPOINTER_TO_UINT(value);
+	fwrite(rec, sizeof(rec), 1, expire->fp);
+
+	return FALSE;
+}
+
+/* remove the temporary files left by a crash. the ones modified
+   recently may still be written by a prefetch thread */
+static void news_remove_stale_tmp_files(const gchar *dir, stime_t now)
+{
+	GDir *dp;
+	const gchar *dir_name;
+	gchar *file;
+	GStatBuf s;
+	gint n_removed = 0;
+
+	if ((dp = g_dir_open(dir, 0, NULL)) == NULL)
+		return;
+
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		if (!g_str_has_suffix(dir_name, ".tmp"))
+			continue;
+		file = g_strconcat(dir, G_DIR_SEPARATOR_S, dir_name, NULL);
+		if (g_stat(file, &s) == 0 && !S_ISDIR(s.st_mode) &&
+		    now - s.st_mtime >= NEWS_EXPIRE_INTERVAL) {
+			if (g_unlink(file) < 0) {
+				FILE_OP_ERROR(file, "unlink");
+			} else
+				n_removed++;
+		}
+		g_free(file);
+	}
+
+	g_dir_close(dp);
+
+	if (n_removed > 0)
+		debug_print("news_remove_stale_tmp_files: %s: "
+			    "%d files removed\n", dir, n_removed);
+}
+
+static void news_expire_caches(const gchar *dir)
+{
+	GHashTable *table;
+	NewsExpireData expire;
+	gchar *file, *tmp;
+	stime_t now, last_expire;
+	guint32 rec[2];
+	FILE *fp;
+
+	now = time(NULL);
+	file = news_get_access_index_file(dir);
+
+	S_LOCK(access_index);
+
+	table = news_access_index_read(file, &last_expire);
+	if (table && now - last_expire < NEWS_EXPIRE_INTERVAL) {
+		S_UNLOCK(access_index);
+		g_hash_table_destroy(table);
+		g_free(file);
+		return;
+	}
+	if (!table)
+		table = news_access_index_scan_dir(dir);
+
+	debug_print("Deleting expired cached articles...\n");
+
+	tmp = g_strconcat(file, ".tmp", NULL);
+	if ((fp = g_fopen(tmp, "wb")) == NULL) {
+		FILE_OP_ERROR(tmp, "fopen");
+		S_UNLOCK(access_index);
+		g_hash_table_destroy(table);
+		g_free(tmp);
+		g_free(file);
+		return;
+	}
+
+	rec[0] = 0;
+	rec[1] = (guint32)now;
+	fwrite(rec, sizeof(rec), 1, fp);
+
+	expire.dir = dir;
+	expire.fp = fp;
+	expire.expire_time = now - NEWS_CACHE_EXPIRE_HOURS * 60 * 60;
+	g_hash_table_foreach_remove(table, news_expire_func, &expire);
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(tmp, "fclose");
+		g_unlink(tmp);
+	} else if (rename_force(tmp, file) < 0) {
+		FILE_OP_ERROR(file, "rename");
+		g_unlink(tmp);
+	}
+
+	S_UNLOCK(access_index);
+
+	g_hash_table_destroy(table);
+	g_free(tmp);
+	g_free(file);
+
+	news_remove_stale_tmp_files(dir, now);
+}
+
+#if USE_THREADS
+
+/* Prefetching of the new articles.
+   The articles are retrieved by a thread pool. Each thread owns at most
+   one extra NNTP session, which is returned to the idle queue after each
+   article, so the number of sessions is bounded by the number of threads. */
+
+typedef struct _NewsPrefetch
+{
+	GThreadPool *pool;
+	GAsyncQueue *sessions;
+	volatile gint cancelled;
+
+	gchar *server;
+	gushort port;
+	gchar *userid;
+	gchar *passwd;
+	SocksInfo *socks_info;
+#if USE_SSL
+	SSLType ssl_type;
+#endif
+} NewsPrefetch;
+
+typedef struct _NewsPrefetchTask
+{
+	gchar *group;
+	gchar *dir;
+	gint num;
+} NewsPrefetchTask;
+
+static gint news_prefetch_recv(SockInfo *sock, const gchar *file)
+{
+	gchar *buf;
+	gchar *p;
+	gint len;
+	FILE *fp;
+	gint ret = 0;
+
+	if ((fp = g_fopen(file, "wb")) == NULL)
+		FILE_OP_ERROR(file, "fopen");
+
+	for (;;) {
+		if ((len = sock_getline(sock, &buf)) < 0) {
+			ret = -2;
+			break;
+		}
+
+		if (len > 1 && buf[0] == '.' && buf[1] == '\r') {
+			g_free(buf);
+			break;
+		}
+
+		if (len > 1 && buf[len - 1] == '\n' && buf[len - 2] == '\r') {
+			buf[len - 2] = '\n';
+			buf[len - 1] = '\0';
+		}
+
+		p = buf;
+		if (buf[0] == '.' && buf[1] == '.')
+			p++;
+		else if (!strncmp(buf, ">From ", 6))
+			p++;
+
+		if (fp && fputs(p, fp) == EOF) {
+			FILE_OP_ERROR(file, "fputs");
+			fclose(fp);
+			fp = NULL;
+		}
+		g_free(buf);
+	}
+
+	if (!fp)
+		return ret < 0 ? ret : -1;
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		return ret < 0 ? ret : -1;
+	}
+
+	return ret;
+}
+
+static NNTPSession *news_prefetch_session_get(NewsPrefetch *prefetch)
+{
+	Session *session;
+
+	if ((session = g_async_queue_try_pop(prefetch->sessions)) != NULL)
+		return NNTP_SESSION(session);
+
+#if USE_SSL
+	session = news_session_new(prefetch->server, prefetch->port,
+				   prefetch->socks_info, prefetch->userid,
+				   prefetch->passwd, prefetch->ssl_type);
+#else
+	session = news_session_new(prefetch->server, prefetch->port,
+				   prefetch->socks_info, prefetch->userid,
+				   prefetch->passwd);
+#endif
+
+	return NNTP_SESSION(session);
+}
+
+static void news_prefetch_func(gpointer data, gpointer user_data)
+{
+	NewsPrefetchTask *task = (NewsPrefetchTask *)data;
+	NewsPrefetch *prefetch = (NewsPrefetch *)user_data;
+	NNTPSession *session = NULL;
+	gchar nstr[16];
+	gchar *file = NULL, *tmp = NULL;
+	gchar *msgid;
+	gint ok;
+
+	if (g_atomic_int_get(&prefetch->cancelled))
+		goto finish;
+
+	file = g_strconcat(task->dir, G_DIR_SEPARATOR_S,
+			   utos_buf(nstr, task->num), NULL);
+	if (is_file_exist(file))
+		goto finish;
+
+	session = news_prefetch_session_get(prefetch);
+	if (!session) {
+		/* don't retry for every article */
+		g_atomic_int_set(&prefetch->cancelled, 1);
+		goto finish;
+	}
+
+	ok = news_select_group(session, task->group, NULL, NULL, NULL);
+	if (ok == NN_SUCCESS)
+		ok = nntp_article(session, task->num, &msgid);
+	if (ok == NN_SUCCESS) {
+		g_free(msgid);
+		/* readers see either nothing or the complete article */
+		tmp = g_strconcat(file, ".tmp", NULL);
+		if (news_prefetch_recv(SESSION(session)->sock, tmp) < 0) {
+			g_unlink(tmp);
+			ok = NN_SOCKET;
+		} else if (rename_force(tmp, file) < 0) {
+			FILE_OP_ERROR(file, "rename");
+			g_unlink(tmp);
+		} else {
+			debug_print("news_prefetch_func: prefetched %s/%d\n",
+				    task->group, task->num);
+			news_access_index_touch(task->dir, task->num);
+		}
+	}
+
+	if (ok == NN_SOCKET)
+		session_destroy(SESSION(session));
+	else
+		g_async_queue_push(prefetch->sessions, session);
+
+finish:
+	g_free(tmp);
+	g_free(file);
+	g_free(task->group);
+	g_free(task->dir);
+	g_free(task);
+}
+
+static NewsPrefetch *news_prefetch_get(Folder *folder)
+{
+	NewsFolder *nfolder = NEWS_FOLDER(folder);
+	NewsPrefetch *prefetch;
+	PrefsAccount *ac = folder->account;
+	gint n_sessions;
+
+	if (nfolder->prefetch)
+		return (NewsPrefetch *)nfolder->prefetch;
+
+	if (!ac->nntp_server)
+		return NULL;
+	/* the password can't be asked from the prefetch threads */
+	if (ac->use_nntp_auth && ac->userid && ac->userid[0] &&
+	    (!ac->passwd || !ac->passwd[0])) {
+		debug_print("news_prefetch_get: password is not stored\n");
+		return NULL;
+	}
+
+	prefetch = g_new0(NewsPrefetch, 1);
+	prefetch->server = g_strdup(ac->nntp_server);
+	if (ac->use_nntp_auth && ac->userid && ac->userid[0]) {
+		prefetch->userid = g_strdup(ac->userid);
+		prefetch->passwd = g_strdup(ac->passwd);
+	}
+	if (ac->use_socks && ac->use_socks_for_recv && ac->proxy_host)
+		prefetch->socks_info = socks_info_new
+			(ac->socks_type, ac->proxy_host, ac->proxy_port,
+			 ac->use_proxy_auth ? ac->proxy_name : NULL,
+			 ac->use_proxy_auth ? ac->proxy_pass : NULL);
+#if USE_SSL
+	prefetch->port = ac->set_nntpport ? ac->nntpport
+		: ac->ssl_nntp ? NNTPS_PORT : NNTP_PORT;
+	prefetch->ssl_type = ac->ssl_nntp;
+#else
+	prefetch->port = ac->set_nntpport ? ac->nntpport : NNTP_PORT;
+#endif
+
+	n_sessions = CLAMP(prefs_common.news_prefetch_sessions, 1, 4);
+	prefetch->sessions = g_async_queue_new();
+	prefetch->pool = g_thread_pool_new(news_prefetch_func, prefetch,
+					   n_sessions, FALSE, NULL);
+
+	nfolder->prefetch = prefetch;
+
+	return prefetch;
+}
+
+static void news_prefetch_free(Folder *folder)
+{
+	NewsFolder *nfolder = NEWS_FOLDER(folder);
+	NewsPrefetch *prefetch = (NewsPrefetch *)nfolder->prefetch;
+	Session *session;
+
+	if (!prefetch)
+		return;
+
+	g_atomic_int_set(&prefetch->cancelled, 1);
+	g_thread_pool_free(prefetch->pool, FALSE, TRUE);
+
+	while ((session = g_async_queue_try_pop(prefetch->sessions)) != NULL)
+		session_destroy(session);
+	g_async_queue_unref(prefetch->sessions);
+
+	g_free(prefetch->server);
+	g_free(prefetch->userid);
+	g_free(prefetch->passwd);
+	if (prefetch->socks_info)
+		socks_info_free(prefetch->socks_info);
+	g_free(prefetch);
+
+	nfolder->prefetch = NULL;
+}
+
+/* queue the newest articles within the count and size budgets */
+static void news_prefetch_articles(Folder *folder, FolderItem *item,
+				   GSList *newlist)
+{
+	NewsPrefetch *prefetch;
+	GSList *rlist, *cur;
+	gint max_count;
+	gsize max_size, size = 0;
+	gint count = 0;
+	gchar *dir;
+
+	if (!prefs_common.news_prefetch || !newlist)
+		return;
+	if ((prefetch = news_prefetch_get(folder)) == NULL)
+		return;
+
+	/* resume after a connection failure on the next update */
+	g_atomic_int_set(&prefetch->cancelled, 0);
+
+	max_count = prefs_common.news_prefetch_max_articles;
+	max_size = (gsize)MAX(prefs_common.news_prefetch_max_size, 0) * 1024;
+
+	dir = folder_item_get_path(item);
+	rlist = g_slist_reverse(g_slist_copy(newlist));
+
+	for (cur = rlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		NewsPrefetchTask *task;
+
+		if (count >= max_count || size + msginfo->size > max_size)
+			break;
+		count++;
+		size += msginfo->size;
+
+		task = g_new(NewsPrefetchTask, 1);
+		task->group = g_strdup(item->path);
+		task->dir = g_strdup(dir);
+		task->num = msginfo->msgnum;
+		g_thread_pool_push(prefetch->pool, task, NULL);
+	}
+
+	g_slist_free(rlist);
+	g_free(dir);
+
+	if (count > 0)
+		debug_print("news_prefetch_articles: %d articles (%u bytes) "
+			    "queued in %s\n", count, (guint)size, item->path);
+}
+
+#endif /* USE_THREADS */
+
 static void news_delete_all_articles(FolderItem *item)
 {
 	gchar *dir;
+	gchar *file;
 
 	g_return_if_fail(item != NULL);
 	g_return_if_fail(item->folder != NULL);
@@ -1091,6 +2342,10 @@ static void news_delete_all_articles(FolderItem *item)
 
 	dir = folder_item_get_path(item);
 	remove_all_numbered_files(dir);
+	file = news_get_access_index_file(dir);
+	if (is_file_exist(file) && g_unlink(file) < 0)
+		FILE_OP_ERROR(file, "unlink");
+	g_free(file);
 	g_free(dir);
 }
 
@@ -1102,9 +2357,7 @@ static void news_delete_expired_caches(GSList *alist, FolderItem *item)
 	g_return_if_fail(item->folder != NULL);
 	g_return_if_fail(FOLDER_TYPE(item->folder) == F_NEWS);
 
-	debug_print("Deleting expired cached articles...\n");
-
 	dir = folder_item_get_path(item);
-	remove_expired_files(dir, 24 * 7);
+	news_expire_caches(dir);
 	g_free(dir);
 }
@@ -35,6 +35,8 @@ struct _NewsFolder
 	RemoteFolder rfolder;
 
 	gboolean use_auth;
+
+	gpointer prefetch;
 };
 
 struct _NewsGroupInfo
@@ -44,11 +46,17 @@ struct _NewsGroupInfo
 	guint last;
 	gchar type;
 	gboolean subscribed;
+	gboolean has_children;
 };
 
 FolderClass *news_get_class		(void);
 
 GSList *news_get_group_list		(Folder		*folder);
+GSList *news_get_group_subtree		(Folder		*folder,
+					 const gchar	*parent);
+GSList *news_find_group_list		(Folder		*folder,
+					 const gchar	*pattern);
+gint news_update_group_list		(Folder		*folder);
 void news_group_list_free		(GSList		*group_list);
 void news_remove_group_list_cache	(Folder		*folder);
 
@@ -25,6 +25,7 @@
 #include <glib/gi18n.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "nntp.h"
 #include "socket.h"
@@ -179,6 +180,7 @@ static void nntp_session_destroy(Session *session)
 	g_free(nntp_session->group);
 	g_free(nntp_session->userid);
 	g_free(nntp_session->passwd);
+	g_strfreev(nntp_session->overview_fmt);
 }
 
 gint nntp_group(NNTPSession *session, const gchar *group,
@@ -308,6 +310,80 @@ gint nntp_list(NNTPSession *session)
 	return nntp_gen_command(session, NULL, "LIST");
 }
 
+/* The first seven fields of the overview (Subject, From, Date, Message-ID,
+   References, Bytes and Lines) are fixed. Remember the rest so that headers
+   like To and Cc can be taken from the overview instead of extra XHDRs. */
+#define NNTP_OVERVIEW_STD_FIELDS	7
+
+gint nntp_list_overview_fmt(NNTPSession *session)
+{
+	GPtrArray *fields;
+	gchar *line;
+	gchar *p;
+	gint n = 0;
+	gint ok;
+
+	if (session->overview_fmt)
+		return NN_SUCCESS;
+
+	ok = nntp_gen_command(session, NULL, "LIST OVERVIEW.FMT");
+	if (ok != NN_SUCCESS) {
+		if (ok == NN_SOCKET)
+			return ok;
+		/* not supported: only use the standard fields */
+		session->overview_fmt = g_new0(gchar *, 1);
+		return NN_SUCCESS;
+	}
+
+	fields = g_ptr_array_new();
+
+	for (;;) {
+		if (sock_getline(SESSION(session)->sock, &line) < 0) {
+			log_warning(_("error occurred while getting "
+				      "overview format.\n"));
+			g_ptr_array_free(fields, TRUE);
+			return NN_SOCKET;
+		}
+		strretchomp(line);
+		if (line[0] == '.' && line[1] == '\0') {
+			g_free(line);
+			break;
+		}
+
+		if (n++ >= NNTP_OVERVIEW_STD_FIELDS) {
+			if ((p = strchr(line, ':')) != NULL)
+				*p = '\0';
+			g_strstrip(line);
+			g_ptr_array_add(fields, g_ascii_strdown(line, -1));
+		}
+		g_free(line);
+	}
+
+	g_ptr_array_add(fields, NULL);
+	session->overview_fmt = (gchar **)g_ptr_array_free(fields, FALSE);
+
+	return NN_SUCCESS;
+}
+
+/* return the index of the overview field (0 is the article number) which
+   contains the header, or -1 if the overview doesn't have it */
+gint nntp_get_overview_field(NNTPSession *session, const gchar *header)
+{
+	gint i;
+
+	g_return_val_if_fail(header != NULL, -1);
+
+	if (!session->overview_fmt)
+		return -1;
+
+	for (i = 0; session->overview_fmt[i] != NULL; i++) {
+		if (!g_ascii_strcasecmp(session->overview_fmt[i], header))
+			return i + NNTP_OVERVIEW_STD_FIELDS + 1;
+	}
+
+	return -1;
+}
+
 gint nntp_post(NNTPSession *session, FILE *fp)
 {
 	gint ok;
@@ -340,6 +416,20 @@ gint nntp_newgroups(NNTPSession *session)
 	return NN_SUCCESS;
 }
 
+gint nntp_newgroups_since(NNTPSession *session, stime_t since)
+{
+	time_t t = since;
+	struct tm *lt;
+	gchar buf[16];
+
+	lt = gmtime(&t);
+	if (!lt)
+		return NN_ERROR;
+	strftime(buf, sizeof(buf), "%y%m%d %H%M%S", lt);
+
+	return nntp_gen_command(session, NULL, "NEWGROUPS %s GMT", buf);
+}
+
 gint nntp_newnews(NNTPSession *session)
 {
 	return NN_SUCCESS;
@@ -355,6 +445,30 @@ gint nntp_mode(NNTPSession *session, gboolean stream)
 	return ok;
 }
 
+/* send a command without waiting for the response, so that several
+   commands can be pipelined */
+gint nntp_send_command(NNTPSession *session, const gchar *format, ...)
+{
+	gchar buf[NNTPBUFSIZE];
+	va_list args;
+
+	va_start(args, format);
+	g_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	return nntp_gen_send(SESSION(session)->sock, "%s", buf);
+}
+
+gint nntp_recv_response(NNTPSession *session, gchar *argbuf)
+{
+	gint ok;
+
+	ok = nntp_ok(SESSION(session)->sock, argbuf);
+	session_set_access_time(SESSION(session));
+
+	return ok;
+}
+
 static gint nntp_ok(SockInfo *sock, gchar *argbuf)
 {
 	gint ok;
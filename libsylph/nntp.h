@@ -39,6 +39,9 @@ struct _NNTPSession
 	gchar *userid;
 	gchar *passwd;
 	gboolean auth_failed;
+
+	/* additional overview fields (lowercase header names) */
+	gchar **overview_fmt;
 };
 
 #define NN_SUCCESS	0
@@ -113,11 +116,22 @@ gint nntp_xhdr			(NNTPSession	*session,
 				 gint		 first,
 				 gint		 last);
 gint nntp_list			(NNTPSession	*session);
+gint nntp_list_overview_fmt	(NNTPSession	*session);
+gint nntp_get_overview_field	(NNTPSession	*session,
+				 const gchar	*header);
 gint nntp_post			(NNTPSession	*session,
 				 FILE		*fp);
 gint nntp_newgroups		(NNTPSession	*session);
+gint nntp_newgroups_since	(NNTPSession	*session,
+				 stime_t	 since);
 gint nntp_newnews		(NNTPSession	*session);
 gint nntp_mode			(NNTPSession	*session,
 				 gboolean	 stream);
 
+gint nntp_send_command		(NNTPSession	*session,
+				 const gchar	*format,
+				 ...) G_GNUC_PRINTF(2, 3);
+gint nntp_recv_response		(NNTPSession	*session,
+				 gchar		*argbuf);
+
 #endif /* __NNTP_H__ */
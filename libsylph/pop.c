@@ -328,7 +328,7 @@ gint pop3_getrange_uidl_recv(Pop3Session *session, const gchar *data, guint len)
 
 		session->msg[num].uidl = g_strdup(id);
 
-		recv_time = GPOINTER_TO_INT(g_hash_table_lookup(session->uidl_table, id));
+		recv_time = pop3_uidl_store_lookup(session->uidl_store, id);
 		session->msg[num].recv_time = recv_time;
 
 		if (!session->ac_prefs->getall && recv_time != RECV_TIME_NONE)
@@ -486,7 +486,7 @@ Session *pop3_session_new(PrefsAccount *account)
 
 	session->state = POP3_READY;
 	session->ac_prefs = account;
-	session->uidl_table = pop3_get_uidl_table(account);
+	session->uidl_store = pop3_uidl_store_open(account);
 	session->current_time = time(NULL);
 	session->error_val = PS_SUCCESS;
 	session->error_msg = NULL;
@@ -521,10 +521,7 @@ static void pop3_session_destroy(Session *session)
 		g_free(pop3_session->msg[n].uidl);
 	g_free(pop3_session->msg);
 
-	if (pop3_session->uidl_table) {
-		hash_free_strings(pop3_session->uidl_table);
-		g_hash_table_destroy(pop3_session->uidl_table);
-	}
+	pop3_uidl_store_close(pop3_session->uidl_store);
 
 	g_free(pop3_session->greeting);
 	g_free(pop3_session->user);
@@ -532,31 +529,482 @@ static void pop3_session_destroy(Session *session)
 	g_free(pop3_session->error_msg);
 }
 
-GHashTable *pop3_get_uidl_table(PrefsAccount *ac_prefs)
+/* UIDL store.
+ * The received UIDLs are kept in an on-disk hash table with open
+ * addressing, which is memory mapped for lookup. Changed buckets are
+ * written in place and new UIDL strings are appended, so a session
+ * which receives a few messages doesn't rewrite the whole file.
+ * The file is rebuilt when the table gets full, or when too many
+ * entries were removed or are no longer on the server.
+ *
+ * header (UIDLStoreHeader)
+ * buckets (UIDLStoreBucket * n_buckets)
+ * strings (NUL-terminated UIDLs, offset 0 is a dummy empty string)
+ */
+
+#define UIDL_STORE_SUFFIX	".db"
+#define UIDL_STORE_MAGIC	"SUID"
+#define UIDL_STORE_VERSION	1
+#define UIDL_STORE_MIN_BUCKETS	1024
+
+#define UIDL_SLOT_EMPTY		0
+#define UIDL_SLOT_DELETED	G_MAXUINT32
+
+typedef struct _UIDLStoreHeader
 {
-	GHashTable *table;
-	gchar *path;
-	FILE *fp;
-	gchar buf[POPBUFSIZE];
-	gchar uidl[POPBUFSIZE];
-	time_t recv_time;
-	time_t now;
-	gchar *uid;
+	gchar magic[4];
+	guint32 version;
+	guint32 n_buckets;
+	guint32 n_live;
+	guint32 n_deleted;
+	guint32 str_size;
+	guint32 reserved[2];
+} UIDLStoreHeader;
+
+typedef struct _UIDLStoreBucket
+{
+	guint32 hash;
+	guint32 str;
+	gint64 recv_time;
+} UIDLStoreBucket;
 
-	table = g_hash_table_new(g_str_hash, g_str_equal);
+struct _Pop3UIDLStore
+{
+	gchar *file;
+
+	GMappedFile *mfile;
+	const gchar *buckets;
+	const gchar *strings;
+
+	UIDLStoreHeader header;
+
+	/* pending changes */
+	GHashTable *dirty;
+	GString *new_str;
+};
+
+#define UIDL_STORE_BUCKETS_OFFSET	sizeof(UIDLStoreHeader)
+#define UIDL_STORE_STRINGS_OFFSET(n)	\
+	(sizeof(UIDLStoreHeader) + (gsize)(n) * sizeof(UIDLStoreBucket))
+
+/* FNV-1a; g_str_hash() is not guaranteed to be stable */
+static guint32 uidl_hash(const gchar *str)
+{
+	guint32 h = 2166136261U;
+
+	for (; *str != '\0'; str++) {
+		h ^= (guchar)*str;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static gchar *pop3_get_uidl_file(PrefsAccount *ac_prefs)
+{
+	gchar *uid;
+	gchar *path;
 
 	uid = uriencode_for_filename(ac_prefs->userid);
 	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
 			   UIDL_DIR, G_DIR_SEPARATOR_S, ac_prefs->recv_server,
 			   "-", uid, NULL);
 	g_free(uid);
+
+	return path;
+}
+
+static void uidl_store_get_bucket(Pop3UIDLStore *store, guint32 slot,
+				  UIDLStoreBucket *bucket)
+{
+	UIDLStoreBucket *dirty;
+
+	if (store->dirty &&
+	    (dirty = g_hash_table_lookup(store->dirty,
+					 GUINT_TO_POINTER(slot + 1)))) {
+		*bucket = *dirty;
+		return;
+	}
+
+	memcpy(bucket, store->buckets + slot * sizeof(UIDLStoreBucket),
+	       sizeof(UIDLStoreBucket));
+}
+
+static void uidl_store_set_bucket(Pop3UIDLStore *store, guint32 slot,
+				  const UIDLStoreBucket *bucket)
+{
+	UIDLStoreBucket *dirty;
+
+	if (!store->dirty)
+		store->dirty = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+	dirty = g_new(UIDLStoreBucket, 1);
+	*dirty = *bucket;
+	g_hash_table_replace(store->dirty, GUINT_TO_POINTER(slot + 1), dirty);
+}
+
+static const gchar *uidl_store_get_string(Pop3UIDLStore *store, guint32 str)
+{
+	if (str < store->header.str_size)
+		return store->strings + str;
+	if (store->new_str && str - store->header.str_size < store->new_str->len)
+		return store->new_str->str + (str - store->header.str_size);
+
+	return NULL;
+}
+
+/* returns the slot of @uidl, or the slot where it can be inserted */
+static gboolean uidl_store_find(Pop3UIDLStore *store, const gchar *uidl,
+				guint32 hash, guint32 *slot)
+{
+	UIDLStoreBucket bucket;
+	guint32 mask, i, n;
+	gboolean has_free = FALSE;
+	const gchar *str;
+
+	if (store->header.n_buckets == 0)
+		return FALSE;
+
+	mask = store->header.n_buckets - 1;
+
+	for (i = hash & mask, n = 0; n < store->header.n_buckets;
+	     i = (i + 1) & mask, n++) {
+		uidl_store_get_bucket(store, i, &bucket);
+		if (bucket.str == UIDL_SLOT_EMPTY) {
+			if (!has_free)
+				*slot = i;
+			return FALSE;
+		}
+		if (bucket.str == UIDL_SLOT_DELETED) {
+			if (!has_free) {
+				*slot = i;
+				has_free = TRUE;
+			}
+			continue;
+		}
+		if (bucket.hash == hash &&
+		    (str = uidl_store_get_string(store, bucket.str)) != NULL &&
+		    strcmp(str, uidl) == 0) {
+			*slot = i;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void uidl_store_unmap(Pop3UIDLStore *store)
+{
+	if (store->mfile)
+		g_mapped_file_free(store->mfile);
+	store->mfile = NULL;
+	store->buckets = store->strings = NULL;
+	memset(&store->header, 0, sizeof(store->header));
+
+	if (store->dirty)
+		g_hash_table_destroy(store->dirty);
+	store->dirty = NULL;
+	if (store->new_str)
+		g_string_free(store->new_str, TRUE);
+	store->new_str = NULL;
+}
+
+static gint uidl_store_map(Pop3UIDLStore *store)
+{
+	GMappedFile *mfile;
+	const gchar *data;
+	gsize size;
+	UIDLStoreHeader header;
+	gsize str_offset;
+
+	if (!is_file_exist(store->file))
+		return 0;
+
+	if ((mfile = g_mapped_file_new(store->file, FALSE, NULL)) == NULL) {
+		FILE_OP_ERROR(store->file, "g_mapped_file_new");
+		return -1;
+	}
+	data = g_mapped_file_get_contents(mfile);
+	size = g_mapped_file_get_length(mfile);
+
+	if (size < sizeof(header))
+		goto corrupted;
+	memcpy(&header, data, sizeof(header));
+
+	/* bound n_buckets by the file size before computing the offset,
+	   which could overflow otherwise */
+	if (memcmp(header.magic, UIDL_STORE_MAGIC, 4) != 0 ||
+	    header.version != UIDL_STORE_VERSION ||
+	    header.n_buckets == 0 ||
+	    (header.n_buckets & (header.n_buckets - 1)) != 0 ||
+	    header.n_buckets >
+	    (size - sizeof(header)) / sizeof(UIDLStoreBucket))
+		goto corrupted;
+
+	str_offset = UIDL_STORE_STRINGS_OFFSET(header.n_buckets);
+	if (header.str_size == 0 ||
+	    header.str_size > size - str_offset ||
+	    data[str_offset + header.str_size - 1] != '\0')
+		goto corrupted;
+
+	store->mfile = mfile;
+	store->header = header;
+	store->buckets = data + UIDL_STORE_BUCKETS_OFFSET;
+	store->strings = data + str_offset;
+
+	return 0;
+
+corrupted:
+	g_warning("%s: broken UIDL store. Rebuilding.\n", store->file);
+	g_mapped_file_free(mfile);
+	return -1;
+}
+
+typedef struct _UIDLEntry
+{
+	const gchar *uidl;
+	stime_t recv_time;
+} UIDLEntry;
+
+static gint uidl_store_rebuild(Pop3UIDLStore *store, GArray *entries)
+{
+	UIDLStoreHeader header;
+	UIDLStoreBucket *buckets;
+	GString *strings;
+	guint32 n_buckets = UIDL_STORE_MIN_BUCKETS;
+	guint32 mask, slot;
+	gchar *tmp;
+	FILE *fp;
+	guint i;
+
+	/* keep the load factor under 1/3 after rebuilding */
+	while (n_buckets < entries->len * 3)
+		n_buckets <<= 1;
+	mask = n_buckets - 1;
+
+	buckets = g_new0(UIDLStoreBucket, n_buckets);
+	strings = g_string_new("");
+	g_string_append_c(strings, '\0');
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, UIDL_STORE_MAGIC, 4);
+	header.version = UIDL_STORE_VERSION;
+	header.n_buckets = n_buckets;
+
+	for (i = 0; i < entries->len; i++) {
+		UIDLEntry *entry = &g_array_index(entries, UIDLEntry, i);
+		guint32 hash;
+
+		hash = uidl_hash(entry->uidl);
+		for (slot = hash & mask; buckets[slot].str != UIDL_SLOT_EMPTY;
+		     slot = (slot + 1) & mask) {
+			if (buckets[slot].hash == hash &&
+			    !strcmp(strings->str + buckets[slot].str,
+				    entry->uidl))
+				break;
+		}
+		if (buckets[slot].str == UIDL_SLOT_EMPTY) {
+			buckets[slot].hash = hash;
+			buckets[slot].str = strings->len;
+			g_string_append_len(strings, entry->uidl,
+					    strlen(entry->uidl) + 1);
+			header.n_live++;
+		}
+		buckets[slot].recv_time = entry->recv_time;
+	}
+	header.str_size = strings->len;
+
+	tmp = g_strconcat(store->file, ".tmp", NULL);
+	if ((fp = g_fopen(tmp, "wb")) == NULL) {
+		FILE_OP_ERROR(tmp, "fopen");
+		g_free(tmp);
+		g_string_free(strings, TRUE);
+		g_free(buckets);
+		return -1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(buckets, sizeof(UIDLStoreBucket), n_buckets, fp)
+	    != n_buckets ||
+	    fwrite(strings->str, strings->len, 1, fp) != 1) {
+		FILE_OP_ERROR(tmp, "fwrite");
+		fclose(fp);
+		g_unlink(tmp);
+		g_free(tmp);
+		g_string_free(strings, TRUE);
+		g_free(buckets);
+		return -1;
+	}
+
+	g_string_free(strings, TRUE);
+	g_free(buckets);
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(tmp, "fclose");
+		g_unlink(tmp);
+		g_free(tmp);
+		return -1;
+	}
+
+	uidl_store_unmap(store);
+
+	if (rename_force(tmp, store->file) < 0) {
+		FILE_OP_ERROR(store->file, "rename");
+		g_unlink(tmp);
+		g_free(tmp);
+		return -1;
+	}
+	g_free(tmp);
+
+	debug_print("UIDL store rebuilt: %s (%u entries, %u buckets)\n",
+		    store->file, header.n_live, n_buckets);
+
+	return uidl_store_map(store);
+}
+
+typedef struct _UIDLFlushData
+{
+	FILE *fp;
+	const gchar *file;
+	gint ret;
+} UIDLFlushData;
+
+static void uidl_store_write_bucket_func(gpointer key, gpointer value,
+					 gpointer data)
+{
+	UIDLFlushData *flush = (UIDLFlushData *)data;
+	guint32 slot = GPOINTER_TO_UINT(key) - 1;
+
+	if (flush->ret < 0)
+		return;
+
+	if (fseek(flush->fp, UIDL_STORE_BUCKETS_OFFSET +
+		  (glong)slot * sizeof(UIDLStoreBucket), SEEK_SET) < 0 ||
+	    fwrite(value, sizeof(UIDLStoreBucket), 1, flush->fp) != 1) {
+		FILE_OP_ERROR(flush->file, "fwrite");
+		flush->ret = -1;
+	}
+}
+
+/* write the pending changes in place */
+static gint uidl_store_flush(Pop3UIDLStore *store)
+{
+	UIDLStoreHeader header;
+	UIDLFlushData flush;
+	FILE *fp;
+
+	if (!store->dirty)
+		return 0;
+
+	if ((fp = g_fopen(store->file, "r+b")) == NULL) {
+		FILE_OP_ERROR(store->file, "fopen");
+		return -1;
+	}
+
+	header = store->header;
+	flush.fp = fp;
+	flush.file = store->file;
+	flush.ret = 0;
+
+	/* strings first, so that the buckets never point beyond them */
+	if (store->new_str && store->new_str->len > 0) {
+		if (fseek(fp, UIDL_STORE_STRINGS_OFFSET(header.n_buckets) +
+			  header.str_size, SEEK_SET) < 0 ||
+		    fwrite(store->new_str->str, store->new_str->len, 1, fp)
+		    != 1) {
+			FILE_OP_ERROR(store->file, "fwrite");
+			flush.ret = -1;
+		}
+		header.str_size += store->new_str->len;
+	}
+
+	if (flush.ret == 0)
+		g_hash_table_foreach(store->dirty,
+				     uidl_store_write_bucket_func, &flush);
+
+	if (flush.ret == 0 &&
+	    (fseek(fp, 0, SEEK_SET) < 0 ||
+	     fwrite(&header, sizeof(header), 1, fp) != 1)) {
+		FILE_OP_ERROR(store->file, "fwrite");
+		flush.ret = -1;
+	}
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(store->file, "fclose");
+		flush.ret = -1;
+	}
+
+	debug_print("UIDL store updated: %s (%u buckets written)\n",
+		    store->file, g_hash_table_size(store->dirty));
+
+	uidl_store_unmap(store);
+	if (uidl_store_map(store) < 0)
+		return -1;
+
+	return flush.ret;
+}
+
+static void uidl_store_set(Pop3UIDLStore *store, const gchar *uidl,
+			   stime_t recv_time)
+{
+	UIDLStoreBucket bucket;
+	guint32 hash, slot;
+
+	hash = uidl_hash(uidl);
+	if (uidl_store_find(store, uidl, hash, &slot)) {
+		uidl_store_get_bucket(store, slot, &bucket);
+		if (bucket.recv_time == recv_time)
+			return;
+		bucket.recv_time = recv_time;
+	} else {
+		uidl_store_get_bucket(store, slot, &bucket);
+		if (bucket.str == UIDL_SLOT_DELETED)
+			store->header.n_deleted--;
+		store->header.n_live++;
+
+		if (!store->new_str)
+			store->new_str = g_string_new(NULL);
+		bucket.hash = hash;
+		bucket.str = store->header.str_size + store->new_str->len;
+		bucket.recv_time = recv_time;
+		g_string_append_len(store->new_str, uidl, strlen(uidl) + 1);
+	}
+
+	uidl_store_set_bucket(store, slot, &bucket);
+}
+
+static void uidl_store_remove(Pop3UIDLStore *store, const gchar *uidl)
+{
+	UIDLStoreBucket bucket;
+	guint32 slot;
+
+	if (!uidl_store_find(store, uidl, uidl_hash(uidl), &slot))
+		return;
+
+	uidl_store_get_bucket(store, slot, &bucket);
+	bucket.str = UIDL_SLOT_DELETED;
+	uidl_store_set_bucket(store, slot, &bucket);
+	store->header.n_live--;
+	store->header.n_deleted++;
+}
+
+/* read the UIDL list of the old text format */
+static GArray *pop3_read_uidl_text(const gchar *path, GStringChunk *chunk)
+{
+	GArray *entries;
+	FILE *fp;
+	gchar buf[POPBUFSIZE];
+	gchar uidl[POPBUFSIZE];
+	UIDLEntry entry;
+	time_t recv_time;
+	time_t now;
+
 	if ((fp = g_fopen(path, "rb")) == NULL) {
 		if (ENOENT != errno) FILE_OP_ERROR(path, "fopen");
-		g_free(path);
-		return table;
+		return NULL;
 	}
-	g_free(path);
 
+	entries = g_array_new(FALSE, FALSE, sizeof(UIDLEntry));
 	now = time(NULL);
 
 	while (fgets(buf, sizeof(buf), fp) != NULL) {
@@ -570,49 +1018,177 @@ GHashTable *pop3_get_uidl_table(PrefsAccount *ac_prefs)
 		}
 		if (recv_time == RECV_TIME_NONE)
 			recv_time = RECV_TIME_RECEIVED;
-		g_hash_table_insert(table, g_strdup(uidl),
-				    GINT_TO_POINTER(recv_time));
+		entry.uidl = g_string_chunk_insert(chunk, uidl);
+		entry.recv_time = recv_time;
+		g_array_append_val(entries, entry);
 	}
 
 	fclose(fp);
+	return entries;
+}
+
+Pop3UIDLStore *pop3_uidl_store_open(PrefsAccount *ac_prefs)
+{
+	Pop3UIDLStore *store;
+	gchar *path;
+
+	g_return_val_if_fail(ac_prefs != NULL, NULL);
+
+	path = pop3_get_uidl_file(ac_prefs);
+
+	store = g_new0(Pop3UIDLStore, 1);
+	store->file = g_strconcat(path, UIDL_STORE_SUFFIX, NULL);
+
+	if (!is_file_exist(store->file) && is_file_exist(path)) {
+		GStringChunk *chunk;
+		GArray *entries;
+
+		debug_print("converting UIDL list: %s\n", path);
+		chunk = g_string_chunk_new(4096);
+		entries = pop3_read_uidl_text(path, chunk);
+		if (entries && uidl_store_rebuild(store, entries) == 0) {
+			if (g_unlink(path) < 0)
+				FILE_OP_ERROR(path, "unlink");
+		}
+		if (entries)
+			g_array_free(entries, TRUE);
+		g_string_chunk_free(chunk);
+	} else if (uidl_store_map(store) < 0)
+		uidl_store_unmap(store);
+
+	g_free(path);
+
+	return store;
+}
+
+void pop3_uidl_store_close(Pop3UIDLStore *store)
+{
+	if (!store)
+		return;
+
+	uidl_store_unmap(store);
+	g_free(store->file);
+	g_free(store);
+}
+
+stime_t pop3_uidl_store_lookup(Pop3UIDLStore *store, const gchar *uidl)
+{
+	UIDLStoreBucket bucket;
+	guint32 slot;
+
+	if (!store || !store->mfile)
+		return RECV_TIME_NONE;
+
+	if (!uidl_store_find(store, uidl, uidl_hash(uidl), &slot))
+		return RECV_TIME_NONE;
+
+	uidl_store_get_bucket(store, slot, &bucket);
+	return bucket.recv_time;
+}
+
+/* kept for compatibility. builds the table of UIDL -> receive time from
+   the UIDL store */
+GHashTable *pop3_get_uidl_table(PrefsAccount *ac_prefs)
+{
+	GHashTable *table;
+	Pop3UIDLStore *store;
+	UIDLStoreBucket bucket;
+	guint32 i;
+
+	table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	store = pop3_uidl_store_open(ac_prefs);
+	if (store->mfile) {
+		for (i = 0; i < store->header.n_buckets; i++) {
+			uidl_store_get_bucket(store, i, &bucket);
+			if (bucket.str == UIDL_SLOT_EMPTY ||
+			    bucket.str == UIDL_SLOT_DELETED ||
+			    bucket.str >= store->header.str_size)
+				continue;
+			g_hash_table_insert
+				(table, g_strdup(store->strings + bucket.str),
+				 GINT_TO_POINTER(bucket.recv_time));
+		}
+	}
+	pop3_uidl_store_close(store);
+
 	return table;
 }
 
 gint pop3_write_uidl_list(Pop3Session *session)
 {
-	gchar *path;
-	PrefFile *pfile;
+	Pop3UIDLStore *store;
 	Pop3MsgInfo *msg;
+	GArray *entries;
+	guint32 n_found = 0, n_removed = 0, n_used;
+	gint n_stale;
+	guint32 slot;
 	gint n;
-	gchar *uid;
+	gint ret;
 
 	if (!session->uidl_is_valid) return 0;
 
-	uid = uriencode_for_filename(session->ac_prefs->userid);
-	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   UIDL_DIR, G_DIR_SEPARATOR_S,
-			   session->ac_prefs->recv_server,
-			   "-", uid, NULL);
-	g_free(uid);
-	if ((pfile = prefs_file_open(path)) == NULL) {
-		g_free(path);
-		return -1;
+	if (session->uidl_store && session->uidl_store->mfile)
+		store = session->uidl_store;
+	else {
+		pop3_uidl_store_close(session->uidl_store);
+		store = session->uidl_store =
+			pop3_uidl_store_open(session->ac_prefs);
 	}
-	prefs_file_set_backup_generation(pfile, 0);
+
+	entries = g_array_new(FALSE, FALSE, sizeof(UIDLEntry));
 
 	for (n = 1; n <= session->count; n++) {
+		UIDLEntry entry;
+		gboolean found;
+
 		msg = &session->msg[n];
-		if (!msg->uidl || !msg->received)
+		if (!msg->uidl)
 			continue;
-		if (session->state == POP3_DONE && msg->deleted)
+		found = store->mfile &&
+			uidl_store_find(store, msg->uidl,
+					uidl_hash(msg->uidl), &slot);
+		if (!msg->received ||
+		    (session->state == POP3_DONE && msg->deleted)) {
+			if (found)
+				n_removed++;
 			continue;
-		fprintf(pfile->fp, "%s\t%ld\n", msg->uidl, msg->recv_time);
+		}
+		if (found)
+			n_found++;
+		entry.uidl = msg->uidl;
+		entry.recv_time = msg->recv_time;
+		g_array_append_val(entries, entry);
 	}
 
-	if (prefs_file_close(pfile) < 0)
-		g_warning("%s: failed to write UIDL list.\n", path);
+	/* entries no longer on the server are dropped on rebuilding */
+	n_stale = MAX((gint)(store->header.n_live - n_found - n_removed), 0);
+	n_used = store->header.n_live + store->header.n_deleted +
+		(entries->len - n_found);
 
-	g_free(path);
+	if (!store->mfile || n_used * 2 > store->header.n_buckets ||
+	    n_stale + n_removed + store->header.n_deleted >
+	    MAX(UIDL_STORE_MIN_BUCKETS / 4, entries->len / 4)) {
+		ret = uidl_store_rebuild(store, entries);
+	} else {
+		for (n = 1; n <= session->count; n++) {
+			msg = &session->msg[n];
+			if (!msg->uidl)
+				continue;
+			if (!msg->received ||
+			    (session->state == POP3_DONE && msg->deleted))
+				uidl_store_remove(store, msg->uidl);
+			else
+				uidl_store_set(store, msg->uidl,
+					       msg->recv_time);
+		}
+		ret = uidl_store_flush(store);
+	}
+
+	g_array_free(entries, TRUE);
+
+	if (ret < 0)
+		g_warning("%s: failed to write UIDL list.\n", store->file);
 
 	return 0;
 }
@@ -33,6 +33,7 @@
 
 typedef struct _Pop3MsgInfo	Pop3MsgInfo;
 typedef struct _Pop3Session	Pop3Session;
+typedef struct _Pop3UIDLStore	Pop3UIDLStore;
 
 #define POP3_SESSION(obj)	((Pop3Session *)obj)
 
@@ -136,7 +137,7 @@ struct _Pop3Session
 
 	Pop3MsgInfo *msg;
 
-	GHashTable *uidl_table;
+	Pop3UIDLStore *uidl_store;
 
 	gboolean auth_only;
 
@@ -161,6 +162,11 @@ struct _Pop3Session
 
 Session *pop3_session_new	(PrefsAccount	*account);
 
+Pop3UIDLStore *pop3_uidl_store_open	(PrefsAccount	*account);
+void pop3_uidl_store_close		(Pop3UIDLStore	*store);
+stime_t pop3_uidl_store_lookup		(Pop3UIDLStore	*store,
+					 const gchar	*uidl);
+
 GHashTable *pop3_get_uidl_table	(PrefsAccount	*account);
 gint pop3_write_uidl_list	(Pop3Session	*session);
 
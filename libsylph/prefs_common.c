@@ -355,6 +355,8 @@ static PrefParam param[] = {
 
 	{"resize_image", "TRUE", &prefs_common.resize_image, P_BOOL},
 	{"inline_image", "TRUE", &prefs_common.inline_image, P_BOOL},
+	{"textview_render_limit", "0", &prefs_common.textview_render_limit,
+	 P_INT},
 
 	/* Encoding */
 	{"default_encoding", NULL, &prefs_common.default_encoding, P_STRING},
@@ -516,6 +518,13 @@ static PrefParam param[] = {
 	{"strict_cache_check", "FALSE", &prefs_common.strict_cache_check,
 	 P_BOOL},
 	{"io_timeout_secs", "60", &prefs_common.io_timeout_secs, P_INT},
+	{"news_prefetch", "FALSE", &prefs_common.news_prefetch, P_BOOL},
+	{"news_prefetch_max_articles", "200",
+	 &prefs_common.news_prefetch_max_articles, P_INT},
+	{"news_prefetch_max_size", "10240",
+	 &prefs_common.news_prefetch_max_size, P_INT},
+	{"news_prefetch_sessions", "2", &prefs_common.news_prefetch_sessions,
+	 P_INT},
 
 	/* File selector */
 	{"filesel_prev_open_dir", NULL, &prefs_common.prev_open_dir, P_STRING},
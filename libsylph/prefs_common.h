@@ -355,6 +355,13 @@ struct _PrefsCommon
 	gint startup_online_mode;            /* Online */
 
 	gint addressbook_col_nickname;
+
+	gboolean news_prefetch;              /* Advanced */
+	gint news_prefetch_max_articles;
+	gint news_prefetch_max_size;         /* KB */
+	gint news_prefetch_sessions;
+
+	gint textview_render_limit;          /* KB, 0: no limit */
 };
 
 extern PrefsCommon prefs_common;
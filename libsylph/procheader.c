@@ -35,6 +35,7 @@
 #include "displayheader.h"
 #include "prefs_common.h"
 #include "utils.h"
+#include "slock.h"
 
 #define BUFFSIZE	8192
 
@@ -575,45 +576,129 @@ enum
 	H_X_FACE	= 11
 };
 
-MsgInfo *procheader_parse_stream(FILE *fp, MsgFlags flags, gboolean full)
+static const struct {
+	const gchar *name;
+	gint len;
+	gboolean unfold;
+} parse_fields[] = {
+	{"Date",		 4, FALSE},
+	{"From",		 4, TRUE},
+	{"To",			 2, TRUE},
+	{"Newsgroups",		10, TRUE},
+	{"Subject",		 7, TRUE},
+	{"Message-Id",		10, FALSE},
+	{"References",		10, FALSE},
+	{"In-Reply-To",		11, FALSE},
+	{"Content-Type",	12, FALSE},
+	{"Seen",		 4, FALSE},
+	{"Cc",			 2, TRUE},
+	{"X-Face",		 6, FALSE}
+};
+
+/* perfect hash of the names in parse_fields[] (generated by searching
+   a multiplier which gives no collisions) */
+#define PARSE_FIELD_HASH(name, len)				\
+	((g_ascii_tolower((name)[0]) * 13 +			\
+	  g_ascii_tolower((name)[(len) - 1]) + (len)) & 31)
+
+static const gint8 parse_field_table[32] = {
+	-1, -1, -1, H_X_FACE, -1, -1, -1, H_REFERENCES,
+	-1, H_SEEN, -1, -1, H_CC, -1, -1, H_IN_REPLY_TO,
+	-1, -1, H_SUBJECT, H_NEWSGROUPS, -1, H_TO, -1, H_MSG_ID,
+	H_CONTENT_TYPE, -1, -1, -1, -1, H_DATE, -1, H_FROM
+};
+
+static gint procheader_lookup_parse_field(const gchar *name, gint len,
+					  gboolean full)
 {
-	static HeaderEntry hentry_full[] = {{"Date:",		NULL, FALSE},
-					   {"From:",		NULL, TRUE},
-					   {"To:",		NULL, TRUE},
-					   {"Newsgroups:",	NULL, TRUE},
-					   {"Subject:",		NULL, TRUE},
-					   {"Message-Id:",	NULL, FALSE},
-					   {"References:",	NULL, FALSE},
-					   {"In-Reply-To:",	NULL, FALSE},
-					   {"Content-Type:",	NULL, FALSE},
-					   {"Seen:",		NULL, FALSE},
-					   {"Cc:",		NULL, TRUE},
-					   {"X-Face:",		NULL, FALSE},
-					   {NULL,		NULL, FALSE}};
-
-	static HeaderEntry hentry_short[] = {{"Date:",		NULL, FALSE},
-					    {"From:",		NULL, TRUE},
-					    {"To:",		NULL, TRUE},
-					    {"Newsgroups:",	NULL, TRUE},
-					    {"Subject:",	NULL, TRUE},
-					    {"Message-Id:",	NULL, FALSE},
-					    {"References:",	NULL, FALSE},
-					    {"In-Reply-To:",	NULL, FALSE},
-					    {"Content-Type:",	NULL, FALSE},
-					    {"Seen:",		NULL, FALSE},
-					    {NULL,		NULL, FALSE}};
+	gint hnum;
+
+	if (len < 2)
+		return -1;
+
+	hnum = parse_field_table[PARSE_FIELD_HASH(name, len)];
+	if (hnum < 0 || parse_fields[hnum].len != len ||
+	    g_ascii_strncasecmp(parse_fields[hnum].name, name, len) != 0)
+		return -1;
+	if (!full && hnum > H_SEEN)
+		return -1;
+
+	return hnum;
+}
+
+/* read the header up to the empty line at once */
+static gchar *procheader_read_header_block(FILE *fp)
+{
+	gchar *buf;
+	gchar *line;
+	gsize size = BUFFSIZE;
+	gsize len = 0;
+	gboolean line_head = TRUE;
+
+	buf = g_malloc(size);
+
+	for (;;) {
+		if (size - len < BUFFSIZE / 2) {
+			size *= 2;
+			buf = g_realloc(buf, size);
+		}
+		line = buf + len;
+		if (fgets(line, size - len, fp) == NULL)
+			break;
+		if (line_head && (line[0] == '\r' || line[0] == '\n'))
+			break;
+		len += strlen(line);
+		line_head = (len > 0 && buf[len - 1] == '\n');
+	}
+	buf[len] = '\0';
+
+	return buf;
+}
+
+/* unfold the field in place in the same way as
+   procheader_get_one_field() */
+static void procheader_unfold_field(gchar *str)
+{
+	gchar *p = str;
+	gchar *q = str;
+
+	while (*p != '\0') {
+		if (*p != '\n') {
+			*q++ = *p++;
+			continue;
+		}
+
+		/* replace return code and the following white spaces
+		   with a space */
+		while (q > str && *(q - 1) == '\r')
+			q--;
+		p++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p != '\n' && *p != '\0')
+			*q++ = ' ';
+	}
 
+	while (q > str && *(q - 1) == '\r')
+		q--;
+	*q = '\0';
+}
+
+MsgInfo *procheader_parse_stream(FILE *fp, MsgFlags flags, gboolean full)
+{
 	MsgInfo *msginfo;
 	gchar buf[BUFFSIZE];
+	gchar *block;
+	gchar *field;
+	gchar *next;
+	gchar *end;
+	gchar *colon;
 	gchar *p;
 	gchar *hp;
-	HeaderEntry *hentry;
 	gint hnum;
 	gchar *from = NULL, *to = NULL, *subject = NULL, *cc = NULL;
 	gchar *charset = NULL;
 
-	hentry = full ? hentry_full : hentry_short;
-
 	if (MSG_IS_QUEUED(flags)) {
 		while (fgets(buf, sizeof(buf), fp) != NULL)
 			if (buf[0] == '\r' || buf[0] == '\n') break;
@@ -624,9 +709,38 @@ MsgInfo *procheader_parse_stream(FILE *fp, MsgFlags flags, gboolean full)
 	msginfo->references = NULL;
 	msginfo->inreplyto = NULL;
 
-	while ((hnum = procheader_get_one_field(buf, sizeof(buf), fp, hentry))
-	       != -1) {
-		hp = buf + strlen(hentry[hnum].name);
+	block = procheader_read_header_block(fp);
+
+	for (field = block; *field != '\0'; field = next) {
+		/* find the end of the field including the folded lines */
+		end = field;
+		while ((end = strchr(end, '\n')) != NULL &&
+		       (end[1] == ' ' || end[1] == '\t'))
+			end++;
+		if (end) {
+			next = end + 1;
+			*end = '\0';
+		} else {
+			end = field + strlen(field);
+			next = end;
+		}
+
+		if ((colon = memchr(field, ':', end - field)) == NULL)
+			continue;
+		hnum = procheader_lookup_parse_field(field, colon - field,
+						     full);
+		if (hnum < 0)
+			continue;
+
+		if (parse_fields[hnum].unfold)
+			procheader_unfold_field(field);
+		else {
+			/* remove trailing return code */
+			while (end > field && *(end - 1) == '\r')
+				*--end = '\0';
+		}
+
+		hp = colon + 1;
 		while (*hp == ' ' || *hp == '\t') hp++;
 
 		switch (hnum) {
@@ -655,7 +769,9 @@ MsgInfo *procheader_parse_stream(FILE *fp, MsgFlags flags, gboolean full)
 					g_strconcat(p, ",", hp, NULL);
 				g_free(p);
 			} else
-				msginfo->newsgroups = g_strdup(buf + 12);
+				msginfo->newsgroups =
+					g_strdup(field[11] != '\0' ?
+						 field + 12 : hp);
 			break;
 		case H_SUBJECT:
 			if (msginfo->subject) break;
@@ -719,6 +835,8 @@ MsgInfo *procheader_parse_stream(FILE *fp, MsgFlags flags, gboolean full)
 		}
 	}
 
+	g_free(block);
+
 	if (from) {
 		msginfo->from = conv_unmime_header(from, charset);
 		subst_control(msginfo->from, ' ');
@@ -873,9 +991,180 @@ static gint procheader_scan_date_string(const gchar *str,
 	return -1;
 }
 
-stime_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
+static const gchar monthstr[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+/* cache of recently parsed Date strings. mailing list traffic often
+   contains the same Date string many times */
+#define DATE_CACHE_SIZE		64
+#define DATE_CACHE_STR_LEN	64
+
+typedef struct _DateCacheEntry
+{
+	gchar str[DATE_CACHE_STR_LEN];
+	stime_t timer;
+} DateCacheEntry;
+
+static DateCacheEntry date_cache[DATE_CACHE_SIZE];
+S_LOCK_DEFINE_STATIC(date_cache);
+
+static gboolean procheader_date_cache_lookup(const gchar *str, stime_t *timer)
+{
+	DateCacheEntry *entry;
+	gboolean found = FALSE;
+
+	if (strlen(str) >= DATE_CACHE_STR_LEN)
+		return FALSE;
+
+	entry = &date_cache[g_str_hash(str) % DATE_CACHE_SIZE];
+
+	S_LOCK(date_cache);
+	if (entry->str[0] != '\0' && strcmp(entry->str, str) == 0) {
+		*timer = entry->timer;
+		found = TRUE;
+	}
+	S_UNLOCK(date_cache);
+
+	return found;
+}
+
+static void procheader_date_cache_add(const gchar *str, stime_t timer)
+{
+	DateCacheEntry *entry;
+
+	if (strlen(str) >= DATE_CACHE_STR_LEN)
+		return;
+
+	entry = &date_cache[g_str_hash(str) % DATE_CACHE_SIZE];
+
+	S_LOCK(date_cache);
+	strcpy(entry->str, str);
+	entry->timer = timer;
+	S_UNLOCK(date_cache);
+}
+
+static const gchar *procheader_date_read_num(const gchar *p, gint max_digits,
+					     gint *num)
+{
+	gint n = 0;
+	gint i;
+
+	for (i = 0; i < max_digits && g_ascii_isdigit(*p); i++, p++)
+		n = n * 10 + (*p - '0');
+	if (i == 0)
+		return NULL;
+
+	*num = n;
+	return p;
+}
+
+/* number of days since 1970-01-01 of the proleptic Gregorian calendar */
+static gint64 procheader_days_from_civil(gint y, gint m, gint d)
+{
+	gint64 era;
+	gint yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/* parse the usual RFC 2822 form "[Wdy,] DD Mon YYYY hh:mm[:ss] zone"
+   with an explicit zone, and convert it to UTC without mktime().
+   returns -1 for anything else, which is left to the generic parser */
+static gint procheader_date_parse_fast(const gchar *str, stime_t *timer)
+{
+	const gchar *p = str;
+	const gchar *m;
+	gint day, month = 0, year, hh, mm, ss = 0;
+	gint zone;
+	gint64 t;
+
+	while (g_ascii_isspace(*p)) p++;
+
+	/* weekday */
+	if (g_ascii_isalpha(*p)) {
+		while (g_ascii_isalpha(*p)) p++;
+		if (*p == ',') p++;
+		while (g_ascii_isspace(*p)) p++;
+	}
+
+	if ((p = procheader_date_read_num(p, 2, &day)) == NULL ||
+	    !g_ascii_isspace(*p))
+		return -1;
+	while (g_ascii_isspace(*p)) p++;
+
+	if (!g_ascii_isalpha(p[0]) || !g_ascii_isalpha(p[1]) ||
+	    !g_ascii_isalpha(p[2]))
+		return -1;
+	for (m = monthstr; *m != '\0'; m += 3) {
+		if (!g_ascii_strncasecmp(m, p, 3)) {
+			month = (gint)(m - monthstr) / 3 + 1;
+			break;
+		}
+	}
+	if (month == 0)
+		return -1;
+	while (g_ascii_isalpha(*p)) p++;
+	if (!g_ascii_isspace(*p))
+		return -1;
+	while (g_ascii_isspace(*p)) p++;
+
+	if ((p = procheader_date_read_num(p, 4, &year)) == NULL ||
+	    !g_ascii_isspace(*p))
+		return -1;
+	while (g_ascii_isspace(*p)) p++;
+
+	/* Y2K compliant :) */
+	if (year < 1000) {
+		if (year < 50)
+			year += 2000;
+		else
+			year += 1900;
+	}
+
+	if ((p = procheader_date_read_num(p, 2, &hh)) == NULL || *p++ != ':')
+		return -1;
+	if ((p = procheader_date_read_num(p, 2, &mm)) == NULL)
+		return -1;
+	if (*p == ':') {
+		if ((p = procheader_date_read_num(p + 1, 2, &ss)) == NULL)
+			return -1;
+	}
+	if (!g_ascii_isspace(*p))
+		return -1;
+	while (g_ascii_isspace(*p)) p++;
+
+	/* only numeric zones and UT / GMT. the others are handled by
+	   remote_tzoffset_sec() */
+	if ((p[0] == '+' || p[0] == '-') &&
+	    g_ascii_isdigit(p[1]) && g_ascii_isdigit(p[2]) &&
+	    g_ascii_isdigit(p[3]) && g_ascii_isdigit(p[4])) {
+		zone = (((p[1] - '0') * 10 + (p[2] - '0')) * 60 +
+			(p[3] - '0') * 10 + (p[4] - '0')) * 60;
+		if (p[0] == '-')
+			zone = -zone;
+	} else if (!strncmp(p, "UT", 2) || !strncmp(p, "GM", 2))
+		zone = 0;
+	else
+		return -1;
+
+	t = procheader_days_from_civil(year, month, day) * 86400 +
+		hh * 3600 + mm * 60 + ss - zone;
+
+	/* leave out-of-range dates to the generic parser */
+	if (t < 0 || t >= G_MAXINT - 12 * 3600)
+		return -1;
+
+	*timer = (stime_t)t;
+	return 0;
+}
+
+static gint procheader_date_parse_full(const gchar *src, stime_t *timer_p)
 {
-	static gchar monthstr[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 	gchar weekday[11];
 	gint day;
 	gchar month[10];
@@ -884,7 +1173,7 @@ stime_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
 	gchar zone[6];
 	GDateMonth dmonth = G_DATE_BAD_MONTH;
 	struct tm t;
-	gchar *p;
+	const gchar *p;
 	time_t timer_;
 	time_t tz_offset;
 	stime_t timer;
@@ -892,9 +1181,7 @@ stime_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
 	if (procheader_scan_date_string(src, weekday, &day, month, &year,
 					&hh, &mm, &ss, zone) < 0) {
 		g_warning("procheader_scan_date_string: date parse failed: %s", src);
-		if (dest && len > 0)
-			strncpy2(dest, src, len);
-		return 0;
+		return -1;
 	}
 
 	/* Y2K compliant :) */
@@ -934,9 +1221,7 @@ stime_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
 			timer_ = G_MAXINT - 12 * 3600;
 		} else {
 			g_warning("mktime: can't convert date: %s", src);
-			if (dest)
-				dest[0] = '\0';
-			return 0;
+			return -2;
 		}
 	}
 
@@ -947,6 +1232,35 @@ stime_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
 			timer += tzoffset_sec(&timer) - tz_offset;
 	}
 
+	*timer_p = timer;
+	return 0;
+}
+
+stime_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
+{
+	stime_t timer = 0;
+	gint ret = 0;
+
+	/* only the results of the fast path are cached. they do not
+	   depend on the local time zone, while the generic parser
+	   interprets a date without a known zone as local time */
+	if (!procheader_date_cache_lookup(src, &timer)) {
+		if (procheader_date_parse_fast(src, &timer) == 0)
+			procheader_date_cache_add(src, timer);
+		else
+			ret = procheader_date_parse_full(src, &timer);
+	}
+
+	if (ret == -1) {
+		if (dest && len > 0)
+			strncpy2(dest, src, len);
+		return 0;
+	} else if (ret < 0) {
+		if (dest)
+			dest[0] = '\0';
+		return 0;
+	}
+
 	if (dest)
 		procheader_date_get_localtime(dest, len, timer);
 
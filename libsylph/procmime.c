@@ -29,6 +29,7 @@
 #include <string.h>
 #include <locale.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "procmime.h"
 #include "procheader.h"
@@ -38,7 +39,9 @@
 #include "html.h"
 #include "codeconv.h"
 #include "utils.h"
+#include "slock.h"
 #include "prefs_common.h"
+#include "folder.h"
 
 #undef MIME_DEBUG
 /* #define MIME_DEBUG */
@@ -50,6 +53,30 @@
 
 #define MAX_MIME_LEVEL	64
 
+/* MIME structure cache. Each record is:
+ *   msgnum, record length, size, mtime, inode, hash of the head,
+ *   number of parts, parts...
+ * and each part (in pre-order) is:
+ *   parent index, relation to parent, MimeInfo fields */
+#define MIME_CACHE_MAX_SIZE	(4 * 1024 * 1024)
+#define MIME_CACHE_HEAD_SIZE	512
+
+#define MIME_CACHE_CHILD	0
+#define MIME_CACHE_SUB		1
+
+typedef struct _MimeCacheIndex
+{
+	GHashTable *table;	/* msgnum -> record offset */
+	off_t size;
+} MimeCacheIndex;
+
+S_LOCK_DEFINE_STATIC(mime_cache);
+static GHashTable *mime_cache_table = NULL;
+
+static MimeInfo *procmime_mime_cache_lookup	(MsgInfo	*msginfo);
+static void procmime_mime_cache_store		(MsgInfo	*msginfo,
+						 MimeInfo	*mimeinfo);
+
 static GHashTable *procmime_get_mime_type_table	(void);
 static GList *procmime_get_mime_type_list	(const gchar *file);
 
@@ -192,6 +219,9 @@ MimeInfo *procmime_scan_message(MsgInfo *msginfo)
 
 	g_return_val_if_fail(msginfo != NULL, NULL);
 
+	if ((mimeinfo = procmime_mime_cache_lookup(msginfo)) != NULL)
+		return mimeinfo;
+
 	if ((fp = procmsg_open_message_decrypted(msginfo, &mimeinfo)) == NULL)
 		return NULL;
 
@@ -203,6 +233,7 @@ MimeInfo *procmime_scan_message(MsgInfo *msginfo)
 		if (mimeinfo->mime_type == MIME_MULTIPART ||
 		    mimeinfo->mime_type == MIME_MESSAGE_RFC822)
 			procmime_scan_multipart_message(mimeinfo, fp);
+		procmime_mime_cache_store(msginfo, mimeinfo);
 	}
 
 	fclose(fp);
@@ -210,6 +241,484 @@ MimeInfo *procmime_scan_message(MsgInfo *msginfo)
 	return mimeinfo;
 }
 
+static gchar *procmime_get_mime_cache_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, NULL);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, MIME_CACHE_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
+static gboolean procmime_mime_cache_is_usable(MsgInfo *msginfo)
+{
+	if (!msginfo->folder || !msginfo->folder->path || msginfo->msgnum <= 0)
+		return FALSE;
+	/* IMAP and news cache files have no mtime to compare with */
+	if (msginfo->mtime == 0)
+		return FALSE;
+	/* the tree of a decrypted message describes the plaintext file */
+	if (MSG_IS_ENCRYPTED(msginfo->flags) || msginfo->encinfo)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* size and mtime don't tell a message rewritten within the same second,
+   so the inode and the first bytes of the file are also compared */
+static gboolean procmime_mime_cache_get_file_id(MsgInfo *msginfo,
+						guint32 *ino, guint32 *head)
+{
+	gchar *file;
+	GStatBuf s;
+	FILE *fp;
+	guchar buf[MIME_CACHE_HEAD_SIZE];
+	size_t len, i;
+	guint32 h = 5381;
+
+	file = procmsg_get_message_file_path(msginfo);
+	if (!file)
+		return FALSE;
+	if (g_stat(file, &s) < 0 || (fp = g_fopen(file, "rb")) == NULL) {
+		g_free(file);
+		return FALSE;
+	}
+	len = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	g_free(file);
+
+	for (i = 0; i < len; i++)
+		h = (h << 5) + h + buf[i];
+
+	*ino = (guint32)s.st_ino;
+	*head = h;
+
+	return TRUE;
+}
+
+static void procmime_mime_cache_index_free(MimeCacheIndex *idx)
+{
+	g_hash_table_destroy(idx->table);
+	g_free(idx);
+}
+
+static void procmime_mime_cache_index_reset(MimeCacheIndex *idx)
+{
+	g_hash_table_destroy(idx->table);
+	idx->table = g_hash_table_new(NULL, NULL);
+	idx->size = 0;
+}
+
+/* must be called with mime_cache locked */
+static MimeCacheIndex *procmime_mime_cache_get_index(const gchar *file)
+{
+	MimeCacheIndex *idx;
+	GStatBuf s;
+	FILE *fp;
+	gchar buf[BUFFSIZE];
+	guint32 rec[2];
+	off_t offset;
+
+	if (!mime_cache_table)
+		mime_cache_table = g_hash_table_new_full
+			(g_str_hash, g_str_equal, g_free,
+			 (GDestroyNotify)procmime_mime_cache_index_free);
+
+	idx = g_hash_table_lookup(mime_cache_table, file);
+	if (!idx) {
+		idx = g_new0(MimeCacheIndex, 1);
+		idx->table = g_hash_table_new(NULL, NULL);
+		idx->size = -1;
+		g_hash_table_insert(mime_cache_table, g_strdup(file), idx);
+	}
+
+	if (g_stat(file, &s) < 0) {
+		procmime_mime_cache_index_reset(idx);
+		return idx;
+	}
+	/* the cache file was not touched since it was indexed */
+	if (idx->size == s.st_size)
+		return idx;
+
+	procmime_mime_cache_index_reset(idx);
+
+	fp = procmsg_open_data_file(file, MIME_CACHE_VERSION, DATA_READ,
+				    buf, sizeof(buf));
+	if (!fp)
+		return idx;
+
+	offset = sizeof(guint32);
+	while (fread(rec, sizeof(rec), 1, fp) == 1) {
+		if (fseek(fp, rec[1], SEEK_CUR) < 0)
+			break;
+		if (offset + sizeof(rec) + rec[1] > s.st_size)
+			break;
+		/* later records override earlier ones */
+		g_hash_table_insert(idx->table, GUINT_TO_POINTER(rec[0]),
+				    GSIZE_TO_POINTER(offset));
+		offset += sizeof(rec) + rec[1];
+	}
+
+	fclose(fp);
+	idx->size = offset;
+
+	return idx;
+}
+
+static gboolean procmime_mime_cache_read_int(const gchar **p,
+					     const gchar *endp, guint32 *n)
+{
+	if (endp - *p < sizeof(guint32))
+		return FALSE;
+	memcpy(n, *p, sizeof(guint32));
+	*p += sizeof(guint32);
+
+	return TRUE;
+}
+
+static gboolean procmime_mime_cache_read_str(const gchar **p,
+					     const gchar *endp, gchar **str)
+{
+	guint32 len;
+
+	*str = NULL;
+	if (!procmime_mime_cache_read_int(p, endp, &len))
+		return FALSE;
+	if (len > endp - *p)
+		return FALSE;
+	if (len > 0) {
+		*str = g_strndup(*p, len);
+		*p += len;
+	}
+
+	return TRUE;
+}
+
+static MimeInfo *procmime_mime_cache_parse(MsgInfo *msginfo,
+					   guint32 file_ino, guint32 file_head,
+					   const gchar *p, const gchar *endp)
+{
+	MimeInfo **parts;
+	MimeInfo *root = NULL;
+	guint32 size, mtime, ino, head, nparts;
+	guint32 parent, relation, encoding_type, mime_type;
+	guint32 fpos, part_size, content_size, level;
+	guint32 i;
+
+	if (!procmime_mime_cache_read_int(&p, endp, &size) ||
+	    !procmime_mime_cache_read_int(&p, endp, &mtime) ||
+	    !procmime_mime_cache_read_int(&p, endp, &ino) ||
+	    !procmime_mime_cache_read_int(&p, endp, &head) ||
+	    !procmime_mime_cache_read_int(&p, endp, &nparts))
+		return NULL;
+	if (size != (guint32)msginfo->size || mtime != (guint32)msginfo->mtime)
+		return NULL;
+	if (ino != file_ino || head != file_head)
+		return NULL;
+	if (nparts == 0 || nparts > (endp - p) / (sizeof(guint32) * 8))
+		return NULL;
+
+	parts = g_new0(MimeInfo *, nparts);
+
+	for (i = 0; i < nparts; i++) {
+		MimeInfo *partinfo;
+
+		if (!procmime_mime_cache_read_int(&p, endp, &parent) ||
+		    !procmime_mime_cache_read_int(&p, endp, &relation) ||
+		    !procmime_mime_cache_read_int(&p, endp, &encoding_type) ||
+		    !procmime_mime_cache_read_int(&p, endp, &mime_type) ||
+		    !procmime_mime_cache_read_int(&p, endp, &fpos) ||
+		    !procmime_mime_cache_read_int(&p, endp, &part_size) ||
+		    !procmime_mime_cache_read_int(&p, endp, &content_size) ||
+		    !procmime_mime_cache_read_int(&p, endp, &level))
+			break;
+		if ((i == 0) != (parent == (guint32)-1))
+			break;
+		if (i > 0 && parent >= i)
+			break;
+		if (encoding_type > ENC_UNKNOWN || mime_type > MIME_UNKNOWN)
+			break;
+
+		partinfo = procmime_mimeinfo_new();
+		partinfo->encoding_type = encoding_type;
+		partinfo->mime_type = mime_type;
+		partinfo->fpos = fpos;
+		partinfo->size = part_size;
+		partinfo->content_size = content_size;
+
+		if (i == 0)
+			root = partinfo;
+		else if (relation == MIME_CACHE_SUB) {
+			if (parts[parent]->sub) {
+				procmime_mimeinfo_free_all(partinfo);
+				break;
+			}
+			parts[parent]->sub = partinfo;
+			partinfo->main = parts[parent];
+			partinfo->parent = parts[parent]->parent;
+		} else
+			procmime_mimeinfo_insert(parts[parent], partinfo);
+		partinfo->level = level;
+		parts[i] = partinfo;
+
+		if (!procmime_mime_cache_read_str(&p, endp, &partinfo->encoding) ||
+		    !procmime_mime_cache_read_str(&p, endp, &partinfo->content_type) ||
+		    !procmime_mime_cache_read_str(&p, endp, &partinfo->charset) ||
+		    !procmime_mime_cache_read_str(&p, endp, &partinfo->name) ||
+		    !procmime_mime_cache_read_str(&p, endp, &partinfo->boundary) ||
+		    !procmime_mime_cache_read_str(&p, endp, &partinfo->content_disposition) ||
+		    !procmime_mime_cache_read_str(&p, endp, &partinfo->filename))
+			break;
+	}
+
+	g_free(parts);
+
+	if (i < nparts) {
+		g_warning("MIME cache data is corrupted\n");
+		procmime_mimeinfo_free_all(root);
+		return NULL;
+	}
+
+	return root;
+}
+
+static MimeInfo *procmime_mime_cache_lookup(MsgInfo *msginfo)
+{
+	MimeCacheIndex *idx;
+	MimeInfo *mimeinfo = NULL;
+	gchar *file;
+	gpointer offset;
+	FILE *fp;
+	guint32 rec[2];
+	guint32 ino, head;
+	gchar *data;
+
+	if (!procmime_mime_cache_is_usable(msginfo))
+		return NULL;
+
+	file = procmime_get_mime_cache_file(msginfo->folder);
+	if (!file)
+		return NULL;
+
+	S_LOCK(mime_cache);
+
+	idx = procmime_mime_cache_get_index(file);
+	if (!g_hash_table_lookup_extended(idx->table,
+					  GUINT_TO_POINTER(msginfo->msgnum),
+					  NULL, &offset)) {
+		S_UNLOCK(mime_cache);
+		g_free(file);
+		return NULL;
+	}
+
+	if (!procmime_mime_cache_get_file_id(msginfo, &ino, &head)) {
+		S_UNLOCK(mime_cache);
+		g_free(file);
+		return NULL;
+	}
+
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		S_UNLOCK(mime_cache);
+		g_free(file);
+		return NULL;
+	}
+
+	if (fseek(fp, GPOINTER_TO_SIZE(offset), SEEK_SET) == 0 &&
+	    fread(rec, sizeof(rec), 1, fp) == 1 &&
+	    rec[0] == msginfo->msgnum) {
+		data = g_malloc(rec[1]);
+		if (fread(data, rec[1], 1, fp) == 1)
+			mimeinfo = procmime_mime_cache_parse
+				(msginfo, ino, head, data, data + rec[1]);
+		g_free(data);
+	}
+
+	fclose(fp);
+	S_UNLOCK(mime_cache);
+
+	if (mimeinfo)
+		debug_print("procmime_scan_message: %s/%d: "
+			    "MIME structure found in cache\n",
+			    msginfo->folder->path, msginfo->msgnum);
+
+	g_free(file);
+	return mimeinfo;
+}
+
+static void procmime_mime_cache_append_int(GString *data, guint32 n)
+{
+	g_string_append_len(data, (gchar *)&n, sizeof(n));
+}
+
+static void procmime_mime_cache_append_str(GString *data, const gchar *str)
+{
+	guint32 len;
+
+	len = str ? strlen(str) : 0;
+	procmime_mime_cache_append_int(data, len);
+	if (len > 0)
+		g_string_append_len(data, str, len);
+}
+
+static void procmime_mime_cache_append_part(GString *data, MimeInfo *mimeinfo,
+					    guint32 parent, guint32 relation,
+					    guint32 *nparts)
+{
+	MimeInfo *child;
+	guint32 i = (*nparts)++;
+
+	procmime_mime_cache_append_int(data, parent);
+	procmime_mime_cache_append_int(data, relation);
+	procmime_mime_cache_append_int(data, mimeinfo->encoding_type);
+	procmime_mime_cache_append_int(data, mimeinfo->mime_type);
+	procmime_mime_cache_append_int(data, mimeinfo->fpos);
+	procmime_mime_cache_append_int(data, mimeinfo->size);
+	procmime_mime_cache_append_int(data, mimeinfo->content_size);
+	procmime_mime_cache_append_int(data, mimeinfo->level);
+	procmime_mime_cache_append_str(data, mimeinfo->encoding);
+	procmime_mime_cache_append_str(data, mimeinfo->content_type);
+	procmime_mime_cache_append_str(data, mimeinfo->charset);
+	procmime_mime_cache_append_str(data, mimeinfo->name);
+	procmime_mime_cache_append_str(data, mimeinfo->boundary);
+	procmime_mime_cache_append_str(data, mimeinfo->content_disposition);
+	procmime_mime_cache_append_str(data, mimeinfo->filename);
+
+	if (mimeinfo->sub)
+		procmime_mime_cache_append_part(data, mimeinfo->sub, i,
+						MIME_CACHE_SUB, nparts);
+	for (child = mimeinfo->children; child != NULL; child = child->next)
+		procmime_mime_cache_append_part(data, child, i,
+						MIME_CACHE_CHILD, nparts);
+}
+
+static void procmime_mime_cache_store(MsgInfo *msginfo, MimeInfo *mimeinfo)
+{
+	MimeCacheIndex *idx;
+	GString *parts;
+	GString *data;
+	guint32 nparts = 0;
+	guint32 ino, head;
+	gchar *file;
+	FILE *fp;
+	off_t offset;
+
+	if (!procmime_mime_cache_is_usable(msginfo))
+		return;
+	/* single part messages are cheap to scan */
+	if (mimeinfo->mime_type != MIME_MULTIPART &&
+	    mimeinfo->mime_type != MIME_MESSAGE_RFC822)
+		return;
+	if (mimeinfo->content_type &&
+	    !g_ascii_strcasecmp(mimeinfo->content_type, "multipart/encrypted"))
+		return;
+	if (!procmime_mime_cache_get_file_id(msginfo, &ino, &head))
+		return;
+
+	file = procmime_get_mime_cache_file(msginfo->folder);
+	if (!file)
+		return;
+
+	parts = g_string_new(NULL);
+	procmime_mime_cache_append_part(parts, mimeinfo, (guint32)-1, 0,
+					&nparts);
+
+	data = g_string_sized_new(parts->len + sizeof(guint32) * 7);
+	procmime_mime_cache_append_int(data, msginfo->msgnum);
+	procmime_mime_cache_append_int(data, parts->len + sizeof(guint32) * 5);
+	procmime_mime_cache_append_int(data, msginfo->size);
+	procmime_mime_cache_append_int(data, msginfo->mtime);
+	procmime_mime_cache_append_int(data, ino);
+	procmime_mime_cache_append_int(data, head);
+	procmime_mime_cache_append_int(data, nparts);
+	g_string_append_len(data, parts->str, parts->len);
+	g_string_free(parts, TRUE);
+
+	S_LOCK(mime_cache);
+
+	idx = procmime_mime_cache_get_index(file);
+	if (idx->size >= MIME_CACHE_MAX_SIZE) {
+		debug_print("procmime_mime_cache_store: %s exceeds %d bytes. "
+			    "Discarding it.\n", file, MIME_CACHE_MAX_SIZE);
+		fp = procmsg_open_data_file(file, MIME_CACHE_VERSION,
+					    DATA_WRITE, NULL, 0);
+	} else
+		fp = procmsg_open_data_file(file, MIME_CACHE_VERSION,
+					    DATA_APPEND, NULL, 0);
+	if (!fp) {
+		S_UNLOCK(mime_cache);
+		g_string_free(data, TRUE);
+		g_free(file);
+		return;
+	}
+
+	if (fseek(fp, 0L, SEEK_END) < 0 || (offset = ftell(fp)) < 0) {
+		FILE_OP_ERROR(file, "fseek");
+		fclose(fp);
+		S_UNLOCK(mime_cache);
+		g_string_free(data, TRUE);
+		g_free(file);
+		return;
+	}
+	/* the file was (re)created */
+	if (offset <= sizeof(guint32))
+		procmime_mime_cache_index_reset(idx);
+
+	if (fwrite(data->str, data->len, 1, fp) != 1) {
+		FILE_OP_ERROR(file, "fwrite");
+		idx->size = -1;
+	} else if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		idx->size = -1;
+		fp = NULL;
+	} else {
+		fp = NULL;
+		g_hash_table_insert(idx->table,
+				    GUINT_TO_POINTER(msginfo->msgnum),
+				    GSIZE_TO_POINTER(offset));
+		idx->size = offset + data->len;
+	}
+	if (fp)
+		fclose(fp);
+
+	S_UNLOCK(mime_cache);
+
+	g_string_free(data, TRUE);
+	g_free(file);
+}
+
+void procmime_clear_mime_cache(FolderItem *item)
+{
+	gchar *file;
+
+	g_return_if_fail(item != NULL);
+
+	if (!item->path)
+		return;
+
+	file = procmime_get_mime_cache_file(item);
+	if (!file)
+		return;
+
+	S_LOCK(mime_cache);
+	if (is_file_exist(file) && g_unlink(file) < 0)
+		FILE_OP_ERROR(file, "unlink");
+	if (mime_cache_table) {
+		g_hash_table_remove(mime_cache_table, file);
+		if (g_hash_table_size(mime_cache_table) == 0) {
+			g_hash_table_destroy(mime_cache_table);
+			mime_cache_table = NULL;
+		}
+	}
+	S_UNLOCK(mime_cache);
+
+	g_free(file);
+}
+
 MimeInfo *procmime_scan_message_stream(FILE *fp)
 {
 	MimeInfo *mimeinfo;
@@ -1139,6 +1648,268 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 	return outfp;
 }
 
+/*
+ * Pull-based decoding of a MIME part.
+ *
+ * A ProcMimeStream reads the body of a part from INFP up to the next
+ * boundary, decodes the transfer encoding, normalizes line breaks of text
+ * parts and optionally converts the charset, one line at a time.  It uses
+ * fixed buffers of BUFFSIZE bytes (lines longer than that are returned in
+ * pieces, like fgets()), so no temporary file is needed whatever the size
+ * of the part is.
+ */
+
+struct _ProcMimeStream
+{
+	FILE *fp;
+	gchar *boundary;
+	gint boundary_len;
+	EncodingType encoding_type;
+	gboolean normalize_lbreak;
+	gboolean eof;
+
+	Base64Decoder *decoder;
+	gboolean uu_begin;
+	gchar prev_empty_line[3];
+	gboolean cont_line;
+
+	/* decoded data which is not returned yet */
+	gchar pending[BUFFSIZE * 2];
+	gint pending_len;
+
+	gchar line[BUFFSIZE + 2];
+	gchar *src_encoding;
+	gchar *dest_encoding;
+	gboolean convert;
+	gchar *conv_str;
+	gboolean conv_fail;
+};
+
+static void procmime_stream_append(ProcMimeStream *stream, const gchar *data,
+				   gint len)
+{
+	len = MIN(len, (gint)sizeof(stream->pending) - stream->pending_len);
+	memcpy(stream->pending + stream->pending_len, data, len);
+	stream->pending_len += len;
+}
+
+/* decode one raw line of input into the pending buffer.
+   Returns FALSE at the end of the part. */
+static gboolean procmime_stream_fill(ProcMimeStream *stream)
+{
+	gchar buf[BUFFSIZE];
+	gchar outbuf[BUFFSIZE];
+	gint len;
+	gboolean cont_line;
+
+	if (stream->eof)
+		return FALSE;
+
+	if (fgets(buf, sizeof(buf), stream->fp) == NULL ||
+	    (stream->boundary &&
+	     IS_BOUNDARY(buf, stream->boundary, stream->boundary_len))) {
+		stream->eof = TRUE;
+		if (!stream->boundary && stream->prev_empty_line[0]) {
+			procmime_stream_append
+				(stream, stream->prev_empty_line,
+				 strlen(stream->prev_empty_line));
+			stream->prev_empty_line[0] = '\0';
+		}
+		return stream->pending_len > 0;
+	}
+
+	len = strlen(buf);
+	cont_line = stream->cont_line;
+	stream->cont_line = (len > 0 && buf[len - 1] != '\n');
+
+	switch (stream->encoding_type) {
+	case ENC_BASE64:
+		len = base64_decoder_decode(stream->decoder, buf,
+					    (guchar *)outbuf);
+		if (len < 0) {
+			g_warning("Bad BASE64 content\n");
+			stream->eof = TRUE;
+			return stream->pending_len > 0;
+		}
+		procmime_stream_append(stream, outbuf, len);
+		break;
+	case ENC_X_UUENCODE:
+		if (!stream->uu_begin) {
+			if (!strncmp(buf, "begin ", 6))
+				stream->uu_begin = TRUE;
+			break;
+		}
+		len = fromuutobits(outbuf, buf);
+		if (len <= 0) {
+			if (len < 0)
+				g_warning("Bad UUENCODE content(%d)\n", len);
+			stream->eof = TRUE;
+			return stream->pending_len > 0;
+		}
+		procmime_stream_append(stream, outbuf, len);
+		break;
+	default:
+		if (stream->prev_empty_line[0]) {
+			procmime_stream_append
+				(stream, stream->prev_empty_line,
+				 strlen(stream->prev_empty_line));
+			stream->prev_empty_line[0] = '\0';
+		}
+		if (!cont_line &&
+		    (buf[0] == '\n' || (buf[0] == '\r' && buf[1] == '\n')))
+			strcpy(stream->prev_empty_line, buf);
+		else if (stream->encoding_type == ENC_QUOTED_PRINTABLE) {
+			len = qp_decode_line(buf);
+			procmime_stream_append(stream, buf, len);
+		} else
+			procmime_stream_append(stream, buf, len);
+		break;
+	}
+
+	return TRUE;
+}
+
+static ProcMimeStream *procmime_stream_new_real(FILE *infp,
+						MimeInfo *mimeinfo)
+{
+	ProcMimeStream *stream;
+	ContentType content_type;
+
+	stream = g_new0(ProcMimeStream, 1);
+	stream->fp = infp;
+	stream->encoding_type = mimeinfo->encoding_type;
+
+	if (mimeinfo->parent && mimeinfo->parent->boundary) {
+		/* the stream may outlive the MimeInfo tree */
+		stream->boundary = g_strdup(mimeinfo->parent->boundary);
+		stream->boundary_len = strlen(stream->boundary);
+	}
+
+	content_type = procmime_scan_mime_type(mimeinfo->content_type);
+	if (content_type == MIME_TEXT || content_type == MIME_TEXT_HTML)
+		stream->normalize_lbreak = TRUE;
+
+	if (stream->encoding_type == ENC_BASE64)
+		stream->decoder = base64_decoder_new();
+
+	return stream;
+}
+
+/* decode the part MIMEINFO read from the current position of INFP
+   (the beginning of the body), like procmime_decode_content(). */
+ProcMimeStream *procmime_decode_stream_new(FILE *infp, MimeInfo *mimeinfo)
+{
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+
+	return procmime_stream_new_real(infp, mimeinfo);
+}
+
+/* decode the text part MIMEINFO of INFP and convert it to ENCODING,
+   like procmime_get_text_content(). HTML is not rendered. */
+ProcMimeStream *procmime_text_stream_new(MimeInfo *mimeinfo, FILE *infp,
+					 const gchar *encoding)
+{
+	ProcMimeStream *stream;
+	gchar buf[BUFFSIZE];
+
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+	g_return_val_if_fail(infp != NULL, NULL);
+
+	if (fseek(infp, mimeinfo->fpos, SEEK_SET) < 0) {
+		perror("fseek");
+		return NULL;
+	}
+
+	while (fgets(buf, sizeof(buf), infp) != NULL)
+		if (buf[0] == '\r' || buf[0] == '\n') break;
+
+	stream = procmime_stream_new_real(infp, mimeinfo);
+	stream->convert = TRUE;
+	stream->src_encoding = g_strdup
+		(prefs_common.force_charset ? prefs_common.force_charset
+		 : mimeinfo->charset ? mimeinfo->charset
+		 : prefs_common.default_encoding);
+	stream->dest_encoding = g_strdup(encoding);
+
+	return stream;
+}
+
+/* return the next line of the decoded part, or NULL at the end.
+   The returned string is owned by STREAM and valid until the next call. */
+const gchar *procmime_stream_gets(ProcMimeStream *stream)
+{
+	gchar *nl;
+	gint len;
+
+	g_return_val_if_fail(stream != NULL, NULL);
+
+	g_free(stream->conv_str);
+	stream->conv_str = NULL;
+
+	for (;;) {
+		nl = memchr(stream->pending, '\n', stream->pending_len);
+		if (nl || stream->pending_len >= BUFFSIZE - 1)
+			break;
+		if (!procmime_stream_fill(stream))
+			break;
+	}
+
+	if (nl)
+		len = nl - stream->pending + 1;
+	else
+		len = MIN(stream->pending_len, BUFFSIZE - 1);
+	if (len == 0)
+		return NULL;
+
+	/* keep a CR which may be followed by LF in the next chunk */
+	if (!nl && stream->normalize_lbreak && len > 1 &&
+	    stream->pending[len - 1] == '\r' && !stream->eof)
+		len--;
+
+	memcpy(stream->line, stream->pending, len);
+	stream->line[len] = '\0';
+	stream->pending_len -= len;
+	memmove(stream->pending, stream->pending + len, stream->pending_len);
+
+	if (stream->normalize_lbreak && nl) {
+#ifdef G_OS_WIN32
+		strretchomp(stream->line);
+		strcat(stream->line, "\r\n");
+#else
+		strcrchomp(stream->line);
+#endif
+	}
+
+	if (stream->convert) {
+		stream->conv_str = conv_codeset_strdup(stream->line,
+						       stream->src_encoding,
+						       stream->dest_encoding);
+		if (stream->conv_str)
+			return stream->conv_str;
+		stream->conv_fail = TRUE;
+	}
+
+	return stream->line;
+}
+
+void procmime_stream_free(ProcMimeStream *stream)
+{
+	if (!stream)
+		return;
+
+	if (stream->conv_fail)
+		g_warning(_("procmime_stream_gets(): Code conversion failed.\n"));
+
+	if (stream->decoder)
+		base64_decoder_free(stream->decoder);
+	g_free(stream->boundary);
+	g_free(stream->conv_str);
+	g_free(stream->src_encoding);
+	g_free(stream->dest_encoding);
+	g_free(stream);
+}
+
 gint procmime_get_part(const gchar *outfile, const gchar *infile,
 		       MimeInfo *mimeinfo)
 {
@@ -1275,7 +2046,6 @@ FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 {
 	FILE *tmpfp, *outfp;
 	const gchar *src_encoding;
-	gboolean conv_fail = FALSE;
 	gchar buf[BUFFSIZE];
 
 	g_return_val_if_fail(mimeinfo != NULL, NULL);
@@ -1283,6 +2053,32 @@ FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
 			     mimeinfo->mime_type == MIME_TEXT_HTML, NULL);
 
+	if (mimeinfo->mime_type == MIME_TEXT) {
+		ProcMimeStream *stream;
+		const gchar *str;
+
+		stream = procmime_text_stream_new(mimeinfo, infp, encoding);
+		if (!stream)
+			return NULL;
+		if ((outfp = my_tmpfile()) == NULL) {
+			perror("tmpfile");
+			procmime_stream_free(stream);
+			return NULL;
+		}
+		while ((str = procmime_stream_gets(stream)) != NULL)
+			fputs(str, outfp);
+		procmime_stream_free(stream);
+
+		if (fflush(outfp) == EOF) {
+			perror("fflush");
+			fclose(outfp);
+			return NULL;
+		}
+		rewind(outfp);
+
+		return outfp;
+	}
+
 	if (fseek(infp, mimeinfo->fpos, SEEK_SET) < 0) {
 		perror("fseek");
 		return NULL;
@@ -1305,20 +2101,7 @@ FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 		: mimeinfo->charset ? mimeinfo->charset
 		: prefs_common.default_encoding;
 
-	if (mimeinfo->mime_type == MIME_TEXT) {
-		while (fgets(buf, sizeof(buf), tmpfp) != NULL) {
-			gchar *str;
-
-			str = conv_codeset_strdup(buf, src_encoding, encoding);
-			if (str) {
-				fputs(str, outfp);
-				g_free(str);
-			} else {
-				conv_fail = TRUE;
-				fputs(buf, outfp);
-			}
-		}
-	} else if (mimeinfo->mime_type == MIME_TEXT_HTML) {
+	if (mimeinfo->mime_type == MIME_TEXT_HTML) {
 		HTMLParser *parser;
 		CodeConverter *conv;
 		const gchar *str;
@@ -1332,9 +2115,6 @@ FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 		conv_code_converter_destroy(conv);
 	}
 
-	if (conv_fail)
-		g_warning(_("procmime_get_text_content(): Code conversion failed.\n"));
-
 	fclose(tmpfp);
 	if (fflush(outfp) == EOF) {
 		perror("fflush");
@@ -1399,6 +2179,30 @@ gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
 		return FALSE;
 	}
 
+	if (mimeinfo->mime_type == MIME_TEXT) {
+		ProcMimeStream *stream;
+		const gchar *line;
+		gboolean found = FALSE;
+
+		stream = procmime_text_stream_new(mimeinfo, infp, NULL);
+		if (!stream) {
+			fclose(infp);
+			return FALSE;
+		}
+		while ((line = procmime_stream_gets(stream)) != NULL) {
+			strncpy2(buf, line, sizeof(buf));
+			strretchomp(buf);
+			if (find_func(buf, str)) {
+				found = TRUE;
+				break;
+			}
+		}
+		procmime_stream_free(stream);
+		fclose(infp);
+
+		return found;
+	}
+
 	outfp = procmime_get_text_content(mimeinfo, infp, NULL);
 	fclose(infp);
 
@@ -30,6 +30,7 @@
 typedef struct _MimeType	MimeType;
 typedef struct _MailCap		MailCap;
 typedef struct _MimeInfo	MimeInfo;
+typedef struct _ProcMimeStream	ProcMimeStream;
 
 #include "procmsg.h"
 #include "utils.h"
@@ -146,6 +147,8 @@ MimeInfo *procmime_scan_message_stream	(FILE		*fp);
 void procmime_scan_multipart_message	(MimeInfo	*mimeinfo,
 					 FILE		*fp);
 
+void procmime_clear_mime_cache		(FolderItem	*item);
+
 /* scan headers */
 
 void procmime_scan_encoding		(MimeInfo	*mimeinfo,
@@ -186,6 +189,16 @@ FILE *procmime_get_text_content		(MimeInfo	*mimeinfo,
 FILE *procmime_get_first_text_content	(MsgInfo	*msginfo,
 					 const gchar	*encoding);
 
+ProcMimeStream *procmime_decode_stream_new
+					(FILE		*infp,
+					 MimeInfo	*mimeinfo);
+ProcMimeStream *procmime_text_stream_new
+					(MimeInfo	*mimeinfo,
+					 FILE		*infp,
+					 const gchar	*encoding);
+const gchar *procmime_stream_gets	(ProcMimeStream	*stream);
+void procmime_stream_free		(ProcMimeStream	*stream);
+
 gboolean procmime_find_string_part	(MimeInfo	*mimeinfo,
 					 const gchar	*filename,
 					 const gchar	*str,
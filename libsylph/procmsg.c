@@ -33,12 +33,32 @@
 #include "prefs_common.h"
 #include "folder.h"
 #include "codeconv.h"
+#include "slock.h"
 
 typedef struct _MsgFlagInfo {
 	guint msgnum;
 	MsgFlags flags;
 } MsgFlagInfo;
 
+#define MARK_BUF_SIZE		512	/* 64 entries */
+#define MARK_FP_CACHE_SIZE	8
+#define MARK_SYNC_INTERVAL	1000	/* msec */
+
+typedef struct _MarkBuf {
+	gchar *file;
+	GByteArray *data;
+	FILE *fp;
+} MarkBuf;
+
+/* write-behind buffers of the flags appended by procmsg_add_flags(),
+   keyed by the mark file. up to MARK_FP_CACHE_SIZE of them keep their
+   mark file open for appending. */
+static GHashTable *mark_buf_table = NULL;
+static GList *mark_fp_list = NULL;	/* most recently used first */
+static guint mark_sync_tag = 0;
+
+S_LOCK_DEFINE_STATIC(mark_buf);
+
 static GSList *procmsg_read_cache_queue		(FolderItem	*item,
 						 gboolean	 scan_file);
 
@@ -857,14 +877,116 @@ static void procmsg_flush_folder_foreach_func(gpointer key, gpointer val,
 
 void procmsg_flush_folder_foreach(GHashTable *folder_table)
 {
+	procmsg_sync_mark_files();
 	g_hash_table_foreach(folder_table, procmsg_flush_folder_foreach_func,
 			     NULL);
 }
 
+/* must be called with mark_buf locked */
+static void procmsg_mark_buf_write(MarkBuf *mbuf)
+{
+	if (mbuf->data->len == 0)
+		return;
+
+	if (mbuf->fp)
+		mark_fp_list = g_list_remove(mark_fp_list, mbuf);
+	else {
+		if (g_list_length(mark_fp_list) >= MARK_FP_CACHE_SIZE) {
+			GList *last = g_list_last(mark_fp_list);
+			MarkBuf *lru = (MarkBuf *)last->data;
+
+			if (fclose(lru->fp) == EOF)
+				FILE_OP_ERROR(lru->file, "fclose");
+			lru->fp = NULL;
+			mark_fp_list = g_list_delete_link(mark_fp_list, last);
+		}
+
+		mbuf->fp = procmsg_open_data_file(mbuf->file, MARK_VERSION,
+						  DATA_APPEND, NULL, 0);
+		if (!mbuf->fp) {
+			g_warning(_("can't open mark file\n"));
+			g_byte_array_set_size(mbuf->data, 0);
+			return;
+		}
+	}
+	mark_fp_list = g_list_prepend(mark_fp_list, mbuf);
+
+	if (fwrite(mbuf->data->data, mbuf->data->len, 1, mbuf->fp) != 1)
+		FILE_OP_ERROR(mbuf->file, "fwrite");
+	g_byte_array_set_size(mbuf->data, 0);
+}
+
+/* must be called with mark_buf locked */
+static void procmsg_mark_buf_free(MarkBuf *mbuf)
+{
+	procmsg_mark_buf_write(mbuf);
+	if (mbuf->fp) {
+		if (fclose(mbuf->fp) == EOF)
+			FILE_OP_ERROR(mbuf->file, "fclose");
+		mark_fp_list = g_list_remove(mark_fp_list, mbuf);
+	}
+	g_byte_array_free(mbuf->data, TRUE);
+	g_free(mbuf->file);
+	g_free(mbuf);
+}
+
+static gboolean procmsg_mark_buf_free_func(gpointer key, gpointer value,
+					   gpointer data)
+{
+	procmsg_mark_buf_free((MarkBuf *)value);
+	return TRUE;
+}
+
+/* write out the buffered flags of the mark file before it is opened */
+static void procmsg_mark_buf_close(const gchar *file)
+{
+	MarkBuf *mbuf;
+
+	if (!file)
+		return;
+
+	S_LOCK(mark_buf);
+	if (mark_buf_table &&
+	    (mbuf = g_hash_table_lookup(mark_buf_table, file)) != NULL) {
+		g_hash_table_remove(mark_buf_table, file);
+		procmsg_mark_buf_free(mbuf);
+	}
+	S_UNLOCK(mark_buf);
+}
+
+/* write out all the buffered flags and close the cached mark files */
+void procmsg_sync_mark_files(void)
+{
+	S_LOCK(mark_buf);
+	if (mark_buf_table && g_hash_table_size(mark_buf_table) > 0) {
+		debug_print("procmsg_sync_mark_files: syncing %u mark files\n",
+			    g_hash_table_size(mark_buf_table));
+		g_hash_table_foreach_remove(mark_buf_table,
+					    procmsg_mark_buf_free_func, NULL);
+	}
+	if (mark_sync_tag > 0) {
+		g_source_remove(mark_sync_tag);
+		mark_sync_tag = 0;
+	}
+	S_UNLOCK(mark_buf);
+}
+
+static gboolean procmsg_sync_mark_files_timeout_func(gpointer data)
+{
+	S_LOCK(mark_buf);
+	mark_sync_tag = 0;
+	S_UNLOCK(mark_buf);
+
+	procmsg_sync_mark_files();
+
+	return FALSE;
+}
+
 void procmsg_add_flags(FolderItem *item, gint num, MsgFlags flags)
 {
-	FILE *fp;
-	MsgInfo msginfo;
+	gchar *markfile;
+	MarkBuf *mbuf;
+	guint32 idata;
 
 	g_return_if_fail(item != NULL);
 
@@ -873,16 +995,38 @@ void procmsg_add_flags(FolderItem *item, gint num, MsgFlags flags)
 		return;
 	}
 
-	if ((fp = procmsg_open_mark_file(item, DATA_APPEND)) == NULL) {
-		g_warning(_("can't open mark file\n"));
-		return;
-	}
+	markfile = folder_item_get_mark_file(item);
+	g_return_if_fail(markfile != NULL);
 
-	msginfo.msgnum = num;
-	msginfo.flags = flags;
+	S_LOCK(mark_buf);
 
-	procmsg_write_flags(&msginfo, fp);
-	fclose(fp);
+	if (!mark_buf_table)
+		mark_buf_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	mbuf = g_hash_table_lookup(mark_buf_table, markfile);
+	if (!mbuf) {
+		mbuf = g_new0(MarkBuf, 1);
+		mbuf->file = markfile;
+		mbuf->data = g_byte_array_sized_new(MARK_BUF_SIZE);
+		g_hash_table_insert(mark_buf_table, mbuf->file, mbuf);
+	} else
+		g_free(markfile);
+
+	/* same as procmsg_write_flags() */
+	idata = (guint32)num;
+	g_byte_array_append(mbuf->data, (guint8 *)&idata, sizeof(idata));
+	idata = (guint32)flags.perm_flags;
+	g_byte_array_append(mbuf->data, (guint8 *)&idata, sizeof(idata));
+
+	if (mbuf->data->len >= MARK_BUF_SIZE)
+		procmsg_mark_buf_write(mbuf);
+
+	if (mark_sync_tag == 0)
+		mark_sync_tag = g_timeout_add_full
+			(G_PRIORITY_LOW, MARK_SYNC_INTERVAL,
+			 procmsg_sync_mark_files_timeout_func, NULL, NULL);
+
+	S_UNLOCK(mark_buf);
 }
 
 struct MarkSum {
@@ -1168,6 +1312,7 @@ FILE *procmsg_open_mark_file(FolderItem *item, DataOpenMode mode)
 	FILE *fp;
 
 	markfile = folder_item_get_mark_file(item);
+	procmsg_mark_buf_close(markfile);
 	fp = procmsg_open_data_file(markfile, MARK_VERSION, mode, NULL, 0);
 	g_free(markfile);
 
@@ -1181,6 +1326,8 @@ void procmsg_clear_cache(FolderItem *item)
 	fp = procmsg_open_cache_file(item, DATA_WRITE);
 	if (fp)
 		fclose(fp);
+
+	procmime_clear_mime_cache(item);
 }
 
 void procmsg_clear_mark(FolderItem *item)
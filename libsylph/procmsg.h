@@ -269,6 +269,7 @@ void	procmsg_flush_folder_foreach	(GHashTable	*folder_table);
 void	procmsg_add_flags		(FolderItem	*item,
 					 gint		 num,
 					 MsgFlags	 flags);
+void	procmsg_sync_mark_files		(void);
 
 void	procmsg_get_mark_sum		(FolderItem	*item,
 					 gint		*new,
@@ -0,0 +1,223 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* checks that a command condition gives the same results when the
+   command is kept running with "coproc:" as when it is executed for each
+   message, and prints the messages per second of both */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "procmsg.h"
+#include "utils.h"
+
+#define N_MESSAGES	200
+
+/* exits with 0 if the header has "X-Test: yes". With no argument, it
+   reads the file names from stdin and writes one status per line. Only
+   builtins are used, so that starting the shell is the main cost. */
+static const gchar check_script[] =
+	"check()\n"
+	"{\n"
+	"	while read line; do\n"
+	"		case \"$line\" in\n"
+	"		\"X-Test: yes\"*) return 0;;\n"
+	"		\"\") return 1;;\n"
+	"		esac\n"
+	"	done < \"$1\"\n"
+	"	return 1\n"
+	"}\n"
+	"if [ $# -gt 0 ]; then check \"$1\"; exit $?; fi\n"
+	"while read file; do check \"$file\"; echo $?; done\n";
+
+static gint failed = 0;
+static guint32 seed = 1;
+
+static guint32 test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static MsgInfo *create_message(const gchar *dir, gint num, gboolean *match)
+{
+	MsgInfo *msginfo;
+	gchar *file;
+	FILE *fp;
+
+	file = g_strdup_printf("%s%c%d", dir, G_DIR_SEPARATOR, num);
+	if ((fp = g_fopen(file, "wb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		g_free(file);
+		return NULL;
+	}
+
+	*match = (test_random() % 3 == 0);
+	fprintf(fp, "From: user%d@example.com\n", num);
+	fprintf(fp, "Subject: message %d\n", num);
+	if (*match)
+		fprintf(fp, "X-Test: yes\n");
+	else if (test_random() % 2 == 0)
+		fprintf(fp, "X-Test: no\n");
+	fprintf(fp, "\nX-Test: yes\n");
+	fclose(fp);
+
+	msginfo = g_new0(MsgInfo, 1);
+	msginfo->msgnum = num;
+	msginfo->file_path = file;
+
+	return msginfo;
+}
+
+static FilterRule *create_rule(const gchar *cmdline)
+{
+	FilterCond *cond;
+	FilterAction *action;
+
+	cond = filter_cond_new(FLT_COND_CMD_TEST, 0, 0, NULL, cmdline);
+	action = filter_action_new(FLT_ACTION_MARK, NULL);
+
+	return filter_rule_new("test", FLT_OR, g_slist_append(NULL, cond),
+			       g_slist_append(NULL, action));
+}
+
+static gdouble match_all(const gchar *label, FilterRule *rule,
+			 MsgInfo *msgs[], gboolean result[])
+{
+	FilterInfo *fltinfo;
+	GTimer *timer;
+	gdouble elapsed;
+	gint i;
+
+	timer = g_timer_new();
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		fltinfo = filter_info_new();
+		result[i] = filter_match_rule(rule, msgs[i], NULL, fltinfo);
+		if (fltinfo->error != FLT_ERROR_OK) {
+			g_print("FAIL: message %d: error (%s)\n", i + 1,
+				label);
+			failed++;
+		}
+		filter_info_free(fltinfo);
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+static void test_cmd_test(const gchar *dir)
+{
+	MsgInfo *msgs[N_MESSAGES];
+	gboolean expected[N_MESSAGES];
+	gboolean spawn_result[N_MESSAGES], coproc_result[N_MESSAGES];
+	FilterRule *spawn_rule, *coproc_rule;
+	gchar *script, *cmdline;
+	gdouble spawn_time, coproc_time;
+	gint i;
+
+	script = g_strconcat(dir, G_DIR_SEPARATOR_S, "check.sh", NULL);
+	if (str_write_to_file(check_script, script) < 0) {
+		g_print("FAIL: can't write %s\n", script);
+		failed++;
+		g_free(script);
+		return;
+	}
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		msgs[i] = create_message(dir, i + 1, &expected[i]);
+		if (!msgs[i]) {
+			g_print("FAIL: can't write message %d\n", i + 1);
+			failed++;
+			return;
+		}
+	}
+
+	cmdline = g_strconcat("sh ", script, NULL);
+	spawn_rule = create_rule(cmdline);
+	g_free(cmdline);
+	cmdline = g_strconcat(FILTER_COPROC_PREFIX, "sh ", script, NULL);
+	coproc_rule = create_rule(cmdline);
+	g_free(cmdline);
+
+	spawn_time = match_all("spawn", spawn_rule, msgs, spawn_result);
+	coproc_time = match_all("coproc", coproc_rule, msgs, coproc_result);
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		if (spawn_result[i] != expected[i] ||
+		    coproc_result[i] != expected[i]) {
+			g_print("FAIL: message %d: expected %d, "
+				"got %d (spawn) %d (coproc)\n", i + 1,
+				expected[i], spawn_result[i],
+				coproc_result[i]);
+			failed++;
+		}
+	}
+
+	g_print("command test: %d messages: %.1f msgs/sec (spawn), "
+		"%.1f msgs/sec (coproc)\n", N_MESSAGES,
+		spawn_time > 0.0 ? N_MESSAGES / spawn_time : 0.0,
+		coproc_time > 0.0 ? N_MESSAGES / coproc_time : 0.0);
+
+	filter_coproc_stop_all();
+
+	filter_rule_free(coproc_rule);
+	filter_rule_free(spawn_rule);
+	for (i = 0; i < N_MESSAGES; i++)
+		procmsg_msginfo_free(msgs[i]);
+	g_free(script);
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *dir;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	dir = g_strdup_printf("%s%ctest_filter.%d", g_get_tmp_dir(),
+			      G_DIR_SEPARATOR, getpid());
+	if (make_dir_hier(dir) < 0) {
+		g_print("FAIL: can't create %s\n", dir);
+		return 1;
+	}
+
+	test_cmd_test(dir);
+
+	remove_dir_recursive(dir);
+	g_free(dir);
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
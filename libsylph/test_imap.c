@@ -0,0 +1,424 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* appends messages to a local IMAP4 stand-in with each set of the
+   capabilities used by imap_add_msgs(), and checks that the server
+   received the same data as canonicalize_file() writes. The stand-in
+   sends each response after a latency (msec, the first argument), as a
+   remote server would. */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "folder.h"
+#include "procmsg.h"
+#include "prefs_account.h"
+#include "prefs_common.h"
+#include "socket.h"
+#include "utils.h"
+
+#define N_MESSAGES	200
+#define DEFAULT_LATENCY	2	/* msec */
+#define SERVER_BUFSIZE	1024
+
+typedef struct _ImapServer
+{
+	gint sock;
+	const gchar *capability;
+	gint reject;		/* message which is refused, or -1 */
+	gint latency;
+
+	GPtrArray *msgs;	/* GString of the stored messages */
+	GAsyncQueue *queue;	/* ImapResponse to be sent */
+	FILE *out;
+} ImapServer;
+
+typedef struct _ImapResponse
+{
+	GTimeVal due;
+	gchar *str;
+} ImapResponse;
+
+static gint failed = 0;
+static gint latency = DEFAULT_LATENCY;
+
+/* the response is sent after the latency from when the request was
+   received, so that the pipelined requests are answered together */
+static void server_respond(ImapServer *server, const gchar *format, ...)
+	G_GNUC_PRINTF(2, 3);
+
+static void server_respond(ImapServer *server, const gchar *format, ...)
+{
+	ImapResponse *resp;
+	va_list args;
+
+	resp = g_new(ImapResponse, 1);
+	g_get_current_time(&resp->due);
+	g_time_val_add(&resp->due, server->latency * 1000);
+	va_start(args, format);
+	resp->str = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	g_async_queue_push(server->queue, resp);
+}
+
+static gpointer server_write_func(gpointer data)
+{
+	ImapServer *server = (ImapServer *)data;
+	ImapResponse *resp;
+	GTimeVal now;
+	glong wait;
+
+	for (;;) {
+		resp = g_async_queue_pop(server->queue);
+		if (!resp->str) {
+			g_free(resp);
+			break;
+		}
+
+		g_get_current_time(&now);
+		wait = (resp->due.tv_sec - now.tv_sec) * G_USEC_PER_SEC +
+			resp->due.tv_usec - now.tv_usec;
+		if (wait > 0)
+			g_usleep(wait);
+
+		fputs(resp->str, server->out);
+		if (g_async_queue_length(server->queue) <= 0)
+			fflush(server->out);
+		g_free(resp->str);
+		g_free(resp);
+	}
+
+	fflush(server->out);
+
+	return NULL;
+}
+
+/* read the literals of APPEND (and MULTIAPPEND) beginning with line */
+static void server_append(ImapServer *server, FILE *in, const gchar *tag,
+			  gchar *line)
+{
+	GString *msg;
+	gchar *p;
+	gint first = server->msgs->len + 1;
+	gint size;
+	gboolean refused = FALSE;
+
+	for (;;) {
+		strretchomp(line);
+		if (*line == '\0')
+			break;
+		if ((p = strrchr(line, '{')) == NULL) {
+			server_respond(server, "%s BAD no literal\r\n", tag);
+			return;
+		}
+		size = atoi(p + 1);
+		if (!strchr(p, '+'))
+			server_respond(server, "+ Ready for literal data\r\n");
+
+		msg = g_string_sized_new(size);
+		g_string_set_size(msg, size);
+		if (fread(msg->str, 1, size, in) != size) {
+			g_string_free(msg, TRUE);
+			return;
+		}
+		if (server->reject == server->msgs->len &&
+		    strstr(msg->str, "X-Refuse: yes")) {
+			refused = TRUE;
+			g_string_free(msg, TRUE);
+		} else
+			g_ptr_array_add(server->msgs, msg);
+
+		if (fgets(line, SERVER_BUFSIZE, in) == NULL)
+			return;
+	}
+
+	if (refused)
+		server_respond(server, "%s NO refused\r\n", tag);
+	else if (first == server->msgs->len)
+		server_respond(server, "%s OK [APPENDUID 1 %d] done\r\n",
+			       tag, first);
+	else
+		server_respond(server, "%s OK [APPENDUID 1 %d:%d] done\r\n",
+			       tag, first, server->msgs->len);
+}
+
+static gpointer server_func(gpointer data)
+{
+	ImapServer *server = (ImapServer *)data;
+	GThread *writer;
+	FILE *in;
+	gchar line[SERVER_BUFSIZE];
+	gchar tag[16], cmd[16];
+	gint fd;
+
+	if ((fd = fd_accept(server->sock)) < 0)
+		return NULL;
+	in = fdopen(fd, "rb");
+	server->out = fdopen(dup(fd), "wb");
+	writer = g_thread_create(server_write_func, server, TRUE, NULL);
+
+	server_respond(server, "* PREAUTH IMAP4 stand-in ready\r\n");
+
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (sscanf(line, "%15s %15s", tag, cmd) != 2)
+			continue;
+
+		if (!g_ascii_strcasecmp(cmd, "CAPABILITY"))
+			server_respond(server, "* CAPABILITY %s\r\n"
+				       "%s OK done\r\n",
+				       server->capability, tag);
+		else if (!g_ascii_strcasecmp(cmd, "NAMESPACE"))
+			server_respond(server, "* NAMESPACE "
+				       "((\"\" \"/\")) NIL NIL\r\n"
+				       "%s OK done\r\n", tag);
+		else if (!g_ascii_strcasecmp(cmd, "STATUS"))
+			server_respond(server, "* STATUS \"INBOX\" "
+				       "(MESSAGES %d RECENT 0 UIDNEXT %d "
+				       "UIDVALIDITY 1 UNSEEN 0)\r\n"
+				       "%s OK done\r\n", server->msgs->len,
+				       server->msgs->len + 1, tag);
+		else if (!g_ascii_strcasecmp(cmd, "APPEND"))
+			server_append(server, in, tag, line);
+		else if (!g_ascii_strcasecmp(cmd, "LOGOUT")) {
+			server_respond(server, "* BYE\r\n%s OK done\r\n", tag);
+			break;
+		} else
+			server_respond(server, "%s OK done\r\n", tag);
+	}
+
+	g_async_queue_push(server->queue, g_new0(ImapResponse, 1));
+	g_thread_join(writer);
+	fclose(server->out);
+	fclose(in);
+
+	return NULL;
+}
+
+static GSList *create_messages(const gchar *dir)
+{
+	GSList *file_list = NULL;
+	MsgFileInfo *fileinfo;
+	GString *str;
+	gchar *file;
+	gint i, j;
+
+	str = g_string_new(NULL);
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		g_string_printf(str, "From: user%d@example.com\n"
+				"To: test@example.com\n"
+				"Subject: message %d\n"
+				"Date: Mon, 19 Oct 2026 12:%02d:00 +0900\n",
+				i, i, i % 60);
+		if (i % 50 == 10)
+			g_string_append(str, "X-Refuse: yes\n");
+		g_string_append(str, "\n");
+		/* some are larger than the limit of LITERAL-, and some
+		   have CRLF already */
+		for (j = 0; j < (i % 7 == 0 ? 200 : 5); j++)
+			g_string_append_printf(str, "line %d of message %d%s",
+					       j, i,
+					       i % 5 == 0 ? "\r\n" : "\n");
+		if (i % 11 == 0)
+			g_string_append(str, "no line break");
+
+		file = g_strdup_printf("%s%c%d", dir, G_DIR_SEPARATOR, i + 1);
+		str_write_to_file(str->str, file);
+
+		fileinfo = g_new0(MsgFileInfo, 1);
+		fileinfo->file = file;
+		file_list = g_slist_append(file_list, fileinfo);
+	}
+
+	g_string_free(str, TRUE);
+
+	return file_list;
+}
+
+static void check_messages(ImapServer *server, GSList *file_list,
+			   const gchar *dir)
+{
+	GSList *cur;
+	GString *msg;
+	gchar *file, *data;
+	gint i = 0;
+	gint n;
+
+	file = g_strconcat(dir, G_DIR_SEPARATOR_S, "canonical", NULL);
+
+	for (cur = file_list, n = 0; cur != NULL && n < server->msgs->len;
+	     cur = cur->next, i++) {
+		if (server->reject == i)
+			continue;
+		msg = g_ptr_array_index(server->msgs, n++);
+		canonicalize_file(((MsgFileInfo *)cur->data)->file, file);
+		data = file_read_to_str(file);
+		if (!data || strcmp(data, msg->str) != 0) {
+			g_print("FAIL: %s: message %d differs\n",
+				server->capability, i + 1);
+			failed++;
+		}
+		g_free(data);
+	}
+
+	g_free(file);
+}
+
+static void test_add_msgs(const gchar *dir, GSList *file_list,
+			  const gchar *capability, gint reject)
+{
+	ImapServer server;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	GThread *thread;
+	PrefsAccount *ac;
+	Folder *folder;
+	FolderItem *item;
+	GTimer *timer;
+	gint ret;
+	gint i;
+
+	server.capability = capability;
+	server.reject = reject;
+	server.latency = latency;
+	server.msgs = g_ptr_array_new();
+	server.queue = g_async_queue_new();
+	if ((server.sock = fd_open_inet(0)) < 0 ||
+	    getsockname(server.sock, (struct sockaddr *)&addr, &len) < 0) {
+		g_print("FAIL: can't open the server socket\n");
+		failed++;
+		return;
+	}
+	thread = g_thread_create(server_func, &server, TRUE, NULL);
+
+	ac = g_new0(PrefsAccount, 1);
+	ac->protocol = A_IMAP4;
+	ac->recv_server = g_strdup("127.0.0.1");
+	ac->set_imapport = TRUE;
+	ac->imapport = ntohs(addr.sin_port);
+	ac->userid = g_strdup("user");
+	ac->passwd = g_strdup("pass");
+
+	folder = folder_new(F_IMAP, "imap", NULL);
+	folder->account = ac;
+	folder_add(folder);
+	item = folder_item_new("INBOX", "INBOX");
+	folder_item_append(FOLDER_ITEM(folder->node->data), item);
+
+	timer = g_timer_new();
+	ret = folder_item_add_msgs(item, file_list, FALSE, NULL);
+	g_print("%s: %d messages: %.2f sec\n", capability, server.msgs->len,
+		g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	if (reject < 0 && (ret != N_MESSAGES ||
+			   server.msgs->len != N_MESSAGES)) {
+		g_print("FAIL: %s: returned %d, %d messages stored\n",
+			capability, ret, server.msgs->len);
+		failed++;
+	}
+	if (reject >= 0 && (ret != -1 || server.msgs->len == 0)) {
+		g_print("FAIL: %s: returned %d on refusal, %d stored\n",
+			capability, ret, server.msgs->len);
+		failed++;
+	}
+	/* the messages which were stored must be counted even if one of
+	   them was refused */
+	if (item->total != server.msgs->len) {
+		g_print("FAIL: %s: %d messages counted, %d stored\n",
+			capability, item->total, server.msgs->len);
+		failed++;
+	}
+	check_messages(&server, file_list, dir);
+
+	folder_destroy(folder);
+	g_free(ac->passwd);
+	g_free(ac->userid);
+	g_free(ac->recv_server);
+	g_free(ac);
+
+	g_thread_join(thread);
+	fd_close(server.sock);
+	for (i = 0; i < server.msgs->len; i++)
+		g_string_free(g_ptr_array_index(server.msgs, i), TRUE);
+	g_ptr_array_free(server.msgs, TRUE);
+	g_async_queue_unref(server.queue);
+}
+
+int main(int argc, char *argv[])
+{
+	GSList *file_list, *cur;
+	gchar *dir;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	if (argc > 1)
+		latency = atoi(argv[1]);
+
+	dir = g_strdup_printf("%s%ctest_imap.%d", g_get_tmp_dir(),
+			      G_DIR_SEPARATOR, getpid());
+	if (make_dir_hier(dir) < 0) {
+		g_print("FAIL: can't create %s\n", dir);
+		return 1;
+	}
+	set_rc_dir(dir);
+	prefs_common.online_mode = TRUE;
+
+	file_list = create_messages(dir);
+
+	test_add_msgs(dir, file_list, "IMAP4rev1 UIDPLUS", -1);
+	test_add_msgs(dir, file_list, "IMAP4rev1 UIDPLUS LITERAL+", -1);
+	test_add_msgs(dir, file_list, "IMAP4rev1 UIDPLUS LITERAL-", -1);
+	test_add_msgs(dir, file_list,
+		      "IMAP4rev1 UIDPLUS MULTIAPPEND LITERAL+", -1);
+	/* the APPENDs after the refused one are stored too */
+	test_add_msgs(dir, file_list, "IMAP4rev1 UIDPLUS LITERAL+", 10);
+
+	for (cur = file_list; cur != NULL; cur = cur->next) {
+		MsgFileInfo *fileinfo = (MsgFileInfo *)cur->data;
+		g_free(fileinfo->file);
+		g_free(fileinfo);
+	}
+	g_slist_free(file_list);
+
+	remove_dir_recursive(dir);
+	g_free(dir);
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
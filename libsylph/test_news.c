@@ -0,0 +1,272 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* gets the article list of a group of 500000 articles from a local NNTP
+   stand-in, once with To and Cc in the overview and once with them
+   retrieved by XHDR, and checks that every article has its own headers.
+   Some articles are missing from the overview, so that a positional
+   match of the XHDR lines would be detected. */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "folder.h"
+#include "news.h"
+#include "procmsg.h"
+#include "prefs_account.h"
+#include "prefs_common.h"
+#include "socket.h"
+#include "utils.h"
+
+#define N_ARTICLES	500000
+#define TEST_GROUP	"test.group"
+
+typedef struct _NewsServer
+{
+	gint sock;
+	gboolean over_to_cc;
+} NewsServer;
+
+static gint failed = 0;
+
+#define ARTICLE_EXISTS(num)	((num) % 7 != 0)
+#define ARTICLE_HAS_CC(num)	((num) % 3 == 0)
+
+static void server_write_over(FILE *fp, gint num, gboolean over_to_cc)
+{
+	fprintf(fp, "%d\tarticle %d\tuser%d@example.com\t"
+		"Mon, 19 Oct 2026 12:00:00 +0900\t<%d@example.com>\t\t"
+		"%d\t20\tXref: localhost " TEST_GROUP ":%d",
+		num, num, num % 1000, num, 1000 + num % 500, num);
+	if (over_to_cc) {
+		fprintf(fp, "\tTo: group%d@example.com", num % 100);
+		if (ARTICLE_HAS_CC(num))
+			fprintf(fp, "\tCc: cc%d@example.com", num);
+		else
+			fprintf(fp, "\tCc:");
+	}
+	fprintf(fp, "\r\n");
+}
+
+static void server_command(FILE *fp, NewsServer *server, const gchar *cmd)
+{
+	gchar header[16];
+	gint first, last, num;
+
+	if (!g_ascii_strncasecmp(cmd, "GROUP ", 6)) {
+		fprintf(fp, "211 %d 1 %d " TEST_GROUP "\r\n",
+			N_ARTICLES, N_ARTICLES);
+	} else if (!g_ascii_strcasecmp(cmd, "LIST OVERVIEW.FMT")) {
+		fprintf(fp, "215 Order of fields in overview database.\r\n"
+			"Subject:\r\nFrom:\r\nDate:\r\nMessage-ID:\r\n"
+			"References:\r\n:bytes\r\n:lines\r\nXref:full\r\n");
+		if (server->over_to_cc)
+			fprintf(fp, "To:full\r\nCc:full\r\n");
+		fprintf(fp, ".\r\n");
+	} else if (sscanf(cmd, "XOVER %d-%d", &first, &last) == 2) {
+		fprintf(fp, "224 Overview information follows\r\n");
+		for (num = first; num <= last; num++) {
+			if (ARTICLE_EXISTS(num))
+				server_write_over(fp, num, server->over_to_cc);
+		}
+		fprintf(fp, ".\r\n");
+	} else if (sscanf(cmd, "XHDR %15s %d-%d", header, &first, &last)
+		   == 3) {
+		/* also lists the articles which are not in the overview */
+		fprintf(fp, "221 %s fields follow\r\n", header);
+		for (num = first; num <= last; num++) {
+			if (!g_ascii_strcasecmp(header, "to"))
+				fprintf(fp, "%d group%d@example.com\r\n",
+					num, num % 100);
+			else if (ARTICLE_HAS_CC(num))
+				fprintf(fp, "%d cc%d@example.com\r\n",
+					num, num);
+		}
+		fprintf(fp, ".\r\n");
+	} else if (!g_ascii_strncasecmp(cmd, "MODE ", 5)) {
+		fprintf(fp, "200 Posting allowed\r\n");
+	} else
+		fprintf(fp, "500 Unknown command\r\n");
+}
+
+static gpointer server_func(gpointer data)
+{
+	NewsServer *server = (NewsServer *)data;
+	FILE *in, *out;
+	gchar buf[1024];
+	gint fd;
+
+	if ((fd = fd_accept(server->sock)) < 0)
+		return NULL;
+	in = fdopen(fd, "rb");
+	out = fdopen(dup(fd), "wb");
+
+	fprintf(out, "200 NNTP stand-in ready\r\n");
+	fflush(out);
+
+	while (fgets(buf, sizeof(buf), in) != NULL) {
+		strretchomp(buf);
+		if (!g_ascii_strcasecmp(buf, "QUIT")) {
+			fprintf(out, "205 Bye\r\n");
+			break;
+		}
+		server_command(out, server, buf);
+		fflush(out);
+	}
+
+	fclose(out);
+	fclose(in);
+
+	return NULL;
+}
+
+static void check_article(MsgInfo *msginfo, gint num)
+{
+	gchar buf[64];
+
+	if (msginfo->msgnum != num) {
+		g_print("FAIL: article %d: got %d\n", num, msginfo->msgnum);
+		failed++;
+		return;
+	}
+
+	g_snprintf(buf, sizeof(buf), "article %d", num);
+	if (strcmp2(msginfo->subject, buf) != 0) {
+		g_print("FAIL: article %d: Subject: %s\n", num,
+			msginfo->subject);
+		failed++;
+	}
+	g_snprintf(buf, sizeof(buf), "group%d@example.com", num % 100);
+	if (strcmp2(msginfo->to, buf) != 0) {
+		g_print("FAIL: article %d: To: %s\n", num, msginfo->to);
+		failed++;
+	}
+	g_snprintf(buf, sizeof(buf), "cc%d@example.com", num);
+	if (ARTICLE_HAS_CC(num) ? strcmp2(msginfo->cc, buf) != 0
+	    : msginfo->cc != NULL) {
+		g_print("FAIL: article %d: Cc: %s\n", num, msginfo->cc);
+		failed++;
+	}
+}
+
+static void test_get_article_list(gboolean over_to_cc)
+{
+	NewsServer server;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	GThread *thread;
+	PrefsAccount *ac;
+	Folder *folder;
+	FolderItem *item;
+	GSList *mlist, *cur;
+	GTimer *timer;
+	gchar *path;
+	gint num = 0;
+
+	server.over_to_cc = over_to_cc;
+	if ((server.sock = fd_open_inet(0)) < 0 ||
+	    getsockname(server.sock, (struct sockaddr *)&addr, &len) < 0) {
+		g_print("FAIL: can't open the server socket\n");
+		failed++;
+		return;
+	}
+	thread = g_thread_create(server_func, &server, TRUE, NULL);
+
+	ac = g_new0(PrefsAccount, 1);
+	ac->protocol = A_NNTP;
+	ac->nntp_server = g_strdup("127.0.0.1");
+	ac->set_nntpport = TRUE;
+	ac->nntpport = ntohs(addr.sin_port);
+
+	folder = folder_new(F_NEWS, "news", ac->nntp_server);
+	folder->account = ac;
+	folder_add(folder);
+	item = folder_item_new(TEST_GROUP, TEST_GROUP);
+	folder_item_append(FOLDER_ITEM(folder->node->data), item);
+	path = folder_item_get_path(item);
+	make_dir_hier(path);
+	g_free(path);
+
+	timer = g_timer_new();
+	mlist = folder_item_get_msg_list(item, FALSE);
+	g_print("%s: %d articles: %.2f sec\n",
+		over_to_cc ? "overview with To and Cc" : "overview and XHDR",
+		g_slist_length(mlist), g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	if (g_slist_length(mlist) != N_ARTICLES - N_ARTICLES / 7) {
+		g_print("FAIL: got %d articles\n", g_slist_length(mlist));
+		failed++;
+	}
+	for (cur = mlist; cur != NULL && failed < 10; cur = cur->next) {
+		do {
+			num++;
+		} while (!ARTICLE_EXISTS(num));
+		check_article((MsgInfo *)cur->data, num);
+	}
+
+	procmsg_msg_list_free(mlist);
+	folder_destroy(folder);
+	g_free(ac->nntp_server);
+	g_free(ac);
+
+	g_thread_join(thread);
+	fd_close(server.sock);
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *dir;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	dir = g_strdup_printf("%s%ctest_news.%d", g_get_tmp_dir(),
+			      G_DIR_SEPARATOR, getpid());
+	if (make_dir_hier(dir) < 0) {
+		g_print("FAIL: can't create %s\n", dir);
+		return 1;
+	}
+	set_rc_dir(dir);
+	prefs_common.online_mode = TRUE;
+
+	test_get_article_list(TRUE);
+	test_get_article_list(FALSE);
+
+	remove_dir_recursive(dir);
+	g_free(dir);
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,677 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* compares procheader_date_parse() and procheader_parse_stream() with
+   the previous implementations, which are kept here as the reference */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "procheader.h"
+#include "procmsg.h"
+#include "procmime.h"
+#include "codeconv.h"
+#include "utils.h"
+
+#define BUFFSIZE	8192
+
+static gint failed = 0;
+static guint32 seed = 1;
+
+static guint32 test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+#define PICK(array)	(array[test_random() % G_N_ELEMENTS(array)])
+
+/* the previous date parser (sscanf() and mktime() only) */
+
+static gint old_scan_date_string(const gchar *str,
+				 gchar *weekday, gint *day,
+				 gchar *month, gint *year,
+				 gint *hh, gint *mm, gint *ss,
+				 gchar *zone)
+{
+	gint result;
+
+	*zone = '\0';
+	result = sscanf(str, "%10s %d %9s %d %2d:%2d:%2d %5s",
+			weekday, day, month, year, hh, mm, ss, zone);
+	if (result >= 7) return 0;
+
+	result = sscanf(str, "%3s,%d %9s %d %2d:%2d:%2d %5s",
+			weekday, day, month, year, hh, mm, ss, zone);
+	if (result >= 7) return 0;
+
+	result = sscanf(str, "%3s,%d %9s %d %2d.%2d.%2d %5s",
+			weekday, day, month, year, hh, mm, ss, zone);
+	if (result >= 7) return 0;
+
+	result = sscanf(str, "%3s %d, %9s %d %2d:%2d:%2d %5s",
+			weekday, day, month, year, hh, mm, ss, zone);
+	if (result >= 7) return 0;
+
+	result = sscanf(str, "%d %9s %d %2d:%2d:%2d %5s",
+			day, month, year, hh, mm, ss, zone);
+	if (result >= 6) return 0;
+
+	result = sscanf(str, "%d-%2s-%2d %2d:%2d:%2d",
+			year, month, day, hh, mm, ss);
+	if (result == 6) return 0;
+
+	*ss = 0;
+	result = sscanf(str, "%10s %d %9s %d %2d:%2d %5s",
+			weekday, day, month, year, hh, mm, zone);
+	if (result >= 6) return 0;
+
+	result = sscanf(str, "%d %9s %d %2d:%2d %5s",
+			day, month, year, hh, mm, zone);
+	if (result >= 5) return 0;
+
+	return -1;
+}
+
+static stime_t old_date_parse(gchar *dest, const gchar *src, gint len)
+{
+	static gchar monthstr[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	gchar weekday[11];
+	gint day;
+	gchar month[10];
+	gint year;
+	gint hh, mm, ss;
+	gchar zone[6];
+	GDateMonth dmonth = G_DATE_BAD_MONTH;
+	struct tm t;
+	gchar *p;
+	time_t timer_;
+	time_t tz_offset;
+	stime_t timer;
+
+	if (old_scan_date_string(src, weekday, &day, month, &year,
+				 &hh, &mm, &ss, zone) < 0) {
+		if (dest && len > 0)
+			strncpy2(dest, src, len);
+		return 0;
+	}
+
+	if (year < 1000) {
+		if (year < 50)
+			year += 2000;
+		else
+			year += 1900;
+	}
+
+	month[3] = '\0';
+	if (g_ascii_isdigit(month[0])) {
+		dmonth = atoi(month);
+	} else {
+		for (p = monthstr; *p != '\0'; p += 3) {
+			if (!g_ascii_strncasecmp(p, month, 3)) {
+				dmonth = (gint)(p - monthstr) / 3 + 1;
+				break;
+			}
+		}
+	}
+
+	t.tm_sec = ss;
+	t.tm_min = mm;
+	t.tm_hour = hh;
+	t.tm_mday = day;
+	t.tm_mon = dmonth - 1;
+	t.tm_year = year - 1900;
+	t.tm_wday = 0;
+	t.tm_yday = 0;
+	t.tm_isdst = -1;
+
+	timer_ = mktime(&t);
+	if (timer_ == -1) {
+		if (year >= 2038) {
+			timer_ = G_MAXINT - 12 * 3600;
+		} else {
+			if (dest)
+				dest[0] = '\0';
+			return 0;
+		}
+	}
+
+	timer = timer_;
+	if (timer < G_MAXINT - 12 * 3600) {
+		tz_offset = remote_tzoffset_sec(zone);
+		if (tz_offset != -1)
+			timer += tzoffset_sec(&timer) - tz_offset;
+	}
+
+	if (dest)
+		procheader_date_get_localtime(dest, len, timer);
+
+	return timer;
+}
+
+/* the previous header parser (procheader_get_one_field() per field) */
+
+enum
+{
+	H_DATE		= 0,
+	H_FROM		= 1,
+	H_TO		= 2,
+	H_NEWSGROUPS	= 3,
+	H_SUBJECT	= 4,
+	H_MSG_ID	= 5,
+	H_REFERENCES	= 6,
+	H_IN_REPLY_TO	= 7,
+	H_CONTENT_TYPE	= 8,
+	H_SEEN		= 9,
+	H_CC		= 10,
+	H_X_FACE	= 11
+};
+
+static MsgInfo *old_parse_stream(FILE *fp, MsgFlags flags, gboolean full)
+{
+	static HeaderEntry hentry_full[] = {{"Date:",		NULL, FALSE},
+					   {"From:",		NULL, TRUE},
+					   {"To:",		NULL, TRUE},
+					   {"Newsgroups:",	NULL, TRUE},
+					   {"Subject:",		NULL, TRUE},
+					   {"Message-Id:",	NULL, FALSE},
+					   {"References:",	NULL, FALSE},
+					   {"In-Reply-To:",	NULL, FALSE},
+					   {"Content-Type:",	NULL, FALSE},
+					   {"Seen:",		NULL, FALSE},
+					   {"Cc:",		NULL, TRUE},
+					   {"X-Face:",		NULL, FALSE},
+					   {NULL,		NULL, FALSE}};
+
+	static HeaderEntry hentry_short[] = {{"Date:",		NULL, FALSE},
+					    {"From:",		NULL, TRUE},
+					    {"To:",		NULL, TRUE},
+					    {"Newsgroups:",	NULL, TRUE},
+					    {"Subject:",	NULL, TRUE},
+					    {"Message-Id:",	NULL, FALSE},
+					    {"References:",	NULL, FALSE},
+					    {"In-Reply-To:",	NULL, FALSE},
+					    {"Content-Type:",	NULL, FALSE},
+					    {"Seen:",		NULL, FALSE},
+					    {NULL,		NULL, FALSE}};
+
+	MsgInfo *msginfo;
+	gchar buf[BUFFSIZE];
+	gchar *p;
+	gchar *hp;
+	HeaderEntry *hentry;
+	gint hnum;
+	gchar *from = NULL, *to = NULL, *subject = NULL, *cc = NULL;
+	gchar *charset = NULL;
+
+	hentry = full ? hentry_full : hentry_short;
+
+	if (MSG_IS_QUEUED(flags)) {
+		while (fgets(buf, sizeof(buf), fp) != NULL)
+			if (buf[0] == '\r' || buf[0] == '\n') break;
+	}
+
+	msginfo = g_new0(MsgInfo, 1);
+	msginfo->flags = flags;
+
+	while ((hnum = procheader_get_one_field(buf, sizeof(buf), fp, hentry))
+	       != -1) {
+		hp = buf + strlen(hentry[hnum].name);
+		while (*hp == ' ' || *hp == '\t') hp++;
+
+		switch (hnum) {
+		case H_DATE:
+			if (msginfo->date) break;
+			msginfo->date_t =
+				procheader_date_parse(NULL, hp, 0);
+			msginfo->date = g_strdup(hp);
+			break;
+		case H_FROM:
+			if (from) break;
+			from = g_strdup(hp);
+			break;
+		case H_TO:
+			if (to) {
+				p = to;
+				to = g_strconcat(p, ", ", hp, NULL);
+				g_free(p);
+			} else
+				to = g_strdup(hp);
+			break;
+		case H_NEWSGROUPS:
+			if (msginfo->newsgroups) {
+				p = msginfo->newsgroups;
+				msginfo->newsgroups =
+					g_strconcat(p, ",", hp, NULL);
+				g_free(p);
+			} else
+				msginfo->newsgroups = g_strdup(buf + 12);
+			break;
+		case H_SUBJECT:
+			if (msginfo->subject) break;
+			subject = g_strdup(hp);
+			break;
+		case H_MSG_ID:
+			if (msginfo->msgid) break;
+
+			extract_parenthesis(hp, '<', '>');
+			remove_space(hp);
+			msginfo->msgid = g_strdup(hp);
+			break;
+		case H_REFERENCES:
+			msginfo->references =
+				references_list_prepend(msginfo->references,
+							hp);
+			break;
+		case H_IN_REPLY_TO:
+			if (msginfo->inreplyto) break;
+
+			eliminate_parenthesis(hp, '(', ')');
+			if ((p = strrchr(hp, '<')) != NULL &&
+			    strchr(p + 1, '>') != NULL) {
+				extract_parenthesis(p, '<', '>');
+				remove_space(p);
+				if (*p != '\0')
+					msginfo->inreplyto = g_strdup(p);
+			}
+			break;
+		case H_CONTENT_TYPE:
+			if (!g_ascii_strncasecmp(hp, "multipart", 9)) {
+				MSG_SET_TMP_FLAGS(msginfo->flags, MSG_MIME);
+			} else {
+				if (!g_ascii_strncasecmp(hp, "text/html", 9)) {
+					MSG_SET_TMP_FLAGS(msginfo->flags, MSG_MIME_HTML);
+				}
+				if (!charset) {
+					procmime_scan_content_type_str
+						(hp, NULL, &charset, NULL, NULL);
+				}
+			}
+			break;
+		case H_SEEN:
+			MSG_UNSET_PERM_FLAGS(msginfo->flags, MSG_NEW|MSG_UNREAD);
+			break;
+		case H_CC:
+			if (cc) {
+				p = cc;
+				cc = g_strconcat(p, ", ", hp, NULL);
+				g_free(p);
+			} else
+				cc = g_strdup(hp);
+			break;
+		case H_X_FACE:
+			if (msginfo->xface) break;
+			msginfo->xface = g_strdup(hp);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (from) {
+		msginfo->from = conv_unmime_header(from, charset);
+		subst_control(msginfo->from, ' ');
+		msginfo->fromname = procheader_get_fromname(msginfo->from);
+		g_free(from);
+	}
+	if (to) {
+		msginfo->to = conv_unmime_header(to, charset);
+		subst_control(msginfo->to, ' ');
+		g_free(to);
+	}
+	if (subject) {
+		msginfo->subject = conv_unmime_header(subject, charset);
+		subst_control(msginfo->subject, ' ');
+		g_free(subject);
+	}
+	if (cc) {
+		msginfo->cc = conv_unmime_header(cc, charset);
+		subst_control(msginfo->cc, ' ');
+		g_free(cc);
+	}
+
+	if (!msginfo->inreplyto && msginfo->references)
+		msginfo->inreplyto =
+			g_strdup((gchar *)msginfo->references->data);
+
+	if (MSG_IS_MIME(msginfo->flags)) {
+		MimeInfo *mimeinfo, *part;
+		gboolean has_html = FALSE;
+
+		part = mimeinfo = procmime_scan_message_stream(fp);
+		while (part) {
+			if (part->mime_type != MIME_TEXT &&
+			    part->mime_type != MIME_TEXT_HTML &&
+			    part->mime_type != MIME_MULTIPART)
+				break;
+			if (part->mime_type == MIME_TEXT_HTML)
+				has_html = TRUE;
+			part = procmime_mimeinfo_next(part);
+		}
+
+		if (has_html && !part) {
+			MSG_SET_TMP_FLAGS(msginfo->flags, MSG_MIME_HTML);
+		}
+
+		procmime_mimeinfo_free_all(mimeinfo);
+	}
+
+	g_free(charset);
+
+	return msginfo;
+}
+
+/* date parsing */
+
+static const gchar *date_corpus[] = {
+	"Mon, 12 Feb 2024 13:45:01 +0900",
+	"Mon, 12 Feb 2024 13:45:01 +0900 (JST)",
+	"Tue, 1 Jan 2002 00:00:00 -0800",
+	"1 Jan 02 00:00:00 GMT",
+	"Wed, 31 Dec 1999 23:59:59 UT",
+	"Thu, 29 Feb 2024 12:00 +0000",
+	"Fri,  3 Mar 2023 01:02:03 -0330",
+	"Sat, 30 Feb 2021 10:00:00 +0100",
+	"12 Sep 1998 10:10:10 +1345",
+	"Monday, 12 September 2005 08:00:00 +0000",
+	"Mon, 12 Feb 2024 13:45:01 PST",
+	"Mon, 12 Feb 2024 13:45:01",
+	"2024-02-12 13:45:01",
+	"Mon,12 Feb 2024 13:45:01 +0900",
+	"Mon, 12 Feb 2024 13.45.01 +0900",
+	"1 Jan 1970 00:00:00 +0000",
+	"1 Jan 1970 00:00:00 +0100",
+	"19 Jan 2038 03:14:07 +0000",
+	"Mon, 12 Feb 2024 25:61:61 +0900",
+	"Mon 12, Feb 2024 13:45:01 +0900",
+	"garbage",
+	""
+};
+
+static const gchar *weekdays[] = {
+	"", "Mon, ", "Tue,", "wed ", "Thursday, ", "  Fri, "
+};
+static const gchar *months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep",
+	"Oct", "Nov", "Dec", "jan", "FEB", "September", "Foo"
+};
+static const gchar *years[] = {
+	"70", "99", "02", "37", "1971", "1999", "2000", "2024", "2037"
+};
+static const gchar *times[] = {
+	"00:00:00", "13:45:01", "23:59:59", "9:05:00", "13:45", "7:5"
+};
+static const gchar *zones[] = {
+	"+0000", "+0900", "-0800", "+0530", "-0330", "+0545", "GMT", "UT",
+	"UTC", "EST", "PDT", "JST", "Z", "", "+0900 (JST)", "-0000"
+};
+static const gchar *spaces[] = {
+	" ", " ", " ", "  ", "\t"
+};
+
+/* time zones without daylight saving time, where mktime() gives an
+   unambiguous result */
+static const gchar *test_tz[] = {
+	"UTC0", "JST-9", "IST-5:30", "NPT-5:45", "EST5", "NST3:30"
+};
+
+static void test_date_one(const gchar *str)
+{
+	gchar weekday[11], month[10], zone[6];
+	gint day, year, hh, mm, ss;
+	gchar old_dest[64], new_dest[64];
+	stime_t old_t, new_t;
+
+	/* the fast path also accepts some forms which the old patterns
+	   missed, such as "Tue,12 Aug 70 7:05 GMT". only the strings the
+	   old parser could read are compared */
+	if (old_scan_date_string(str, weekday, &day, month, &year,
+				 &hh, &mm, &ss, zone) < 0)
+		return;
+
+	old_t = old_date_parse(old_dest, str, sizeof(old_dest));
+	new_t = procheader_date_parse(new_dest, str, sizeof(new_dest));
+
+	if (old_t != new_t || strcmp(old_dest, new_dest) != 0) {
+		g_print("FAIL: date \"%s\" (TZ=%s): %ld [%s] != %ld [%s]\n",
+			str, g_getenv("TZ"), (glong)old_t, old_dest,
+			(glong)new_t, new_dest);
+		failed++;
+	}
+}
+
+static void test_date(void)
+{
+	gchar str[256];
+	gint i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(test_tz); i++) {
+		g_setenv("TZ", test_tz[i], TRUE);
+		tzset();
+
+		for (j = 0; j < G_N_ELEMENTS(date_corpus); j++)
+			test_date_one(date_corpus[j]);
+
+		seed = 1;
+		for (j = 0; j < 20000; j++) {
+			g_snprintf(str, sizeof(str), "%s%d%s%s%s%s%s%s%s%s",
+				   PICK(weekdays), test_random() % 31 + 1,
+				   PICK(spaces), PICK(months),
+				   PICK(spaces), PICK(years),
+				   PICK(spaces), PICK(times),
+				   PICK(spaces), PICK(zones));
+			test_date_one(str);
+		}
+	}
+
+	g_unsetenv("TZ");
+	tzset();
+}
+
+/* header parsing */
+
+static const gchar *names[] = {
+	"Date", "From", "To", "Newsgroups", "Subject", "Message-Id",
+	"References", "In-Reply-To", "Content-Type", "Seen", "Cc", "X-Face",
+	"date", "FROM", "message-ID", "cc", "to", "Received", "Return-Path",
+	"X-Mailer", "Dates", "Fro", "T", "Subjects", "Content-Types",
+	"Reply-To", "Sender", "C", "X-Faces", "In-Reply-Tos"
+};
+static const gchar *separators[] = {
+	":", ": ", ":  ", ":\t", " :", ": \t"
+};
+static const gchar *values[] = {
+	"Mon, 12 Feb 2024 13:45:01 +0900",
+	"Foo Bar <foo@example.com>",
+	"\"Bar, Baz\" <bar@example.org>, qux@example.net",
+	"=?ISO-2022-JP?B?GyRCJUYlOSVIGyhC?= <jp@example.jp>",
+	"=?UTF-8?Q?caf=C3=A9?=",
+	"<1234@example.com>",
+	"<1@x> <2@y> (comment) <3@z>",
+	"(comment) <reply@example.com> (more)",
+	"text/plain; charset=us-ascii",
+	"text/plain; charset=\"iso-2022-jp\"",
+	"text/html; charset=utf-8",
+	"multipart/mixed; boundary=\"b1\"",
+	"multipart/alternative; boundary=b1",
+	"comp.mail.misc,fj.mail",
+	"spaced  value  ",
+	"",
+	"a\tb",
+	"x"
+};
+static const gchar *bodies[] = {
+	"body line\n",
+	"--b1\nContent-Type: text/plain\n\nplain\n--b1\n"
+	"Content-Type: text/html\n\n<p>html</p>\n--b1--\n",
+	"--b1\nContent-Type: text/html\n\n<p>html</p>\n--b1--\n",
+	"--b1\nContent-Type: image/png\n\nxxx\n--b1--\n",
+	"Subject: not a header\n"
+};
+
+static void write_header(FILE *fp)
+{
+	const gchar *eol;
+	gint n, i;
+
+	eol = test_random() % 4 == 0 ? "\r\n" : "\n";
+
+	n = test_random() % 12;
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%s%s%s%s", PICK(names), PICK(separators),
+			PICK(values), eol);
+		/* folded lines */
+		while (test_random() % 4 == 0) {
+			switch (test_random() % 4) {
+			case 0:
+				fprintf(fp, "\t%s%s", PICK(values), eol);
+				break;
+			case 1:
+				fprintf(fp, "  %s%s", PICK(values), eol);
+				break;
+			case 2:
+				fprintf(fp, " %s", eol);
+				break;
+			default:
+				fprintf(fp, "\t \t%s %s%s", PICK(values),
+					PICK(values), eol);
+				break;
+			}
+		}
+	}
+}
+
+static gboolean str_equal(const gchar *s1, const gchar *s2)
+{
+	if (s1 == NULL || s2 == NULL)
+		return s1 == s2;
+	return strcmp(s1, s2) == 0;
+}
+
+static gboolean slist_equal(GSList *l1, GSList *l2)
+{
+	for (; l1 != NULL && l2 != NULL; l1 = l1->next, l2 = l2->next) {
+		if (!str_equal((gchar *)l1->data, (gchar *)l2->data))
+			return FALSE;
+	}
+	return l1 == l2;
+}
+
+static gboolean msginfo_equal(MsgInfo *m1, MsgInfo *m2)
+{
+	return m1->date_t == m2->date_t &&
+		m1->flags.perm_flags == m2->flags.perm_flags &&
+		m1->flags.tmp_flags == m2->flags.tmp_flags &&
+		str_equal(m1->fromname, m2->fromname) &&
+		str_equal(m1->date, m2->date) &&
+		str_equal(m1->from, m2->from) &&
+		str_equal(m1->to, m2->to) &&
+		str_equal(m1->cc, m2->cc) &&
+		str_equal(m1->newsgroups, m2->newsgroups) &&
+		str_equal(m1->subject, m2->subject) &&
+		str_equal(m1->msgid, m2->msgid) &&
+		str_equal(m1->inreplyto, m2->inreplyto) &&
+		slist_equal(m1->references, m2->references) &&
+		str_equal(m1->xface, m2->xface);
+}
+
+static void test_parse_stream(void)
+{
+	MsgFlags flags = {MSG_NEW|MSG_UNREAD, 0};
+	MsgInfo *old_msginfo, *new_msginfo;
+	FILE *fp;
+	glong old_pos, new_pos;
+	gboolean full;
+	gint i;
+
+	seed = 1;
+	for (i = 0; i < 5000; i++) {
+		if ((fp = my_tmpfile()) == NULL) {
+			g_print("FAIL: can't create a temporary file\n");
+			failed++;
+			return;
+		}
+
+		full = test_random() % 2;
+		if (test_random() % 8 == 0) {
+			MSG_SET_TMP_FLAGS(flags, MSG_QUEUED);
+			write_header(fp);
+			fputs("\n", fp);
+		} else
+			MSG_UNSET_TMP_FLAGS(flags, MSG_QUEUED);
+		write_header(fp);
+		if (test_random() % 8 != 0) {
+			fputs(test_random() % 2 ? "\n" : "\r\n", fp);
+			fputs(PICK(bodies), fp);
+		}
+
+		rewind(fp);
+		old_msginfo = old_parse_stream(fp, flags, full);
+		old_pos = ftell(fp);
+		rewind(fp);
+		new_msginfo = procheader_parse_stream(fp, flags, full);
+		new_pos = ftell(fp);
+
+		if (!msginfo_equal(old_msginfo, new_msginfo) ||
+		    old_pos != new_pos) {
+			g_print("FAIL: header #%d (full: %d): "
+				"the message info differs\n", i, full);
+			g_print("  from: [%s] [%s]\n",
+				old_msginfo->from ? old_msginfo->from : "(null)",
+				new_msginfo->from ? new_msginfo->from : "(null)");
+			g_print("  subject: [%s] [%s]\n",
+				old_msginfo->subject ? old_msginfo->subject : "(null)",
+				new_msginfo->subject ? new_msginfo->subject : "(null)");
+			g_print("  position: %ld %ld\n", old_pos, new_pos);
+			failed++;
+		}
+
+		procmsg_msginfo_free(old_msginfo);
+		procmsg_msginfo_free(new_msginfo);
+		fclose(fp);
+	}
+}
+
+static void log_func(const gchar *log_domain, GLogLevelFlags log_level,
+		     const gchar *message, gpointer data)
+{
+	/* the parse errors of the test data are expected */
+}
+
+int main(int argc, char *argv[])
+{
+	g_log_set_handler(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, log_func, NULL);
+
+	test_date();
+	test_parse_stream();
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
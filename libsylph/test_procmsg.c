@@ -0,0 +1,179 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* checks that the mark files written through the buffers of
+   procmsg_add_flags() are the same as the ones written by opening the
+   mark file for each entry, as it was done before */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "folder.h"
+#include "procmsg.h"
+#include "utils.h"
+
+#define N_FOLDERS	20
+#define N_FLAGS		20000
+
+static gint failed = 0;
+static guint32 seed = 1;
+
+static guint32 test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+/* the previous procmsg_add_flags() for a folder which is not opened */
+static void old_add_flags(FolderItem *item, gint num, MsgFlags flags)
+{
+	FILE *fp;
+	MsgInfo msginfo;
+
+	if ((fp = procmsg_open_mark_file(item, DATA_APPEND)) == NULL) {
+		g_warning("can't open mark file\n");
+		return;
+	}
+
+	msginfo.msgnum = num;
+	msginfo.flags = flags;
+
+	procmsg_write_flags(&msginfo, fp);
+	fclose(fp);
+}
+
+static Folder *create_folder(const gchar *path, FolderItem *items[])
+{
+	Folder *folder;
+	FolderItem *item;
+	gchar name[16];
+	gint i;
+
+	folder = folder_new(F_MH, path, path);
+	folder_add(folder);
+	for (i = 0; i < N_FOLDERS; i++) {
+		g_snprintf(name, sizeof(name), "f%d", i);
+		item = folder_item_new(name, name);
+		folder_item_append(FOLDER_ITEM(folder->node->data), item);
+		items[i] = item;
+	}
+
+	return folder;
+}
+
+static void compare_mark_files(FolderItem *old_item, FolderItem *new_item)
+{
+	gchar *old_file, *new_file;
+	gchar *old_data = NULL, *new_data = NULL;
+	gsize old_len = 0, new_len = 0;
+
+	old_file = folder_item_get_mark_file(old_item);
+	new_file = folder_item_get_mark_file(new_item);
+
+	g_file_get_contents(old_file, &old_data, &old_len, NULL);
+	g_file_get_contents(new_file, &new_data, &new_len, NULL);
+
+	if (old_len != new_len ||
+	    (old_len > 0 && memcmp(old_data, new_data, old_len) != 0)) {
+		g_print("FAIL: %s (%u bytes) != %s (%u bytes)\n",
+			old_file, (guint)old_len, new_file, (guint)new_len);
+		failed++;
+	}
+
+	g_free(new_data);
+	g_free(old_data);
+	g_free(new_file);
+	g_free(old_file);
+}
+
+static void test_add_flags(const gchar *dir)
+{
+	FolderItem *old_items[N_FOLDERS], *new_items[N_FOLDERS];
+	Folder *old_folder, *new_folder;
+	gchar *old_path, *new_path;
+	MsgFlags flags = {0, 0};
+	FILE *fp;
+	gint i, n;
+
+	old_path = g_strconcat(dir, G_DIR_SEPARATOR_S, "old", NULL);
+	new_path = g_strconcat(dir, G_DIR_SEPARATOR_S, "new", NULL);
+	old_folder = create_folder(old_path, old_items);
+	new_folder = create_folder(new_path, new_items);
+
+	/* mostly a few busy folders, so that both the size limit of the
+	   buffers and the cache of the open files are exercised */
+	for (i = 0; i < N_FLAGS; i++) {
+		if (test_random() % 4 == 0)
+			n = test_random() % N_FOLDERS;
+		else
+			n = test_random() % 3;
+		flags.perm_flags = test_random() & 0x3ff;
+
+		old_add_flags(old_items[n], i + 1, flags);
+		procmsg_add_flags(new_items[n], i + 1, flags);
+
+		/* opening the mark file must write out its buffer first */
+		if (test_random() % 500 == 0) {
+			fp = procmsg_open_mark_file(new_items[n], DATA_READ);
+			if (fp)
+				fclose(fp);
+			compare_mark_files(old_items[n], new_items[n]);
+		}
+	}
+
+	procmsg_sync_mark_files();
+
+	for (i = 0; i < N_FOLDERS; i++)
+		compare_mark_files(old_items[i], new_items[i]);
+
+	folder_destroy(new_folder);
+	folder_destroy(old_folder);
+	g_free(new_path);
+	g_free(old_path);
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *dir;
+
+	dir = g_strdup_printf("%s%ctest_procmsg.%d", g_get_tmp_dir(),
+			      G_DIR_SEPARATOR, getpid());
+	if (make_dir_hier(dir) < 0) {
+		g_print("FAIL: can't create %s\n", dir);
+		return 1;
+	}
+
+	test_add_flags(dir);
+
+	remove_dir_recursive(dir);
+	g_free(dir);
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
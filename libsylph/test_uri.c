@@ -0,0 +1,186 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* compares the clickable part scanner based on find_uri_token() with
+   the previous one, which ran strcasestr() for each token */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define MAX_PARTS	256
+
+static gint failed = 0;
+static guint32 seed = 1;
+
+static guint32 test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+#define PICK(array)	(array[test_random() % G_N_ELEMENTS(array)])
+
+typedef struct _URIPart
+{
+	gint bp, ep;
+	gint pti;
+} URIPart;
+
+static struct {
+	const gchar *needle;
+	gboolean (*parse)	(const gchar *start,
+				 const gchar *scanpos,
+				 const gchar **bp_,
+				 const gchar **ep_);
+} parser[] = {
+	{"http://",  get_uri_part},
+	{"https://", get_uri_part},
+	{"ftp://",   get_uri_part},
+	{"www.",     get_uri_part},
+	{"mailto:",  get_uri_part},
+	{"@",        get_email_part}
+};
+
+static void add_part(URIPart *parts, gint *n_parts, const gchar *linebuf,
+		     const gchar *bp, const gchar *ep, gint pti)
+{
+	if (*n_parts >= MAX_PARTS)
+		return;
+	parts[*n_parts].bp = bp - linebuf;
+	parts[*n_parts].ep = ep - linebuf;
+	parts[*n_parts].pti = pti;
+	(*n_parts)++;
+}
+
+/* the previous scanner of textview_make_clickable_parts() */
+static gint old_scan(const gchar *linebuf, URIPart *parts)
+{
+	const gint PARSE_ELEMS = G_N_ELEMENTS(parser);
+	gboolean do_search[] = {TRUE, TRUE, TRUE, TRUE, TRUE, TRUE};
+	const gchar *walk, *bp, *ep;
+	gint n_parts = 0;
+	gint n;
+
+	for (walk = linebuf, n = 0;;) {
+		gint last_index = PARSE_ELEMS;
+		const gchar *scanpos = NULL;
+
+		for (n = 0; n < PARSE_ELEMS; n++) {
+			const gchar *tmp;
+
+			if (do_search[n]) {
+				tmp = strcasestr(walk, parser[n].needle);
+				if (tmp) {
+					if (scanpos == NULL || tmp < scanpos) {
+						scanpos = tmp;
+						last_index = n;
+					}
+				} else
+					do_search[n] = FALSE;
+			}
+		}
+
+		if (scanpos) {
+			if (parser[last_index].parse(walk, scanpos, &bp, &ep)
+			    && (ep - bp - 1) > strlen(parser[last_index].needle)) {
+				add_part(parts, &n_parts, linebuf,
+					 bp, ep, last_index);
+				walk = ep;
+			} else
+				walk = scanpos +
+					strlen(parser[last_index].needle);
+		} else
+			break;
+	}
+
+	return n_parts;
+}
+
+/* the current scanner of textview_make_clickable_parts() */
+static gint new_scan(const gchar *linebuf, URIPart *parts)
+{
+	const gchar *walk, *scanpos, *bp, *ep;
+	gint n_parts = 0;
+	gint n;
+
+	for (walk = linebuf;
+	     (scanpos = find_uri_token(walk, &n)) != NULL;) {
+		if (parser[n].parse(walk, scanpos, &bp, &ep)
+		    && (ep - bp - 1) > strlen(parser[n].needle)) {
+			add_part(parts, &n_parts, linebuf, bp, ep, n);
+			walk = ep;
+		} else
+			walk = scanpos + strlen(parser[n].needle);
+	}
+
+	return n_parts;
+}
+
+static const gchar *fragments[] = {
+	"http://", "HTTPS://", "ftp://", "www.", "WwW.", "mailto:", "@",
+	"hTtP://example.org/a?b=c", "Mailto:a@b.c", "x@y", "foo@example.com",
+	"foo", "bar.com", " ", "\t", ".", ",", "(", ")", "<", ">", "\"",
+	"a", "-", "/", "?", "=", "h", "ht", "htt", "http:/", "ftp:", "ww",
+	"mailto", "\xe3\x81\x82", "\xc3\xa9"
+};
+
+static void test_scan(void)
+{
+	URIPart old_parts[MAX_PARTS], new_parts[MAX_PARTS];
+	gint old_n, new_n;
+	gchar buf[1024];
+	gint i, j, n;
+
+	for (i = 0; i < 300000; i++) {
+		buf[0] = '\0';
+		n = test_random() % 30;
+		for (j = 0; j < n; j++)
+			g_strlcat(buf, PICK(fragments), sizeof(buf));
+
+		old_n = old_scan(buf, old_parts);
+		new_n = new_scan(buf, new_parts);
+
+		if (old_n != new_n ||
+		    memcmp(old_parts, new_parts,
+			   old_n * sizeof(URIPart)) != 0) {
+			g_print("FAIL: \"%s\": %d part(s) != %d part(s)\n",
+				buf, old_n, new_n);
+			failed++;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	test_scan();
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
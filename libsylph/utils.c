@@ -58,6 +58,7 @@
 
 #include "utils.h"
 #include "socket.h"
+#include "slock.h"
 
 #define BUFFSIZE	8192
 
@@ -1991,6 +1992,161 @@ gint get_uri_len(const gchar *str)
 	return 0;
 }
 
+/* find_uri_token() - finds the first trigger token of a URI or a mail
+   address at or after str. All tokens are searched in one pass; the
+   first character selects the token to compare. *pti is set to the
+   index of the token in the order "http://", "https://", "ftp://",
+   "www.", "mailto:" and "@". */
+const gchar *find_uri_token(const gchar *str, gint *pti)
+{
+	const gchar *p;
+
+	for (p = str; *p != '\0'; p++) {
+		switch (*p) {
+		case 'h':
+		case 'H':
+			if (!g_ascii_strncasecmp(p + 1, "ttp://", 6)) {
+				*pti = 0;
+				return p;
+			}
+			if (!g_ascii_strncasecmp(p + 1, "ttps://", 7)) {
+				*pti = 1;
+				return p;
+			}
+			break;
+		case 'f':
+		case 'F':
+			if (!g_ascii_strncasecmp(p + 1, "tp://", 5)) {
+				*pti = 2;
+				return p;
+			}
+			break;
+		case 'w':
+		case 'W':
+			if (!g_ascii_strncasecmp(p + 1, "ww.", 3)) {
+				*pti = 3;
+				return p;
+			}
+			break;
+		case 'm':
+		case 'M':
+			if (!g_ascii_strncasecmp(p + 1, "ailto:", 6)) {
+				*pti = 4;
+				return p;
+			}
+			break;
+		case '@':
+			*pti = 5;
+			return p;
+		default:
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* get_uri_part() - retrieves a URI starting from scanpos.
+		    Returns TRUE if succesful */
+gboolean get_uri_part(const gchar *start, const gchar *scanpos,
+		      const gchar **bp, const gchar **ep)
+{
+	const gchar *ep_;
+
+	g_return_val_if_fail(start != NULL, FALSE);
+	g_return_val_if_fail(scanpos != NULL, FALSE);
+	g_return_val_if_fail(bp != NULL, FALSE);
+	g_return_val_if_fail(ep != NULL, FALSE);
+
+	*bp = scanpos;
+
+	/* find end point of URI */
+	for (ep_ = scanpos; *ep_ != '\0'; ep_++) {
+		if (!g_ascii_isgraph(*ep_) ||
+		    !isascii(*(const guchar *)ep_) ||
+		    strchr("()<>{}[]\"", *ep_))
+			break;
+	}
+
+	/* no punctuation at end of string */
+
+	/* FIXME: this stripping of trailing punctuations may bite with other URIs.
+	 * should pass some URI type to this function and decide on that whether
+	 * to perform punctuation stripping */
+
+#define IS_REAL_PUNCT(ch)	(g_ascii_ispunct(ch) && !strchr("/?=", ch)) 
+
+	for (; ep_ - 1 > scanpos + 1 && IS_REAL_PUNCT(*(ep_ - 1)); ep_--)
+		;
+
+#undef IS_REAL_PUNCT
+
+	*ep = ep_;
+
+	return TRUE;		
+}
+
+/* valid mail address characters */
+#define IS_RFC822_CHAR(ch) \
+	(isascii(ch) && \
+	 (ch) > 32   && \
+	 (ch) != 127 && \
+	 !g_ascii_isspace(ch) && \
+	 !strchr("(),;<>\"", (ch)))
+
+/* alphabet and number within 7bit ASCII */
+#define IS_ASCII_ALNUM(ch)	(isascii(ch) && g_ascii_isalnum(ch))
+
+/* get_email_part() - retrieves an email address. Returns TRUE if succesful */
+gboolean get_email_part(const gchar *start, const gchar *scanpos,
+			const gchar **bp, const gchar **ep)
+{
+	/* more complex than the uri part because we need to scan back and forward starting from
+	 * the scan position. */
+	gboolean result = FALSE;
+	const gchar *bp_;
+	const gchar *ep_;
+
+	g_return_val_if_fail(start != NULL, FALSE);
+	g_return_val_if_fail(scanpos != NULL, FALSE);
+	g_return_val_if_fail(bp != NULL, FALSE);
+	g_return_val_if_fail(ep != NULL, FALSE);
+
+	/* scan start of address */
+	for (bp_ = scanpos - 1;
+	     bp_ >= start && IS_RFC822_CHAR(*(const guchar *)bp_); bp_--)
+		;
+
+	/* TODO: should start with an alnum? */
+	bp_++;
+	for (; bp_ < scanpos && !IS_ASCII_ALNUM(*(const guchar *)bp_); bp_++)
+		;
+
+	if (bp_ != scanpos) {
+		/* scan end of address */
+		for (ep_ = scanpos + 1;
+		     *ep_ && IS_RFC822_CHAR(*(const guchar *)ep_); ep_++)
+			;
+
+		/* TODO: really should terminate with an alnum? */
+		for (; ep_ > scanpos && !IS_ASCII_ALNUM(*(const guchar *)ep_);
+		     --ep_)
+			;
+		ep_++;
+
+		if (ep_ > scanpos + 1) {
+			*ep = ep_;
+			*bp = bp_;
+			result = TRUE;
+		}
+	}
+
+	return result;
+}
+
+#undef IS_ASCII_ALNUM
+#undef IS_RFC822_CHAR
+
 /* Decodes URL-Encoded strings (i.e. strings in which spaces are replaced by
  * plusses, and escape characters are used)
  * Note: decoded_uri and encoded_uri can point the same location
@@ -2757,6 +2913,427 @@ gint remove_all_numbered_files(const gchar *dir)
 	return remove_numbered_files(dir, 0, UINT_MAX);
 }
 
+/* remove_all_numbered_files_async() detaches the directory by renaming it
+   to a hidden tombstone next to it and recreating it empty, so the folder
+   appears empty at once. The numbered files are then unlinked by a single
+   worker thread, and other entries are moved back. The caller must use
+   remove_all_numbered_files() instead if the directory may contain
+   numbered subfolders, which would be moved back only by the worker.
+   Each tombstone is recorded in REMOVING_LIST under the rc directory,
+   and the ones left by a crash are finished by
+   remove_numbered_files_resume_all() on the next startup. */
+#define REMOVE_PROGRESS_FILES	1000
+#define REMOVE_TOMB_INFIX	".removing."
+#define REMOVE_SWEEP_MAX_LEVEL	64
+
+typedef struct _RemoveFilesJob
+{
+	gchar *dir;
+	gchar *tomb;
+} RemoveFilesJob;
+
+#if USE_THREADS
+static GThreadPool *remove_files_pool = NULL;
+static volatile gint remove_files_remain = 0;
+#endif
+
+static void remove_files_job_run(RemoveFilesJob *job)
+{
+	GDir *dp;
+	const gchar *dir_name;
+	gchar *file, *dest;
+	gint n_removed = 0;
+
+	debug_print("removing numbered files in %s\n", job->tomb);
+
+	if ((dp = g_dir_open(job->tomb, 0, NULL)) == NULL) {
+		g_warning("failed to open directory: %s\n", job->tomb);
+		return;
+	}
+
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		file = g_strconcat(job->tomb, G_DIR_SEPARATOR_S, dir_name,
+				   NULL);
+		if (to_unumber(dir_name) > 0 && !is_dir_exist(file)) {
+			if (g_unlink(file) < 0) {
+				FILE_OP_ERROR(file, "unlink");
+			} else if (++n_removed % REMOVE_PROGRESS_FILES == 0)
+				debug_print("%s: %d files removed\n",
+					    job->dir, n_removed);
+		} else {
+			/* numbered subfolders */
+			dest = g_strconcat(job->dir, G_DIR_SEPARATOR_S,
+					   dir_name, NULL);
+			if (is_file_entry_exist(dest))
+				g_warning("%s already exists, leaving %s\n",
+					  dest, file);
+			else if (g_rename(file, dest) < 0)
+				FILE_OP_ERROR(file, "rename");
+			g_free(dest);
+		}
+		g_free(file);
+	}
+
+	g_dir_close(dp);
+
+	if (g_rmdir(job->tomb) < 0)
+		FILE_OP_ERROR(job->tomb, "rmdir");
+
+	debug_print("%s: %d files removed (done)\n", job->dir, n_removed);
+}
+
+static void remove_files_job_free(RemoveFilesJob *job)
+{
+	g_free(job->tomb);
+	g_free(job->dir);
+	g_free(job);
+}
+
+#if USE_THREADS
+static void remove_files_job_func(gpointer push_data, gpointer data)
+{
+	RemoveFilesJob *job = (RemoveFilesJob *)push_data;
+
+	remove_files_job_run(job);
+	remove_files_job_free(job);
+	g_atomic_int_add(&remove_files_remain, -1);
+}
+#endif
+
+static gchar *remove_files_get_tomb(const gchar *dir)
+{
+	static guint serial = 0;
+	gchar *abs_dir, *parent, *base, *tomb;
+
+	if (g_path_is_absolute(dir))
+		abs_dir = g_strdup(dir);
+	else {
+		gchar *cur_dir;
+
+		cur_dir = g_get_current_dir();
+		abs_dir = g_strconcat(cur_dir, G_DIR_SEPARATOR_S, dir, NULL);
+		g_free(cur_dir);
+	}
+	parent = g_path_get_dirname(abs_dir);
+	base = g_path_get_basename(abs_dir);
+
+	/* dot directories are ignored by the folder scan */
+	do {
+		tomb = g_strdup_printf("%s%c.%s" REMOVE_TOMB_INFIX "%d.%u",
+				       parent, G_DIR_SEPARATOR, base,
+				       (gint)getpid(), ++serial);
+		if (!is_file_entry_exist(tomb))
+			break;
+		g_free(tomb);
+	} while (1);
+
+	g_free(base);
+	g_free(parent);
+	g_free(abs_dir);
+
+	return tomb;
+}
+
+static gchar *remove_files_get_list_file(void)
+{
+	return g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S, REMOVING_LIST,
+			   NULL);
+}
+
+/* record TOMB so that it is resumed if this session is interrupted */
+static void remove_files_list_add(const gchar *tomb)
+{
+	gchar *file;
+	FILE *fp;
+
+	file = remove_files_get_list_file();
+	if ((fp = g_fopen(file, "ab")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		g_free(file);
+		return;
+	}
+	fprintf(fp, "%s\n", tomb);
+	if (fclose(fp) == EOF)
+		FILE_OP_ERROR(file, "fclose");
+	g_free(file);
+}
+
+/* read the recorded tombstones which still exist */
+static GSList *remove_files_list_read(void)
+{
+	gchar *file;
+	FILE *fp;
+	gchar buf[BUFFSIZE];
+	GSList *list = NULL;
+
+	file = remove_files_get_list_file();
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		if (ENOENT != errno)
+			FILE_OP_ERROR(file, "fopen");
+		g_free(file);
+		return NULL;
+	}
+	g_free(file);
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		strretchomp(buf);
+		if (buf[0] != '\0' && is_dir_exist(buf) &&
+		    !g_slist_find_custom(list, buf, (GCompareFunc)strcmp))
+			list = g_slist_prepend(list, g_strdup(buf));
+	}
+
+	fclose(fp);
+
+	return g_slist_reverse(list);
+}
+
+/* rewrite the list with the tombstones which are still left */
+static void remove_files_list_update(void)
+{
+	GSList *list, *cur;
+	gchar *file;
+
+	list = remove_files_list_read();
+	file = remove_files_get_list_file();
+	if (is_file_exist(file) && g_unlink(file) < 0)
+		FILE_OP_ERROR(file, "unlink");
+	g_free(file);
+
+	for (cur = list; cur != NULL; cur = cur->next)
+		remove_files_list_add((gchar *)cur->data);
+
+	slist_free_strings(list);
+	g_slist_free(list);
+}
+
+/* move back the subfolders and the dot files of TOMB to DIR now, and
+   remove the numbered files by the worker. Numbered subfolders are
+   found and moved back by the worker, so that the message files need
+   not be stat'ed here, unless move_numbered_dirs is TRUE. */
+static gint remove_files_start(const gchar *dir, gchar *tomb,
+			       gboolean move_numbered_dirs)
+{
+	RemoveFilesJob *job;
+	GDir *dp;
+	const gchar *dir_name;
+	gchar *file, *dest;
+
+	if ((dp = g_dir_open(tomb, 0, NULL)) != NULL) {
+		while ((dir_name = g_dir_read_name(dp)) != NULL) {
+			file = g_strconcat(tomb, G_DIR_SEPARATOR_S, dir_name,
+					   NULL);
+			if (to_unumber(dir_name) > 0 &&
+			    (!move_numbered_dirs || !is_dir_exist(file))) {
+				g_free(file);
+				continue;
+			}
+			dest = g_strconcat(dir, G_DIR_SEPARATOR_S, dir_name,
+					   NULL);
+			if (is_file_entry_exist(dest))
+				g_warning("%s already exists, leaving %s\n",
+					  dest, file);
+			else if (g_rename(file, dest) < 0)
+				FILE_OP_ERROR(file, "rename");
+			g_free(dest);
+			g_free(file);
+		}
+		g_dir_close(dp);
+	} else
+		g_warning("failed to open directory: %s\n", tomb);
+
+	job = g_new(RemoveFilesJob, 1);
+	job->dir = g_strdup(dir);
+	job->tomb = tomb;
+
+#if USE_THREADS
+	remove_files_list_add(tomb);
+
+	if (!remove_files_pool)
+		remove_files_pool = g_thread_pool_new(remove_files_job_func,
+						      NULL, 1, FALSE, NULL);
+	if (remove_files_pool) {
+		g_atomic_int_inc(&remove_files_remain);
+		g_thread_pool_push(remove_files_pool, job, NULL);
+		return 0;
+	}
+#endif
+
+	remove_files_job_run(job);
+	remove_files_job_free(job);
+
+	return 0;
+}
+
+gint remove_all_numbered_files_async(const gchar *dir)
+{
+	gchar *tomb;
+
+	g_return_val_if_fail(dir != NULL, -1);
+
+	if (!is_dir_exist(dir))
+		return remove_all_numbered_files(dir);
+
+	tomb = remove_files_get_tomb(dir);
+	if (g_rename(dir, tomb) < 0) {
+		FILE_OP_ERROR(dir, "rename");
+		g_free(tomb);
+		return remove_all_numbered_files(dir);
+	}
+	if (make_dir(dir) < 0) {
+		if (g_rename(tomb, dir) < 0)
+			FILE_OP_ERROR(tomb, "rename");
+		g_free(tomb);
+		return remove_all_numbered_files(dir);
+	}
+
+	return remove_files_start(dir, tomb, FALSE);
+}
+
+/* finish the removal which was interrupted in a previous session.
+   TOMB is the tombstone created by remove_all_numbered_files_async() */
+gint remove_numbered_files_resume(const gchar *tomb)
+{
+	gchar *parent, *name, *infix, *base, *dir;
+	gint pid;
+	gint ret;
+
+	g_return_val_if_fail(tomb != NULL, -1);
+
+	name = g_path_get_basename(tomb);
+	if (name[0] != '.' ||
+	    (infix = g_strrstr(name, REMOVE_TOMB_INFIX)) == NULL ||
+	    infix == name + 1) {
+		g_free(name);
+		return -1;
+	}
+
+	/* the removal of this session is still in progress */
+	pid = atoi(infix + strlen(REMOVE_TOMB_INFIX));
+	if (pid == (gint)getpid()) {
+		g_free(name);
+		return 0;
+	}
+
+	base = g_strndup(name + 1, infix - name - 1);
+	parent = g_path_get_dirname(tomb);
+	dir = g_strconcat(parent, G_DIR_SEPARATOR_S, base, NULL);
+	g_free(parent);
+	g_free(base);
+	g_free(name);
+
+	debug_print("resuming the removal of %s\n", dir);
+
+	/* interrupted before the directory was recreated */
+	if (!is_dir_exist(dir) && make_dir(dir) < 0) {
+		g_free(dir);
+		return -1;
+	}
+
+	ret = remove_files_start(dir, g_strdup(tomb), TRUE);
+	g_free(dir);
+
+	return ret;
+}
+
+static void remove_numbered_files_sweep_real(const gchar *dir, gint level)
+{
+	GDir *dp;
+	const gchar *dir_name;
+	gchar *file;
+	GSList *tombs = NULL, *subdirs = NULL, *cur;
+
+	if (level >= REMOVE_SWEEP_MAX_LEVEL) {
+		g_warning("remove_numbered_files_sweep: "
+			  "max recursion level (%d) reached: %s\n",
+			  REMOVE_SWEEP_MAX_LEVEL, dir);
+		return;
+	}
+
+	if ((dp = g_dir_open(dir, 0, NULL)) == NULL)
+		return;
+
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		/* don't stat the message files */
+		if (to_unumber(dir_name) > 0)
+			continue;
+
+		file = g_strconcat(dir, G_DIR_SEPARATOR_S, dir_name, NULL);
+		if (dir_name[0] == '.') {
+			if (strstr(dir_name, REMOVE_TOMB_INFIX) &&
+			    is_dir_exist(file))
+				tombs = g_slist_prepend(tombs, file);
+			else
+				g_free(file);
+		} else if (is_dir_exist(file))
+			subdirs = g_slist_prepend(subdirs, file);
+		else
+			g_free(file);
+	}
+
+	g_dir_close(dp);
+
+	/* the subfolders are moved back before they are searched */
+	for (cur = tombs; cur != NULL; cur = cur->next)
+		remove_numbered_files_resume((gchar *)cur->data);
+	for (cur = subdirs; cur != NULL; cur = cur->next)
+		remove_numbered_files_sweep_real((gchar *)cur->data,
+						 level + 1);
+
+	slist_free_strings(tombs);
+	g_slist_free(tombs);
+	slist_free_strings(subdirs);
+	g_slist_free(subdirs);
+}
+
+/* finish the removals recorded by an interrupted session. Only the
+   recorded tombstones are looked at, so no folder needs to be read */
+void remove_numbered_files_resume_all(void)
+{
+	GSList *list, *cur;
+	gchar *file;
+
+	list = remove_files_list_read();
+
+	/* the resumed tombstones are recorded again */
+	file = remove_files_get_list_file();
+	if (is_file_exist(file) && g_unlink(file) < 0)
+		FILE_OP_ERROR(file, "unlink");
+	g_free(file);
+
+	for (cur = list; cur != NULL; cur = cur->next)
+		remove_numbered_files_resume((gchar *)cur->data);
+
+	slist_free_strings(list);
+	g_slist_free(list);
+}
+
+/* find the tombstones left under DIR by an interrupted session and
+   finish them. Numbered directories are not searched. */
+void remove_numbered_files_sweep(const gchar *dir)
+{
+	g_return_if_fail(dir != NULL);
+
+	remove_numbered_files_sweep_real(dir, 0);
+}
+
+/* wait until all the pending removals have finished */
+void remove_numbered_files_wait(void)
+{
+#if USE_THREADS
+	if (!remove_files_pool)
+		return;
+
+	if (g_atomic_int_get(&remove_files_remain) > 0)
+		debug_print("waiting for %d pending removals...\n",
+			    g_atomic_int_get(&remove_files_remain));
+
+	g_thread_pool_free(remove_files_pool, FALSE, TRUE);
+	remove_files_pool = NULL;
+
+	remove_files_list_update();
+#endif
+}
+
 gint remove_expired_files(const gchar *dir, guint hours)
 {
 	GDir *dp;
@@ -4600,15 +5177,17 @@ gchar *input_query_password(const gchar *server, const gchar *user)
 
 /* logging */
 
+#define LOG_BUF_SIZE		16384
+#define LOG_FLUSH_INTERVAL	1	/* sec */
+
+/* the log file is written in batches: the messages are collected in
+   log_buf and written when it is full, when LOG_FLUSH_INTERVAL has
+   elapsed, or immediately for warnings and errors */
 static FILE *log_fp = NULL;
-#if USE_THREADS
-G_LOCK_DEFINE_STATIC(log_fp);
-#define S_LOCK(name)	G_LOCK(name)
-#define S_UNLOCK(name)	G_UNLOCK(name)
-#else
-#define S_LOCK(name)
-#define S_UNLOCK(name)
-#endif
+static GString *log_buf = NULL;
+static time_t log_flush_time = 0;
+static guint log_flush_tag = 0;
+S_LOCK_DEFINE_STATIC(log_fp);
 
 void set_log_file(const gchar *filename)
 {
@@ -4617,17 +5196,36 @@ void set_log_file(const gchar *filename)
 		log_fp = g_fopen(filename, "w");
 		if (!log_fp)
 			FILE_OP_ERROR(filename, "fopen");
+		if (!log_buf)
+			log_buf = g_string_sized_new(LOG_BUF_SIZE);
 	}
 	S_UNLOCK(log_fp);
 }
 
+/* must be called with log_fp locked */
+static void log_write_buf(void)
+{
+	if (log_fp && log_buf->len > 0) {
+		fwrite(log_buf->str, log_buf->len, 1, log_fp);
+		fflush(log_fp);
+	}
+	if (log_buf)
+		g_string_truncate(log_buf, 0);
+	time(&log_flush_time);
+}
+
 void close_log_file(void)
 {
 	S_LOCK(log_fp);
 	if (log_fp) {
+		log_write_buf();
 		fclose(log_fp);
 		log_fp = NULL;
 	}
+	if (log_flush_tag > 0) {
+		g_source_remove(log_flush_tag);
+		log_flush_tag = 0;
+	}
 	S_UNLOCK(log_fp);
 }
 
@@ -4717,27 +5315,55 @@ void status_print(const gchar *format, ...)
 
 #define TIME_LEN	11
 
-void log_write(const gchar *str, const gchar *prefix)
+static gboolean log_flush_timeout_func(gpointer data)
 {
 	S_LOCK(log_fp);
+	log_write_buf();
+	log_flush_tag = 0;
+	S_UNLOCK(log_fp);
 
-	if (log_fp) {
-		gchar buf[TIME_LEN + 1];
-		time_t t;
+	return FALSE;
+}
 
-		time(&t);
-		strftime(buf, TIME_LEN + 1, "[%H:%M:%S] ", localtime(&t));
+/* append a line to the log buffer. the buffer is written out if @flush
+   is TRUE or it's full, otherwise a timer is set to write it later. */
+static void log_append(const gchar *time_str, const gchar *prefix,
+		       const gchar *str, gboolean flush)
+{
+	time_t t;
+
+	S_LOCK(log_fp);
 
-		fputs(buf, log_fp);
+	if (log_fp) {
+		g_string_append_len(log_buf, time_str, TIME_LEN);
 		if (prefix)
-			fputs(prefix, log_fp);
-		fputs(str, log_fp);
-		fflush(log_fp);
+			g_string_append(log_buf, prefix);
+		g_string_append(log_buf, str);
+
+		time(&t);
+		if (flush || log_buf->len >= LOG_BUF_SIZE ||
+		    t - log_flush_time >= LOG_FLUSH_INTERVAL)
+			log_write_buf();
+		else if (log_flush_tag == 0)
+			log_flush_tag = g_timeout_add_full
+				(G_PRIORITY_LOW, LOG_FLUSH_INTERVAL * 1000,
+				 log_flush_timeout_func, NULL, NULL);
 	}
 
 	S_UNLOCK(log_fp);
 }
 
+void log_write(const gchar *str, const gchar *prefix)
+{
+	gchar buf[TIME_LEN + 1];
+	time_t t;
+
+	time(&t);
+	strftime(buf, TIME_LEN + 1, "[%H:%M:%S] ", localtime(&t));
+
+	log_append(buf, prefix, str, FALSE);
+}
+
 void log_print(const gchar *format, ...)
 {
 	va_list args;
@@ -4753,12 +5379,7 @@ void log_print(const gchar *format, ...)
 
 	if (debug_mode) g_print("%s", buf);
 	log_print_ui_func(buf);
-	S_LOCK(log_fp);
-	if (log_fp) {
-		fputs(buf, log_fp);
-		fflush(log_fp);
-	}
-	S_UNLOCK(log_fp);
+	log_append(buf, NULL, buf + TIME_LEN, FALSE);
 	if (log_verbosity_count)
 		log_show_status_func(buf + TIME_LEN);
 }
@@ -4778,14 +5399,7 @@ void log_message(const gchar *format, ...)
 
 	if (debug_mode) g_message("%s", buf + TIME_LEN);
 	log_message_ui_func(buf + TIME_LEN);
-	S_LOCK(log_fp);
-	if (log_fp) {
-		fwrite(buf, TIME_LEN, 1, log_fp);
-		fputs("* message: ", log_fp);
-		fputs(buf + TIME_LEN, log_fp);
-		fflush(log_fp);
-	}
-	S_UNLOCK(log_fp);
+	log_append(buf, "* message: ", buf + TIME_LEN, FALSE);
 	log_show_status_func(buf + TIME_LEN);
 }
 
@@ -4804,14 +5418,7 @@ void log_warning(const gchar *format, ...)
 
 	g_warning("%s", buf);
 	log_warning_ui_func(buf + TIME_LEN);
-	S_LOCK(log_fp);
-	if (log_fp) {
-		fwrite(buf, TIME_LEN, 1, log_fp);
-		fputs("** warning: ", log_fp);
-		fputs(buf + TIME_LEN, log_fp);
-		fflush(log_fp);
-	}
-	S_UNLOCK(log_fp);
+	log_append(buf, "** warning: ", buf + TIME_LEN, TRUE);
 }
 
 void log_error(const gchar *format, ...)
@@ -4829,21 +5436,14 @@ void log_error(const gchar *format, ...)
 
 	g_warning("%s", buf);
 	log_error_ui_func(buf + TIME_LEN);
-	S_LOCK(log_fp);
-	if (log_fp) {
-		fwrite(buf, TIME_LEN, 1, log_fp);
-		fputs("*** error: ", log_fp);
-		fputs(buf + TIME_LEN, log_fp);
-		fflush(log_fp);
-	}
-	S_UNLOCK(log_fp);
+	log_append(buf, "*** error: ", buf + TIME_LEN, TRUE);
 }
 
 void log_flush(void)
 {
 	S_LOCK(log_fp);
 	if (log_fp)
-		fflush(log_fp);
+		log_write_buf();
 	S_UNLOCK(log_fp);
 	log_flush_ui_func();
 }
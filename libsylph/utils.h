@@ -401,6 +401,16 @@ GList *uri_list_extract_filenames	(const gchar	*uri_list);
 gboolean is_uri_string			(const gchar	*str);
 gchar *get_uri_path			(const gchar	*uri);
 gint get_uri_len			(const gchar	*str);
+const gchar *find_uri_token		(const gchar	*str,
+					 gint		*pti);
+gboolean get_uri_part			(const gchar	*start,
+					 const gchar	*scanpos,
+					 const gchar    **bp,
+					 const gchar    **ep);
+gboolean get_email_part			(const gchar	*start,
+					 const gchar	*scanpos,
+					 const gchar    **bp,
+					 const gchar    **ep);
 void decode_uri				(gchar		*decoded_uri,
 					 const gchar	*encoded_uri);
 void decode_xdigit_encoded_str		(gchar		*decoded,
@@ -460,6 +470,15 @@ gint remove_numbered_files	(const gchar	*dir,
 				 guint		 first,
 				 guint		 last);
 gint remove_all_numbered_files	(const gchar	*dir);
+gint remove_all_numbered_files_async
+				(const gchar	*dir);
+void remove_numbered_files_wait	(void);
+gint remove_numbered_files_resume
+				(const gchar	*tomb);
+void remove_numbered_files_resume_all
+				(void);
+void remove_numbered_files_sweep
+				(const gchar	*dir);
 gint remove_expired_files	(const gchar	*dir,
 				 guint		 hours);
 gint remove_dir_recursive	(const gchar	*dir);
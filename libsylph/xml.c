@@ -28,24 +28,33 @@
 
 #define SPARSE_MEMORY
 /* if this is defined all attr.names and tag.names are stored
- * in a hash table */
+ * in a hash table. They are never freed because there are only a few
+ * distinct names, which saves reference counting on every tag. */
 #if defined(SPARSE_MEMORY)
-#include "stringtable.h" 
 
-static StringTable *xml_string_table;
+static GHashTable *xml_string_table;
 
-static void xml_string_table_create(void)
+static gchar *xml_string_add(const gchar *str)
 {
+	gchar *interned;
+
 	if (xml_string_table == NULL)
-		xml_string_table = string_table_new();
+		xml_string_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	interned = g_hash_table_lookup(xml_string_table, str);
+	if (!interned) {
+		interned = g_strdup(str);
+		g_hash_table_insert(xml_string_table, interned, interned);
+	}
+
+	return interned;
 }
+
 #define XML_STRING_ADD(str) \
-	string_table_insert_string(xml_string_table, (str))
-#define XML_STRING_FREE(str) \
-	string_table_free_string(xml_string_table, (str))
+	xml_string_add(str)
+#define XML_STRING_FREE(str)
 
-#define XML_STRING_TABLE_CREATE() \
-	xml_string_table_create()
+#define XML_STRING_TABLE_CREATE()
 
 #else /* !SPARSE_MEMORY */
 
@@ -58,10 +67,11 @@ static void xml_string_table_create(void)
 
 #endif /* SPARSE_MEMORY */
 
+/* size of a block read from the file */
+#define XMLREADSIZE	(XMLBUFSIZE * 4)
+
 static void xml_free_tag	(XMLTag		*tag);
-static gint xml_get_parenthesis	(XMLFile	*file,
-				 gchar		*buf,
-				 gint		 len);
+static gchar *xml_get_parenthesis(XMLFile	*file);
 
 XMLFile *xml_open_file(const gchar *path)
 {
@@ -87,6 +97,7 @@ XMLFile *xml_open_file(const gchar *path)
 	newfile->tag_stack = NULL;
 	newfile->level = 0;
 	newfile->is_empty_element = FALSE;
+	newfile->need_conv = TRUE;
 
 	return newfile;
 }
@@ -151,20 +162,16 @@ GNode *xml_parse_file(const gchar *path)
 
 	xml_close_file(file);
 
-#if defined(SPARSE_MEMORY)
-	if (get_debug_mode())
-		string_table_get_stats(xml_string_table);
-#endif
-
 	return node;
 }
 
 gint xml_get_dtd(XMLFile *file)
 {
-	gchar buf[XMLBUFSIZE];
-	gchar *bufp = buf;
+	gchar *buf;
+	gchar *bufp;
 
-	if (xml_get_parenthesis(file, buf, sizeof(buf)) < 0) return -1;
+	if ((buf = xml_get_parenthesis(file)) == NULL) return -1;
+	bufp = buf;
 
 	if ((*bufp++ == '?') &&
 	    (bufp = strcasestr(bufp, "xml")) &&
@@ -177,6 +184,10 @@ gint xml_get_dtd(XMLFile *file)
 			file->encoding = g_strdup(bufp);
 		} else
 			file->encoding = g_strdup(CS_INTERNAL);
+		/* the names and values are used as they are */
+		file->need_conv =
+			g_ascii_strcasecmp(file->encoding, CS_INTERNAL) != 0 &&
+			g_ascii_strcasecmp(file->encoding, CS_US_ASCII) != 0;
 	} else {
 		g_warning("Can't get xml dtd\n");
 		return -1;
@@ -185,10 +196,21 @@ gint xml_get_dtd(XMLFile *file)
 	return 0;
 }
 
+static gchar *xml_conv_str(XMLFile *file, const gchar *str)
+{
+	gchar *conv_str;
+
+	if (!file->need_conv)
+		return NULL;
+
+	conv_str = conv_codeset_strdup(str, file->encoding, CS_INTERNAL);
+	return conv_str;
+}
+
 gint xml_parse_next_tag(XMLFile *file)
 {
-	gchar buf[XMLBUFSIZE];
-	gchar *bufp = buf;
+	gchar *buf;
+	gchar *bufp;
 	gchar *tag_str;
 	XMLTag *tag;
 	gint len;
@@ -199,7 +221,7 @@ gint xml_parse_next_tag(XMLFile *file)
 		return 0;
 	}
 
-	if (xml_get_parenthesis(file, buf, sizeof(buf)) < 0) {
+	if ((buf = xml_get_parenthesis(file)) == NULL) {
 		g_warning("xml_parse_next_tag(): Can't parse next tag\n");
 		return -1;
 	}
@@ -223,29 +245,18 @@ gint xml_parse_next_tag(XMLFile *file)
 		buf[len - 1] = '\0';
 		g_strchomp(buf);
 	}
-	if (strlen(buf) == 0) {
+	if (buf[0] == '\0') {
 		g_warning("xml_parse_next_tag(): Tag name is empty\n");
 		return -1;
 	}
 
+	bufp = buf;
 	while (*bufp != '\0' && !g_ascii_isspace(*bufp)) bufp++;
-	if (*bufp == '\0') {
-		tag_str = conv_codeset_strdup(buf, file->encoding, CS_INTERNAL);
-		if (tag_str) {
-			tag->tag = XML_STRING_ADD(tag_str);
-			g_free(tag_str);
-		} else
-			tag->tag = XML_STRING_ADD(buf);
-		return 0;
-	} else {
+	if (*bufp != '\0')
 		*bufp++ = '\0';
-		tag_str = conv_codeset_strdup(buf, file->encoding, CS_INTERNAL);
-		if (tag_str) {
-			tag->tag = XML_STRING_ADD(tag_str);
-			g_free(tag_str);
-		} else
-			tag->tag = XML_STRING_ADD(buf);
-	}
+	tag_str = xml_conv_str(file, buf);
+	tag->tag = XML_STRING_ADD(tag_str ? tag_str : buf);
+	g_free(tag_str);
 
 	/* parse attributes ( name=value ) */
 	while (*bufp) {
@@ -283,16 +294,12 @@ gint xml_parse_next_tag(XMLFile *file)
 
 		g_strchomp(attr_name);
 		xml_unescape_str(attr_value);
-		utf8_attr_name = conv_codeset_strdup
-			(attr_name, file->encoding, CS_INTERNAL);
-		utf8_attr_value = conv_codeset_strdup
-			(attr_value, file->encoding, CS_INTERNAL);
-		if (!utf8_attr_name)
-			utf8_attr_name = g_strdup(attr_name);
-		if (!utf8_attr_value)
-			utf8_attr_value = g_strdup(attr_value);
-
-		attr = xml_attr_new(utf8_attr_name, utf8_attr_value);
+		utf8_attr_name = xml_conv_str(file, attr_name);
+		utf8_attr_value = xml_conv_str(file, attr_value);
+
+		attr = xml_attr_new(utf8_attr_name ? utf8_attr_name : attr_name,
+				    utf8_attr_value ? utf8_attr_value
+				    : attr_value);
 		xml_tag_add_attr(tag, attr);
 
 		g_free(utf8_attr_value);
@@ -341,53 +348,83 @@ GList *xml_get_current_tag_attr(XMLFile *file)
 	return tag->attr;
 }
 
+#define XML_BUF_REMAIN(file) \
+	((file)->buf->len - ((file)->bufp - (file)->buf->str))
+
+/* find @c from the current position, reading more data as needed */
+static gchar *xml_find_char(XMLFile *file, gchar c)
+{
+	gchar *p;
+	gsize scanned = 0;
+
+	while ((p = memchr(file->bufp + scanned, c,
+			   XML_BUF_REMAIN(file) - scanned)) == NULL) {
+		scanned = XML_BUF_REMAIN(file);
+		if (xml_read_line(file) < 0) return NULL;
+	}
+
+	return p;
+}
+
 gchar *xml_get_element(XMLFile *file)
 {
 	gchar *str;
 	gchar *new_str;
+	gchar *start;
 	gchar *end;
 
-	while ((end = strchr(file->bufp, '<')) == NULL)
-		if (xml_read_line(file) < 0) return NULL;
+	if ((end = xml_find_char(file, '<')) == NULL)
+		return NULL;
 
 	if (end == file->bufp)
 		return NULL;
 
-	str = g_strndup(file->bufp, end - file->bufp);
 	/* this is not XML1.0 strict */
-	g_strstrip(str);
-	xml_unescape_str(str);
-
+	for (start = file->bufp; start < end && g_ascii_isspace(*start);
+	     start++)
+		;
 	file->bufp = end;
-	xml_truncate_buf(file);
+	while (end > start && g_ascii_isspace(*(end - 1)))
+		end--;
 
-	if (str[0] == '\0') {
-		g_free(str);
+	if (start == end)
 		return NULL;
-	}
 
-	new_str = conv_codeset_strdup(str, file->encoding, CS_INTERNAL);
-	if (!new_str)
-		new_str = g_strdup(str);
-	g_free(str);
+	str = g_strndup(start, end - start);
+	xml_unescape_str(str);
 
-	return new_str;
+	if ((new_str = xml_conv_str(file, str)) != NULL) {
+		g_free(str);
+		str = new_str;
+	}
+
+	return str;
 }
 
+/* read the next block. the data before the current position may be
+   discarded, so the pointers into the buffer become invalid. */
 gint xml_read_line(XMLFile *file)
 {
-	gchar buf[XMLBUFSIZE];
-	gint index;
-
-	if (fgets(buf, sizeof(buf), file->fp) == NULL)
+	gsize consumed;
+	gsize len;
+	gsize size;
+
+	/* discard the consumed data when it's at least half of the buffer,
+	   so each byte is moved at most once on average */
+	consumed = file->bufp - file->buf->str;
+	if (consumed > 0 && consumed >= file->buf->len / 2)
+		xml_truncate_buf(file);
+
+	consumed = file->bufp - file->buf->str;
+	len = file->buf->len;
+	g_string_set_size(file->buf, len + XMLREADSIZE);
+	size = fread(file->buf->str + len, 1, XMLREADSIZE, file->fp);
+	g_string_truncate(file->buf, len + size);
+	file->bufp = file->buf->str + consumed;
+
+	if (size == 0)
 		return -1;
 
-	index = file->bufp - file->buf->str;
-
-	g_string_append(file->buf, buf);
-
-	file->bufp = file->buf->str + index;
-
 	return 0;
 }
 
@@ -479,41 +516,50 @@ gint xml_unescape_str(gchar *str)
 {
 	gchar *start;
 	gchar *end;
-	gchar *p = str;
+	gchar *p;
+	gchar *q;
 	gchar ch;
 	gint len;
 
-	while ((start = strchr(p, '&')) != NULL) {
-		if ((end = strchr(start + 1, ';')) == NULL) {
-			g_warning("Unescaped `&' appeared\n");
-			p = start + 1;
+	if ((start = strchr(str, '&')) == NULL)
+		return 0;
+
+	/* copy in place in one pass */
+	for (p = q = start; *p != '\0'; ) {
+		if (*p != '&') {
+			*q++ = *p++;
 			continue;
 		}
-		len = end - start + 1;
-		if (len < 3) {
-			p = end + 1;
+		if ((end = strchr(p + 1, ';')) == NULL) {
+			g_warning("Unescaped `&' appeared\n");
+			*q++ = *p++;
 			continue;
 		}
+		len = end - p + 1;
 
-		if (!strncmp(start, "&lt;", 4))
+		if (len < 3)
+			ch = '\0';
+		else if (!strncmp(p, "&lt;", 4))
 			ch = '<';
-		else if (!strncmp(start, "&gt;", 4))
+		else if (!strncmp(p, "&gt;", 4))
 			ch = '>';
-		else if (!strncmp(start, "&amp;", 5))
+		else if (!strncmp(p, "&amp;", 5))
 			ch = '&';
-		else if (!strncmp(start, "&apos;", 6))
+		else if (!strncmp(p, "&apos;", 6))
 			ch = '\'';
-		else if (!strncmp(start, "&quot;", 6))
+		else if (!strncmp(p, "&quot;", 6))
 			ch = '\"';
-		else {
-			p = end + 1;
-			continue;
-		}
+		else
+			ch = '\0';
 
-		*start = ch;
-		memmove(start + 1, end + 1, strlen(end + 1) + 1);
-		p = start + 1;
+		if (ch == '\0') {
+			memmove(q, p, len);
+			q += len;
+		} else
+			*q++ = ch;
+		p = end + 1;
 	}
+	*q = '\0';
 
 	return 0;
 }
@@ -663,26 +709,27 @@ static void xml_free_tag(XMLTag *tag)
 	g_free(tag);
 }
 
-static gint xml_get_parenthesis(XMLFile *file, gchar *buf, gint len)
+/* returns the contents between the next '<' and '>' as a slice of the
+   buffer, which is valid until the next read */
+static gchar *xml_get_parenthesis(XMLFile *file)
 {
 	gchar *start;
 	gchar *end;
 
-	buf[0] = '\0';
+	if ((start = xml_find_char(file, '<')) == NULL) return NULL;
 
-	while ((start = strchr(file->bufp, '<')) == NULL)
-		if (xml_read_line(file) < 0) return -1;
+	file->bufp = start + 1;
 
-	start++;
-	file->bufp = start;
+	if ((end = xml_find_char(file, '>')) == NULL) return NULL;
 
-	while ((end = strchr(file->bufp, '>')) == NULL)
-		if (xml_read_line(file) < 0) return -1;
-
-	strncpy2(buf, file->bufp, MIN(end - file->bufp + 1, len));
-	g_strstrip(buf);
+	start = file->bufp;
 	file->bufp = end + 1;
-	xml_truncate_buf(file);
 
-	return 0;
+	while (start < end && g_ascii_isspace(*start))
+		start++;
+	while (end > start && g_ascii_isspace(*(end - 1)))
+		end--;
+	*end = '\0';
+
+	return start;
 }
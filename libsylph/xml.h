@@ -62,6 +62,8 @@ struct _XMLFile
 	guint level;
 
 	gboolean is_empty_element;
+
+	gboolean need_conv;
 };
 
 XMLFile *xml_open_file		(const gchar	*path);
@@ -41,12 +41,17 @@
 
 /* How it works:
  *
- * The address book is read into memory. We set up an address list
- * containing all address book entries. Next we make the completion
- * list, which contains all the completable strings, and store a
- * reference to the address entry it belongs to.
- * After calling the g_completion_complete(), we get a reference
- * to a valid email address.  
+ * The address book is read into memory. We set up an address table
+ * containing all address book entries, unique by name and address.
+ * Next we make the completion index, which is an array of all the
+ * completable strings (case-folded) sorted by strcmp(), each with a
+ * reference to the address entry it belongs to. A prefix is completed
+ * by a binary search for the first string not less than the prefix.
+ *
+ * When the address book is changed, it is read again on the next
+ * completion and only the differences are applied to the index: the
+ * entries which were not seen again are swept, and the new strings are
+ * sorted and merged into the index.
  *
  * Completion is very simplified. We never complete on another prefix,
  * i.e. we neglect the next smallest possible prefix for the current
@@ -63,6 +68,8 @@ typedef struct
 {
 	gchar *name;
 	gchar *address;
+	guint  seq;		/* order in the address book */
+	guint  generation;	/* last refresh which has seen it */
 } address_entry;
 
 /* completion_entry - structure used to complete addresses, with a reference
@@ -70,27 +77,33 @@ typedef struct
  */
 typedef struct
 {
-	gchar		*string; /* string to complete */
-	address_entry	*ref;	 /* address the string belongs to  */
+	gchar		*string;	/* case-folded string to complete */
+	address_entry	*ref;		/* address the string belongs to  */
+	guint		 generation;	/* last refresh which has seen it */
 } completion_entry;
 
 /*******************************************************************************/
 
 static gint	    ref_count;		/* list ref count */
-static GList 	   *completion_list;	/* list of strings to be checked */
-static GList 	   *address_list;	/* address storage */
-static GCompletion *completion;		/* completion object */
+static GHashTable  *address_table;	/* address storage */
+static GHashTable  *completion_table;	/* unique completion entries */
+static GPtrArray   *completion_index;	/* completion entries sorted by
+					   string */
+static GPtrArray   *completion_new;	/* entries added by the refresh */
+static guint	    completion_generation;
+static guint	    address_seq;
+static gboolean	    completion_dirty;	/* address book was changed */
 
 /* To allow for continuing completion we have to keep track of the state
  * using the following variables. No need to create a context object. */
 
 static gint	    completion_count;		/* nr of addresses incl. the prefix */
 static gint	    completion_next;		/* next prev address */
-static GSList	   *completion_addresses;	/* unique addresses found in the
+static GPtrArray   *completion_addresses;	/* unique addresses found in the
 						   completion cache. */
 static gchar	   *completion_prefix;		/* last prefix. (this is cached here
-						 * because the prefix passed to g_completion
-						 * is g_strdown()'ed */
+						 * because the prefix used for the
+						 * lookup is case-folded */
 
 /*******************************************************************************/
 
@@ -99,70 +112,97 @@ static void address_completion_entry_changed		(GtkEditable *editable,
 							 gpointer     data);
 
 
-/* completion_func() - used by GTK to find the string data to be used for 
- * completion 
- */
-static gchar *completion_func(gpointer data)
+static guint address_entry_hash(gconstpointer key)
 {
-	g_return_val_if_fail(data != NULL, NULL);
+	const address_entry *ae = key;
 
-	return ((completion_entry *)data)->string;
-} 
+	return g_str_hash(ae->name) * 31 + g_str_hash(ae->address);
+}
 
-static void init_all(void)
+static gboolean address_entry_equal(gconstpointer a, gconstpointer b)
 {
-	completion = g_completion_new(completion_func);
-	g_return_if_fail(completion != NULL);
+	const address_entry *ae1 = a;
+	const address_entry *ae2 = b;
+
+	return strcmp(ae1->name, ae2->name) == 0 &&
+		strcmp(ae1->address, ae2->address) == 0;
 }
 
-static void free_all(void)
+static guint completion_entry_hash(gconstpointer key)
 {
-	GList *walk;
+	const completion_entry *ce = key;
 
-	walk = g_list_first(completion_list);
-	for (; walk != NULL; walk = g_list_next(walk)) {
-		completion_entry *ce = (completion_entry *) walk->data;
-		g_free(ce->string);
-		g_free(ce);
-	}
-	g_list_free(completion_list);
-	completion_list = NULL;
-
-	walk = address_list;
-	for (; walk != NULL; walk = g_list_next(walk)) {
-		address_entry *ae = (address_entry *) walk->data;
-		g_free(ae->name);
-		g_free(ae->address);
-		g_free(ae);
-	}
-	g_list_free(address_list);
-	address_list = NULL;
+	return g_str_hash(ce->string) ^ g_direct_hash(ce->ref);
+}
+
+static gboolean completion_entry_equal(gconstpointer a, gconstpointer b)
+{
+	const completion_entry *ce1 = a;
+	const completion_entry *ce2 = b;
 
-	g_completion_free(completion);
-	completion = NULL;
+	return ce1->ref == ce2->ref && strcmp(ce1->string, ce2->string) == 0;
 }
 
-static gint address_entry_find_func(gconstpointer a, gconstpointer b)
+static gint completion_entry_compare(gconstpointer a, gconstpointer b)
 {
-	const address_entry *ae1 = a;
-	const address_entry *ae2 = b;
-	gint val;
+	const completion_entry *ce1 = *(const completion_entry **)a;
+	const completion_entry *ce2 = *(const completion_entry **)b;
 
-	if (!a || !b)
-		return -1;
+	return strcmp(ce1->string, ce2->string);
+}
 
-	val = strcmp(ae1->name, ae2->name);
-	if (val != 0)
-		return val;
-	val = strcmp(ae1->address, ae2->address);
-	if (val != 0)
-		return val;
+static gint address_entry_seq_compare(gconstpointer a, gconstpointer b)
+{
+	const address_entry *ae1 = *(const address_entry **)a;
+	const address_entry *ae2 = *(const address_entry **)b;
 
-	return 0;
+	return (ae1->seq > ae2->seq) - (ae1->seq < ae2->seq);
+}
+
+static void init_all(void)
+{
+	address_table = g_hash_table_new(address_entry_hash,
+					 address_entry_equal);
+	completion_table = g_hash_table_new(completion_entry_hash,
+					    completion_entry_equal);
+	completion_index = g_ptr_array_new();
+	completion_generation = 0;
+	address_seq = 0;
+	completion_dirty = FALSE;
+}
+
+static void address_entry_free_func(gpointer key, gpointer value,
+				    gpointer data)
+{
+	address_entry *ae = (address_entry *)value;
+
+	g_free(ae->name);
+	g_free(ae->address);
+	g_free(ae);
+}
+
+static void free_all(void)
+{
+	guint i;
+
+	for (i = 0; i < completion_index->len; i++) {
+		completion_entry *ce = g_ptr_array_index(completion_index, i);
+		g_free(ce->string);
+		g_free(ce);
+	}
+	g_ptr_array_free(completion_index, TRUE);
+	completion_index = NULL;
+	g_hash_table_destroy(completion_table);
+	completion_table = NULL;
+
+	g_hash_table_foreach(address_table, address_entry_free_func, NULL);
+	g_hash_table_destroy(address_table);
+	address_table = NULL;
 }
 
 static void add_completion_entry(const gchar *str, address_entry *ae)
 {
+	completion_entry key;
 	completion_entry *ce;
 
 	if (!str || *str == '\0')
@@ -170,11 +210,21 @@ static void add_completion_entry(const gchar *str, address_entry *ae)
 	if (!ae)
 		return;
 
-	ce = g_new0(completion_entry, 1);
-	/* GCompletion list is case sensitive */
-	ce->string = g_utf8_strdown(str, -1);
+	key.string = g_utf8_casefold(str, -1);
+	key.ref = ae;
+
+	if ((ce = g_hash_table_lookup(completion_table, &key)) != NULL) {
+		g_free(key.string);
+		ce->generation = completion_generation;
+		return;
+	}
+
+	ce = g_new(completion_entry, 1);
+	ce->string = key.string;
 	ce->ref = ae;
-	completion_list = g_list_append(completion_list, ce);
+	ce->generation = completion_generation;
+	g_hash_table_insert(completion_table, ce, ce);
+	g_ptr_array_add(completion_new, ce);
 }
 
 /* add_address() - adds address to the completion list. this function looks
@@ -182,25 +232,28 @@ static void add_completion_entry(const gchar *str, address_entry *ae)
  */
 static gint add_address(const gchar *name, const gchar *firstname, const gchar *lastname, const gchar *nickname, const gchar *address)
 {
+	address_entry  key;
 	address_entry *ae;
-	GList         *found;
 
 	if (!address || *address == '\0')
 		return -1;
 
 	/* debugg_print("add_address: [%s] [%s] [%s] [%s] [%s]\n", name, firstname, lastname, nickname, address); */
 
-	ae = g_new0(address_entry, 1);
-	ae->name    = g_strdup(name ? name : "");
-	ae->address = g_strdup(address);		
-	if ((found = g_list_find_custom(address_list, ae,
-					address_entry_find_func))) {
-		g_free(ae->name);
-		g_free(ae->address);
-		g_free(ae);
-		ae = (address_entry *)found->data;
-	} else
-		address_list = g_list_append(address_list, ae);
+	key.name    = (gchar *)(name ? name : "");
+	key.address = (gchar *)address;
+	if ((ae = g_hash_table_lookup(address_table, &key)) == NULL) {
+		ae = g_new0(address_entry, 1);
+		ae->name    = g_strdup(key.name);
+		ae->address = g_strdup(address);
+		g_hash_table_insert(address_table, ae, ae);
+	}
+	/* number the kept entries again too, so that the order follows
+	   the address book after it was edited */
+	if (ae->generation != completion_generation) {
+		ae->seq        = address_seq++;
+		ae->generation = completion_generation;
+	}
  
 	if (name) {
 		const gchar *p = name;
@@ -227,6 +280,83 @@ static void read_address_book(void) {
 	addressbook_load_completion_full( add_address );
 }
 
+static gboolean address_entry_sweep_func(gpointer key, gpointer value,
+					 gpointer data)
+{
+	address_entry *ae = (address_entry *)value;
+
+	if (ae->generation == completion_generation)
+		return FALSE;
+
+	g_free(ae->name);
+	g_free(ae->address);
+	g_free(ae);
+
+	return TRUE;
+}
+
+/* refresh_completion_index() - reads the address book and applies the
+ * differences to the completion index.
+ */
+static void refresh_completion_index(void)
+{
+	GPtrArray *merged;
+	completion_entry *ce;
+	guint i, j, n_removed;
+
+	completion_generation++;
+	completion_new = g_ptr_array_new();
+	address_seq = 0;
+
+	read_address_book();
+
+	/* sweep the entries which were not seen again */
+	for (i = 0, j = 0; i < completion_index->len; i++) {
+		ce = g_ptr_array_index(completion_index, i);
+		if (ce->generation == completion_generation)
+			completion_index->pdata[j++] = ce;
+		else {
+			g_hash_table_remove(completion_table, ce);
+			g_free(ce->string);
+			g_free(ce);
+		}
+	}
+	n_removed = completion_index->len - j;
+	g_ptr_array_set_size(completion_index, j);
+	g_hash_table_foreach_remove(address_table, address_entry_sweep_func,
+				    NULL);
+
+	/* merge the new entries into the index */
+	if (completion_new->len > 0) {
+		g_ptr_array_sort(completion_new, completion_entry_compare);
+		merged = g_ptr_array_sized_new
+			(completion_index->len + completion_new->len);
+		for (i = 0, j = 0;
+		     i < completion_index->len || j < completion_new->len; ) {
+			if (j >= completion_new->len ||
+			    (i < completion_index->len &&
+			     completion_entry_compare
+				(&completion_index->pdata[i],
+				 &completion_new->pdata[j]) <= 0))
+				g_ptr_array_add(merged,
+						completion_index->pdata[i++]);
+			else
+				g_ptr_array_add(merged,
+						completion_new->pdata[j++]);
+		}
+		g_ptr_array_free(completion_index, TRUE);
+		completion_index = merged;
+	}
+
+	debug_print("refresh_completion_index: %u added, %u removed, "
+		    "%u total\n", completion_new->len, n_removed,
+		    completion_index->len);
+
+	g_ptr_array_free(completion_new, TRUE);
+	completion_new = NULL;
+	completion_dirty = FALSE;
+}
+
 /* start_address_completion() - returns the number of addresses 
  * that should be matched for completion.
  */
@@ -235,16 +365,13 @@ gint start_address_completion(void)
 	clear_completion_cache();
 	if (!ref_count) {
 		init_all();
-		/* open the address book */
-		read_address_book();
-		/* merge the completion entry list into g_completion */
-		if (completion_list)
-			g_completion_add_items(completion, completion_list);
+		/* open the address book and make the completion index */
+		refresh_completion_index();
 	}
 	ref_count++;
 	debug_print("start_address_completion ref count %d\n", ref_count);
 
-	return g_list_length(completion_list);
+	return completion_index->len;
 }
 
 /* get_address_from_edit() - returns a possible address (or a part)
@@ -328,36 +455,6 @@ void replace_address_in_edit(GtkEntry *entry, const gchar *newtext,
 		(entry, address_completion_entry_changed, NULL);
 }
 
-#if 0
-static gint insert_address_func(gconstpointer a, gconstpointer b)
-{
-	const address_entry *ae1 = a;
-	const address_entry *ae2 = b;
-	gchar *s1, *s2;
-	gint val;
-
-	if (!a || !b)
-		return -1;
-
-	s1 = g_utf8_casefold(ae1->address, -1);
-	s2 = g_utf8_casefold(ae2->address, -1);
-	val = g_utf8_collate(s1, s2);
-	g_free(s2);
-	g_free(s1);
-	if (val != 0)
-		return val;
-	s1 = g_utf8_casefold(ae1->name, -1);
-	s2 = g_utf8_casefold(ae2->name, -1);
-	val = g_utf8_collate(s1, s2);
-	g_free(s2);
-	g_free(s1);
-	if (val != 0)
-		return val;
-
-	return 0;
-}
-#endif
-
 /* complete_address() - tries to complete an addres, and returns the
  * number of addresses found. use get_complete_address() to get one.
  * returns zero if no match was found, otherwise the number of addresses,
@@ -365,45 +462,61 @@ static gint insert_address_func(gconstpointer a, gconstpointer b)
  */
 guint complete_address(const gchar *str)
 {
-	GList *result;
+	GHashTable *found;
 	gchar *d;
-	guint  count, cpl;
+	gsize len;
+	guint count, lo, hi, mid;
 	completion_entry *ce;
 
 	g_return_val_if_fail(str != NULL, 0);
 
 	clear_completion_cache();
-	completion_prefix = g_strdup(str);
 
-	/* g_completion is case sensitive */
-	d = g_utf8_strdown(str, -1);
-	result = g_completion_complete(completion, d, NULL);
+	if (!completion_index)
+		return 0;
+	if (completion_dirty)
+		refresh_completion_index();
+
+	d = g_utf8_casefold(str, -1);
+	len = strlen(d);
+
+	/* find the first string not less than the prefix */
+	lo = 0;
+	hi = completion_index->len;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ce = g_ptr_array_index(completion_index, mid);
+		if (strcmp(ce->string, d) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	count = g_list_length(result);
-	if (count) {
-		/* create list with unique addresses  */
-		for (cpl = 0, result = g_list_first(result);
-		     result != NULL;
-		     result = g_list_next(result)) {
-			ce = (completion_entry *)(result->data);
-			if (NULL == g_slist_find(completion_addresses,
-						 ce->ref)) {
-				cpl++;
-				completion_addresses =
-					g_slist_append(completion_addresses,
-						       ce->ref);
-#if 0
-					g_slist_insert_sorted
-						(completion_addresses, ce->ref,
-						 insert_address_func);
-#endif
-			}
+	/* create list with unique addresses  */
+	found = g_hash_table_new(NULL, NULL);
+	completion_addresses = g_ptr_array_new();
+	for (; lo < completion_index->len; lo++) {
+		ce = g_ptr_array_index(completion_index, lo);
+		if (strncmp(ce->string, d, len) != 0)
+			break;
+		if (g_hash_table_lookup(found, ce->ref) == NULL) {
+			g_hash_table_insert(found, ce->ref, ce->ref);
+			g_ptr_array_add(completion_addresses, ce->ref);
 		}
-		count = cpl + 1;	/* index 0 is the original prefix */
+	}
+	g_hash_table_destroy(found);
+
+	count = completion_addresses->len;
+	if (count) {
+		/* keep the order of the address book */
+		g_ptr_array_sort(completion_addresses,
+				 address_entry_seq_compare);
+		completion_prefix = g_strdup(str);
+		count++;		/* index 0 is the original prefix */
 		completion_next = 1;	/* we start at the first completed one */
 	} else {
-		g_free(completion_prefix);
-		completion_prefix = NULL;
+		g_ptr_array_free(completion_addresses, TRUE);
+		completion_addresses = NULL;
 	}
 
 	completion_count = count;
@@ -426,8 +539,11 @@ gchar *get_complete_address(gint index)
 			address = g_strdup(completion_prefix);
 		else {
 			/* get something from the unique addresses */
-			p = (address_entry *)g_slist_nth_data
-				(completion_addresses, index - 1);
+			p = NULL;
+			if (completion_addresses &&
+			    (guint)(index - 1) < completion_addresses->len)
+				p = g_ptr_array_index(completion_addresses,
+						      index - 1);
 			if (p != NULL) {
 				if (!p->name || p->name[0] == '\0')
 					address = g_strdup(p->address);
@@ -489,11 +605,13 @@ guint get_completion_count(void)
 void clear_completion_cache(void)
 {
 	if (is_completion_pending()) {
-		if (completion_prefix)
+		if (completion_prefix) {
 			g_free(completion_prefix);
+			completion_prefix = NULL;
+		}
 
 		if (completion_addresses) {
-			g_slist_free(completion_addresses);
+			g_ptr_array_free(completion_addresses, TRUE);
 			completion_addresses = NULL;
 		}
 
@@ -514,17 +632,14 @@ gboolean is_completion_pending(void)
 gint invalidate_address_completion(void)
 {
 	if (ref_count) {
-		/* simply the same as start_address_completion() */
+		/* the index is updated on the next completion */
 		debug_print("Invalidation request for address completion\n");
-		free_all();
-		init_all();
-		read_address_book();
-		if (completion_list)
-			g_completion_add_items(completion, completion_list);
+		completion_dirty = TRUE;
 		clear_completion_cache();
+		return completion_index->len;
 	}
 
-	return g_list_length(completion_list);
+	return 0;
 }
 
 gint end_address_completion(void)
@@ -665,7 +780,10 @@ static void completion_window_apply_selection_address_only(GtkCList *clist, GtkE
 
 	row = GPOINTER_TO_INT(clist->selection->data);
 
-	ae = (address_entry *)g_slist_nth_data(completion_addresses, row - 1);
+	ae = NULL;
+	if (completion_addresses && row > 0 &&
+	    (guint)(row - 1) < completion_addresses->len)
+		ae = g_ptr_array_index(completion_addresses, row - 1);
 	if (ae && ae->address) {
 		address = get_address_from_edit(entry, &cursor_pos);
 		g_free(address);
@@ -739,7 +739,8 @@ static gboolean addrbook_read_tree( AddressBookFile *book, XMLFile *file ) {
 }
 
 /*
-* Resolve folder items visitor function.
+* Resolve folder items visitor function. Items are prepended to the lists of
+* the root folder, which are reversed when all items are visited.
 */
 static void addrbook_res_items_vis( gpointer key, gpointer value, gpointer data ) {
 	AddressBookFile *book = data;
@@ -747,11 +748,11 @@ static void addrbook_res_items_vis( gpointer key, gpointer value, gpointer data
 	ItemFolder *rootFolder = book->addressCache->rootFolder;
 	if( obj->parent == NULL ) {
 		if( ADDRITEM_TYPE(obj) == ITEMTYPE_PERSON ) {
-			rootFolder->listPerson = g_list_append( rootFolder->listPerson, obj );
+			rootFolder->listPerson = g_list_prepend( rootFolder->listPerson, obj );
 			ADDRITEM_PARENT(obj) = ADDRITEM_OBJECT(rootFolder);
 		}
 		else if( ADDRITEM_TYPE(obj) == ITEMTYPE_GROUP ) {
-			rootFolder->listGroup = g_list_append( rootFolder->listGroup, obj );
+			rootFolder->listGroup = g_list_prepend( rootFolder->listGroup, obj );
 			ADDRITEM_PARENT(obj) = ADDRITEM_OBJECT(rootFolder);
 		}
 	}
@@ -769,6 +770,10 @@ static void addrbook_resolve_folder_items( AddressBookFile *book ) {
 	while( nodeFolder ) {
 		ItemFolder *folder = nodeFolder->data;
 		listRemove = NULL;
+		/* Build the item lists in reverse, appending is too slow for large folders */
+		folder->listFolder = g_list_reverse( folder->listFolder );
+		folder->listPerson = g_list_reverse( folder->listPerson );
+		folder->listGroup = g_list_reverse( folder->listGroup );
 		node = folder->listItems;
 		while( node ) {
 			gchar *uid = node->data;
@@ -776,18 +781,18 @@ static void addrbook_resolve_folder_items( AddressBookFile *book ) {
 			if( aio ) {
 				if( aio->type == ITEMTYPE_FOLDER ) {
 					ItemFolder *item = ( ItemFolder * ) aio;
-					folder->listFolder = g_list_append( folder->listFolder, item );
+					folder->listFolder = g_list_prepend( folder->listFolder, item );
 					ADDRITEM_PARENT(item) = ADDRITEM_OBJECT(folder);
 					addrcache_hash_add_folder( book->addressCache, folder );
 				}
 				else if( aio->type == ITEMTYPE_PERSON ) {
 					ItemPerson *item = ( ItemPerson * ) aio;
-					folder->listPerson = g_list_append( folder->listPerson, item );
+					folder->listPerson = g_list_prepend( folder->listPerson, item );
 					ADDRITEM_PARENT(item) = ADDRITEM_OBJECT(folder);
 				}
 				else if( aio->type == ITEMTYPE_GROUP ) {
 					ItemGroup *item = ( ItemGroup * ) aio;
-					folder->listGroup = g_list_append( folder->listGroup, item );
+					folder->listGroup = g_list_prepend( folder->listGroup, item );
 					ADDRITEM_PARENT(item) = ADDRITEM_OBJECT(folder);
 				}
 				/* Replace data with pointer to item */
@@ -800,6 +805,9 @@ static void addrbook_resolve_folder_items( AddressBookFile *book ) {
 			}
 			node = g_list_next( node );
 		}
+		folder->listFolder = g_list_reverse( folder->listFolder );
+		folder->listPerson = g_list_reverse( folder->listPerson );
+		folder->listGroup = g_list_reverse( folder->listGroup );
 		rootFolder->listFolder = g_list_append( rootFolder->listFolder, folder );
 
 		/* Process remove list */
@@ -839,7 +847,11 @@ static void addrbook_resolve_folder_items( AddressBookFile *book ) {
 	g_list_free( listRemove );
 
 	/* Move all unparented persons and groups into root folder */
+	rootFolder->listPerson = g_list_reverse( rootFolder->listPerson );
+	rootFolder->listGroup = g_list_reverse( rootFolder->listGroup );
 	g_hash_table_foreach( book->addressCache->itemHash, addrbook_res_items_vis, book );
+	rootFolder->listPerson = g_list_reverse( rootFolder->listPerson );
+	rootFolder->listGroup = g_list_reverse( rootFolder->listGroup );
 
 	/* Free up some more */
 	nodeFolder = book->tempList;
@@ -854,12 +866,465 @@ static void addrbook_resolve_folder_items( AddressBookFile *book ) {
 
 }
 
+/* **********************************************************************
+* Address book snapshot.
+*
+* A binary copy of the parsed address book is kept next to the XML file
+* (".addrbook-NNNNNN.cache"). It is used instead of parsing the XML
+* while the modification time and the size of the XML file are the same
+* as recorded in the snapshot. The XML file is always the master copy;
+* the snapshot is rewritten after the XML is read or saved.
+*
+* Records are replayed with the same address cache operations as the
+* XML parser uses, in the order the XML file is written: persons, groups
+* and folders.
+* ***********************************************************************
+*/
+
+#define AB_SNAPSHOT_PREFIX       "."
+#define AB_SNAPSHOT_SUFFIX       ".cache"
+#define AB_SNAPSHOT_MAGIC        "SABS"
+#define AB_SNAPSHOT_VERSION      1
+
+#define AB_SNAPSHOT_NULL         G_MAXUINT32
+
+enum {
+	AB_SNAP_END    = 0,
+	AB_SNAP_PERSON = 1,
+	AB_SNAP_GROUP  = 2,
+	AB_SNAP_FOLDER = 3
+};
+
+typedef struct _AddrSnapshotHeader AddrSnapshotHeader;
+struct _AddrSnapshotHeader {
+	gchar   magic[4];
+	guint32 version;
+	gint64  mtime;
+	gint64  size;
+	gint64  dataSize;
+};
+
+typedef struct _AddrSnapshotReader AddrSnapshotReader;
+struct _AddrSnapshotReader {
+	const gchar *p;
+	const gchar *end;
+	gboolean error;
+};
+
+static gchar *addrbook_get_snapshot_file( AddressBookFile *book ) {
+	gchar *base;
+	gchar *file;
+	gsize len;
+
+	base = g_strdup( book->fileName );
+	len = strlen( base );
+	if( len > strlen( ADDRBOOK_SUFFIX ) &&
+	    strcmp( base + len - strlen( ADDRBOOK_SUFFIX ), ADDRBOOK_SUFFIX ) == 0 ) {
+		base[ len - strlen( ADDRBOOK_SUFFIX ) ] = '\0';
+	}
+	file = g_strconcat( book->path, G_DIR_SEPARATOR_S, AB_SNAPSHOT_PREFIX,
+			    base, AB_SNAPSHOT_SUFFIX, NULL );
+	g_free( base );
+	return file;
+}
+
+static void addrbook_snap_put_int( GString *buf, guint32 val ) {
+	g_string_append_len( buf, (gchar *) &val, sizeof( val ) );
+}
+
+static void addrbook_snap_put_str( GString *buf, const gchar *str ) {
+	if( str == NULL ) {
+		addrbook_snap_put_int( buf, AB_SNAPSHOT_NULL );
+		return;
+	}
+	addrbook_snap_put_int( buf, strlen( str ) );
+	g_string_append( buf, str );
+}
+
+static guint32 addrbook_snap_get_int( AddrSnapshotReader *rd ) {
+	guint32 val;
+
+	if( rd->error || rd->end - rd->p < (gint) sizeof( val ) ) {
+		rd->error = TRUE;
+		return 0;
+	}
+	memcpy( &val, rd->p, sizeof( val ) );
+	rd->p += sizeof( val );
+	return val;
+}
+
+static gchar *addrbook_snap_get_str( AddrSnapshotReader *rd ) {
+	guint32 len;
+	gchar *str;
+
+	len = addrbook_snap_get_int( rd );
+	if( rd->error || len == AB_SNAPSHOT_NULL ) return NULL;
+	if( (guint32) ( rd->end - rd->p ) < len ) {
+		rd->error = TRUE;
+		return NULL;
+	}
+	str = g_strndup( rd->p, len );
+	rd->p += len;
+	return str;
+}
+
+/*
+* Snapshot hash table visitor functions.
+*/
+static void addrbook_snap_person_vis( gpointer key, gpointer value, gpointer data ) {
+	AddrItemObject *obj = ( AddrItemObject * ) value;
+	ItemPerson *person = ( ItemPerson * ) value;
+	GString *buf = data;
+	GList *node;
+
+	if( ! obj || ADDRITEM_TYPE(obj) != ITEMTYPE_PERSON ) return;
+
+	addrbook_snap_put_int( buf, AB_SNAP_PERSON );
+	addrbook_snap_put_str( buf, ADDRITEM_ID(person) );
+	addrbook_snap_put_str( buf, person->firstName );
+	addrbook_snap_put_str( buf, person->lastName );
+	addrbook_snap_put_str( buf, person->nickName );
+	addrbook_snap_put_str( buf, ADDRITEM_NAME(person) );
+
+	addrbook_snap_put_int( buf, g_list_length( person->listEMail ) );
+	for( node = person->listEMail; node; node = g_list_next( node ) ) {
+		ItemEMail *email = node->data;
+		addrbook_snap_put_str( buf, ADDRITEM_ID(email) );
+		addrbook_snap_put_str( buf, ADDRITEM_NAME(email) );
+		addrbook_snap_put_str( buf, email->address );
+		addrbook_snap_put_str( buf, email->remarks );
+	}
+
+	addrbook_snap_put_int( buf, g_list_length( person->listAttrib ) );
+	for( node = person->listAttrib; node; node = g_list_next( node ) ) {
+		UserAttribute *attrib = node->data;
+		addrbook_snap_put_str( buf, attrib->uid );
+		addrbook_snap_put_str( buf, attrib->name );
+		addrbook_snap_put_str( buf, attrib->value );
+	}
+}
+
+static void addrbook_snap_group_vis( gpointer key, gpointer value, gpointer data ) {
+	AddrItemObject *obj = ( AddrItemObject * ) value;
+	ItemGroup *group = ( ItemGroup * ) value;
+	GString *buf = data;
+	GList *node;
+
+	if( ! obj || ADDRITEM_TYPE(obj) != ITEMTYPE_GROUP ) return;
+
+	addrbook_snap_put_int( buf, AB_SNAP_GROUP );
+	addrbook_snap_put_str( buf, ADDRITEM_ID(group) );
+	addrbook_snap_put_str( buf, ADDRITEM_NAME(group) );
+	addrbook_snap_put_str( buf, group->remarks );
+
+	addrbook_snap_put_int( buf, g_list_length( group->listEMail ) );
+	for( node = group->listEMail; node; node = g_list_next( node ) ) {
+		ItemEMail *email = node->data;
+		ItemPerson *person = ( ItemPerson * ) ADDRITEM_PARENT(email);
+		addrbook_snap_put_str( buf, person ? ADDRITEM_ID(person) : NULL );
+		addrbook_snap_put_str( buf, ADDRITEM_ID(email) );
+	}
+}
+
+static void addrbook_snap_folder_vis( gpointer key, gpointer value, gpointer data ) {
+	AddrItemObject *obj = ( AddrItemObject * ) value;
+	ItemFolder *folder = ( ItemFolder * ) value;
+	GString *buf = data;
+	GList *node;
+
+	if( ! obj || ADDRITEM_TYPE(obj) != ITEMTYPE_FOLDER ) return;
+
+	addrbook_snap_put_int( buf, AB_SNAP_FOLDER );
+	addrbook_snap_put_str( buf, ADDRITEM_ID(folder) );
+	addrbook_snap_put_str( buf, ADDRITEM_NAME(folder) );
+	addrbook_snap_put_str( buf, folder->remarks );
+
+	addrbook_snap_put_int( buf, g_list_length( folder->listPerson ) +
+			       g_list_length( folder->listGroup ) +
+			       g_list_length( folder->listFolder ) );
+	for( node = folder->listPerson; node; node = g_list_next( node ) ) {
+		addrbook_snap_put_str( buf, ADDRITEM_ID(node->data) );
+	}
+	for( node = folder->listGroup; node; node = g_list_next( node ) ) {
+		addrbook_snap_put_str( buf, ADDRITEM_ID(node->data) );
+	}
+	for( node = folder->listFolder; node; node = g_list_next( node ) ) {
+		addrbook_snap_put_str( buf, ADDRITEM_ID(node->data) );
+	}
+}
+
+/*
+* Write snapshot of address book for XML file fileSpec.
+*/
+static void addrbook_write_snapshot( AddressBookFile *book, const gchar *fileSpec ) {
+	AddrSnapshotHeader header;
+	GStatBuf s;
+	GString *buf;
+	gchar *snapFile, *tmpFile;
+	FILE *fp;
+
+	if( g_stat( fileSpec, &s ) < 0 ) return;
+
+	buf = g_string_sized_new( 4096 );
+	addrbook_snap_put_str( buf, book->name );
+	g_hash_table_foreach( book->addressCache->itemHash, addrbook_snap_person_vis, buf );
+	g_hash_table_foreach( book->addressCache->itemHash, addrbook_snap_group_vis, buf );
+	g_hash_table_foreach( book->addressCache->itemHash, addrbook_snap_folder_vis, buf );
+	addrbook_snap_put_int( buf, AB_SNAP_END );
+
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, AB_SNAPSHOT_MAGIC, 4 );
+	header.version = AB_SNAPSHOT_VERSION;
+	header.mtime = s.st_mtime;
+	header.size = s.st_size;
+	header.dataSize = buf->len;
+
+	snapFile = addrbook_get_snapshot_file( book );
+	tmpFile = g_strconcat( snapFile, ".tmp", NULL );
+	if( ( fp = g_fopen( tmpFile, "wb" ) ) == NULL ) {
+		FILE_OP_ERROR( tmpFile, "fopen" );
+	}
+	else if( fwrite( &header, sizeof( header ), 1, fp ) != 1 ||
+		 fwrite( buf->str, buf->len, 1, fp ) != 1 ) {
+		FILE_OP_ERROR( tmpFile, "fwrite" );
+		fclose( fp );
+		g_unlink( tmpFile );
+	}
+	else if( fclose( fp ) == EOF ) {
+		FILE_OP_ERROR( tmpFile, "fclose" );
+		g_unlink( tmpFile );
+	}
+	else if( rename_force( tmpFile, snapFile ) < 0 ) {
+		FILE_OP_ERROR( snapFile, "rename" );
+		g_unlink( tmpFile );
+	}
+
+	g_free( tmpFile );
+	g_free( snapFile );
+	g_string_free( buf, TRUE );
+}
+
+static void addrbook_snap_read_person( AddressBookFile *book, AddrSnapshotReader *rd ) {
+	ItemPerson *person;
+	guint32 i, n;
+
+	person = addritem_create_item_person();
+	ADDRITEM_ID(person) = addrbook_snap_get_str( rd );
+	person->firstName = addrbook_snap_get_str( rd );
+	person->lastName = addrbook_snap_get_str( rd );
+	person->nickName = addrbook_snap_get_str( rd );
+	ADDRITEM_NAME(person) = addrbook_snap_get_str( rd );
+
+	n = addrbook_snap_get_int( rd );
+	for( i = 0; i < n && ! rd->error; i++ ) {
+		ItemEMail *email = addritem_create_item_email();
+		ADDRITEM_ID(email) = addrbook_snap_get_str( rd );
+		ADDRITEM_NAME(email) = addrbook_snap_get_str( rd );
+		email->address = addrbook_snap_get_str( rd );
+		email->remarks = addrbook_snap_get_str( rd );
+		addrcache_person_add_email( book->addressCache, person, email );
+	}
+	if( ADDRITEM_ID(person) == NULL ||
+	    ! addrcache_hash_add_person( book->addressCache, person ) ) {
+		addritem_free_item_person( person );
+		person = NULL;
+	}
+
+	n = addrbook_snap_get_int( rd );
+	for( i = 0; i < n && ! rd->error; i++ ) {
+		UserAttribute *attrib = addritem_create_attribute();
+		attrib->uid = addrbook_snap_get_str( rd );
+		attrib->name = addrbook_snap_get_str( rd );
+		attrib->value = addrbook_snap_get_str( rd );
+		if( person ) {
+			addritem_person_add_attribute( person, attrib );
+		}
+		else {
+			addritem_free_attribute( attrib );
+		}
+	}
+}
+
+static void addrbook_snap_read_group( AddressBookFile *book, AddrSnapshotReader *rd ) {
+	ItemGroup *group;
+	gchar *pid, *eid;
+	guint32 i, n;
+
+	group = addritem_create_item_group();
+	ADDRITEM_ID(group) = addrbook_snap_get_str( rd );
+	ADDRITEM_NAME(group) = addrbook_snap_get_str( rd );
+	group->remarks = addrbook_snap_get_str( rd );
+	if( ADDRITEM_ID(group) == NULL ||
+	    ! addrcache_hash_add_group( book->addressCache, group ) ) {
+		addritem_free_item_group( group );
+		group = NULL;
+	}
+
+	n = addrbook_snap_get_int( rd );
+	for( i = 0; i < n && ! rd->error; i++ ) {
+		ItemEMail *email;
+
+		pid = addrbook_snap_get_str( rd );
+		eid = addrbook_snap_get_str( rd );
+		email = addrcache_get_email( book->addressCache, pid, eid );
+		if( email && group ) {
+			addrcache_group_add_email( book->addressCache, group, email );
+		}
+		g_free( pid );
+		g_free( eid );
+	}
+}
+
+static void addrbook_snap_read_folder( AddressBookFile *book, AddrSnapshotReader *rd ) {
+	ItemFolder *folder;
+	GList *items = NULL;
+	gchar *uid;
+	guint32 i, n;
+
+	folder = addritem_create_item_folder();
+	ADDRITEM_ID(folder) = addrbook_snap_get_str( rd );
+	ADDRITEM_NAME(folder) = addrbook_snap_get_str( rd );
+	folder->remarks = addrbook_snap_get_str( rd );
+
+	n = addrbook_snap_get_int( rd );
+	for( i = 0; i < n && ! rd->error; i++ ) {
+		uid = addrbook_snap_get_str( rd );
+		if( uid ) items = g_list_prepend( items, uid );
+	}
+
+	if( ADDRITEM_ID(folder) != NULL &&
+	    addrcache_hash_add_folder( book->addressCache, folder ) ) {
+		folder->listItems = g_list_reverse( items );
+		book->tempList = g_list_prepend( book->tempList, folder );
+		ADDRITEM_PARENT(folder) = NULL;	/* We will resolve folder later */
+	}
+	else {
+		mgu_free_dlist( items );
+		addritem_free_item_folder( folder );
+	}
+}
+
+/*
+* Read snapshot of address book for XML file fileSpec.
+* Return: TRUE if address book was loaded from the snapshot.
+*/
+static gboolean addrbook_read_snapshot( AddressBookFile *book, const gchar *fileSpec ) {
+	AddrSnapshotHeader header;
+	AddrSnapshotReader rd;
+	GMappedFile *mfile;
+	GStatBuf s;
+	gchar *snapFile;
+	const gchar *data;
+	gsize size;
+	guint32 type;
+	gchar *name;
+
+	if( g_stat( fileSpec, &s ) < 0 ) return FALSE;
+
+	snapFile = addrbook_get_snapshot_file( book );
+	if( ! is_file_exist( snapFile ) ) {
+		g_free( snapFile );
+		return FALSE;
+	}
+	mfile = g_mapped_file_new( snapFile, FALSE, NULL );
+	if( mfile == NULL ) {
+		g_free( snapFile );
+		return FALSE;
+	}
+	data = g_mapped_file_get_contents( mfile );
+	size = g_mapped_file_get_length( mfile );
+
+	if( size < sizeof( header ) ) goto stale;
+	memcpy( &header, data, sizeof( header ) );
+	if( memcmp( header.magic, AB_SNAPSHOT_MAGIC, 4 ) != 0 ||
+	    header.version != AB_SNAPSHOT_VERSION ||
+	    header.mtime != (gint64) s.st_mtime ||
+	    header.size != (gint64) s.st_size ||
+	    header.dataSize != (gint64) ( size - sizeof( header ) ) ) {
+		goto stale;
+	}
+
+	rd.p = data + sizeof( header );
+	rd.end = data + size;
+	rd.error = FALSE;
+
+	book->tempList = NULL;
+	name = addrbook_snap_get_str( &rd );
+	addrbook_set_name( book, name );
+	g_free( name );
+
+	while( ! rd.error ) {
+		type = addrbook_snap_get_int( &rd );
+		if( type == AB_SNAP_END || rd.error ) break;
+		if( type == AB_SNAP_PERSON ) {
+			addrbook_snap_read_person( book, &rd );
+		}
+		else if( type == AB_SNAP_GROUP ) {
+			addrbook_snap_read_group( book, &rd );
+		}
+		else if( type == AB_SNAP_FOLDER ) {
+			addrbook_snap_read_folder( book, &rd );
+		}
+		else {
+			rd.error = TRUE;
+		}
+	}
+
+	if( rd.error ) {
+		GList *node;
+
+		g_warning( "%s: broken address book snapshot\n", snapFile );
+		/* Free the UID's which were not resolved yet */
+		for( node = book->tempList; node; node = g_list_next( node ) ) {
+			ItemFolder *folder = node->data;
+			mgu_free_dlist( folder->listItems );
+			folder->listItems = NULL;
+		}
+		addrcache_clear( book->addressCache );
+		g_list_free( book->tempList );
+		book->tempList = NULL;
+		goto stale;
+	}
+
+	book->tempList = g_list_reverse( book->tempList );
+	addrbook_resolve_folder_items( book );
+
+	g_mapped_file_free( mfile );
+	g_free( snapFile );
+	return TRUE;
+
+stale:
+	g_mapped_file_free( mfile );
+	g_free( snapFile );
+	return FALSE;
+}
+
+/*
+* Remove snapshot of address book. Should be called when the address book
+* file is removed.
+*/
+void addrbook_remove_snapshot( AddressBookFile *book ) {
+	gchar *snapFile;
+
+	g_return_if_fail( book != NULL );
+	if( book->path == NULL || book->fileName == NULL ) return;
+
+	snapFile = addrbook_get_snapshot_file( book );
+	if( is_file_exist( snapFile ) && g_unlink( snapFile ) < 0 ) {
+		FILE_OP_ERROR( snapFile, "unlink" );
+	}
+	g_free( snapFile );
+}
+
 /*
 * Read address book file.
 */
 gint addrbook_read_data( AddressBookFile *book ) {
 	XMLFile *file = NULL;
 	gchar *fileSpec = NULL;
+#ifdef MEASURE_TIME
+	GTimer *timer;
+#endif
 
 	g_return_val_if_fail( book != NULL, -1 );
 
@@ -867,14 +1332,36 @@ gint addrbook_read_data( AddressBookFile *book ) {
 	book->retVal = MGU_OPEN_FILE;
 	book->accessFlag = FALSE;
 	book->modifyFlag = FALSE;
+
+#ifdef MEASURE_TIME
+	timer = g_timer_new();
+#endif
+	if( addrbook_read_snapshot( book, fileSpec ) ) {
+#ifdef MEASURE_TIME
+		g_timer_stop( timer );
+		g_print( "%s: %s: snapshot loaded: %f sec\n",
+			 G_STRFUNC, fileSpec, g_timer_elapsed( timer, NULL ) );
+		g_timer_destroy( timer );
+#endif
+		g_free( fileSpec );
+		book->tempList = NULL;
+		book->readFlag = TRUE;
+		book->dirtyFlag = FALSE;
+		book->retVal = MGU_SUCCESS;
+		return book->retVal;
+	}
+
 	file = xml_open_file( fileSpec );
-	g_free( fileSpec );
 	if( file ) {
 		book->tempList = NULL;
 
 		/* Trap for parsing errors. */
 		if( setjmp( book->jumper ) ) {
 			xml_close_file( file );
+			g_free( fileSpec );
+#ifdef MEASURE_TIME
+			g_timer_destroy( timer );
+#endif
 			return book->retVal;
 		}
 		addrbook_read_tree( book, file );
@@ -885,7 +1372,20 @@ gint addrbook_read_data( AddressBookFile *book ) {
 		book->tempList = NULL;
 		book->readFlag = TRUE;
 		book->dirtyFlag = FALSE;
+#ifdef MEASURE_TIME
+		g_timer_stop( timer );
+		g_print( "%s: %s: XML parsed: %f sec\n",
+			 G_STRFUNC, fileSpec, g_timer_elapsed( timer, NULL ) );
+#endif
+
+		if( book->retVal == MGU_SUCCESS ) {
+			addrbook_write_snapshot( book, fileSpec );
+		}
 	}
+#ifdef MEASURE_TIME
+	g_timer_destroy( timer );
+#endif
+	g_free( fileSpec );
 	return book->retVal;
 }
 
@@ -1133,7 +1633,13 @@ gint addrbook_save_data( AddressBookFile *book ) {
 
 	addrbook_write_to( book, book->fileName );
 	if( book->retVal == MGU_SUCCESS ) {
+		gchar *fileSpec;
+
 		book->dirtyFlag = FALSE;
+
+		fileSpec = g_strconcat( book->path, G_DIR_SEPARATOR_S, book->fileName, NULL );
+		addrbook_write_snapshot( book, fileSpec );
+		g_free( fileSpec );
 	}
 	return book->retVal;
 }
@@ -80,6 +80,7 @@ ItemEMail *addrbook_group_remove_email	( AddressBookFile *book, ItemGroup *group
 
 gint addrbook_read_data			( AddressBookFile *book );
 gint addrbook_save_data			( AddressBookFile *book );
+void addrbook_remove_snapshot		( AddressBookFile *book );
 
 ItemEMail *addrbook_move_email_before	( AddressBookFile *book, ItemPerson *person,
 					  ItemEMail *itemMove, ItemEMail *itemTarget );
@@ -42,6 +42,7 @@
 #include "prefs.h"
 #include "procmime.h"
 #include "utils.h"
+#include "slock.h"
 #include "gtkutils.h"
 #include "codeconv.h"
 #include "about.h"
@@ -2392,6 +2393,7 @@ static void addressbook_treenode_delete_cb(gpointer data, guint action,
 				debug_print("removing %s\n", bookFile);
 				g_unlink(bookFile);
 				g_free(bookFile);
+				addrbook_remove_snapshot(abf);
 			}
 			remFlag = TRUE;
 		}
@@ -4829,14 +4831,7 @@ static void addressbook_export_csv_cb(void)
 
 static GHashTable *addr_table;
 
-#if USE_THREADS
-G_LOCK_DEFINE_STATIC(addr_table);
-#define S_LOCK(name)	G_LOCK(name)
-#define S_UNLOCK(name)	G_UNLOCK(name)
-#else
-#define S_LOCK(name)
-#define S_UNLOCK(name)
-#endif
+S_LOCK_DEFINE_STATIC(addr_table);
 
 static gint load_address(const gchar *name, const gchar *address,
 			 const gchar *nickname)
@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <string.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtkmain.h>
 #include <gtk/gtkwidget.h>
@@ -75,6 +76,7 @@ static GtkWidget *file_entry;
 static GtkWidget *src_button;
 static GtkWidget *file_button;
 static GtkWidget *selected_only_chkbtn;
+static GtkWidget *subfolders_chkbtn;
 static GtkWidget *ok_button;
 static GtkWidget *cancel_button;
 static gboolean export_finished;
@@ -89,6 +91,9 @@ static gint export_eml		(FolderItem	*src,
 				 GSList		*sel_mlist,
 				 const gchar	*path,
 				 gint		 type);
+static gint export_mbox_subfolders
+				(FolderItem	*src,
+				 const gchar	*mbox);
 
 static void export_format_menu_cb	(GtkWidget	*widget,
 					 gpointer	 data);
@@ -189,6 +194,7 @@ static gint export_do(void)
 	gchar *msg;
 	gint type;
 	gboolean selected_only;
+	gboolean subfolders;
 	MainWindow *mainwin;
 	GSList *mlist = NULL;
 
@@ -209,6 +215,8 @@ static gint export_do(void)
 
 	selected_only = gtk_toggle_button_get_active
 		(GTK_TOGGLE_BUTTON(selected_only_chkbtn));
+	subfolders = gtk_toggle_button_get_active
+		(GTK_TOGGLE_BUTTON(subfolders_chkbtn));
 
 	if (selected_only) {
 		mainwin = main_window_get();
@@ -243,6 +251,8 @@ static gint export_do(void)
 		folder_set_ui_func2(src->folder, export_mbox_func, NULL);
 		if (mlist)
 			ok = export_msgs_to_mbox(src, mlist, mbox);
+		else if (subfolders)
+			ok = export_mbox_subfolders(src, mbox);
 		else
 			ok = export_to_mbox(src, mbox);
 		folder_set_ui_func2(src->folder, NULL, NULL);
@@ -340,6 +350,75 @@ static gint export_eml(FolderItem *src, GSList *sel_mlist, const gchar *path,
 	return ok;
 }
 
+static gboolean export_append_item_func(GNode *node, gpointer data)
+{
+	GSList **list = (GSList **)data;
+	FolderItem *item;
+
+	g_return_val_if_fail(node->data != NULL, FALSE);
+
+	item = FOLDER_ITEM(node->data);
+	if (item->path && item->stype != F_VIRTUAL)
+		*list = g_slist_prepend(*list, item);
+
+	return FALSE;
+}
+
+/* export SRC into MBOX, and each of its subfolders into
+   MBOX.<relative path with '/' replaced by '.'>. The files are
+   written in parallel by export_folders_to_mbox(). */
+static gint export_mbox_subfolders(FolderItem *src, const gchar *mbox)
+{
+	GSList *src_list = NULL, *mbox_list = NULL;
+	GSList *cur;
+	gint ok;
+
+	g_node_traverse(src->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			export_append_item_func, &src_list);
+	if (!src_list)
+		return 0;
+	src_list = g_slist_reverse(src_list);
+
+	for (cur = src_list; cur != NULL; cur = cur->next) {
+		FolderItem *item = FOLDER_ITEM(cur->data);
+		const gchar *rel;
+		gchar *name, *fs_name;
+
+		if (item == src) {
+			mbox_list = g_slist_append(mbox_list, g_strdup(mbox));
+			continue;
+		}
+
+		rel = item->path;
+		if (src->path && g_str_has_prefix(rel, src->path) &&
+		    rel[strlen(src->path)] == '/')
+			rel += strlen(src->path) + 1;
+		name = g_strdup(rel);
+		subst_char(name, '/', '.');
+		fs_name = g_filename_from_utf8(name, -1, NULL, NULL, NULL);
+		if (!fs_name) {
+			g_warning("failed to convert character set.");
+			fs_name = g_strdup(name);
+		}
+		mbox_list = g_slist_append(mbox_list,
+					   g_strconcat(mbox, ".", fs_name,
+						       NULL));
+		g_free(fs_name);
+		g_free(name);
+	}
+
+	gtk_progress_bar_pulse(GTK_PROGRESS_BAR(progress->progressbar));
+	ui_update();
+
+	ok = export_folders_to_mbox(src_list, mbox_list);
+
+	slist_free_strings(mbox_list);
+	g_slist_free(mbox_list);
+	g_slist_free(src_list);
+
+	return ok;
+}
+
 static void export_create(void)
 {
 	GtkWidget *vbox;
@@ -442,8 +521,18 @@ static void export_create(void)
 	gtk_box_pack_start(GTK_BOX(hbox), selected_only_chkbtn,
 			   FALSE, FALSE, 0);
 
+	hbox = gtk_hbox_new(FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+	gtk_container_set_border_width(GTK_CONTAINER(hbox), 4);
+
+	subfolders_chkbtn = gtk_check_button_new_with_label
+		(_("Export subfolders into separate mbox files"));
+	gtk_box_pack_start(GTK_BOX(hbox), subfolders_chkbtn,
+			   FALSE, FALSE, 0);
+
 	SET_TOGGLE_SENSITIVITY_REV(selected_only_chkbtn, src_entry);
 	SET_TOGGLE_SENSITIVITY_REV(selected_only_chkbtn, src_button);
+	SET_TOGGLE_SENSITIVITY_REV(selected_only_chkbtn, subfolders_chkbtn);
 
 	gtkut_stock_button_set_create(&confirm_area,
 				      &ok_button, GTK_STOCK_OK,
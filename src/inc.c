@@ -392,35 +392,50 @@ static gint inc_remote_account_mail(MainWindow *mainwin, PrefsAccount *account)
 	if (account->protocol == A_IMAP4 &&
 	    account->imap_filter_inbox_on_recv) {
 		FolderItem *inbox = FOLDER(account->folder)->inbox;
-		GSList *mlist, *cur;
+		GSList *mlist, *junk_mlist = NULL, *cur;
 		FilterInfo *fltinfo;
+		FilterInfo **fltinfos;
+		gboolean *is_junk;
 		GSList junk_fltlist = {NULL, NULL};
 		FilterRule *junk_rule;
+		FilterCmdTestCache *junk_cache = NULL;
+		gboolean do_junk;
 		gint n_filtered = 0;
+		gint i;
 
 		debug_print("inc_remote_account_mail(): filtering IMAP4 INBOX\n");
 		mlist = folder_item_get_uncached_msg_list(inbox);
 		debug_print("inc_remote_account_mail(): uncached messages: %d\n", g_slist_length(mlist));
 
+		fltinfos = g_new0(FilterInfo *, g_slist_length(mlist));
+		is_junk = g_new0(gboolean, g_slist_length(mlist));
+
 		junk_rule = filter_junk_rule_create(account, NULL, TRUE);
 		if (junk_rule)
 			junk_fltlist.data = junk_rule;
+		do_junk = prefs_common.enable_junk &&
+			prefs_common.filter_junk_on_recv && junk_rule != NULL;
+
+		/* when the junk filter runs first, classify all new messages
+		   with one bulk command */
+		if (do_junk && prefs_common.filter_junk_before)
+			junk_cache = filter_cmd_test_bulk
+				(prefs_common.junk_classify_cmd, mlist);
 
-		for (cur = mlist; cur != NULL; cur = cur->next) {
+		for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++) {
 			MsgInfo *msginfo = (MsgInfo *)cur->data;
-			gboolean is_junk = FALSE;
 
 			fltinfo = filter_info_new();
 			fltinfo->account = account;
 			fltinfo->flags = msginfo->flags;
+			fltinfo->cmd_test_cache = junk_cache;
+			fltinfos[i] = fltinfo;
 
-			if (prefs_common.enable_junk &&
-			    prefs_common.filter_junk_on_recv &&
-			    prefs_common.filter_junk_before && junk_rule) {
+			if (do_junk && prefs_common.filter_junk_before) {
 				filter_apply_msginfo
 					(&junk_fltlist, msginfo, fltinfo);
 				if (fltinfo->drop_done)
-					is_junk = TRUE;
+					is_junk[i] = TRUE;
 			}
 
 			if (!fltinfo->drop_done) {
@@ -428,15 +443,39 @@ static gint inc_remote_account_mail(MainWindow *mainwin, PrefsAccount *account)
 						     msginfo, fltinfo);
 			}
 
-			if (!fltinfo->drop_done &&
-			    prefs_common.enable_junk &&
-			    prefs_common.filter_junk_on_recv &&
-			    !prefs_common.filter_junk_before && junk_rule) {
+			if (!fltinfo->drop_done && do_junk &&
+			    !prefs_common.filter_junk_before)
+				junk_mlist = g_slist_prepend(junk_mlist,
+							     msginfo);
+		}
+
+		/* otherwise classify only the messages which are still in
+		   INBOX after the user's rules */
+		if (junk_mlist) {
+			junk_mlist = g_slist_reverse(junk_mlist);
+			junk_cache = filter_cmd_test_bulk
+				(prefs_common.junk_classify_cmd, junk_mlist);
+			g_slist_free(junk_mlist);
+
+			for (cur = mlist, i = 0; cur != NULL;
+			     cur = cur->next, i++) {
+				MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+				fltinfo = fltinfos[i];
+				if (fltinfo->drop_done)
+					continue;
+				fltinfo->cmd_test_cache = junk_cache;
 				filter_apply_msginfo
 					(&junk_fltlist, msginfo, fltinfo);
 				if (fltinfo->drop_done)
-					is_junk = TRUE;
+					is_junk[i] = TRUE;
 			}
+		}
+
+		for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++) {
+			MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+			fltinfo = fltinfos[i];
 
 			if (msginfo->flags.perm_flags !=
 			    fltinfo->flags.perm_flags) {
@@ -457,7 +496,7 @@ static gint inc_remote_account_mail(MainWindow *mainwin, PrefsAccount *account)
 				if (account->imap_check_inbox_only ||
 				    fltinfo->move_dest->folder !=
 				    inbox->folder) {
-					if (!is_junk &&
+					if (!is_junk[i] &&
 					    fltinfo->move_dest->stype != F_TRASH &&
 					    fltinfo->move_dest->stype != F_JUNK &&
 					    (MSG_IS_NEW(fltinfo->flags) ||
@@ -466,8 +505,8 @@ static gint inc_remote_account_mail(MainWindow *mainwin, PrefsAccount *account)
 				}
 			} else if (fltinfo->actions[FLT_ACTION_DELETE])
 				folder_item_remove_msg(inbox, msginfo);
-			else if (!is_junk && (MSG_IS_NEW(msginfo->flags) ||
-					      MSG_IS_UNREAD(msginfo->flags)))
+			else if (!is_junk[i] && (MSG_IS_NEW(msginfo->flags) ||
+						 MSG_IS_UNREAD(msginfo->flags)))
 				++new_msgs;
 
 			if (fltinfo->drop_done)
@@ -476,6 +515,9 @@ static gint inc_remote_account_mail(MainWindow *mainwin, PrefsAccount *account)
 			filter_info_free(fltinfo);
 		}
 
+		g_free(is_junk);
+		g_free(fltinfos);
+		filter_cmd_test_cache_free(junk_cache);
 		if (junk_rule)
 			filter_rule_free(junk_rule);
 
@@ -36,20 +36,36 @@
 #include "utils.h"
 #include "gtkutils.h"
 #include "codeconv.h"
+#include "slock.h"
 
 #define TRIM_LINES	25
 
+/* the appended lines are queued and inserted into the text buffer in
+   batches of at most FLUSH_LINES lines, FLUSH_INTERVAL ms after the
+   first queued one */
+#define FLUSH_LINES	1000
+#define FLUSH_INTERVAL	100
+
 static LogWindow *logwindow;
 
 #if USE_THREADS
 static GThread *main_thread;
 #endif
+S_LOCK_DEFINE_STATIC(logqueue);
 
 static void log_window_print_func	(const gchar	*str);
 static void log_window_message_func	(const gchar	*str);
 static void log_window_warning_func	(const gchar	*str);
 static void log_window_error_func	(const gchar	*str);
 
+static void log_window_insert		(GtkTextBuffer	*buffer,
+					 GtkTextIter	*iter,
+					 const gchar	*str,
+					 LogType	 type);
+static void log_window_flush_lines	(gint		 max_lines);
+static gboolean log_window_flush_timeout_func
+					(gpointer	 data);
+
 static void hide_cb		(GtkWidget	*widget,
 				 LogWindow	*logwin);
 static gboolean key_pressed	(GtkWidget	*widget,
@@ -102,10 +118,9 @@ LogWindow *log_window_create(void)
 	logwin->scrolledwin = scrolledwin;
 	logwin->text = text;
 	logwin->lines = 1;
+	logwin->queue = g_queue_new();
 
 #if USE_THREADS
-	logwin->aqueue = g_async_queue_new();
-
 	main_thread = g_thread_self();
 	debug_print("main_thread = %p\n", main_thread);
 #endif
@@ -172,79 +187,130 @@ void log_window_show(LogWindow *logwin)
 	gtk_window_present(GTK_WINDOW(logwin->window));
 }
 
-static void log_window_append_real(const gchar *str, LogType type)
+typedef struct _LogData
 {
-	GtkTextView *text;
-	GtkTextBuffer *buffer;
-	GtkTextIter iter;
-	GdkColor *color = NULL;
-	gchar *head = NULL;
-	const gchar *tag;
-	gint line_limit = prefs_common.logwin_line_limit;
-
-	g_return_if_fail(logwindow != NULL);
-
-#if USE_THREADS
-	if (g_thread_self() != main_thread) {
-		g_fprintf(stderr, "log_window_append_real called from non-main thread (%p)\n", g_thread_self());
-		return;
-	}
-#endif
-
-	gdk_threads_enter();
-
-	text = GTK_TEXT_VIEW(logwindow->text);
-	buffer = gtk_text_view_get_buffer(text);
-
-	if (line_limit > 0 && logwindow->lines >= line_limit) {
-		GtkTextIter start, end;
+	gchar *str;
+	LogType type;
+} LogData;
 
-		gtk_text_buffer_get_start_iter(buffer, &start);
-		end = start;
-		gtk_text_iter_forward_lines(&end, TRIM_LINES);
-		gtk_text_buffer_delete(buffer, &start, &end);
-		logwindow->lines = gtk_text_buffer_get_line_count(buffer);
-	}
+static void log_window_insert(GtkTextBuffer *buffer, GtkTextIter *iter,
+			      const gchar *str, LogType type)
+{
+	const gchar *tag;
 
 	switch (type) {
 	case LOG_MSG:
-		color = &logwindow->msg_color;
 		tag = "message";
-		head = "* ";
 		break;
 	case LOG_WARN:
-		color = &logwindow->warn_color;
 		tag = "warn";
-		head = "** ";
 		break;
 	case LOG_ERROR:
-		color = &logwindow->error_color;
 		tag = "error";
-		head = "*** ";
 		break;
 	default:
 		tag = NULL;
 		break;
 	}
 
+	gtk_text_buffer_insert_with_tags_by_name(buffer, iter, str, -1,
+						 tag, NULL);
+}
+
+/* insert up to @max_lines queued lines (all if @max_lines <= 0). lines
+   of the same type are inserted at once, and the buffer is trimmed and
+   scrolled once for the whole batch. */
+static void log_window_flush_lines(gint max_lines)
+{
+	GtkTextView *text;
+	GtkTextBuffer *buffer;
+	GtkTextIter iter;
+	GString *run;
+	LogType run_type = LOG_NORMAL;
+	GList *list = NULL, *cur;
+	LogData *logdata;
+	gint line_limit = prefs_common.logwin_line_limit;
+	gint n = 0;
+
+	g_return_if_fail(logwindow != NULL);
+
+	S_LOCK(logqueue);
+	while ((max_lines <= 0 || n < max_lines) &&
+	       (logdata = g_queue_pop_head(logwindow->queue)) != NULL) {
+		list = g_list_prepend(list, logdata);
+		n++;
+	}
+	S_UNLOCK(logqueue);
+
+	if (!list)
+		return;
+	list = g_list_reverse(list);
+
+	/* skip the lines which would be trimmed right away */
+	cur = list;
+	if (line_limit > 0) {
+		for (; n > line_limit; n--)
+			cur = cur->next;
+	}
+
+	gdk_threads_enter();
+
+	text = GTK_TEXT_VIEW(logwindow->text);
+	buffer = gtk_text_view_get_buffer(text);
 	gtk_text_buffer_get_end_iter(buffer, &iter);
 
-	if (head)
-		gtk_text_buffer_insert_with_tags_by_name
-			(buffer, &iter, head, -1, tag, NULL);
+	run = g_string_new(NULL);
 
-	if (!g_utf8_validate(str, -1, NULL)) {
-		gchar *str_;
+	for (; cur != NULL; cur = cur->next) {
+		logdata = (LogData *)cur->data;
 
-		str_ = conv_utf8todisp(str, NULL);
-		if (str_) {
-			gtk_text_buffer_insert_with_tags_by_name
-				(buffer, &iter, str_, -1, tag, NULL);
-			g_free(str_);
+		if (run->len > 0 && logdata->type != run_type) {
+			log_window_insert(buffer, &iter, run->str, run_type);
+			g_string_truncate(run, 0);
 		}
-	} else {
-		gtk_text_buffer_insert_with_tags_by_name
-			(buffer, &iter, str, -1, tag, NULL);
+		run_type = logdata->type;
+
+		switch (logdata->type) {
+		case LOG_MSG:
+			g_string_append(run, "* ");
+			break;
+		case LOG_WARN:
+			g_string_append(run, "** ");
+			break;
+		case LOG_ERROR:
+			g_string_append(run, "*** ");
+			break;
+		default:
+			break;
+		}
+
+		if (!g_utf8_validate(logdata->str, -1, NULL)) {
+			gchar *str_;
+
+			str_ = conv_utf8todisp(logdata->str, NULL);
+			if (str_) {
+				g_string_append(run, str_);
+				g_free(str_);
+			}
+		} else
+			g_string_append(run, logdata->str);
+
+		logwindow->lines++;
+	}
+
+	if (run->len > 0)
+		log_window_insert(buffer, &iter, run->str, run_type);
+	g_string_free(run, TRUE);
+
+	if (line_limit > 0 && logwindow->lines >= line_limit) {
+		GtkTextIter start, end;
+
+		gtk_text_buffer_get_start_iter(buffer, &start);
+		end = start;
+		gtk_text_iter_forward_lines
+			(&end, logwindow->lines - line_limit + TRIM_LINES);
+		gtk_text_buffer_delete(buffer, &start, &end);
+		logwindow->lines = gtk_text_buffer_get_line_count(buffer);
 	}
 
 	if (GTK_WIDGET_VISIBLE(text)) {
@@ -253,59 +319,66 @@ static void log_window_append_real(const gchar *str, LogType type)
 		gtk_text_view_scroll_mark_onscreen(text, mark);
 	}
 
-	logwindow->lines++;
-
 	gdk_threads_leave();
+
+	for (cur = list; cur != NULL; cur = cur->next) {
+		logdata = (LogData *)cur->data;
+		g_free(logdata->str);
+		g_free(logdata);
+	}
+	g_list_free(list);
 }
 
-void log_window_append(const gchar *str, LogType type)
+static gboolean log_window_flush_timeout_func(gpointer data)
 {
-#if USE_THREADS
-	if (g_thread_self() != main_thread) {
-		log_window_append_queue(str, type);
-		return;
-	}
+	gboolean remain;
 
-	log_window_flush();
-#endif
-	log_window_append_real(str, type);
+	log_window_flush_lines(FLUSH_LINES);
+
+	S_LOCK(logqueue);
+	remain = !g_queue_is_empty(logwindow->queue);
+	if (!remain)
+		logwindow->flush_tag = 0;
+	S_UNLOCK(logqueue);
+
+	return remain;
 }
 
-typedef struct _LogData
+void log_window_append(const gchar *str, LogType type)
 {
-	gchar *str;
-	LogType type;
-} LogData;
+	log_window_append_queue(str, type);
+}
 
+/* can be called from any thread */
 void log_window_append_queue(const gchar *str, LogType type)
 {
-#if USE_THREADS
 	LogData *logdata;
 
+	g_return_if_fail(logwindow != NULL);
+
 	logdata = g_new(LogData, 1);
 	logdata->str = g_strdup(str);
 	logdata->type = type;
 
-	g_async_queue_push(logwindow->aqueue, logdata);
-#endif
+	S_LOCK(logqueue);
+	g_queue_push_tail(logwindow->queue, logdata);
+	if (logwindow->flush_tag == 0)
+		logwindow->flush_tag = g_timeout_add_full
+			(G_PRIORITY_DEFAULT_IDLE, FLUSH_INTERVAL,
+			 log_window_flush_timeout_func, NULL, NULL);
+	S_UNLOCK(logqueue);
 }
 
 void log_window_flush(void)
 {
 #if USE_THREADS
-	LogData *logdata;
-
 	if (g_thread_self() != main_thread) {
 		g_fprintf(stderr, "log_window_flush called from non-main thread (%p)\n", g_thread_self());
 		return;
 	}
-
-	while ((logdata = g_async_queue_try_pop(logwindow->aqueue))) {
-		log_window_append_real(logdata->str, logdata->type);
-		g_free(logdata->str);
-		g_free(logdata);
-	}
 #endif
+
+	log_window_flush_lines(0);
 }
 
 static void log_window_print_func(const gchar *str)
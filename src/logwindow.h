@@ -45,9 +45,8 @@ struct _LogWindow
 
 	gint lines;
 
-#if USE_THREADS
-	GAsyncQueue *aqueue;
-#endif
+	GQueue *queue;
+	guint flush_tag;
 };
 
 LogWindow *log_window_create(void);
@@ -74,6 +74,7 @@
 #include "compose.h"
 #include "logwindow.h"
 #include "folder.h"
+#include "imap.h"
 #include "setup.h"
 #include "sylmain.h"
 #include "utils.h"
@@ -355,6 +356,8 @@ int main(int argc, char *argv[])
 		new_account = setup_account();
 	}
 
+	remove_numbered_files_resume_all();
+
 	account_set_menu();
 	main_window_reflect_prefs_all();
 
@@ -965,6 +968,10 @@ void app_will_exit(gboolean force)
 
 	inc_autocheck_timer_remove();
 
+	imap_flag_queue_flush_all();
+	filter_coproc_stop_all();
+	procmsg_sync_mark_files();
+
 	if (prefs_common.clean_on_exit)
 		main_window_empty_trash(mainwin,
 					!force && prefs_common.ask_on_clean);
@@ -975,6 +982,7 @@ void app_will_exit(gboolean force)
 		    ac->folder)
 			procmsg_remove_all_cached_messages(FOLDER(ac->folder));
 	}
+	remove_numbered_files_wait();
 
 	syl_plugin_unload_all();
 
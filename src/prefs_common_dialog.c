@@ -168,6 +168,8 @@ static struct Message {
 	GtkWidget *chkbtn_htmlonly;
 	GtkWidget *spinbtn_linespc;
 	GtkObject *spinbtn_linespc_adj;
+	GtkWidget *spinbtn_renderlimit;
+	GtkObject *spinbtn_renderlimit_adj;
 
 	GtkWidget *chkbtn_smoothscroll;
 	GtkWidget *spinbtn_scrollstep;
@@ -479,6 +481,8 @@ static PrefsUIData ui_data[] = {
 	 prefs_set_data_from_toggle, prefs_set_toggle},
 	{"line_space", &message.spinbtn_linespc,
 	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
+	{"textview_render_limit", &message.spinbtn_renderlimit,
+	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 
 	/* {"textview_cursor_visible", NULL, NULL, NULL}, */
 
@@ -1945,6 +1949,10 @@ static GtkWidget *prefs_message_create(void)
 	GtkWidget *label_linespc;
 	GtkObject *spinbtn_linespc_adj;
 	GtkWidget *spinbtn_linespc;
+	GtkWidget *hbox_renderlimit;
+	GtkWidget *label_renderlimit;
+	GtkObject *spinbtn_renderlimit_adj;
+	GtkWidget *spinbtn_renderlimit;
 
 	GtkWidget *frame_scr;
 	GtkWidget *vbox_scr;
@@ -2048,6 +2056,33 @@ static GtkWidget *prefs_message_create(void)
 	gtk_box_pack_start (GTK_BOX (hbox_linespc), label_linespc,
 			    FALSE, FALSE, 0);
 
+	hbox_renderlimit = gtk_hbox_new (FALSE, 8);
+	gtk_widget_show (hbox_renderlimit);
+	gtk_box_pack_start (GTK_BOX (vbox2), hbox_renderlimit,
+			    FALSE, FALSE, 0);
+
+	label_renderlimit = gtk_label_new
+		(_("Display large text parts up to"));
+	gtk_widget_show (label_renderlimit);
+	gtk_box_pack_start (GTK_BOX (hbox_renderlimit), label_renderlimit,
+			    FALSE, FALSE, 0);
+
+	spinbtn_renderlimit_adj = gtk_adjustment_new
+		(0, 0, 1048576, 64, 1024, 0);
+	spinbtn_renderlimit = gtk_spin_button_new
+		(GTK_ADJUSTMENT (spinbtn_renderlimit_adj), 1, 0);
+	gtk_widget_show (spinbtn_renderlimit);
+	gtk_box_pack_start (GTK_BOX (hbox_renderlimit), spinbtn_renderlimit,
+			    FALSE, FALSE, 0);
+	gtk_widget_set_size_request (spinbtn_renderlimit, 80, -1);
+	gtk_spin_button_set_numeric (GTK_SPIN_BUTTON (spinbtn_renderlimit),
+				     TRUE);
+
+	label_renderlimit = gtk_label_new (_("KB at first (0: unlimited)"));
+	gtk_widget_show (label_renderlimit);
+	gtk_box_pack_start (GTK_BOX (hbox_renderlimit), label_renderlimit,
+			    FALSE, FALSE, 0);
+
 	PACK_FRAME(vbox1, frame_scr, _("Scroll"));
 
 	vbox_scr = gtk_vbox_new (FALSE, 0);
@@ -2096,6 +2131,9 @@ static GtkWidget *prefs_message_create(void)
 	message.chkbtn_htmlonly    = chkbtn_htmlonly;
 	message.spinbtn_linespc    = spinbtn_linespc;
 
+	message.spinbtn_renderlimit     = spinbtn_renderlimit;
+	message.spinbtn_renderlimit_adj = spinbtn_renderlimit_adj;
+
 	message.chkbtn_smoothscroll    = chkbtn_smoothscroll;
 	message.spinbtn_scrollstep     = spinbtn_scrollstep;
 	message.spinbtn_scrollstep_adj = spinbtn_scrollstep_adj;
@@ -278,11 +278,9 @@ gint rpop3_account(PrefsAccount *account)
 	rpop3_window.stop_load = FALSE;
 	rpop3_window.cancelled = FALSE;
 	rpop3_window.finished = FALSE;
-	if (POP3_SESSION(session)->uidl_table) {
-		hash_free_strings(POP3_SESSION(session)->uidl_table);
-		g_hash_table_destroy(POP3_SESSION(session)->uidl_table);
-		POP3_SESSION(session)->uidl_table =
-			g_hash_table_new(g_str_hash, g_str_equal);
+	if (POP3_SESSION(session)->uidl_store) {
+		pop3_uidl_store_close(POP3_SESSION(session)->uidl_store);
+		POP3_SESSION(session)->uidl_store = NULL;
 	}
 
 	/* override Pop3Session handlers */
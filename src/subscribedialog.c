@@ -85,6 +85,7 @@ static GtkTreeStore *tree_store;
 
 static GSList *group_list;
 static GSList *subscribe_list;
+static GHashTable *subscribe_table;
 static Folder *news_folder;
 
 static void subscribe_dialog_create	(void);
@@ -93,6 +94,10 @@ static void subscribe_dialog_set_list	(const gchar	*pattern,
 static void subscribe_search		(void);
 static void subscribe_clear		(void);
 
+static gboolean subscribe_is_subscribed	(const gchar	*name);
+static void subscribe_set_subscribed	(const gchar	*name,
+					 gboolean	 subscribed);
+
 static gboolean subscribe_recv_func	(SockInfo	*sock,
 					 gint		 count,
 					 gint		 read_bytes,
@@ -120,11 +125,20 @@ static gboolean subscribe_selected	(GtkTreeSelection	*selection,
 static void subscribe_toggled	(GtkCellRenderer	*cell,
 				 gchar			*path,
 				 gpointer		 data);
+static void subscribe_row_expanded	(GtkTreeView	*treeview,
+					 GtkTreeIter	*iter,
+					 GtkTreePath	*path,
+					 gpointer	 data);
 
 static void entry_activated	(GtkEditable	*editable);
 static void search_clicked	(GtkWidget	*widget,
 				 gpointer	 data);
 
+static void subscribe_list_func(gpointer key, gpointer value, gpointer data)
+{
+	subscribe_list = g_slist_prepend(subscribe_list, g_strdup(value));
+}
+
 GSList *subscribe_dialog(Folder *folder)
 {
 	GNode *node;
@@ -145,10 +159,13 @@ GSList *subscribe_dialog(Folder *folder)
 	GTK_EVENTS_FLUSH();
 
 	subscribe_list = NULL;
+	subscribe_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, g_free);
 	for (node = folder->node->children; node != NULL; node = node->next) {
 		item = FOLDER_ITEM(node->data);
 		subscribe_list = g_slist_append(subscribe_list,
 						g_strdup(item->path));
+		subscribe_set_subscribed(item->path, TRUE);
 	}
 
 	subscribe_dialog_set_list(NULL, TRUE);
@@ -160,20 +177,18 @@ GSList *subscribe_dialog(Folder *folder)
 	main_window_popup(main_window_get());
 
 	if (ack) {
-		GSList *cur;
-
 		slist_free_strings(subscribe_list);
+		g_slist_free(subscribe_list);
 		subscribe_list = NULL;
-		for (cur = group_list; cur != NULL; cur = cur->next) {
-			NewsGroupInfo *ginfo = (NewsGroupInfo *)cur->data;
-
-			if (ginfo->subscribed)
-				subscribe_list = g_slist_append
-					(subscribe_list, g_strdup(ginfo->name));
-		}
+		g_hash_table_foreach(subscribe_table, subscribe_list_func,
+				     NULL);
+		subscribe_list = g_slist_sort(subscribe_list,
+					      (GCompareFunc)g_ascii_strcasecmp);
 	}
 
 	subscribe_clear();
+	g_hash_table_destroy(subscribe_table);
+	subscribe_table = NULL;
 
 	return subscribe_list;
 }
@@ -267,6 +282,8 @@ static void subscribe_dialog_create(void)
 					       NULL, NULL);
 
 	gtk_container_add(GTK_CONTAINER(scrolledwin), treeview);
+	g_signal_connect(G_OBJECT(treeview), "row-expanded",
+			 G_CALLBACK(subscribe_row_expanded), NULL);
 
 	renderer = gtk_cell_renderer_toggle_new();
 	column = gtk_tree_view_column_new_with_attributes
@@ -402,18 +419,11 @@ static gboolean subscribe_create_parent(const gchar *name,
 	return TRUE;
 }
 
-static gboolean subscribe_create_branch(NewsGroupInfo *ginfo,
-					const gchar *pattern,
-					GtkTreeIter *iter)
+static void subscribe_set_group(GtkTreeIter *iter, NewsGroupInfo *ginfo)
 {
-	GtkTreeIter iter_;
-	GtkTreeIter parent;
-	const gchar *name = ginfo->name;
-	gchar *parent_name;
 	gint count;
 	const gchar *count_str;
 	const gchar *type_str;
-	gboolean has_parent;
 
 	count = ginfo->last - ginfo->first;
 	if (count < 0)
@@ -429,6 +439,28 @@ static gboolean subscribe_create_branch(NewsGroupInfo *ginfo,
 	else
 		type_str = _("unknown");
 
+	ginfo->subscribed = subscribe_is_subscribed(ginfo->name);
+
+	gtk_tree_store_set(tree_store, iter,
+			   SUBSCRIBE_TOGGLE, ginfo->subscribed,
+			   SUBSCRIBE_NAME, ginfo->name,
+			   SUBSCRIBE_NUM, count_str,
+			   SUBSCRIBE_TYPE, type_str,
+			   SUBSCRIBE_INFO, ginfo,
+			   SUBSCRIBE_CAN_TOGGLE, TRUE,
+			   -1);
+}
+
+static gboolean subscribe_create_branch(NewsGroupInfo *ginfo,
+					const gchar *pattern,
+					GtkTreeIter *iter)
+{
+	GtkTreeIter iter_;
+	GtkTreeIter parent;
+	const gchar *name = ginfo->name;
+	gchar *parent_name;
+	gboolean has_parent;
+
 	parent_name = subscribe_get_parent_name(name);
 	has_parent = subscribe_create_parent(parent_name, pattern, &parent);
 	if (!subscribe_hash_get_branch_node(name, &iter_)) {
@@ -441,13 +473,7 @@ static gboolean subscribe_create_branch(NewsGroupInfo *ginfo,
 			gtk_tree_store_append(tree_store, &iter_, NULL);
 	}
 
-	gtk_tree_store_set(tree_store, &iter_,
-			   SUBSCRIBE_NAME, name,
-			   SUBSCRIBE_NUM, count_str,
-			   SUBSCRIBE_TYPE, type_str,
-			   SUBSCRIBE_INFO, ginfo,
-			   SUBSCRIBE_CAN_TOGGLE, TRUE,
-			   -1);
+	subscribe_set_group(&iter_, ginfo);
 
 	g_free(parent_name);
 
@@ -456,11 +482,37 @@ static gboolean subscribe_create_branch(NewsGroupInfo *ginfo,
 	return TRUE;
 }
 
+/* append the groups and the hierarchies under parent. The hierarchies get
+   an empty child row which is replaced when they are expanded. */
+static void subscribe_append_children(GtkTreeIter *parent, GSList *list)
+{
+	GSList *cur;
+
+	for (cur = list; cur != NULL; cur = cur->next) {
+		NewsGroupInfo *ginfo = (NewsGroupInfo *)cur->data;
+		GtkTreeIter iter;
+		GtkTreeIter child;
+
+		if (!ginfo->name || !is_ascii_str(ginfo->name))
+			continue;
+
+		gtk_tree_store_append(tree_store, &iter, parent);
+		if (ginfo->type != '\0')
+			subscribe_set_group(&iter, ginfo);
+		else
+			gtk_tree_store_set(tree_store, &iter,
+					   SUBSCRIBE_NAME, ginfo->name, -1);
+
+		if (ginfo->has_children)
+			gtk_tree_store_append(tree_store, &child, &iter);
+	}
+}
+
 static void subscribe_dialog_set_list(const gchar *pattern, gboolean refresh)
 {
 	gchar *pattern_;
+	GSList *list;
 	GSList *cur;
-	GPatternSpec *pspec;
 
 	if (locked) return;
 	locked = TRUE;
@@ -480,47 +532,48 @@ static void subscribe_dialog_set_list(const gchar *pattern, gboolean refresh)
 		gtk_label_set_text(GTK_LABEL(status_label),
 				   _("Getting newsgroup list..."));
 		GTK_EVENTS_FLUSH();
-		recv_set_ui_func(subscribe_recv_func, NULL);
-		group_list = news_get_group_list(news_folder);
-		group_list = g_slist_reverse(group_list);
-		recv_set_ui_func(NULL, NULL);
-		statusbar_pop_all();
-		if (group_list == NULL && ack == TRUE) {
-			alertpanel_error(_("Can't retrieve newsgroup list."));
-			g_free(pattern_);
-			locked = FALSE;
-			return;
-		}
 	} else {
 		gtk_tree_store_clear(tree_store);
+		news_group_list_free(group_list);
+		group_list = NULL;
 	}
 
-	subscribe_hash_init();
+	/* the top level is loaded lazily, and the search results at once */
+	recv_set_ui_func(subscribe_recv_func, NULL);
+	if (!strcmp(pattern_, "*"))
+		list = news_get_group_subtree(news_folder, "");
+	else
+		list = news_find_group_list(news_folder, pattern_);
+	recv_set_ui_func(NULL, NULL);
+	statusbar_pop_all();
+
+	if (list == NULL && refresh && !strcmp(pattern_, "*") && ack == TRUE) {
+		alertpanel_error(_("Can't retrieve newsgroup list."));
+		g_free(pattern_);
+		locked = FALSE;
+		return;
+	}
 
-	pspec = g_pattern_spec_new(pattern_);
+	group_list = list;
 
-	for (cur = group_list; cur != NULL ; cur = cur->next) {
-		NewsGroupInfo *ginfo = (NewsGroupInfo *)cur->data;
-		GtkTreeIter iter;
+	if (!strcmp(pattern_, "*"))
+		subscribe_append_children(NULL, list);
+	else {
+		subscribe_hash_init();
 
-		if (!ginfo->name || !is_ascii_str(ginfo->name))
-			continue;
+		for (cur = list; cur != NULL; cur = cur->next) {
+			NewsGroupInfo *ginfo = (NewsGroupInfo *)cur->data;
+			GtkTreeIter iter;
 
-		if (g_slist_find_custom(subscribe_list, ginfo->name,
-					(GCompareFunc)g_ascii_strcasecmp)
-		    != NULL)
-			ginfo->subscribed = TRUE;
+			if (!ginfo->name || !is_ascii_str(ginfo->name))
+				continue;
 
-		if (g_pattern_match_string(pspec, ginfo->name)) {
 			subscribe_create_branch(ginfo, pattern_, &iter);
-			if (ginfo->subscribed)
-				gtk_tree_store_set(tree_store, &iter,
-						   SUBSCRIBE_TOGGLE, TRUE, -1);
 		}
+
+		subscribe_hash_free();
 	}
 
-	g_pattern_spec_free(pspec);
-	subscribe_hash_free();
 	g_free(pattern_);
 
 	gtk_label_set_text(GTK_LABEL(status_label), _("Done."));
@@ -547,6 +600,31 @@ static void subscribe_clear(void)
 	group_list = NULL;
 }
 
+static gboolean subscribe_is_subscribed(const gchar *name)
+{
+	gchar *key;
+	gboolean subscribed;
+
+	key = g_ascii_strdown(name, -1);
+	subscribed = g_hash_table_lookup(subscribe_table, key) != NULL;
+	g_free(key);
+
+	return subscribed;
+}
+
+static void subscribe_set_subscribed(const gchar *name, gboolean subscribed)
+{
+	gchar *key;
+
+	key = g_ascii_strdown(name, -1);
+	if (subscribed)
+		g_hash_table_replace(subscribe_table, key, g_strdup(name));
+	else {
+		g_hash_table_remove(subscribe_table, key);
+		g_free(key);
+	}
+}
+
 static gboolean subscribe_recv_func(SockInfo *sock, gint count, gint read_bytes,
 				    gpointer data)
 {
@@ -589,10 +667,22 @@ static void cancel_clicked(GtkWidget *widget, gpointer data)
 static void refresh_clicked(GtkWidget *widget, gpointer data)
 { 
 	gchar *str;
+	gint ok;
 
 	if (locked) return;
 
-	news_remove_group_list_cache(news_folder);
+	/* only the groups created since the last refresh are retrieved */
+	locked = TRUE;
+	gtk_label_set_text(GTK_LABEL(status_label),
+			   _("Getting newsgroup list..."));
+	GTK_EVENTS_FLUSH();
+	recv_set_ui_func(subscribe_recv_func, NULL);
+	ok = news_update_group_list(news_folder);
+	recv_set_ui_func(NULL, NULL);
+	statusbar_pop_all();
+	locked = FALSE;
+	if (ok < 0)
+		alertpanel_error(_("Can't retrieve newsgroup list."));
 
 	str = gtk_editable_get_chars(GTK_EDITABLE(entry), 0, -1);
 	subscribe_dialog_set_list(str, TRUE);
@@ -645,11 +735,41 @@ static void subscribe_toggled(GtkCellRenderer *cell, gchar *path_str,
 			   -1);
 	if (ginfo && can_toggle) {
 		ginfo->subscribed = !enabled;
+		subscribe_set_subscribed(ginfo->name, !enabled);
 		gtk_tree_store_set(tree_store, &iter,
 				   SUBSCRIBE_TOGGLE, !enabled, -1);
 	}
 }
 
+static void subscribe_row_expanded(GtkTreeView *treeview, GtkTreeIter *iter,
+				   GtkTreePath *path, gpointer data)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(tree_store);
+	GtkTreeIter child;
+	gchar *name = NULL;
+	GSList *list;
+
+	if (!gtk_tree_model_iter_children(model, &child, iter))
+		return;
+	gtk_tree_model_get(model, &child, SUBSCRIBE_NAME, &name, -1);
+	if (name) {
+		/* already loaded */
+		g_free(name);
+		return;
+	}
+
+	gtk_tree_model_get(model, iter, SUBSCRIBE_NAME, &name, -1);
+	if (!name)
+		return;
+
+	list = news_get_group_subtree(news_folder, name);
+	subscribe_append_children(iter, list);
+	group_list = g_slist_concat(group_list, list);
+	gtk_tree_store_remove(tree_store, &child);
+
+	g_free(name);
+}
+
 static void entry_activated(GtkEditable *editable)
 {
 	subscribe_search();
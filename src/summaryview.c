@@ -4846,6 +4846,7 @@ static gboolean summary_filter_junk_func(GtkTreeModel *model, GtkTreePath *path,
 
 	fltinfo = filter_info_new();
 	fltinfo->flags = msginfo->flags;
+	fltinfo->cmd_test_cache = summaryview->junk_cache;
 	filter_apply_msginfo(summaryview->junk_fltlist, msginfo, fltinfo);
 
 	if (fltinfo->actions[FLT_ACTION_MOVE] ||
@@ -4914,6 +4915,24 @@ static void summary_filter_real(SummaryView *summaryview,
 	summaryview->filtered = 0;
 	summaryview->flt_count = 0;
 
+	/* classify all messages at once before applying the junk rule */
+	if (summaryview->junk_fltlist && prefs_common.junk_classify_cmd) {
+		GSList *mlist;
+
+		STATUSBAR_POP(summaryview->mainwin);
+		STATUSBAR_PUSH(summaryview->mainwin,
+			       _("Classifying messages..."));
+		GTK_EVENTS_FLUSH();
+
+		if (selected_only)
+			mlist = summary_get_selected_msg_list(summaryview);
+		else
+			mlist = summary_get_msg_list(summaryview);
+		summaryview->junk_cache = filter_cmd_test_bulk
+			(prefs_common.junk_classify_cmd, mlist);
+		g_slist_free(mlist);
+	}
+
 	if (selected_only) {
 		rows = summary_get_selected_rows(summaryview);
 		summaryview->flt_total = g_list_length(rows);
@@ -4928,6 +4947,9 @@ static void summary_filter_real(SummaryView *summaryview,
 				       func, summaryview);
 	}
 
+	filter_cmd_test_cache_free(summaryview->junk_cache);
+	summaryview->junk_cache = NULL;
+
 	if (sort_key != SORT_BY_NONE)
 		summary_sort(summaryview, sort_key, sort_type);
 
@@ -5013,9 +5035,8 @@ static void summary_junk_func(GtkTreeModel *model, GtkTreePath *path,
 			      GtkTreeIter *iter, gpointer data)
 {
 	FilterRule rule = {NULL, FLT_OR, NULL, NULL, FLT_TIMING_ANY, TRUE};
-	FilterAction action1 = {FLT_ACTION_EXEC, NULL, 0};
-	FilterAction action2 = {FLT_ACTION_MOVE, NULL, 0};
-	FilterAction action3 = {FLT_ACTION_MARK_READ, NULL, 0};
+	FilterAction action1 = {FLT_ACTION_MOVE, NULL, 0};
+	FilterAction action2 = {FLT_ACTION_MARK_READ, NULL, 0};
 	SummaryView *summaryview = (SummaryView *)data;
 	MsgInfo *msginfo;
 	FilterInfo *fltinfo;
@@ -5030,29 +5051,22 @@ static void summary_junk_func(GtkTreeModel *model, GtkTreePath *path,
 	if (summaryview->to_folder)
 		junk_id = folder_item_get_identifier(summaryview->to_folder);
 
-	action1.str_value = prefs_common.junk_learncmd;
-	action2.str_value = junk_id;
+	action1.str_value = junk_id;
 
-	rule.action_list = g_slist_append(rule.action_list, &action1);
 	if (junk_id)
-		rule.action_list = g_slist_append(rule.action_list, &action2);
+		rule.action_list = g_slist_append(rule.action_list, &action1);
 	if (prefs_common.mark_junk_as_read)
-		rule.action_list = g_slist_append(rule.action_list, &action3);
+		rule.action_list = g_slist_append(rule.action_list, &action2);
 
 	fltinfo = filter_info_new();
 	fltinfo->flags = msginfo->flags;
 
 	ret = filter_action_exec(&rule, msginfo, file, fltinfo);
 
-	if (ret < 0 || fltinfo->last_exec_exit_status != 0) {
-		g_warning("summary_junk_func: junk filter command returned %d",
-			  fltinfo->last_exec_exit_status);
-		alertpanel_error
-			(_("Execution of the junk filter command failed.\n"
-			   "Please check the junk mail control setting."));
+	if (ret < 0) {
+		g_warning("summary_junk_func: cannot set the message as junk");
 	} else {
-		if (ret == 0 &&
-		    msginfo->flags.perm_flags != fltinfo->flags.perm_flags) {
+		if (msginfo->flags.perm_flags != fltinfo->flags.perm_flags) {
 			msginfo->flags = fltinfo->flags;
 			summary_set_row(summaryview, iter, msginfo);
 			if (MSG_IS_IMAP(msginfo->flags)) {
@@ -5061,8 +5075,7 @@ static void summary_junk_func(GtkTreeModel *model, GtkTreePath *path,
 						(msginfo, MSG_NEW | MSG_UNREAD);
 			}
 		}
-		if (ret == 0 && fltinfo->actions[FLT_ACTION_MOVE] &&
-		    fltinfo->move_dest)
+		if (fltinfo->actions[FLT_ACTION_MOVE] && fltinfo->move_dest)
 			summary_move_row_to(summaryview, iter,
 					    fltinfo->move_dest);
 	}
@@ -5073,39 +5086,30 @@ static void summary_junk_func(GtkTreeModel *model, GtkTreePath *path,
 	g_free(file);
 }
 
-static void summary_not_junk_func(GtkTreeModel *model, GtkTreePath *path,
-				  GtkTreeIter *iter, gpointer data)
+static gint summary_learn_junk(SummaryView *summaryview, const gchar *cmdline)
 {
-	FilterRule rule = {NULL, FLT_OR, NULL, NULL, FLT_TIMING_ANY, TRUE};
-	FilterAction action = {FLT_ACTION_EXEC, NULL, 0};
-	MsgInfo *msginfo;
-	FilterInfo *fltinfo;
-	gchar *file;
+	GSList *mlist;
 	gint ret;
 
-	gtk_tree_model_get(model, iter, S_COL_MSG_INFO, &msginfo, -1);
-	file = procmsg_get_message_file(msginfo);
-	g_return_if_fail(file != NULL);
-
-	action.str_value = prefs_common.nojunk_learncmd;
-
-	rule.action_list = g_slist_append(rule.action_list, &action);
-
-	fltinfo = filter_info_new();
+	mlist = summary_get_selected_msg_list(summaryview);
+	if (!mlist)
+		return 0;
 
-	ret = filter_action_exec(&rule, msginfo, file, fltinfo);
+	main_window_cursor_wait(summaryview->mainwin);
+	ret = filter_cmd_exec_bulk(cmdline, mlist);
+	main_window_cursor_normal(summaryview->mainwin);
+	g_slist_free(mlist);
 
-	if (ret < 0 || fltinfo->last_exec_exit_status != 0) {
-		g_warning("summary_not_junk_func: junk filter command returned %d",
-			  fltinfo->last_exec_exit_status);
+	if (ret != 0) {
+		g_warning("summary_learn_junk: junk filter command returned %d",
+			  ret);
 		alertpanel_error
 			(_("Execution of the junk filter command failed.\n"
 			   "Please check the junk mail control setting."));
+		return -1;
 	}
 
-	filter_info_free(fltinfo);
-	g_slist_free(rule.action_list);
-	g_free(file);
+	return 0;
 }
 
 void summary_junk(SummaryView *summaryview)
@@ -5134,6 +5138,13 @@ void summary_junk(SummaryView *summaryview)
 
 	summary_lock(summaryview);
 
+	/* learn all selected messages with as few commands as possible,
+	   then move them */
+	if (summary_learn_junk(summaryview, prefs_common.junk_learncmd) < 0) {
+		summary_unlock(summaryview);
+		return;
+	}
+
 	summaryview->to_folder = junk;
 	gtk_tree_selection_selected_foreach(summaryview->selection,
 					    summary_junk_func, summaryview);
@@ -5162,8 +5173,7 @@ void summary_not_junk(SummaryView *summaryview)
 
 	debug_print("Set mail as not junk\n");
 
-	gtk_tree_selection_selected_foreach(summaryview->selection,
-					    summary_not_junk_func, summaryview);
+	summary_learn_junk(summaryview, prefs_common.nojunk_learncmd);
 
 	summary_unlock(summaryview);
 }
@@ -162,6 +162,7 @@ private:
 
 	/* junk filter list */
 	GSList *junk_fltlist;
+	FilterCmdTestCache *junk_cache;
 
 	/* generic flag */
 	gint tmp_flag;
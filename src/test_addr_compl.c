@@ -0,0 +1,395 @@
+/*
+ * Sylpheed -- a GTK+ based, lightweight, and fast e-mail client
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* completes the prefixes typed one key at a time against an address book
+   of 50000 contacts, prints the latency of each keystroke, and checks the
+   results against a linear scan of the address book. The address book
+   is then reordered and edited, and the results after the refresh of the
+   completion index must follow the new order. */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <string.h>
+
+#include "addr_compl.h"
+#include "addressbook.h"
+#include "utils.h"
+
+#define N_CONTACTS	50000
+#define N_NEW		2000
+#define N_TARGETS	50
+#define MAX_KEYS	12
+
+typedef struct _Contact
+{
+	gchar *name;
+	gchar *firstname;
+	gchar *lastname;
+	gchar *nickname;
+	gchar *address;
+} Contact;
+
+static const gchar *first_names[] = {
+	"Alice", "Albert", "Alfred", "Bob", "Bert", "Carol", "Charles",
+	"Dave", "Diana", "Eve", "Edward", "Frank", "Grace", "Heidi", "Ivan",
+	"Judy", "Mallory", "Oscar", "Peggy", "Trent", "Victor", "Walter"
+};
+
+static const gchar *last_names[] = {
+	"Smith", "Smithson", "Jones", "Johnson", "Brown", "Miller", "Davis",
+	"Garcia", "Wilson", "Moore", "Taylor", "Anderson", "Thomas",
+	"Jackson", "White", "Harris", "Martin", "Thompson", "Clark", "Lewis"
+};
+
+static gint failed = 0;
+static guint32 seed = 1;
+
+static Contact contacts[N_CONTACTS + N_NEW];
+/* the address book, as pointers to contacts in address book order */
+static GPtrArray *book;
+
+static guint32 test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+/* all strings are ASCII, so that g_ascii_strncasecmp() matches like the
+   case-folded strings of the completion index */
+static void create_contact(Contact *c, gint i)
+{
+	const gchar *first, *last, *last2;
+	gchar *lfirst, *llast;
+
+	if (i >= 25 && i % 50 == 49) {
+		/* same name and address as an earlier contact */
+		c->name = g_strdup(contacts[i - 25].name);
+		c->address = g_strdup(contacts[i - 25].address);
+		c->nickname = g_strdup_printf("dup%d", i);
+		return;
+	}
+
+	first = first_names[test_random() % G_N_ELEMENTS(first_names)];
+	last = last_names[test_random() % G_N_ELEMENTS(last_names)];
+	last2 = last_names[test_random() % G_N_ELEMENTS(last_names)];
+
+	switch (i % 10) {
+	case 0:
+		c->name = NULL;
+		break;
+	case 1:
+		c->name = g_strdup_printf("%s, %s", last, first);
+		break;
+	case 2:
+		c->name = g_strdup_printf("%s %s-%s", first, last, last2);
+		break;
+	case 3:
+		c->name = g_strdup_printf("%s %c. %s", first, last2[0], last);
+		break;
+	default:
+		c->name = g_strdup_printf("%s %s", first, last);
+		break;
+	}
+	c->firstname = g_strdup(first);
+	c->lastname = g_strdup(last);
+	if (i % 3 == 0)
+		c->nickname = g_strdup_printf("%c%c%d", first[0], last[0], i);
+
+	lfirst = g_ascii_strdown(first, -1);
+	llast = g_ascii_strdown(last, -1);
+	c->address = g_strdup_printf("%s.%s%d@example%d.com", lfirst, llast,
+				     i, i % 50);
+	g_free(llast);
+	g_free(lfirst);
+}
+
+static void free_contact(Contact *c)
+{
+	g_free(c->name);
+	g_free(c->firstname);
+	g_free(c->lastname);
+	g_free(c->nickname);
+	g_free(c->address);
+}
+
+/* replaces the address book of Sylpheed, which needs the GUI */
+gboolean addressbook_load_completion_full(AddressBookCompletionFunc func)
+{
+	Contact *c;
+	guint i;
+
+	for (i = 0; i < book->len; i++) {
+		c = g_ptr_array_index(book, i);
+		func(c->name, c->firstname, c->lastname, c->nickname,
+		     c->address);
+	}
+
+	return TRUE;
+}
+
+static gboolean prefix_match(const gchar *str, const gchar *prefix)
+{
+	return str != NULL && g_ascii_strncasecmp(str, prefix, strlen(prefix))
+		== 0;
+}
+
+#define IS_NAME_SEPARATOR(c) \
+	((c) == '-' || (c) == '.' || g_ascii_isspace(c))
+
+static gboolean contact_match(const Contact *c, const gchar *prefix)
+{
+	const gchar *p;
+
+	if (c->name) {
+		for (p = c->name; *p != '\0'; p++) {
+			if ((p == c->name || IS_NAME_SEPARATOR(*(p - 1))) &&
+			    !IS_NAME_SEPARATOR(*p) && prefix_match(p, prefix))
+				return TRUE;
+		}
+		if (prefix_match(c->name, prefix))
+			return TRUE;
+	}
+
+	return prefix_match(c->firstname, prefix) ||
+		prefix_match(c->lastname, prefix) ||
+		prefix_match(c->nickname, prefix) ||
+		prefix_match(c->address, prefix);
+}
+
+static gchar *format_address(const Contact *c)
+{
+	if (!c->name || c->name[0] == '\0')
+		return g_strdup(c->address);
+	else if (c->name[0] != '"' && strpbrk(c->name, "(),.:;<>@[]") != NULL)
+		return g_strdup_printf("\"%s\" <%s>", c->name, c->address);
+	else
+		return g_strdup_printf("%s <%s>", c->name, c->address);
+}
+
+/* returns the position in the address book of the first contact with the
+   same name and address, for each contact */
+static guint *book_first_positions(void)
+{
+	GHashTable *table;
+	Contact *c;
+	gchar *key;
+	gpointer pos;
+	guint *first;
+	guint i;
+
+	table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	first = g_new(guint, book->len);
+	for (i = 0; i < book->len; i++) {
+		c = g_ptr_array_index(book, i);
+		key = g_strconcat(c->name ? c->name : "", "\n", c->address,
+				  NULL);
+		if (g_hash_table_lookup_extended(table, key, NULL, &pos)) {
+			first[i] = GPOINTER_TO_UINT(pos);
+			g_free(key);
+		} else {
+			first[i] = i;
+			g_hash_table_insert(table, key, GUINT_TO_POINTER(i));
+		}
+	}
+	g_hash_table_destroy(table);
+
+	return first;
+}
+
+/* completes the prefix by scanning the whole address book */
+static GPtrArray *reference_complete(const gchar *prefix, const guint *first)
+{
+	GPtrArray *result;
+	gboolean *found;
+	guint i;
+
+	found = g_new0(gboolean, book->len);
+	for (i = 0; i < book->len; i++) {
+		if (contact_match(g_ptr_array_index(book, i), prefix))
+			found[first[i]] = TRUE;
+	}
+
+	result = g_ptr_array_new();
+	for (i = 0; i < book->len; i++) {
+		if (found[i])
+			g_ptr_array_add(result, format_address
+					(g_ptr_array_index(book, i)));
+	}
+	g_free(found);
+
+	return result;
+}
+
+static void check_completion(const gchar *label, const gchar *prefix,
+			     guint count, const guint *first)
+{
+	GPtrArray *expected;
+	gchar *address;
+	guint i;
+
+	expected = reference_complete(prefix, first);
+
+	if (count != (expected->len ? expected->len + 1 : 0)) {
+		g_print("FAIL: %s: \"%s\": %u addresses, expected %u\n",
+			label, prefix, count ? count - 1 : 0, expected->len);
+		failed++;
+	} else {
+		for (i = 0; i < expected->len; i++) {
+			address = get_complete_address(i + 1);
+			if (strcmp2(address, expected->pdata[i]) != 0) {
+				g_print("FAIL: %s: \"%s\": #%u: %s, "
+					"expected %s\n", label, prefix, i + 1,
+					address, (gchar *)expected->pdata[i]);
+				failed++;
+				g_free(address);
+				break;
+			}
+			g_free(address);
+		}
+	}
+
+	g_ptr_array_foreach(expected, (GFunc)g_free, NULL);
+	g_ptr_array_free(expected, TRUE);
+}
+
+/* types the name, nickname, last name or address of some contacts one
+   key at a time, and completes each prefix */
+static void type_addresses(const gchar *label)
+{
+	GTimer *timer;
+	Contact *c;
+	const gchar *target;
+	gchar prefix[MAX_KEYS + 1];
+	guint *first;
+	guint count;
+	gdouble elapsed, total = 0.0, max = 0.0;
+	gint i, len, n_keys = 0;
+
+	first = book_first_positions();
+	timer = g_timer_new();
+
+	for (i = 0; i < N_TARGETS && failed < 10; i++) {
+		c = g_ptr_array_index(book, test_random() % book->len);
+		switch (i % 4) {
+		case 0:
+			target = c->name;
+			break;
+		case 1:
+			target = c->nickname;
+			break;
+		case 2:
+			target = c->lastname;
+			break;
+		default:
+			target = c->address;
+			break;
+		}
+		if (!target)
+			target = c->address;
+
+		for (len = 1; len <= MAX_KEYS && target[len - 1] != '\0';
+		     len++) {
+			strncpy(prefix, target, len);
+			prefix[len] = '\0';
+
+			g_timer_start(timer);
+			count = complete_address(prefix);
+			elapsed = g_timer_elapsed(timer, NULL);
+			total += elapsed;
+			if (elapsed > max)
+				max = elapsed;
+			n_keys++;
+
+			check_completion(label, prefix, count, first);
+		}
+	}
+
+	g_print("%s: %d keystrokes: average %.3f ms, max %.3f ms\n", label,
+		n_keys, total * 1000 / n_keys, max * 1000);
+
+	g_timer_destroy(timer);
+	g_free(first);
+}
+
+static void test_complete(void)
+{
+	GTimer *timer;
+	GPtrArray *edited;
+	gint i;
+
+	book = g_ptr_array_sized_new(N_CONTACTS);
+	for (i = 0; i < N_CONTACTS; i++) {
+		create_contact(&contacts[i], i);
+		g_ptr_array_add(book, &contacts[i]);
+	}
+
+	timer = g_timer_new();
+	start_address_completion();
+	g_print("index of %d contacts: %.1f ms\n", N_CONTACTS,
+		g_timer_elapsed(timer, NULL) * 1000);
+
+	type_addresses("initial");
+
+	/* new contacts first, then the last three quarters of the book and
+	   the first quarter, without every tenth contact */
+	edited = g_ptr_array_sized_new(N_CONTACTS + N_NEW);
+	for (i = N_CONTACTS; i < N_CONTACTS + N_NEW; i++) {
+		create_contact(&contacts[i], i);
+		g_ptr_array_add(edited, &contacts[i]);
+	}
+	for (i = 0; i < N_CONTACTS; i++) {
+		gint n = (i + N_CONTACTS / 4) % N_CONTACTS;
+
+		if (n % 10 != 5)
+			g_ptr_array_add(edited, &contacts[n]);
+	}
+	g_ptr_array_free(book, TRUE);
+	book = edited;
+
+	invalidate_address_completion();
+	g_timer_start(timer);
+	complete_address("a");
+	g_print("refresh: %.1f ms\n", g_timer_elapsed(timer, NULL) * 1000);
+	g_timer_destroy(timer);
+
+	type_addresses("edited");
+
+	end_address_completion();
+
+	g_ptr_array_free(book, TRUE);
+	book = NULL;
+	for (i = 0; i < N_CONTACTS + N_NEW; i++)
+		free_contact(&contacts[i]);
+}
+
+int main(int argc, char *argv[])
+{
+	test_complete();
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * Sylpheed -- a GTK+ based, lightweight, and fast e-mail client
+ * Copyright (C) 1999-2026 Hiroyuki Yamamoto
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* saves an address book of 50000 persons and loads it by parsing the
+   XML file and from the snapshot, and checks that both give the same
+   contents. The snapshot is then broken at its last record, which must
+   make the load fall back to the XML file and rewrite the snapshot. */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "addrbook.h"
+#include "addrcache.h"
+#include "addritem.h"
+#include "mgutils.h"
+#include "utils.h"
+
+#define N_PERSONS	50000
+#define N_FOLDERS	50
+#define N_GROUPS	100
+#define GROUP_SIZE	20
+
+#define BOOK_FILE	"addrbook-000001.xml"
+#define SNAPSHOT_FILE	".addrbook-000001.cache"
+
+#define STR(s)		((s) ? (s) : "(null)")
+
+static gint failed = 0;
+
+static AddressBookFile *new_book(const gchar *dir)
+{
+	AddressBookFile *book;
+
+	book = addrbook_create_book();
+	addrbook_set_path(book, dir);
+	addrbook_set_file(book, BOOK_FILE);
+
+	return book;
+}
+
+static void add_email(AddressBookFile *book, ItemPerson *person,
+		      const gchar *alias, const gchar *address)
+{
+	ItemEMail *email;
+
+	email = addritem_create_item_email();
+	addritem_email_set_alias(email, alias);
+	addritem_email_set_address(email, address);
+	addrcache_id_email(book->addressCache, email);
+	addrcache_person_add_email(book->addressCache, person, email);
+}
+
+static void add_attribute(AddressBookFile *book, ItemPerson *person,
+			  const gchar *name, const gchar *value)
+{
+	UserAttribute *attrib;
+
+	attrib = addritem_create_attribute();
+	addritem_attrib_set_name(attrib, name);
+	addritem_attrib_set_value(attrib, value);
+	addrcache_id_attribute(book->addressCache, attrib);
+	addritem_person_add_attribute(person, attrib);
+}
+
+static gint save_book(const gchar *dir)
+{
+	AddressBookFile *book;
+	ItemFolder *folders[N_FOLDERS];
+	ItemPerson **persons;
+	ItemGroup *group;
+	GList *list;
+	gchar buf[256], addr[256];
+	gint i, j, ret;
+
+	book = new_book(dir);
+	addrbook_set_name(book, "test");
+
+	for (i = 0; i < N_FOLDERS; i++) {
+		folders[i] = addrbook_add_new_folder
+			(book, i % 5 == 0 ? NULL : folders[i - i % 5]);
+		g_snprintf(buf, sizeof(buf), "folder %d", i);
+		addritem_folder_set_name(folders[i], buf);
+	}
+
+	persons = g_new(ItemPerson *, N_PERSONS);
+	for (i = 0; i < N_PERSONS; i++) {
+		g_snprintf(buf, sizeof(buf), "First%d Last%d", i, i % 1000);
+		g_snprintf(addr, sizeof(addr), "user%d@example.com", i);
+		persons[i] = addrbook_add_contact
+			(book, i % 2 ? folders[i % N_FOLDERS] : NULL, buf, addr,
+			 i % 10 == 0 ? "remarks & <notes>" : NULL);
+		g_snprintf(buf, sizeof(buf), "First%d", i);
+		addritem_person_set_first_name(persons[i], buf);
+		g_snprintf(buf, sizeof(buf), "Last%d", i % 1000);
+		addritem_person_set_last_name(persons[i], buf);
+		if (i % 3 == 0) {
+			g_snprintf(buf, sizeof(buf), "nick%d", i);
+			addritem_person_set_nick_name(persons[i], buf);
+		}
+		if (i % 4 == 0) {
+			g_snprintf(addr, sizeof(addr), "work%d@example.org", i);
+			add_email(book, persons[i], "work", addr);
+		}
+		if (i % 8 == 0)
+			add_attribute(book, persons[i], "phone", "123-4567");
+	}
+
+	for (i = 0; i < N_GROUPS; i++) {
+		list = NULL;
+		for (j = 0; j < GROUP_SIZE; j++) {
+			ItemPerson *person;
+
+			person = persons[(i * 7 + j * 997) % N_PERSONS];
+			list = g_list_append(list, g_list_last
+					     (person->listEMail)->data);
+		}
+		group = addrbook_add_group_list
+			(book, i % 2 ? folders[i % N_FOLDERS] : NULL, list);
+		g_snprintf(buf, sizeof(buf), "group %d", i);
+		addritem_group_set_name(group, buf);
+	}
+	g_free(persons);
+
+	ret = addrbook_save_data(book);
+	addrbook_free_book(book);
+
+	return ret;
+}
+
+static void dump_item_vis(gpointer key, gpointer value, gpointer data)
+{
+	AddrItemObject *obj = (AddrItemObject *)value;
+	GPtrArray *lines = (GPtrArray *)data;
+	AddrItemObject *parent = ADDRITEM_PARENT(obj);
+	GString *str;
+	GList *cur;
+
+	str = g_string_new(NULL);
+	g_string_printf(str, "%d %s %s parent=%s", ADDRITEM_TYPE(obj),
+			STR(ADDRITEM_ID(obj)), STR(ADDRITEM_NAME(obj)),
+			parent ? STR(ADDRITEM_ID(parent)) : "(none)");
+
+	if (ADDRITEM_TYPE(obj) == ITEMTYPE_PERSON) {
+		ItemPerson *person = (ItemPerson *)obj;
+
+		g_string_append_printf(str, " %s %s %s",
+				       STR(person->firstName),
+				       STR(person->lastName),
+				       STR(person->nickName));
+		for (cur = person->listEMail; cur != NULL; cur = cur->next) {
+			ItemEMail *email = (ItemEMail *)cur->data;
+
+			g_string_append_printf(str, " email=%s,%s,%s,%s",
+					       STR(ADDRITEM_ID(email)),
+					       STR(ADDRITEM_NAME(email)),
+					       STR(email->address),
+					       STR(email->remarks));
+		}
+		for (cur = person->listAttrib; cur != NULL; cur = cur->next) {
+			UserAttribute *attrib = (UserAttribute *)cur->data;
+
+			g_string_append_printf(str, " attr=%s,%s,%s",
+					       STR(attrib->uid),
+					       STR(attrib->name),
+					       STR(attrib->value));
+		}
+	} else if (ADDRITEM_TYPE(obj) == ITEMTYPE_GROUP) {
+		ItemGroup *group = (ItemGroup *)obj;
+
+		g_string_append_printf(str, " %s", STR(group->remarks));
+		for (cur = group->listEMail; cur != NULL; cur = cur->next)
+			g_string_append_printf(str, " email=%s",
+					       STR(ADDRITEM_ID(cur->data)));
+	} else if (ADDRITEM_TYPE(obj) == ITEMTYPE_FOLDER) {
+		ItemFolder *folder = (ItemFolder *)obj;
+
+		g_string_append_printf(str, " %s", STR(folder->remarks));
+		for (cur = folder->listPerson; cur != NULL; cur = cur->next)
+			g_string_append_printf(str, " person=%s",
+					       STR(ADDRITEM_ID(cur->data)));
+		for (cur = folder->listGroup; cur != NULL; cur = cur->next)
+			g_string_append_printf(str, " group=%s",
+					       STR(ADDRITEM_ID(cur->data)));
+		for (cur = folder->listFolder; cur != NULL; cur = cur->next)
+			g_string_append_printf(str, " folder=%s",
+					       STR(ADDRITEM_ID(cur->data)));
+	}
+
+	g_ptr_array_add(lines, g_string_free(str, FALSE));
+}
+
+static gint dump_line_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* returns the items of the book as text sorted by type and uid, so that
+   the books read in different ways can be compared */
+static gchar *dump_book(AddressBookFile *book)
+{
+	GPtrArray *lines;
+	gchar *dump;
+
+	lines = g_ptr_array_new();
+	g_hash_table_foreach(book->addressCache->itemHash, dump_item_vis,
+			     lines);
+	g_ptr_array_sort(lines, dump_line_compare);
+	g_ptr_array_add(lines, NULL);
+	dump = g_strjoinv("\n", (gchar **)lines->pdata);
+	g_ptr_array_foreach(lines, (GFunc)g_free, NULL);
+	g_ptr_array_free(lines, TRUE);
+
+	return dump;
+}
+
+static gchar *load_book(const gchar *dir, const gchar *label,
+			gboolean remove_snapshot)
+{
+	AddressBookFile *book;
+	GTimer *timer;
+	gchar *dump;
+	gint ret;
+
+	book = new_book(dir);
+	if (remove_snapshot)
+		addrbook_remove_snapshot(book);
+
+	timer = g_timer_new();
+	ret = addrbook_read_data(book);
+	g_print("%s: %.3f sec\n", label, g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	if (ret != MGU_SUCCESS) {
+		g_print("FAIL: %s: read error %d\n", label, ret);
+		failed++;
+	}
+	dump = dump_book(book);
+	addrbook_free_book(book);
+
+	return dump;
+}
+
+/* overwrites the end record of the snapshot, keeping its size, and
+   returns the last four bytes of the snapshot before that */
+static gboolean break_snapshot(const gchar *file, guint32 *last)
+{
+	FILE *fp;
+	guint32 val = G_MAXUINT32;
+
+	if ((fp = g_fopen(file, "r+b")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return FALSE;
+	}
+	if (fseek(fp, -(glong)sizeof(val), SEEK_END) < 0 ||
+	    fread(last, sizeof(*last), 1, fp) != 1 ||
+	    fseek(fp, -(glong)sizeof(val), SEEK_END) < 0 ||
+	    fwrite(&val, sizeof(val), 1, fp) != 1) {
+		FILE_OP_ERROR(file, "fwrite");
+		fclose(fp);
+		return FALSE;
+	}
+	fclose(fp);
+
+	return TRUE;
+}
+
+static void check_dump(const gchar *label, const gchar *expected,
+		       const gchar *dump)
+{
+	if (strcmp(expected, dump) != 0) {
+		g_print("FAIL: %s: the contents differ from the saved book\n",
+			label);
+		failed++;
+	}
+}
+
+static void test_load(const gchar *dir)
+{
+	gchar *snapshot;
+	gchar *xml_dump, *snap_dump, *fallback_dump;
+	guint32 last, last_again;
+
+	if (save_book(dir) != MGU_SUCCESS) {
+		g_print("FAIL: can't save the address book\n");
+		failed++;
+		return;
+	}
+
+	snapshot = g_strconcat(dir, G_DIR_SEPARATOR_S, SNAPSHOT_FILE, NULL);
+
+	xml_dump = load_book(dir, "XML parse", TRUE);
+	if (!is_file_exist(snapshot)) {
+		g_print("FAIL: the snapshot was not written\n");
+		failed++;
+	}
+	snap_dump = load_book(dir, "snapshot load", FALSE);
+	check_dump("snapshot load", xml_dump, snap_dump);
+
+	if (break_snapshot(snapshot, &last)) {
+		fallback_dump = load_book(dir, "broken snapshot load", FALSE);
+		check_dump("broken snapshot load", xml_dump, fallback_dump);
+		g_free(fallback_dump);
+
+		if (!break_snapshot(snapshot, &last_again) ||
+		    last_again != last) {
+			g_print("FAIL: the broken snapshot was not "
+				"rewritten\n");
+			failed++;
+		}
+	} else {
+		g_print("FAIL: can't break %s\n", snapshot);
+		failed++;
+	}
+
+	g_free(snap_dump);
+	g_free(xml_dump);
+	g_free(snapshot);
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *dir;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	dir = g_strdup_printf("%s%ctest_addrbook.%d", g_get_tmp_dir(),
+			      G_DIR_SEPARATOR, getpid());
+	if (make_dir_hier(dir) < 0) {
+		g_print("FAIL: can't create %s\n", dir);
+		return 1;
+	}
+
+	test_load(dir);
+
+	remove_dir_recursive(dir);
+	g_free(dir);
+
+	if (failed > 0) {
+		g_print("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -35,10 +35,12 @@
 #include <gtk/gtkmenuitem.h>
 #include <gtk/gtkseparatormenuitem.h>
 #include <gtk/gtkstock.h>
+#include <gtk/gtkbutton.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "main.h"
 #include "summaryview.h"
@@ -59,6 +61,10 @@
 #include "menu.h"
 #include "plugin.h"
 
+#undef MEASURE_TIME
+
+#define TEXTVIEW_RENDER_CHUNK_SIZE	65536
+
 typedef struct _RemoteURI	RemoteURI;
 
 struct _RemoteURI
@@ -71,6 +77,30 @@ struct _RemoteURI
 	guint end;
 };
 
+struct _TextViewRender
+{
+	TextView *textview;
+
+	FILE *fp;
+	glong fpos;
+	ProcMimeStream *stream;
+	CodeConverter *conv;
+
+	/* insertion point of the rest of the part */
+	GtkTextMark *mark;
+
+	gsize written;
+	gsize limit;
+	GtkTextChildAnchor *anchor;
+#ifdef MEASURE_TIME
+	GTimer *timer;
+#endif
+};
+
+/* the part reached the limit and waits for its button */
+#define TEXTVIEW_RENDER_IS_PAUSED(render) \
+	((render)->limit > 0 && (render)->written >= (render)->limit)
+
 static GdkColor quote_colors[3] = {
 	{(gulong)0, (gushort)0, (gushort)0, (gushort)0},
 	{(gulong)0, (gushort)0, (gushort)0, (gushort)0},
@@ -164,6 +194,19 @@ static void textview_show_html		(TextView	*textview,
 					 FILE		*fp,
 					 CodeConverter	*conv);
 
+static gboolean textview_render_start	(TextView	*textview,
+					 MimeInfo	*mimeinfo,
+					 FILE		*fp,
+					 CodeConverter	*conv);
+static gboolean textview_render_chunk	(TextViewRender	*render);
+static gboolean textview_render_idle_func
+					(gpointer	 data);
+static void textview_render_add_button	(TextViewRender	*render);
+static void textview_render_remove_button
+					(TextViewRender	*render);
+static void textview_render_free	(TextViewRender	*render);
+static void textview_render_stop	(TextView	*textview);
+
 static void textview_write_line		(TextView	*textview,
 					 const gchar	*str,
 					 CodeConverter	*conv);
@@ -321,6 +364,9 @@ TextView *textview_create(void)
 	textview->uri_list         = NULL;
 	textview->body_pos         = 0;
 	textview->show_all_headers = FALSE;
+	textview->render_list      = NULL;
+	textview->render_idle_tag  = 0;
+	textview->render           = NULL;
 
 	textview_part_menu_create(textview);
 
@@ -1205,19 +1251,54 @@ static void textview_write_body(TextView *textview, MimeInfo *mimeinfo,
 				FILE *fp, const gchar *charset)
 {
 	FILE *tmpfp;
-	gchar buf[BUFFSIZE];
 	CodeConverter *conv;
 
 	conv = conv_code_converter_new(charset, NULL);
 
+	if (mimeinfo->mime_type != MIME_TEXT_HTML ||
+	    !prefs_common.render_html) {
+		ProcMimeStream *stream;
+		const gchar *str;
+#ifdef MEASURE_TIME
+		GTimer *timer;
+		gdouble elapsed;
+		gsize total = 0;
+#endif
+
+		/* large parts are displayed progressively */
+		if (mimeinfo->content_size > TEXTVIEW_RENDER_CHUNK_SIZE &&
+		    textview_render_start(textview, mimeinfo, fp, conv))
+			return;
+
+#ifdef MEASURE_TIME
+		timer = g_timer_new();
+#endif
+
+		/* decode directly from the message file */
+		stream = procmime_decode_stream_new(fp, mimeinfo);
+		while ((str = procmime_stream_gets(stream)) != NULL) {
+#ifdef MEASURE_TIME
+			total += strlen(str);
+#endif
+			textview_write_line(textview, str, conv);
+		}
+		procmime_stream_free(stream);
+		conv_code_converter_destroy(conv);
+
+#ifdef MEASURE_TIME
+		elapsed = g_timer_elapsed(timer, NULL);
+		debug_print("textview_write_body: %lu bytes, %d links: "
+			    "%.3f sec (%.1f MB/s)\n", (gulong)total,
+			    g_slist_length(textview->uri_list), elapsed,
+			    elapsed > 0.0 ? total / elapsed / 1048576.0 : 0.0);
+		g_timer_destroy(timer);
+#endif
+		return;
+	}
+
 	tmpfp = procmime_decode_content(NULL, fp, mimeinfo);
 	if (tmpfp) {
-		if (mimeinfo->mime_type == MIME_TEXT_HTML &&
-		    prefs_common.render_html)
-			textview_show_html(textview, tmpfp, conv);
-		else
-			while (fgets(buf, sizeof(buf), tmpfp) != NULL)
-				textview_write_line(textview, buf, conv);
+		textview_show_html(textview, tmpfp, conv);
 		fclose(tmpfp);
 	} else {
 		textview_write_error
@@ -1229,64 +1310,290 @@ static void textview_write_body(TextView *textview, MimeInfo *mimeinfo,
 	conv_code_converter_destroy(conv);
 }
 
-static void textview_show_html(TextView *textview, FILE *fp,
-			       CodeConverter *conv)
+/* progressive rendering of large text parts. Each part is read through
+   its own file descriptor, because the caller closes its stream after
+   the message is displayed. The rest of the part is inserted at a mark
+   before the following parts in idle time. The parts are written one
+   after another in their order, and a part which reached the limit
+   waits for its button while the following parts go on. */
+
+static gboolean textview_render_start(TextView *textview, MimeInfo *mimeinfo,
+				      FILE *fp, CodeConverter *conv)
 {
-	HTMLParser *parser;
-	const gchar *str;
+	TextViewRender *render;
+	GtkTextBuffer *buffer;
+	GtkTextIter iter;
+	FILE *newfp;
+	glong fpos;
+	gint fd;
 
-	parser = html_parser_new(fp, conv);
-	g_return_if_fail(parser != NULL);
+	if ((fpos = ftell(fp)) < 0)
+		return FALSE;
+	if ((fd = dup(fileno(fp))) < 0)
+		return FALSE;
+	if ((newfp = fdopen(fd, "rb")) == NULL) {
+		close(fd);
+		return FALSE;
+	}
 
-	while ((str = html_parse(parser)) != NULL) {
-		if (parser->href != NULL)
-			textview_write_link(textview, str, parser->href, NULL);
-		else
-			textview_write_line(textview, str, NULL);
+	render = g_new0(TextViewRender, 1);
+	render->textview = textview;
+	render->fp = newfp;
+	render->fpos = fpos;
+	render->stream = procmime_decode_stream_new(newfp, mimeinfo);
+	render->conv = conv;
+	if (prefs_common.textview_render_limit > 0)
+		render->limit = (gsize)prefs_common.textview_render_limit * 1024;
+#ifdef MEASURE_TIME
+	render->timer = g_timer_new();
+#endif
+
+	/* the first screenful is shown immediately */
+	if (!textview_render_chunk(render)) {
+		textview_render_free(render);
+		return TRUE;
 	}
-	textview_write_line(textview, "\n", NULL);
 
-	html_parser_destroy(parser);
+#ifdef MEASURE_TIME
+	debug_print("textview_render_start: first chunk: %.3f sec\n",
+		    g_timer_elapsed(render->timer, NULL));
+#endif
+
+	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textview->text));
+	gtk_text_buffer_get_end_iter(buffer, &iter);
+	render->mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE);
+
+	textview->render_list = g_slist_append(textview->render_list, render);
+
+	if (TEXTVIEW_RENDER_IS_PAUSED(render))
+		textview_render_add_button(render);
+	else if (textview->render_idle_tag == 0)
+		textview->render_idle_tag =
+			g_idle_add(textview_render_idle_func, textview);
+
+	return TRUE;
 }
 
-/* get_uri_part() - retrieves a URI starting from scanpos.
-		    Returns TRUE if succesful */
-static gboolean get_uri_part(const gchar *start, const gchar *scanpos,
-			     const gchar **bp, const gchar **ep)
+/* write the next TEXTVIEW_RENDER_CHUNK_SIZE bytes of the part.
+   Returns FALSE at the end of the part. */
+static gboolean textview_render_chunk(TextViewRender *render)
 {
-	const gchar *ep_;
+	const gchar *str;
+	gsize size = 0;
+	gsize len;
+	gboolean more = TRUE;
+	off_t caller_pos;
+	gint fd;
+
+	/* the file offset is shared with the stream of the caller */
+	fd = fileno(render->fp);
+	caller_pos = lseek(fd, 0, SEEK_CUR);
+	if (fseek(render->fp, render->fpos, SEEK_SET) < 0) {
+		perror("fseek");
+		return FALSE;
+	}
 
-	g_return_val_if_fail(start != NULL, FALSE);
-	g_return_val_if_fail(scanpos != NULL, FALSE);
-	g_return_val_if_fail(bp != NULL, FALSE);
-	g_return_val_if_fail(ep != NULL, FALSE);
+	while (size < TEXTVIEW_RENDER_CHUNK_SIZE &&
+	       !TEXTVIEW_RENDER_IS_PAUSED(render)) {
+		if ((str = procmime_stream_gets(render->stream)) == NULL) {
+			more = FALSE;
+			break;
+		}
+		len = strlen(str);
+		size += len;
+		render->written += len;
+		textview_write_line(render->textview, str, render->conv);
+	}
 
-	*bp = scanpos;
+	render->fpos = ftell(render->fp);
+	if (caller_pos >= 0)
+		lseek(fd, caller_pos, SEEK_SET);
 
-	/* find end point of URI */
-	for (ep_ = scanpos; *ep_ != '\0'; ep_++) {
-		if (!g_ascii_isgraph(*ep_) ||
-		    !isascii(*(const guchar *)ep_) ||
-		    strchr("()<>{}[]\"", *ep_))
+	return more;
+}
+
+static gboolean textview_render_idle_func(gpointer data)
+{
+	TextView *textview = (TextView *)data;
+	TextViewRender *render = NULL;
+	GtkTextBuffer *buffer;
+	GtkTextIter iter;
+	GSList *later = NULL, *cur;
+	gint start, add;
+	gboolean more;
+
+	gdk_threads_enter();
+
+	/* the first part which is not waiting for its button */
+	for (cur = textview->render_list; cur != NULL; cur = cur->next) {
+		if (!TEXTVIEW_RENDER_IS_PAUSED
+			((TextViewRender *)cur->data)) {
+			render = (TextViewRender *)cur->data;
 			break;
+		}
+	}
+	if (!render) {
+		textview->render_idle_tag = 0;
+		gdk_threads_leave();
+		return FALSE;
 	}
 
-	/* no punctuation at end of string */
+	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textview->text));
 
-	/* FIXME: this stripping of trailing punctuations may bite with other URIs.
-	 * should pass some URI type to this function and decide on that whether
-	 * to perform punctuation stripping */
+	if (render->anchor)
+		textview_render_remove_button(render);
 
-#define IS_REAL_PUNCT(ch)	(g_ascii_ispunct(ch) && !strchr("/?=", ch)) 
+	/* the links of the following parts are moved by the insertion */
+	gtk_text_buffer_get_iter_at_mark(buffer, &iter, render->mark);
+	start = gtk_text_iter_get_offset(&iter);
+	for (cur = textview->uri_list; cur != NULL; cur = cur->next) {
+		RemoteURI *uri = (RemoteURI *)cur->data;
+
+		if (uri->start >= start)
+			later = g_slist_prepend(later, uri);
+	}
 
-	for (; ep_ - 1 > scanpos + 1 && IS_REAL_PUNCT(*(ep_ - 1)); ep_--)
-		;
+	textview->render = render;
+	more = textview_render_chunk(render);
+	textview->render = NULL;
 
-#undef IS_REAL_PUNCT
+	gtk_text_buffer_get_iter_at_mark(buffer, &iter, render->mark);
+	add = gtk_text_iter_get_offset(&iter) - start;
+	for (cur = later; cur != NULL; cur = cur->next) {
+		RemoteURI *uri = (RemoteURI *)cur->data;
 
-	*ep = ep_;
+		uri->start += add;
+		uri->end += add;
+	}
+	g_slist_free(later);
 
-	return TRUE;		
+	if (!more) {
+#ifdef MEASURE_TIME
+		debug_print("textview_render_idle_func: %lu bytes: %.3f sec\n",
+			    (gulong)render->written,
+			    g_timer_elapsed(render->timer, NULL));
+#endif
+		textview->render_list =
+			g_slist_remove(textview->render_list, render);
+		textview_render_free(render);
+	} else if (TEXTVIEW_RENDER_IS_PAUSED(render))
+		textview_render_add_button(render);
+
+	gdk_threads_leave();
+
+	return TRUE;
+}
+
+static void textview_render_button_clicked(GtkButton *button, gpointer data)
+{
+	TextViewRender *render = (TextViewRender *)data;
+	TextView *textview = render->textview;
+
+	/* the button is removed in the idle function */
+	render->limit = 0;
+	if (textview->render_idle_tag == 0)
+		textview->render_idle_tag =
+			g_idle_add(textview_render_idle_func, textview);
+}
+
+static void textview_render_add_button(TextViewRender *render)
+{
+	TextView *textview = render->textview;
+	GtkTextView *text = GTK_TEXT_VIEW(textview->text);
+	GtkTextBuffer *buffer;
+	GtkTextIter iter;
+	GtkWidget *button;
+
+	buffer = gtk_text_view_get_buffer(text);
+	gtk_text_buffer_get_iter_at_mark(buffer, &iter, render->mark);
+
+	/* the anchor and the newline */
+	textview_uri_list_update_offsets
+		(textview, gtk_text_iter_get_offset(&iter), 2);
+
+	render->anchor = gtk_text_buffer_create_child_anchor(buffer, &iter);
+	gtk_text_buffer_insert(buffer, &iter, "\n", 1);
+
+	button = gtk_button_new_with_label
+		(_("The rest of this part is not displayed. "
+		   "Click here to display it."));
+	gtk_widget_show(button);
+	g_signal_connect(G_OBJECT(button), "clicked",
+			 G_CALLBACK(textview_render_button_clicked), render);
+	gtk_text_view_add_child_at_anchor(text, button, render->anchor);
+}
+
+static void textview_render_remove_button(TextViewRender *render)
+{
+	TextView *textview = render->textview;
+	GtkTextBuffer *buffer;
+	GtkTextIter start, end;
+	gint pos;
+
+	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textview->text));
+	gtk_text_buffer_get_iter_at_child_anchor(buffer, &start,
+						 render->anchor);
+	pos = gtk_text_iter_get_offset(&start);
+	end = start;
+	gtk_text_iter_forward_chars(&end, 2);
+	gtk_text_buffer_delete(buffer, &start, &end);
+	render->anchor = NULL;
+
+	textview_uri_list_update_offsets(textview, pos, -2);
+}
+
+static void textview_render_free(TextViewRender *render)
+{
+	GtkTextBuffer *buffer;
+
+	if (render->mark) {
+		buffer = gtk_text_view_get_buffer
+			(GTK_TEXT_VIEW(render->textview->text));
+		gtk_text_buffer_delete_mark(buffer, render->mark);
+	}
+	procmime_stream_free(render->stream);
+	fclose(render->fp);
+	conv_code_converter_destroy(render->conv);
+#ifdef MEASURE_TIME
+	g_timer_destroy(render->timer);
+#endif
+	g_free(render);
+}
+
+static void textview_render_stop(TextView *textview)
+{
+	GSList *cur;
+
+	if (textview->render_idle_tag > 0) {
+		g_source_remove(textview->render_idle_tag);
+		textview->render_idle_tag = 0;
+	}
+
+	for (cur = textview->render_list; cur != NULL; cur = cur->next)
+		textview_render_free((TextViewRender *)cur->data);
+	g_slist_free(textview->render_list);
+	textview->render_list = NULL;
+	textview->render = NULL;
+}
+
+static void textview_show_html(TextView *textview, FILE *fp,
+			       CodeConverter *conv)
+{
+	HTMLParser *parser;
+	const gchar *str;
+
+	parser = html_parser_new(fp, conv);
+	g_return_if_fail(parser != NULL);
+
+	while ((str = html_parse(parser)) != NULL) {
+		if (parser->href != NULL)
+			textview_write_link(textview, str, parser->href, NULL);
+		else
+			textview_write_line(textview, str, NULL);
+	}
+	textview_write_line(textview, "\n", NULL);
+
+	html_parser_destroy(parser);
 }
 
 static gchar *make_uri_string(const gchar *bp, const gchar *ep)
@@ -1306,67 +1613,6 @@ static gchar *make_http_uri_string(const gchar *bp, const gchar *ep)
 	return result;
 }
 
-/* valid mail address characters */
-#define IS_RFC822_CHAR(ch) \
-	(isascii(ch) && \
-	 (ch) > 32   && \
-	 (ch) != 127 && \
-	 !g_ascii_isspace(ch) && \
-	 !strchr("(),;<>\"", (ch)))
-
-/* alphabet and number within 7bit ASCII */
-#define IS_ASCII_ALNUM(ch)	(isascii(ch) && g_ascii_isalnum(ch))
-
-/* get_email_part() - retrieves an email address. Returns TRUE if succesful */
-static gboolean get_email_part(const gchar *start, const gchar *scanpos,
-			       const gchar **bp, const gchar **ep)
-{
-	/* more complex than the uri part because we need to scan back and forward starting from
-	 * the scan position. */
-	gboolean result = FALSE;
-	const gchar *bp_;
-	const gchar *ep_;
-
-	g_return_val_if_fail(start != NULL, FALSE);
-	g_return_val_if_fail(scanpos != NULL, FALSE);
-	g_return_val_if_fail(bp != NULL, FALSE);
-	g_return_val_if_fail(ep != NULL, FALSE);
-
-	/* scan start of address */
-	for (bp_ = scanpos - 1;
-	     bp_ >= start && IS_RFC822_CHAR(*(const guchar *)bp_); bp_--)
-		;
-
-	/* TODO: should start with an alnum? */
-	bp_++;
-	for (; bp_ < scanpos && !IS_ASCII_ALNUM(*(const guchar *)bp_); bp_++)
-		;
-
-	if (bp_ != scanpos) {
-		/* scan end of address */
-		for (ep_ = scanpos + 1;
-		     *ep_ && IS_RFC822_CHAR(*(const guchar *)ep_); ep_++)
-			;
-
-		/* TODO: really should terminate with an alnum? */
-		for (; ep_ > scanpos && !IS_ASCII_ALNUM(*(const guchar *)ep_);
-		     --ep_)
-			;
-		ep_++;
-
-		if (ep_ > scanpos + 1) {
-			*ep = ep_;
-			*bp = bp_;
-			result = TRUE;
-		}
-	}
-
-	return result;
-}
-
-#undef IS_ASCII_ALNUM
-#undef IS_RFC822_CHAR
-
 static gchar *make_email_string(const gchar *bp, const gchar *ep)
 {
 	/* returns a mailto: URI; mailto: is also used to detect the
@@ -1383,17 +1629,6 @@ static gchar *make_email_string(const gchar *bp, const gchar *ep)
 	return result;
 }
 
-#define ADD_TXT_POS(bp_, ep_, pti_) \
-{ \
-	struct txtpos *last; \
- \
-	last = g_new(struct txtpos, 1); \
-	last->bp = (bp_); \
-	last->ep = (ep_); \
-	last->pti = (pti_); \
-	txtpos_list = g_slist_append(txtpos_list, last); \
-}
-
 /* textview_make_clickable_parts() - colorizes clickable parts */
 static void textview_make_clickable_parts(TextView *textview,
 					  const gchar *fg_tag,
@@ -1402,15 +1637,12 @@ static void textview_make_clickable_parts(TextView *textview,
 {
 	GtkTextView *text = GTK_TEXT_VIEW(textview->text);
 	GtkTextBuffer *buffer;
-	GtkTextIter iter;
+	GtkTextIter iter, start_iter, end_iter;
 
-	/* parse table - in order of priority */
+	/* parse table - in order of find_uri_token() */
 	struct table {
 		const gchar *needle; /* token */
 
-		/* token search function */
-		gchar    *(*search)	(const gchar *haystack,
-					 const gchar *needle);
 		/* part parsing function */
 		gboolean  (*parse)	(const gchar *start,
 					 const gchar *scanpos,
@@ -1422,109 +1654,112 @@ static void textview_make_clickable_parts(TextView *textview,
 	};
 
 	static struct table parser[] = {
-		{"http://",  strcasestr, get_uri_part,   make_uri_string},
-		{"https://", strcasestr, get_uri_part,   make_uri_string},
-		{"ftp://",   strcasestr, get_uri_part,   make_uri_string},
-		{"www.",     strcasestr, get_uri_part,   make_http_uri_string},
-		{"mailto:",  strcasestr, get_uri_part,   make_uri_string},
-		{"@",        strcasestr, get_email_part, make_email_string}
+		{"http://",  get_uri_part,   make_uri_string},
+		{"https://", get_uri_part,   make_uri_string},
+		{"ftp://",   get_uri_part,   make_uri_string},
+		{"www.",     get_uri_part,   make_http_uri_string},
+		{"mailto:",  get_uri_part,   make_uri_string},
+		{"@",        get_email_part, make_email_string}
 	};
-	const gint PARSE_ELEMS = sizeof parser / sizeof parser[0];
 
-	/* flags for search optimization */
-	gboolean do_search[] = {TRUE, TRUE, TRUE, TRUE, TRUE, TRUE};
-
-	gint  n;
-	const gchar *walk, *bp, *ep;
+	gint n;
+	const gchar *walk, *scanpos, *bp, *ep;
 
 	struct txtpos {
 		const gchar	*bp, *ep;	/* text position */
 		gint		 pti;		/* index in parse table */
 	};
-	GSList *txtpos_list = NULL;
+	struct txtpos *pos;
+	GArray *txtpos_array;
+	GSList *uri_list = NULL;
+	const gchar *prev;
+	gint offset;
+	guint i;
 
 	buffer = gtk_text_view_get_buffer(text);
-	gtk_text_buffer_get_end_iter(buffer, &iter);
+	if (textview->render)
+		gtk_text_buffer_get_iter_at_mark(buffer, &iter,
+						 textview->render->mark);
+	else
+		gtk_text_buffer_get_end_iter(buffer, &iter);
 
 	/* parse for clickable parts, and build a list of begin and
 	   end positions  */
-	for (walk = linebuf, n = 0;;) {
-		gint last_index = PARSE_ELEMS;
-		const gchar *scanpos = NULL;
-
-		/* FIXME: this looks phony. scanning for anything in the
-		   parse table */
-		for (n = 0; n < PARSE_ELEMS; n++) {
-			const gchar *tmp;
-
-			if (do_search[n]) {
-				tmp = parser[n].search(walk, parser[n].needle);
-				if (tmp) {
-					if (scanpos == NULL || tmp < scanpos) {
-						scanpos = tmp;
-						last_index = n;
-					}
-				} else
-					do_search[n] = FALSE;
-			}
-		}
-
-		if (scanpos) {
-			/* check if URI can be parsed */
-			if (parser[last_index].parse(walk, scanpos, &bp, &ep)
-			    && (ep - bp - 1) > strlen(parser[last_index].needle)) {
-					ADD_TXT_POS(bp, ep, last_index);
-					walk = ep;
-			} else
-				walk = scanpos +
-					strlen(parser[last_index].needle);
+	txtpos_array = g_array_new(FALSE, FALSE, sizeof(struct txtpos));
+
+	for (walk = linebuf;
+	     (scanpos = find_uri_token(walk, &n)) != NULL;) {
+		/* check if URI can be parsed */
+		if (parser[n].parse(walk, scanpos, &bp, &ep)
+		    && (ep - bp - 1) > strlen(parser[n].needle)) {
+			g_array_set_size(txtpos_array, txtpos_array->len + 1);
+			pos = &g_array_index(txtpos_array, struct txtpos,
+					     txtpos_array->len - 1);
+			pos->bp = bp;
+			pos->ep = ep;
+			pos->pti = n;
+			walk = ep;
 		} else
-			break;
+			walk = scanpos + strlen(parser[n].needle);
 	}
 
-	/* colorize this line */
-	if (txtpos_list) {
-		const gchar *normal_text = linebuf;
-		GSList *cur;
-
-		/* insert URIs */
-		for (cur = txtpos_list; cur != NULL; cur = cur->next) {
-			struct txtpos *pos = (struct txtpos *)cur->data;
-			RemoteURI *uri;
-
-			uri = g_new(RemoteURI, 1);
-			if (pos->bp - normal_text > 0)
-				gtk_text_buffer_insert_with_tags_by_name
-					(buffer, &iter,
-					 normal_text,
-					 pos->bp - normal_text,
-					 fg_tag, NULL);
-			uri->uri = parser[pos->pti].build_uri(pos->bp, pos->ep);
-			uri->filename = NULL;
-			uri->start = gtk_text_iter_get_offset(&iter);
-			gtk_text_buffer_insert_with_tags_by_name
-				(buffer, &iter, pos->bp, pos->ep - pos->bp,
-				 uri_tag, fg_tag, NULL);
-			uri->end = gtk_text_iter_get_offset(&iter);
-			textview->uri_list =
-				g_slist_append(textview->uri_list, uri);
-			normal_text = pos->ep;
-
-			g_free(pos);
-		}
-
-		if (*normal_text)
-			gtkut_text_buffer_insert_with_tag_by_name
-				(buffer, &iter, normal_text, -1, fg_tag);
+	if (txtpos_array->len == 0) {
+		gtkut_text_buffer_insert_with_tag_by_name
+			(buffer, &iter, linebuf, -1, fg_tag);
+		if (textview->render)
+			gtk_text_buffer_move_mark(buffer,
+						  textview->render->mark, &iter);
+		g_array_free(txtpos_array, TRUE);
+		return;
+	}
 
-		g_slist_free(txtpos_list);
-	} else {
+	/* insert the whole line at once, and then apply the link tag to
+	   the clickable parts */
+	offset = gtk_text_iter_get_offset(&iter);
+	pos = &g_array_index(txtpos_array, struct txtpos,
+			     txtpos_array->len - 1);
+	if (*pos->ep)
 		gtkut_text_buffer_insert_with_tag_by_name
 			(buffer, &iter, linebuf, -1, fg_tag);
+	else
+		gtk_text_buffer_insert_with_tags_by_name
+			(buffer, &iter, linebuf, -1, fg_tag, NULL);
+	if (textview->render)
+		gtk_text_buffer_move_mark(buffer, textview->render->mark,
+					  &iter);
+
+	prev = linebuf;
+	for (i = 0; i < txtpos_array->len; i++) {
+		RemoteURI *uri;
+
+		pos = &g_array_index(txtpos_array, struct txtpos, i);
+
+		uri = g_new(RemoteURI, 1);
+		uri->uri = parser[pos->pti].build_uri(pos->bp, pos->ep);
+		uri->filename = NULL;
+		offset += g_utf8_strlen(prev, pos->bp - prev);
+		uri->start = offset;
+		offset += g_utf8_strlen(pos->bp, pos->ep - pos->bp);
+		uri->end = offset;
+		prev = pos->ep;
+
+		if (uri_tag) {
+			gtk_text_buffer_get_iter_at_offset
+				(buffer, &start_iter, uri->start);
+			gtk_text_buffer_get_iter_at_offset
+				(buffer, &end_iter, uri->end);
+			gtk_text_buffer_apply_tag_by_name
+				(buffer, uri_tag, &start_iter, &end_iter);
+		}
+
+		uri_list = g_slist_prepend(uri_list, uri);
 	}
-}
 
-#undef ADD_TXT_POS
+	textview->uri_list = g_slist_concat(textview->uri_list,
+					    g_slist_reverse(uri_list));
+
+	g_array_free(txtpos_array, TRUE);
+}
 
 static void textview_write_line(TextView *textview, const gchar *str,
 				CodeConverter *conv)
@@ -1643,6 +1878,8 @@ void textview_clear(TextView *textview)
 	GtkTextView *text = GTK_TEXT_VIEW(textview->text);
 	GtkTextBuffer *buffer;
 
+	textview_render_stop(textview);
+
 	buffer = gtk_text_view_get_buffer(text);
 	gtk_text_buffer_set_text(buffer, "", -1);
 
@@ -1662,6 +1899,8 @@ void textview_destroy(TextView *textview)
 	GtkTextBuffer *buffer;
 	GtkClipboard *clipboard;
 
+	textview_render_stop(textview);
+
 	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textview->text));
 	clipboard = gtk_clipboard_get(GDK_SELECTION_PRIMARY);
 	gtk_text_buffer_remove_selection_clipboard(buffer, clipboard);
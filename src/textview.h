@@ -29,6 +29,7 @@
 #include <gtk/gtktexttag.h>
 
 typedef struct _TextView	TextView;
+typedef struct _TextViewRender	TextViewRender;
 
 #include "messageview.h"
 #include "procmime.h"
@@ -54,6 +55,12 @@ struct _TextView
 	gboolean show_all_headers;
 
 	MessageView *messageview;
+
+	/* progressive rendering of large text parts */
+	GSList *render_list;
+	guint render_idle_tag;
+	/* the part being written in idle time */
+	TextViewRender *render;
 };
 
 TextView *textview_create		(void);